@@ -26,6 +26,20 @@ echo "CLK in (PRU1)"
 config-pin -a P8.30 pruin
 config-pin -q P8.30
 
+## DATA and CLK input pins to PRU0, only used for 12 channels
+echo "DATA1 in (PRU0)"
+config-pin -a P9.29 pruin
+config-pin -q P9.29
+echo "DATA2 in (PRU0)"
+config-pin -a P9.30 pruin
+config-pin -q P9.30
+echo "DATA3 in (PRU0)"
+config-pin -a P9.28 pruin
+config-pin -q P9.28
+echo "CLK in (PRU0)"
+config-pin -a P9.25 pruin
+config-pin -q P9.25
+
 ## Debug LED from PRU1
 echo "Debug LED out (PRU1)"
 config-pin -a P8.45 pruout
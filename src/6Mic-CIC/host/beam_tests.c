@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "beamform.h"
+
+#define NCHAN 6
+#define RATE 64000
+#define MID 32768
+#define NFRAMES 16384
+// Uniform circular array of 6 mics, radius in meters
+#define RADIUS 0.05
+
+static uint32_t in[NFRAMES * NCHAN];
+static float out[NFRAMES * BEAM_MAX_BEAMS];
+static float out_single[NFRAMES];
+
+
+double seconds_since(const struct timespec * start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start -> tv_sec) + (now.tv_nsec - start -> tv_nsec) * 1e-9;
+}
+
+
+// Plane wave of the given frequency coming from the given azimuth, in the x-y plane, as raw frames
+void plane_wave(const beam_mic_t * mics, double freq, double azimuth, double amp) {
+    const double ux = cos(azimuth * M_PI / 180.0);
+    const double uy = sin(azimuth * M_PI / 180.0);
+    for (size_t f = 0; f < NFRAMES; ++f) {
+        for (size_t c = 0; c < NCHAN; ++c) {
+            // Mics closer to the source get the wave earlier
+            const double t = (double) f / RATE + (mics[c].x * ux + mics[c].y * uy) / BEAM_SPEED_OF_SOUND;
+            in[f * NCHAN + c] = (uint32_t) (MID + lround(amp * MID * sin(2 * M_PI * freq * t)));
+        }
+    }
+}
+
+
+// Amplitude of beam b in the second half of the output
+double amplitude(const float * frames, size_t nbeams, size_t b) {
+    double power = 0.0;
+    for (size_t f = NFRAMES / 2; f < NFRAMES; ++f) {
+        power += frames[f * nbeams + b] * frames[f * nbeams + b];
+    }
+    return sqrt(2 * power / (NFRAMES - NFRAMES / 2));
+}
+
+
+// Process the input in blocks of odd sizes
+void run(beamformer_t * bf, float * dst) {
+    for (size_t f = 0; f < NFRAMES; f += 1000) {
+        const size_t n = (NFRAMES - f) < 1000 ? (NFRAMES - f) : 1000;
+        beamformer_process(bf, &in[f * NCHAN], n, &dst[f * bf -> nbeams]);
+    }
+}
+
+
+int main(void) {
+    printf("\nSTARTING BEAMFORMER TESTING PROGRAM!\n");
+    beam_mic_t mics[NCHAN];
+    for (size_t c = 0; c < NCHAN; ++c) {
+        mics[c].x = (float) (RADIUS * cos(2 * M_PI * c / NCHAN));
+        mics[c].y = (float) (RADIUS * sin(2 * M_PI * c / NCHAN));
+        mics[c].z = 0.0f;
+    }
+    // 8 beams every 45 degrees
+    beam_direction_t directions[8];
+    for (size_t b = 0; b < 8; ++b) {
+        directions[b].azimuth = 45.0f * b;
+        directions[b].elevation = 0.0f;
+    }
+
+    printf("TEST: The beam steered at a 3 kHz source keeps its level, the opposite one attenuates it: ");
+    plane_wave(mics, 3000.0, 90.0, 0.5);
+    beamformer_t * bf = beamformer_create(mics, NCHAN, directions, 8, RATE, 1000, MID);
+    size_t errors = (bf == NULL);
+    if (bf != NULL) {
+        run(bf, out);
+        const double on_target = amplitude(out, 8, 2);
+        const double opposite = amplitude(out, 8, 6);
+        if (fabs(on_target - 0.5) > 0.01 || 20 * log10(opposite / on_target) > -6) {
+            printf("(%.3f on target, %.1f dB opposite) ", on_target, 20 * log10(opposite / on_target));
+            errors += 1;
+        }
+        beamformer_free(bf);
+    }
+    if (errors == 0) {
+        printf("Success!\n");
+    } else {
+        printf("Failure!\n");
+    }
+
+    printf("TEST: Computing several beams at once gives the same output as each beam alone: ");
+    plane_wave(mics, 1234.0, 200.0, 0.3);
+    bf = beamformer_create(mics, NCHAN, directions, 8, RATE, 1000, MID);
+    errors = (bf == NULL);
+    if (bf != NULL) {
+        run(bf, out);
+        for (size_t b = 0; b < 8 && errors == 0; ++b) {
+            beamformer_t * single = beamformer_create(mics, NCHAN, &directions[b], 1, RATE, 1000, MID);
+            run(single, out_single);
+            for (size_t f = 0; f < NFRAMES; ++f) {
+                errors += out_single[f] != out[f * 8 + b];
+            }
+            beamformer_free(single);
+        }
+        beamformer_free(bf);
+    }
+    if (errors == 0) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! %zu different samples\n", errors);
+    }
+
+    // Cost of a beam, and how many beams can be computed in real time on one core
+    beam_direction_t many[BEAM_MAX_BEAMS];
+    for (size_t b = 0; b < BEAM_MAX_BEAMS; ++b) {
+        many[b].azimuth = 360.0f * b / BEAM_MAX_BEAMS;
+        many[b].elevation = 0.0f;
+    }
+    bf = beamformer_create(mics, NCHAN, many, BEAM_MAX_BEAMS, RATE, 1000, MID);
+    if (bf != NULL) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        run(bf, out);
+        const double per_beam = seconds_since(&start) / (NFRAMES * BEAM_MAX_BEAMS);
+        printf("Beamformer: %zu taps per channel, %.1f ns per frame per beam, %.0f beams in real time at %d Hz\n",
+               bf -> ntaps, per_beam * 1e9, 1.0 / (per_beam * RATE), RATE);
+        beamformer_free(bf);
+    }
+
+    printf("EXITING TESTING PROGRAM\n");
+    return 0;
+}
@@ -0,0 +1,180 @@
+/**
+ * @brief Delay-and-sum beamformer. Headers in beamform.h.
+ *
+ *        Since the frames are interleaved, the filters of all channels of a beam can be laid out in the same
+ *        order as the frames: an output sample is then a single dot product between the filter of the beam
+ *        and the last ntaps frames, contiguous in memory. It is computed with SSE or NEON when available.
+ *
+ * @author Loïc Droz <lk.droz@gmail.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "beamform.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Number of floats processed at once by the dot product, the filters are padded to a multiple of it
+#define BEAM_SIMD_WIDTH 4
+
+
+// Windowed sinc interpolating a signal at t frames from the center of the filter, 0 outside of the filter
+static double beam_interp(double t)
+{
+    const double half = BEAM_FRAC_TAPS / 2.0;
+    if (fabs(t) >= half) {
+        return 0.0;
+    }
+    const double sinc = t == 0.0 ? 1.0 : sin(M_PI * t) / (M_PI * t);
+    return sinc * (0.5 + 0.5 * cos(M_PI * t / half));
+}
+
+
+beamformer_t * beamformer_create(const beam_mic_t * mics, size_t nchan, const beam_direction_t * directions,
+                                 size_t nbeams, size_t sample_rate, size_t max_frames, uint32_t mid)
+{
+    if (nchan == 0 || nchan > BEAM_MAX_CHAN || nbeams == 0 || nbeams > BEAM_MAX_BEAMS || sample_rate == 0 || mid == 0) {
+        fprintf(stderr, "Error! Unsupported beamformer parameters: %zu channels, %zu beams.\n", nchan, nbeams);
+        return NULL;
+    }
+
+    // Delays are relative to a wave reaching the sphere holding the array, so that they are never negative
+    double radius = 0.0;
+    for (size_t c = 0; c < nchan; ++c) {
+        const double r = sqrt(mics[c].x * mics[c].x + mics[c].y * mics[c].y + mics[c].z * mics[c].z);
+        radius = r > radius ? r : radius;
+    }
+    const double max_delay = 2 * radius / BEAM_SPEED_OF_SOUND * sample_rate;
+
+    beamformer_t * bf = calloc(1, sizeof(beamformer_t));
+    if (bf == NULL) {
+        fprintf(stderr, "Error! Could not allocate memory for beamformer.\n");
+        return NULL;
+    }
+    bf -> nchan = nchan;
+    bf -> nbeams = nbeams;
+    bf -> ntaps = (size_t) ceil(max_delay) + BEAM_FRAC_TAPS;
+    bf -> beam_len = (bf -> ntaps * nchan + BEAM_SIMD_WIDTH - 1) / BEAM_SIMD_WIDTH * BEAM_SIMD_WIDTH;
+    bf -> max_frames = max_frames;
+    bf -> mid = mid;
+    bf -> scale = 1.0f / (float) mid;
+    bf -> latency = (float) (radius / BEAM_SPEED_OF_SOUND * sample_rate + BEAM_FRAC_TAPS / 2.0);
+    bf -> taps = calloc(nbeams * bf -> beam_len, sizeof(float));
+    // The dot product of the last frame reads up to beam_len floats, past the end of the frames
+    bf -> history = calloc((bf -> ntaps - 1 + max_frames) * nchan + BEAM_SIMD_WIDTH, sizeof(float));
+    if (bf -> taps == NULL || bf -> history == NULL) {
+        fprintf(stderr, "Error! Could not allocate memory for beamformer taps and history.\n");
+        beamformer_free(bf);
+        return NULL;
+    }
+
+    for (size_t b = 0; b < nbeams; ++b) {
+        const double azimuth = directions[b].azimuth * M_PI / 180.0;
+        const double elevation = directions[b].elevation * M_PI / 180.0;
+        // Unit vector pointing towards the source
+        const double ux = cos(elevation) * cos(azimuth);
+        const double uy = cos(elevation) * sin(azimuth);
+        const double uz = sin(elevation);
+        float * taps = &(bf -> taps[b * bf -> beam_len]);
+
+        for (size_t c = 0; c < nchan; ++c) {
+            // The wave reaches the mics closer to the source first, so they are delayed the most
+            const double ahead = (mics[c].x * ux + mics[c].y * uy + mics[c].z * uz) / BEAM_SPEED_OF_SOUND * sample_rate;
+            const double delay = radius / BEAM_SPEED_OF_SOUND * sample_rate + ahead + BEAM_FRAC_TAPS / 2.0;
+            double sum = 0.0;
+            for (size_t k = 0; k < bf -> ntaps; ++k) {
+                sum += beam_interp(k - delay);
+            }
+            // Unity gain at DC for each channel, and the average of the channels
+            for (size_t k = 0; k < bf -> ntaps; ++k) {
+                taps[(bf -> ntaps - 1 - k) * nchan + c] = (float) (beam_interp(k - delay) / sum / nchan);
+            }
+        }
+    }
+
+    return bf;
+}
+
+
+void beamformer_free(beamformer_t * bf)
+{
+    free(bf -> taps);
+    free(bf -> history);
+    free(bf);
+}
+
+
+// Dot product of n floats, n being a multiple of BEAM_SIMD_WIDTH
+static inline float beam_dot(const float * taps, const float * w, size_t n)
+{
+#if defined(__SSE2__)
+    // Two accumulators to hide the latency of the additions
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 2 * BEAM_SIMD_WIDTH <= n; i += 2 * BEAM_SIMD_WIDTH) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(&taps[i]), _mm_loadu_ps(&w[i])));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(&taps[i + 4]), _mm_loadu_ps(&w[i + 4])));
+    }
+    if (i < n) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(&taps[i]), _mm_loadu_ps(&w[i])));
+    }
+    acc0 = _mm_add_ps(acc0, acc1);
+    acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+    acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+    return _mm_cvtss_f32(acc0);
+#elif defined(__ARM_NEON)
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    for (size_t i = 0; i < n; i += BEAM_SIMD_WIDTH) {
+        acc = vmlaq_f32(acc, vld1q_f32(&taps[i]), vld1q_f32(&w[i]));
+    }
+    const float32x2_t sum = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    return vget_lane_f32(vpadd_f32(sum, sum), 0);
+#else
+    float acc = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        acc += taps[i] * w[i];
+    }
+    return acc;
+#endif
+}
+
+
+size_t beamformer_process(beamformer_t * bf, const uint32_t * src, size_t nframes, float * dst)
+{
+    const size_t nchan = bf -> nchan;
+    const size_t nbeams = bf -> nbeams;
+    const size_t beam_len = bf -> beam_len;
+    const size_t keep = bf -> ntaps - 1;
+    const uint32_t mid = bf -> mid;
+    const float scale = bf -> scale;
+    float * history = bf -> history;
+
+    if (nframes > bf -> max_frames) {
+        nframes = bf -> max_frames;
+    }
+
+    // Center and convert the new frames, after the history
+    float * new_frames = &history[keep * nchan];
+    for (size_t i = 0; i < nframes * nchan; ++i) {
+        new_frames[i] = (float) (int32_t) (src[i] - mid) * scale;
+    }
+
+    for (size_t n = 0; n < nframes; ++n) {
+        const float * w = &history[n * nchan];
+        for (size_t b = 0; b < nbeams; ++b) {
+            dst[n * nbeams + b] = beam_dot(&(bf -> taps[b * beam_len]), w, beam_len);
+        }
+    }
+
+    // Keep the last frames as history for the next call
+    memmove(history, &history[nframes * nchan], keep * nchan * sizeof(float));
+    return nframes;
+}
@@ -0,0 +1,102 @@
+/**
+ * @brief Delay-and-sum beamformer over the microphone array. Computes several beams at once from the raw
+ *        interleaved frames, each steered towards a direction by delaying every channel with a fractional
+ *        delay FIR filter before summing them.
+ *
+ *        The sources are assumed to be far away (plane waves). Directions are given by their azimuth, in the
+ *        x-y plane from the x axis towards the y axis, and their elevation above this plane, in degrees.
+ *
+ * @author Loïc Droz <lk.droz@gmail.com>
+ *
+ */
+
+#ifndef BEAMFORM_H
+#define BEAMFORM_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+// Max number of channels and beams
+#define BEAM_MAX_CHAN 16
+#define BEAM_MAX_BEAMS 64
+// Taps of the windowed sinc interpolating each fractional delay
+#define BEAM_FRAC_TAPS 8
+// Speed of sound in m/s
+#define BEAM_SPEED_OF_SOUND 343.0
+
+/**
+ * @brief Position of a microphone, in meters, relative to the center of the array.
+ *
+ */
+typedef struct {
+    float x;
+    float y;
+    float z;
+} beam_mic_t;
+
+/**
+ * @brief Steering direction of a beam, in degrees.
+ *
+ */
+typedef struct {
+    float azimuth;
+    float elevation;
+} beam_direction_t;
+
+typedef struct {
+    // Number of interleaved input channels and of beams
+    size_t nchan;
+    size_t nbeams;
+    // Length in frames of the filters, which covers the largest delay across the array plus BEAM_FRAC_TAPS
+    size_t ntaps;
+    // Length of the filter of a beam over all channels, ntaps * nchan rounded up to the SIMD width
+    size_t beam_len;
+    // Filters of each beam, beam_len floats each: tap k of channel c at k * nchan + c, in reverse time order
+    // so that they line up with the history in memory
+    float * taps;
+    // Centered samples, scaled to [-1.0, 1.0]: ntaps - 1 frames of history followed by the new frames
+    float * history;
+    // Max number of input frames per call to beamformer_process
+    size_t max_frames;
+    // Conversion of the raw words, see convert_params_t
+    uint32_t mid;
+    float scale;
+    // Delay of the beams relative to the input, in frames, the same for all directions
+    float latency;
+} beamformer_t;
+
+/**
+ * @brief Compute the delay filters for the given array and directions, and allocate the beamformer state.
+ *
+ * @param mics The positions of the microphones, one per channel in the order of the frames.
+ * @param nchan The number of channels.
+ * @param directions The steering direction of each beam.
+ * @param nbeams The number of beams.
+ * @param sample_rate The sample rate of the frames, in Hz.
+ * @param max_frames The max number of input frames passed to beamformer_process at once.
+ * @param mid Value of a silent raw sample, that is half of the CIC gain, see convert_params_t.
+ * @return beamformer_t* A pointer to a new beamformer in case of success, NULL otherwise.
+ */
+beamformer_t * beamformer_create(const beam_mic_t * mics, size_t nchan, const beam_direction_t * directions,
+                                 size_t nbeams, size_t sample_rate, size_t max_frames, uint32_t mid);
+
+/**
+ * @brief Free the resources allocated for the given beamformer.
+ *
+ * @param bf The beamformer to free.
+ */
+void beamformer_free(beamformer_t * bf);
+
+/**
+ * @brief Compute the beams for a block of raw interleaved frames, e.g. read with pcm_read or pcm_acquire.
+ *        The state is kept between calls, so a stream can be split into blocks of any size.
+ *
+ * @param bf The beamformer.
+ * @param src The input frames, nchan raw 32 bits words each.
+ * @param nframes The number of input frames, at most max_frames.
+ * @param dst The buffer to which the output is written, one float per beam for each frame, between -1.0 and 1.0.
+ * @return size_t The number of frames processed.
+ */
+size_t beamformer_process(beamformer_t * bf, const uint32_t * src, size_t nframes, float * dst);
+
+#endif
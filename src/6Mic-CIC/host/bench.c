@@ -0,0 +1,285 @@
+/**
+ * @brief Benchmarks of the capture and read path, run against the simulated PRU backend.
+ *
+ *        Measures the throughput of the ringbuffer, the cost of pcm_read for each number of channels and of the
+ *        streaming conversion, and the latency from the event of a period to its frames in the hands of a reader.
+ *        The results are written as one JSON object per line, to the file given as argument or to stdout, so that
+ *        they can be compared between builds. The logs of the library go to stdout too, redirect them when writing
+ *        to stdout.
+ *
+ * @author Loïc Droz <lk.droz@gmail.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "interface.h"
+#include "loader.h"
+
+// Channels of the frames pushed to the ringbuffer, like the default capture
+#define BENCH_NCHAN 6
+#define BENCH_FRAME_SIZE (SAMPLE_SIZE_BYTES * BENCH_NCHAN)
+// Half of the default PRU buffer, trimmed like setup_mmaps does, in frames
+#define BENCH_HALF_BUFFER_FRAMES ((0x40000 - 0x40000 % 48) / 2 / BENCH_FRAME_SIZE)
+// Bytes moved through the ringbuffer for each block size
+#define BENCH_RINGBUF_BYTES (1ul << 30)
+// Frames read with pcm_read for each number of channels, in reads of BENCH_READ_FRAMES
+#define BENCH_PCM_FRAMES (1ul << 24)
+#define BENCH_READ_FRAMES 1024
+// Frames per period and duration of the latency measurement
+#define BENCH_LATENCY_PERIOD 128
+#define BENCH_LATENCY_SECONDS 4
+
+static uint8_t frames_in[BENCH_HALF_BUFFER_FRAMES * BENCH_FRAME_SIZE];
+static uint8_t frames_out[BENCH_HALF_BUFFER_FRAMES * BENCH_FRAME_SIZE];
+
+
+static double seconds_since(const struct timespec * start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start -> tv_sec) + (now.tv_nsec - start -> tv_nsec) * 1e-9;
+}
+
+
+static int compare_doubles(const void * a, const void * b)
+{
+    const double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+
+// Push and pop blocks of the given size, half of the ringbuffer at a time, so that the producer and the consumer
+// sides are timed separately
+static void bench_ringbuf(FILE * out, size_t block_frames)
+{
+    const size_t ring_frames = 4 * BENCH_HALF_BUFFER_FRAMES;
+    ringbuffer_t * ringbuf = ringbuf_create(ring_frames, BENCH_FRAME_SIZE);
+    if (ringbuf == NULL) {
+        return;
+    }
+    const size_t blocks = (ring_frames / 2) / block_frames;
+    const size_t rounds = BENCH_RINGBUF_BYTES / (blocks * block_frames * BENCH_FRAME_SIZE) + 1;
+    double push_time = 0.0, pop_time = 0.0;
+    int overflow;
+
+    for (size_t r = 0; r < rounds; ++r) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t b = 0; b < blocks; ++b) {
+            ringbuf_push(ringbuf, frames_in, BENCH_FRAME_SIZE, block_frames, &overflow);
+        }
+        push_time += seconds_since(&start);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t b = 0; b < blocks; ++b) {
+            ringbuf_pop(ringbuf, frames_out, BENCH_FRAME_SIZE, block_frames);
+        }
+        pop_time += seconds_since(&start);
+    }
+
+    const double nframes = (double) rounds * blocks * block_frames;
+    fprintf(out, "{\"bench\": \"ringbuf_push\", \"block_frames\": %zu, \"frame_bytes\": %d, \"ns_per_frame\": %.3f, \"gb_per_s\": %.3f}\n",
+            block_frames, BENCH_FRAME_SIZE, push_time * 1e9 / nframes, nframes * BENCH_FRAME_SIZE / push_time * 1e-9);
+    fprintf(out, "{\"bench\": \"ringbuf_pop\", \"block_frames\": %zu, \"frame_bytes\": %d, \"ns_per_frame\": %.3f, \"gb_per_s\": %.3f}\n",
+            block_frames, BENCH_FRAME_SIZE, pop_time * 1e9 / nframes, nframes * BENCH_FRAME_SIZE / pop_time * 1e-9);
+    ringbuf_free(ringbuf);
+}
+
+
+// Cost of packing the raw frames of a period into the smaller formats of the ringbuffer, which the capture thread
+// pays once, and of unpacking them, which each reader of raw frames pays
+static void bench_pack(FILE * out)
+{
+    const pcm_format_t formats[2] = { PCM_FORMAT_S24, PCM_FORMAT_S16 };
+    const char * names[2] = { "s24", "s16" };
+    const size_t nsamples = BENCH_HALF_BUFFER_FRAMES * BENCH_NCHAN;
+    const size_t rounds = BENCH_RINGBUF_BYTES / (nsamples * SAMPLE_SIZE_BYTES) + 1;
+    convert_params_t params;
+    convert_params_init(&params, CIC_ORDER * 4);
+
+    for (size_t f = 0; f < 2; ++f) {
+        double pack_time = 0.0, unpack_time = 0.0;
+        for (size_t r = 0; r < rounds; ++r) {
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            convert_pack((const uint32_t *) frames_in, nsamples, frames_out, formats[f], &params);
+            pack_time += seconds_since(&start);
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            convert_unpack(frames_out, nsamples, formats[f], (uint32_t *) frames_in, &params);
+            unpack_time += seconds_since(&start);
+        }
+        const double nframes = (double) rounds * BENCH_HALF_BUFFER_FRAMES;
+        fprintf(out, "{\"bench\": \"pack\", \"format\": \"%s\", \"frame_bytes\": %zu, \"pack_ns_per_frame\": %.3f, \"unpack_ns_per_frame\": %.3f}\n",
+                names[f], convert_format_size(formats[f]) * BENCH_NCHAN, pack_time * 1e9 / nframes, unpack_time * 1e9 / nframes);
+    }
+}
+
+
+// Cost of the streaming conversion, DC blocking, gain and conversion, of all the channels and of 3 of them
+static void bench_stream(FILE * out)
+{
+    const uint32_t masks[2] = { (1u << BENCH_NCHAN) - 1, 0x15 };
+    const pcm_format_t formats[2] = { PCM_FORMAT_F32, PCM_FORMAT_S16 };
+    const char * names[2] = { "f32", "s16" };
+    const size_t rounds = BENCH_RINGBUF_BYTES / sizeof(frames_in) + 1;
+    convert_params_t params;
+    convert_params_init(&params, CIC_ORDER * 4);
+
+    for (size_t m = 0; m < 2; ++m) {
+        for (size_t f = 0; f < 2; ++f) {
+            const convert_stream_config_t config = { .chan_mask = masks[m], .format = formats[f], .dc_cutoff_hz = 20.0f,
+                                                     .gain = 1.0f, .adaptive_gain = 1, .target_level = 0.5f };
+            convert_stream_t stream;
+            if (convert_stream_init(&stream, &config, BENCH_NCHAN, PRU_PDM_CLOCK_HZ / CIC_DECIMATION, &params)) {
+                continue;
+            }
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (size_t r = 0; r < rounds; ++r) {
+                convert_stream_process(&stream, (const uint32_t *) frames_in, BENCH_HALF_BUFFER_FRAMES, BENCH_NCHAN, frames_out);
+            }
+            const double nframes = (double) rounds * BENCH_HALF_BUFFER_FRAMES;
+            fprintf(out, "{\"bench\": \"stream\", \"format\": \"%s\", \"channels\": %zu, \"ns_per_frame\": %.3f}\n",
+                    names[f], stream.nsel, seconds_since(&start) * 1e9 / nframes);
+        }
+    }
+}
+
+
+// Cost of pcm_read for each number of channels. Recording stays disabled, the frames are pushed to the ringbuffer
+// of the pcm directly, outside of the timed part.
+static void bench_pcm_read(FILE * out)
+{
+    pcm_t * pcm = pru_processing_init(NULL);
+    if (pcm == NULL) {
+        return;
+    }
+    const size_t refill = BENCH_HALF_BUFFER_FRAMES - BENCH_HALF_BUFFER_FRAMES % BENCH_READ_FRAMES;
+    int overflow;
+
+    for (size_t nchan = 1; nchan <= pcm -> nchan; ++nchan) {
+        double read_time = 0.0;
+        size_t nframes = 0;
+        while (nframes < BENCH_PCM_FRAMES) {
+            ringbuf_push(pcm -> main_buffer, frames_in, BENCH_FRAME_SIZE, refill, &overflow);
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (size_t f = 0; f < refill; f += BENCH_READ_FRAMES) {
+                nframes += pcm_read(pcm, frames_out, BENCH_READ_FRAMES, nchan);
+            }
+            read_time += seconds_since(&start);
+        }
+        fprintf(out, "{\"bench\": \"pcm_read\", \"nchan\": %zu, \"read_frames\": %d, \"ns_per_frame\": %.3f, \"gb_per_s\": %.3f}\n",
+                nchan, BENCH_READ_FRAMES, read_time * 1e9 / nframes, (double) nframes * SAMPLE_SIZE_BYTES * nchan / read_time * 1e-9);
+    }
+    pru_processing_close(pcm);
+}
+
+
+// Latency from the event of a period to its frames returned by pcm_read_mask, with the simulated PRU running in
+// real time. The counter signal tells which period each frame belongs to.
+static void bench_latency(FILE * out)
+{
+    const pru_sim_config_t sim_config = {
+        .buffer_len = 0,
+        .speed = 1.0,
+        .signal = PRU_SIM_SIGNAL_COUNTER,
+    };
+    pru_sim_configure(&sim_config);
+    const pcm_config_t config = {
+        .nchan = BENCH_NCHAN,
+        .decimation = CIC_DECIMATION,
+        .period_frames = BENCH_LATENCY_PERIOD,
+        .periods = 0,
+        .firmware = NULL,
+    };
+    pcm_t * pcm = pru_processing_init(&config);
+    if (pcm == NULL) {
+        return;
+    }
+
+    const size_t max_samples = BENCH_LATENCY_SECONDS * pcm -> sample_rate / BENCH_LATENCY_PERIOD;
+    double * latencies = calloc(max_samples, sizeof(double));
+    uint32_t * frames = (uint32_t *) frames_out;
+    size_t nsamples = 0;
+    if (latencies == NULL) {
+        pru_processing_close(pcm);
+        return;
+    }
+
+    enable_recording();
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (nsamples < max_samples && seconds_since(&start) < BENCH_LATENCY_SECONDS + 1) {
+        size_t nframes = pcm_wait(pcm, BENCH_LATENCY_PERIOD, 100);
+        nframes = nframes < BENCH_HALF_BUFFER_FRAMES ? nframes : BENCH_HALF_BUFFER_FRAMES;
+        if (nframes == 0) {
+            continue;
+        }
+        nframes = pcm_read_mask(pcm, frames, nframes, 0xffffffff, PCM_FORMAT_RAW);
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        // Each period whose last frame was read, its event was raised with the sequence number of the next period
+        for (size_t f = 0; f < nframes && nsamples < max_samples; ++f) {
+            const uint32_t frame_index = frames[f * BENCH_NCHAN] / BENCH_NCHAN;
+            struct timespec event;
+            if ((frame_index + 1) % BENCH_LATENCY_PERIOD == 0
+                && pru_sim_event_time((frame_index + 1) / BENCH_LATENCY_PERIOD, &event) == 0) {
+                latencies[nsamples++] = (now.tv_sec - event.tv_sec) * 1e6 + (now.tv_nsec - event.tv_nsec) * 1e-3;
+            }
+        }
+    }
+    disable_recording();
+
+    pcm_stats_t stats;
+    pcm_get_stats(pcm, &stats);
+    pru_processing_close(pcm);
+
+    if (nsamples > 0) {
+        qsort(latencies, nsamples, sizeof(double), compare_doubles);
+        fprintf(out, "{\"bench\": \"latency\", \"period_frames\": %d, \"samples\": %zu, \"periods_lost\": %" PRIu64
+                ", \"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f}\n",
+                BENCH_LATENCY_PERIOD, nsamples, stats.periods_lost, latencies[(nsamples - 1) / 2],
+                latencies[(size_t) (0.99 * (nsamples - 1))], latencies[(size_t) (0.999 * (nsamples - 1))], latencies[nsamples - 1]);
+    }
+    free(latencies);
+}
+
+
+int main(int argc, char ** argv)
+{
+    FILE * out = stdout;
+    if (argc > 1) {
+        out = fopen(argv[1], "w");
+        if (out == NULL) {
+            fprintf(stderr, "Error! Could not open %s.\n", argv[1]);
+            return 1;
+        }
+    }
+
+    // Arbitrary content, the ringbuffer and the raw reads do not depend on it
+    for (size_t i = 0; i < sizeof(frames_in); ++i) {
+        frames_in[i] = (uint8_t) (i * 7);
+    }
+
+    bench_ringbuf(out, BENCH_HALF_BUFFER_FRAMES);
+    bench_ringbuf(out, 256);
+    bench_ringbuf(out, 16);
+    fflush(out);
+    bench_pack(out);
+    fflush(out);
+    bench_stream(out);
+    fflush(out);
+    bench_pcm_read(out);
+    fflush(out);
+    bench_latency(out);
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
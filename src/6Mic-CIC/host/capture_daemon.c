@@ -0,0 +1,80 @@
+/**
+ * @brief Capture daemon: runs the capture and publishes it in a shared memory segment, so that other processes,
+ *        e.g. a recorder, analytics and a UI, read the frames in place with the client side of shm.c.
+ *        Runs until SIGINT or SIGTERM.
+ *
+ *        Usage: capture_daemon [segment name] [filter decimation]
+ *        The segment name defaults to SHM_DEFAULT_NAME. With a filter decimation of 1, 2 or 4, the filter stage
+ *        is enabled, see pcm_enable_filter.
+ *
+ * @author Loïc Droz <lk.droz@gmail.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+#include "interface.h"
+
+// Interval between two reports of the counters, in seconds
+#define REPORT_INTERVAL 10
+
+static volatile sig_atomic_t stop_flag = 0;
+
+
+static void handle_signal(int signum)
+{
+    (void) signum;
+    stop_flag = 1;
+}
+
+
+int main(int argc, char ** argv)
+{
+    pcm_config_t config = PCM_CONFIG_DEFAULT;
+    config.shm_name = argc > 1 ? argv[1] : SHM_DEFAULT_NAME;
+    const unsigned int filter_decimation = argc > 2 ? (unsigned int) atoi(argv[2]) : 0;
+
+    struct sigaction action = { .sa_handler = handle_signal };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    pcm_t * pcm = pru_processing_init(&config);
+    if (pcm == NULL) {
+        return 1;
+    }
+    if (filter_decimation != 0 && pcm_enable_filter(pcm, filter_decimation)) {
+        pru_processing_close(pcm);
+        return 1;
+    }
+    printf("Publishing %zu channels at %zu Hz in %s\n", pcm -> nchan, pcm -> sample_rate, config.shm_name);
+
+    enable_recording();
+    struct timespec last_report;
+    clock_gettime(CLOCK_MONOTONIC, &last_report);
+    while (!stop_flag) {
+        // The clients have their own positions, the default reader of the daemon just follows the capture so
+        // that it does not report overflows
+        pcm_span_t spans[2];
+        const size_t available = pcm_wait(pcm, pcm -> watermark, 1000);
+        pcm_release(pcm, pcm_acquire(pcm, spans, available));
+
+        // On the elapsed time rather than a number of waits, which depends on the watermark and the timeouts
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec - last_report.tv_sec >= REPORT_INTERVAL) {
+            last_report = now;
+            pcm_stats_t stats;
+            pcm_get_stats(pcm, &stats);
+            printf("Periods received : %" PRIu64 ", lost : %" PRIu64 "\n", stats.periods_received, stats.periods_lost);
+            fflush(stdout);
+        }
+    }
+    disable_recording();
+
+    printf("Closing the capture...\n");
+    pru_processing_close(pcm);
+    return 0;
+}
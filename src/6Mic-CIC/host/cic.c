@@ -0,0 +1,217 @@
+/**
+ * @brief Software CIC decimator. Headers in cic.h.
+ *
+ *        Since the integrators are linear (modulo 2^32), integrating 8 PDM bits is the same as advancing the
+ *        integrators by 8 steps with no input, which only takes a few multiply-adds, then adding the
+ *        contribution of the 8 bits from a zero state, which is looked up in a table indexed by the bits.
+ *
+ * @author Loïc Droz <lk.droz@gmail.com>
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "cic.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Number of PDM bits integrated at once by cic_process
+#define CIC_CHUNK 8
+
+// Contribution of 8 PDM bits (bit m is the m-th period) to each integrator, starting from a zero state
+static uint32_t cic_table[256][CIC_STAGES];
+static pthread_once_t cic_table_once = PTHREAD_ONCE_INIT;
+
+
+static void cic_table_init(void)
+{
+    for (unsigned int bits = 0; bits < 256; ++bits) {
+        uint32_t acc[CIC_STAGES] = { 0 };
+        for (unsigned int m = 0; m < CIC_CHUNK; ++m) {
+            acc[0] += (bits >> m) & 1;
+            for (unsigned int s = 1; s < CIC_STAGES; ++s) {
+                acc[s] += acc[s - 1];
+            }
+        }
+        memcpy(cic_table[bits], acc, sizeof(acc));
+    }
+}
+
+
+int cic_init(cic_t * cic, size_t nchan, unsigned int decimation)
+{
+    if (nchan == 0 || nchan > CIC_MAX_CHAN || decimation == 0) {
+        fprintf(stderr, "Error! Unsupported CIC parameters: %zu channels, decimation %u.\n", nchan, decimation);
+        return -1;
+    }
+    pthread_once(&cic_table_once, cic_table_init);
+
+    memset(cic, 0, sizeof(cic_t));
+    cic -> nchan = nchan;
+    cic -> decimation = decimation;
+    return 0;
+}
+
+
+// Comb stages, run every R periods, in the order of the firmware
+static void cic_output(cic_t * cic, uint32_t * frame)
+{
+    for (size_t c = 0; c < cic -> nchan; ++c) {
+        uint32_t x = cic -> integrators[CIC_STAGES - 1][c];
+        for (unsigned int s = 0; s < CIC_STAGES; ++s) {
+            const uint32_t y = x - cic -> combs[s][c];
+            cic -> combs[s][c] = x;
+            x = y;
+        }
+        frame[c] = x;
+    }
+}
+
+
+// Integrate a single PDM period, returns 1 if an output frame was written
+static inline size_t cic_step(cic_t * cic, uint8_t bits, uint32_t * frame)
+{
+    for (size_t c = 0; c < cic -> nchan; ++c) {
+        cic -> integrators[0][c] += (bits >> c) & 1;
+        cic -> integrators[1][c] += cic -> integrators[0][c];
+        cic -> integrators[2][c] += cic -> integrators[1][c];
+        cic -> integrators[3][c] += cic -> integrators[2][c];
+    }
+
+    cic -> phase += 1;
+    if (cic -> phase < cic -> decimation) {
+        return 0;
+    }
+    cic -> phase = 0;
+    cic_output(cic, frame);
+    return 1;
+}
+
+
+size_t cic_process_ref(cic_t * cic, const uint8_t * pdm, size_t nbits, uint32_t * dst)
+{
+    size_t out = 0;
+    for (size_t i = 0; i < nbits; ++i) {
+        out += cic_step(cic, pdm[i], &dst[out * cic -> nchan]);
+    }
+    return out;
+}
+
+
+// Transpose 8 PDM bytes to one byte per channel, bit m of chan_bits[c] being bit c of pdm[m]
+static inline void cic_transpose8(const uint8_t * pdm, size_t nchan, uint8_t * chan_bits)
+{
+    uint64_t x;
+    memcpy(&x, pdm, sizeof(x));
+    for (size_t c = 0; c < nchan; ++c) {
+        // Gather the bits at positions 8 m into the top byte, m becoming bit m
+        const uint64_t column = (x >> c) & 0x0101010101010101ULL;
+        chan_bits[c] = (uint8_t) ((column * 0x0102040810204080ULL) >> 56);
+    }
+}
+
+
+// Advance the integrators of channel c by 8 periods with the given PDM bits
+static inline void cic_integrate8(cic_t * cic, size_t c, uint8_t bits)
+{
+    const uint32_t i0 = cic -> integrators[0][c];
+    const uint32_t i1 = cic -> integrators[1][c];
+    const uint32_t i2 = cic -> integrators[2][c];
+    const uint32_t * contribution = cic_table[bits];
+
+    // Free response over 8 periods, coefficients C(8, 1), C(9, 2), C(10, 3)
+    cic -> integrators[3][c] += 8 * i2 + 36 * i1 + 120 * i0 + contribution[3];
+    cic -> integrators[2][c] += 8 * i1 + 36 * i0 + contribution[2];
+    cic -> integrators[1][c] += 8 * i0 + contribution[1];
+    cic -> integrators[0][c] += contribution[0];
+}
+
+
+// Integrate nchunks groups of 8 PDM periods
+static void cic_integrate_chunks(cic_t * cic, const uint8_t * pdm, size_t nchunks)
+{
+    const size_t nchan = cic -> nchan;
+    size_t k = 0;
+
+#if defined(__SSE2__)
+    // Transpose 16 periods at once: shifting brings bit c of each byte to its top bit, which movemask gathers
+    for (; k + 2 <= nchunks; k += 2) {
+        const __m128i v = _mm_loadu_si128((const __m128i *) &pdm[k * CIC_CHUNK]);
+        uint16_t words[CIC_MAX_CHAN];
+        switch (nchan) {
+            case 8: words[7] = (uint16_t) _mm_movemask_epi8(v); // fall through
+            case 7: words[6] = (uint16_t) _mm_movemask_epi8(_mm_slli_epi64(v, 1)); // fall through
+            case 6: words[5] = (uint16_t) _mm_movemask_epi8(_mm_slli_epi64(v, 2)); // fall through
+            case 5: words[4] = (uint16_t) _mm_movemask_epi8(_mm_slli_epi64(v, 3)); // fall through
+            case 4: words[3] = (uint16_t) _mm_movemask_epi8(_mm_slli_epi64(v, 4)); // fall through
+            case 3: words[2] = (uint16_t) _mm_movemask_epi8(_mm_slli_epi64(v, 5)); // fall through
+            case 2: words[1] = (uint16_t) _mm_movemask_epi8(_mm_slli_epi64(v, 6)); // fall through
+            default: words[0] = (uint16_t) _mm_movemask_epi8(_mm_slli_epi64(v, 7));
+        }
+        for (size_t c = 0; c < nchan; ++c) {
+            cic_integrate8(cic, c, (uint8_t) words[c]);
+            cic_integrate8(cic, c, (uint8_t) (words[c] >> 8));
+        }
+    }
+#endif
+
+    for (; k < nchunks; ++k) {
+        uint8_t chan_bits[CIC_MAX_CHAN];
+        cic_transpose8(&pdm[k * CIC_CHUNK], nchan, chan_bits);
+        for (size_t c = 0; c < nchan; ++c) {
+            cic_integrate8(cic, c, chan_bits[c]);
+        }
+    }
+}
+
+
+size_t cic_process(cic_t * cic, const uint8_t * pdm, size_t nbits, uint32_t * dst)
+{
+    if (cic -> decimation % CIC_CHUNK != 0) {
+        return cic_process_ref(cic, pdm, nbits, dst);
+    }
+
+    const size_t nchan = cic -> nchan;
+    size_t out = 0;
+    size_t i = 0;
+    while (i < nbits) {
+        // One period at a time until aligned on a chunk, and for the last periods
+        if (cic -> phase % CIC_CHUNK != 0 || nbits - i < CIC_CHUNK) {
+            out += cic_step(cic, pdm[i], &dst[out * nchan]);
+            i += 1;
+            continue;
+        }
+
+        // Whole chunks up to the next output frame
+        size_t nchunks = (cic -> decimation - cic -> phase) / CIC_CHUNK;
+        if (nchunks > (nbits - i) / CIC_CHUNK) {
+            nchunks = (nbits - i) / CIC_CHUNK;
+        }
+        cic_integrate_chunks(cic, &pdm[i], nchunks);
+        i += nchunks * CIC_CHUNK;
+        cic -> phase += nchunks * CIC_CHUNK;
+        if (cic -> phase == cic -> decimation) {
+            cic -> phase = 0;
+            cic_output(cic, &dst[out * nchan]);
+            out += 1;
+        }
+    }
+    return out;
+}
+
+
+void cic_pins_to_pdm(const uint32_t * rising, const uint32_t * falling, size_t nbits, uint8_t * pdm)
+{
+    static const unsigned int pins[3] = { CIC_PIN_DAT1, CIC_PIN_DAT2, CIC_PIN_DAT3 };
+    for (size_t i = 0; i < nbits; ++i) {
+        uint8_t bits = 0;
+        for (unsigned int l = 0; l < 3; ++l) {
+            bits |= ((rising[i] >> pins[l]) & 1) << l;
+            bits |= ((falling[i] >> pins[l]) & 1) << (l + 3);
+        }
+        pdm[i] = bits;
+    }
+}
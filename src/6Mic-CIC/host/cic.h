@@ -0,0 +1,93 @@
+/**
+ * @brief Software CIC decimator, bit exact with the PRU1 firmware (pru/pru1.asm): 4 integrators and
+ *        4 combs with wrapping 32 bits arithmetic, one output frame every R rising edges of the PDM clock.
+ *        Used to validate firmware changes, and to decimate raw PDM captures on the host.
+ *
+ *        The PDM input is one byte per clock period, bit c holding the PDM bit of channel c (0-based).
+ *        With the firmware wiring, channels 0 to 2 are sampled on the rising edge on DAT1, DAT2 and DAT3,
+ *        and channels 3 to 5 on the falling edge on the same lines, see cic_pins_to_pdm.
+ *
+ * @author Loïc Droz <lk.droz@gmail.com>
+ *
+ */
+
+#ifndef CIC_H
+#define CIC_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+// Number of integrator and comb stages of the firmware, N
+#define CIC_STAGES 4
+// Max number of channels, one per bit of a PDM input byte
+#define CIC_MAX_CHAN 8
+
+// Input pins of the clock and data lines, offsets in r31, as in the firmware
+#define CIC_PIN_CLK 11
+#define CIC_PIN_DAT1 10
+#define CIC_PIN_DAT2 8
+#define CIC_PIN_DAT3 9
+// Input pins of PRU0, which captures channels 7 to 12 with the same wiring in the 12 channels mode
+#define CIC_PRU0_PIN_CLK 7
+#define CIC_PRU0_PIN_DAT1 1
+#define CIC_PRU0_PIN_DAT2 2
+#define CIC_PRU0_PIN_DAT3 3
+
+typedef struct {
+    // Number of channels and decimation rate R
+    size_t nchan;
+    unsigned int decimation;
+    // Number of PDM periods integrated since the last output frame
+    unsigned int phase;
+    // Integrator stages, and last input of each comb stage, for each channel
+    uint32_t integrators[CIC_STAGES][CIC_MAX_CHAN];
+    uint32_t combs[CIC_STAGES][CIC_MAX_CHAN];
+} cic_t;
+
+/**
+ * @brief Initialize a CIC decimator in the same state as the firmware when it starts, all zeros.
+ *
+ * @param cic The decimator to initialize.
+ * @param nchan The number of channels, at most CIC_MAX_CHAN.
+ * @param decimation The decimation rate R.
+ * @return int 0 in case of success, non-zero if the parameters are invalid.
+ */
+int cic_init(cic_t * cic, size_t nchan, unsigned int decimation);
+
+/**
+ * @brief Decimate a block of PDM input, one bit at a time, exactly like the firmware does. Reference for cic_process.
+ *        The state is kept between calls, so a stream can be split into blocks of any size.
+ *
+ * @param cic The decimator.
+ * @param pdm The PDM input, one byte per clock period, bit c for channel c.
+ * @param nbits The number of clock periods in the input.
+ * @param dst The buffer to which the interleaved output frames are written, nchan 32 bits words each, like the
+ *        frames the firmware writes to the host memory. Must hold nbits / R + 1 frames.
+ * @return size_t The number of output frames.
+ */
+size_t cic_process_ref(cic_t * cic, const uint8_t * pdm, size_t nbits, uint32_t * dst);
+
+/**
+ * @brief Same as cic_process_ref, with the same output bit for bit, but much faster: the PDM bytes are
+ *        transposed to per-channel words (with SSE2 when available), then each channel integrates 8 bits
+ *        at once with a lookup table. Only used when R is a multiple of 8, falls back to cic_process_ref otherwise.
+ *
+ * @param cic The decimator.
+ * @param pdm The PDM input, see cic_process_ref.
+ * @param nbits The number of clock periods in the input.
+ * @param dst The buffer to which the output frames are written, see cic_process_ref.
+ * @return size_t The number of output frames.
+ */
+size_t cic_process(cic_t * cic, const uint8_t * pdm, size_t nbits, uint32_t * dst);
+
+/**
+ * @brief Convert a capture of the input pins to PDM bytes, with the channel order of the firmware.
+ *
+ * @param rising The values of r31 sampled after each rising edge of the clock.
+ * @param falling The values of r31 sampled after each falling edge of the clock.
+ * @param nbits The number of clock periods.
+ * @param pdm The buffer to which the PDM bytes for 6 channels are written, nbits bytes.
+ */
+void cic_pins_to_pdm(const uint32_t * rising, const uint32_t * falling, size_t nbits, uint8_t * pdm);
+
+#endif
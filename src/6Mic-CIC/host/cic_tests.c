@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "cic.h"
+#include "pdm.h"
+
+#define NCHAN 6
+#define R 16
+#define PDM_RATE 1024000
+#define NBITS (PDM_RATE / 4)
+#define MID 32768
+
+static uint8_t pdm[NBITS];
+static uint32_t out_ref[(NBITS / R + 1) * NCHAN];
+static uint32_t out_fast[(NBITS / R + 1) * NCHAN];
+
+
+double seconds_since(const struct timespec * start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start -> tv_sec) + (now.tv_nsec - start -> tv_nsec) * 1e-9;
+}
+
+
+// Amplitude of the sine in channel c of the second half of the output frames
+double amplitude(const uint32_t * frames, size_t nframes, size_t c) {
+    double power = 0.0;
+    for (size_t f = nframes / 2; f < nframes; ++f) {
+        const double x = (double) (int32_t) (frames[f * NCHAN + c] - MID);
+        power += x * x;
+    }
+    return sqrt(2 * power / (nframes - nframes / 2));
+}
+
+
+int main(void) {
+    printf("\nSTARTING CIC TESTING PROGRAM!\n");
+    srand(42);
+    for (size_t i = 0; i < NBITS; ++i) {
+        pdm[i] = (uint8_t) rand();
+    }
+
+    printf("TEST: The reference decimator matches the convolution with the CIC impulse response: ");
+    // Impulse response of 4 cascaded moving sums of length R
+    uint32_t h[CIC_STAGES * (R - 1) + 1] = { 1 };
+    size_t hlen = 1;
+    for (unsigned int s = 0; s < CIC_STAGES; ++s) {
+        uint32_t next[CIC_STAGES * (R - 1) + 1] = { 0 };
+        for (size_t n = 0; n < hlen; ++n) {
+            for (size_t k = 0; k < R; ++k) {
+                next[n + k] += h[n];
+            }
+        }
+        hlen += R - 1;
+        memcpy(h, next, sizeof(h));
+    }
+    cic_t cic;
+    cic_init(&cic, NCHAN, R);
+    size_t nref = cic_process_ref(&cic, pdm, NBITS, out_ref);
+    size_t errors = (nref == NBITS / R) ? 0 : 1;
+    for (size_t f = 0; f < nref && f < 200; ++f) {
+        for (size_t c = 0; c < NCHAN; ++c) {
+            // The frame f is output after the period (f + 1) R - 1
+            uint32_t acc = 0;
+            for (size_t n = 0; n < hlen && n <= (f + 1) * R - 1; ++n) {
+                acc += h[n] * ((pdm[(f + 1) * R - 1 - n] >> c) & 1);
+            }
+            errors += acc != out_ref[f * NCHAN + c];
+        }
+    }
+    if (errors == 0) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! %zu wrong samples\n", errors);
+    }
+
+    printf("TEST: The fast decimator is bit exact with the reference, with blocks of any size: ");
+    cic_init(&cic, NCHAN, R);
+    size_t nfast = 0;
+    for (size_t i = 0, block = 1; i < NBITS; i += block, block = (block * 7 + 3) % 997) {
+        const size_t n = (NBITS - i) < block ? (NBITS - i) : block;
+        nfast += cic_process(&cic, &pdm[i], n, &out_fast[nfast * NCHAN]);
+    }
+    if (nfast == nref && memcmp(out_fast, out_ref, nref * NCHAN * sizeof(uint32_t)) == 0) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! %zu frames instead of %zu, or different samples\n", nfast, nref);
+    }
+
+    printf("TEST: The firmware channel order is DAT1, DAT2, DAT3 on the rising edge, then on the falling edge: ");
+    uint32_t rising[2] = { 1u << CIC_PIN_DAT1 | 1u << CIC_PIN_DAT3, 1u << CIC_PIN_DAT2 };
+    uint32_t falling[2] = { 1u << CIC_PIN_DAT2, 1u << CIC_PIN_DAT1 | 1u << CIC_PIN_DAT3 | 1u << 11 };
+    uint8_t pins_pdm[2];
+    cic_pins_to_pdm(rising, falling, 2, pins_pdm);
+    if (pins_pdm[0] == 0x15 && pins_pdm[1] == 0x2a) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! Got 0x%02x 0x%02x\n", pins_pdm[0], pins_pdm[1]);
+    }
+
+    printf("TEST: PDM tones decimated by the CIC have the expected level: ");
+    const double amps[NCHAN] = { 0.5, 0.25, 0.1, 0.5, 0.25, 0.1 };
+    for (size_t c = 0; c < NCHAN; ++c) {
+        pdm_gen_t gen;
+        pdm_init(&gen, 1000.0 * (c + 1), amps[c], 0.0, PDM_RATE);
+        pdm_generate(&gen, pdm, NBITS, c);
+    }
+    cic_init(&cic, NCHAN, R);
+    nfast = cic_process(&cic, pdm, NBITS, out_fast);
+    errors = 0;
+    for (size_t c = 0; c < NCHAN; ++c) {
+        // Include the droop of the CIC at the tone frequency
+        const double x = M_PI * 1000.0 * (c + 1) / PDM_RATE;
+        const double expected = amps[c] * MID * pow(sin(R * x) / (R * sin(x)), CIC_STAGES);
+        const double actual = amplitude(out_fast, nfast, c);
+        if (fabs(actual - expected) > 0.02 * expected) {
+            printf("(channel %zu: %.0f instead of %.0f) ", c, actual, expected);
+            errors += 1;
+        }
+    }
+    if (errors == 0) {
+        printf("Success!\n");
+    } else {
+        printf("Failure!\n");
+    }
+
+    // Throughput, in PDM samples (one bit of one channel) per second
+    struct timespec start;
+    double elapsed;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    cic_process_ref(&cic, pdm, NBITS, out_ref);
+    elapsed = seconds_since(&start);
+    printf("Reference decimator: %.1f Msamples/s\n", NBITS * NCHAN / elapsed * 1e-6);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int k = 0; k < 10; ++k) {
+        cic_process(&cic, pdm, NBITS, out_fast);
+    }
+    elapsed = seconds_since(&start);
+    printf("Fast decimator: %.1f Msamples/s (real time needs %.1f)\n", 10.0 * NBITS * NCHAN / elapsed * 1e-6, PDM_RATE * NCHAN * 1e-6);
+
+    printf("EXITING TESTING PROGRAM\n");
+    return 0;
+}
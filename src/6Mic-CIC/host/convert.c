@@ -0,0 +1,603 @@
+/**
+ * @brief Channel gathering and sample format conversion kernels. Headers in convert.h.
+ * 
+ *        The raw words are gathered and converted in a single pass. Kernels are specialized for the
+ *        common numbers of selected channels, so that the compiler can unroll the inner loop, and
+ *        reading all channels converts the frames as a flat array using SSE2 or NEON when available.
+ *        The streaming conversion filters the selected channels 4 at a time in the lanes of SSE2 or NEON vectors.
+ * 
+ * @author Loïc Droz <lk.droz@gmail.com>
+ * 
+ */
+
+#include <string.h>
+#include <math.h>
+#include "convert.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+
+void convert_params_init(convert_params_t * params, unsigned int sample_bits)
+{
+    params -> mid = (uint32_t) 1 << (sample_bits - 1);
+    params -> shift16 = sample_bits > 16 ? sample_bits - 16 : 0;
+    params -> shift24 = (int) sample_bits - 24;
+    params -> scale = 1.0f / (float) params -> mid;
+}
+
+
+size_t convert_format_size(pcm_format_t format)
+{
+    switch (format) {
+        case PCM_FORMAT_RAW:
+        case PCM_FORMAT_S32:
+        case PCM_FORMAT_F32:
+            return 4;
+        case PCM_FORMAT_S16:
+            return 2;
+        case PCM_FORMAT_S24:
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+
+size_t convert_mask_to_chans(uint32_t mask, size_t nchan, uint8_t * chans)
+{
+    size_t nsel = 0;
+    for (size_t c = 0; c < nchan && c < CONVERT_MAX_CHAN; ++c) {
+        if (mask & ((uint32_t) 1 << c)) {
+            chans[nsel++] = (uint8_t) c;
+        }
+    }
+    return nsel;
+}
+
+
+// Scalar conversion of one raw word, in each format
+#define CONV_RAW(x) (x)
+#define CONV_S32(x) ((int32_t) ((x) - mid))
+#define CONV_S16(x) saturate16((int32_t) ((x) - mid) >> shift16)
+#define CONV_F32(x) ((float) (int32_t) ((x) - mid) * scale)
+
+static inline int16_t saturate16(int32_t x)
+{
+    return x > INT16_MAX ? INT16_MAX : (x < INT16_MIN ? INT16_MIN : (int16_t) x);
+}
+
+
+// Scale a raw word to 24 bits and store it in 3 bytes, little endian
+static inline void store_s24(uint8_t * out, uint32_t x, uint32_t mid, int shift24)
+{
+    int32_t y = (int32_t) (x - mid);
+    y = shift24 >= 0 ? y >> shift24 : (int32_t) ((uint32_t) y << -shift24);
+    y = y > 0x7fffff ? 0x7fffff : (y < -0x800000 ? -0x800000 : y);
+    out[0] = (uint8_t) y;
+    out[1] = (uint8_t) (y >> 8);
+    out[2] = (uint8_t) (y >> 16);
+}
+
+
+// Gather NSEL channels from each frame. NSEL is a constant in the specialized kernels.
+#define GATHER_LOOP(TYPE, CONV, NSEL) \
+    for (size_t f = 0; f < nframes; ++f) { \
+        const uint32_t * frame = &src[f * nchan]; \
+        TYPE * out = &((TYPE *) dst)[f * (NSEL)]; \
+        for (size_t c = 0; c < (NSEL); ++c) { \
+            out[c] = CONV(frame[chans[c]]); \
+        } \
+    }
+
+#define GATHER_KERNEL(NAME, TYPE, CONV) \
+static void NAME(const uint32_t * src, size_t nframes, size_t nchan, const uint8_t * chans, size_t nsel, \
+                 void * dst, const convert_params_t * params) \
+{ \
+    const uint32_t mid = params -> mid; \
+    const unsigned int shift16 = params -> shift16; \
+    const float scale = params -> scale; \
+    (void) mid; (void) shift16; (void) scale; \
+    switch (nsel) { \
+        case 1: GATHER_LOOP(TYPE, CONV, 1) break; \
+        case 2: GATHER_LOOP(TYPE, CONV, 2) break; \
+        case 3: GATHER_LOOP(TYPE, CONV, 3) break; \
+        case 4: GATHER_LOOP(TYPE, CONV, 4) break; \
+        default: GATHER_LOOP(TYPE, CONV, nsel) break; \
+    } \
+}
+
+GATHER_KERNEL(gather_raw, uint32_t, CONV_RAW)
+GATHER_KERNEL(gather_s32, int32_t, CONV_S32)
+GATHER_KERNEL(gather_s16, int16_t, CONV_S16)
+GATHER_KERNEL(gather_f32, float, CONV_F32)
+
+
+// Packed 24 bits samples are not a C type, so they get their own loop
+static void gather_s24(const uint32_t * src, size_t nframes, size_t nchan, const uint8_t * chans, size_t nsel,
+                       void * dst, const convert_params_t * params)
+{
+    uint8_t * out = (uint8_t *) dst;
+    for (size_t f = 0; f < nframes; ++f) {
+        const uint32_t * frame = &src[f * nchan];
+        for (size_t c = 0; c < nsel; ++c) {
+            store_s24(out, frame[chans[c]], params -> mid, params -> shift24);
+            out += 3;
+        }
+    }
+}
+
+
+// Convert n raw words stored contiguously, used when all channels are read in order
+static void convert_flat(const uint32_t * src, size_t n, void * dst, pcm_format_t format, const convert_params_t * params)
+{
+    const uint32_t mid = params -> mid;
+    const unsigned int shift16 = params -> shift16;
+    const float scale = params -> scale;
+    size_t i = 0;
+
+    if (format == PCM_FORMAT_RAW) {
+        memcpy(dst, src, n * sizeof(uint32_t));
+        return;
+    }
+
+#if defined(__SSE2__)
+    const __m128i vmid = _mm_set1_epi32((int32_t) mid);
+    if (format == PCM_FORMAT_S32) {
+        int32_t * out = (int32_t *) dst;
+        for (; i + 4 <= n; i += 4) {
+            const __m128i x = _mm_loadu_si128((const __m128i *) &src[i]);
+            _mm_storeu_si128((__m128i *) &out[i], _mm_sub_epi32(x, vmid));
+        }
+    } else if (format == PCM_FORMAT_S16) {
+        int16_t * out = (int16_t *) dst;
+        const __m128i vshift = _mm_cvtsi32_si128((int) shift16);
+        for (; i + 8 <= n; i += 8) {
+            const __m128i lo = _mm_sra_epi32(_mm_sub_epi32(_mm_loadu_si128((const __m128i *) &src[i]), vmid), vshift);
+            const __m128i hi = _mm_sra_epi32(_mm_sub_epi32(_mm_loadu_si128((const __m128i *) &src[i + 4]), vmid), vshift);
+            _mm_storeu_si128((__m128i *) &out[i], _mm_packs_epi32(lo, hi));
+        }
+    } else if (format == PCM_FORMAT_F32) {
+        float * out = (float *) dst;
+        const __m128 vscale = _mm_set1_ps(scale);
+        for (; i + 4 <= n; i += 4) {
+            const __m128i x = _mm_sub_epi32(_mm_loadu_si128((const __m128i *) &src[i]), vmid);
+            _mm_storeu_ps(&out[i], _mm_mul_ps(_mm_cvtepi32_ps(x), vscale));
+        }
+    }
+#elif defined(__ARM_NEON)
+    const uint32x4_t vmid = vdupq_n_u32(mid);
+    if (format == PCM_FORMAT_S32) {
+        int32_t * out = (int32_t *) dst;
+        for (; i + 4 <= n; i += 4) {
+            vst1q_s32(&out[i], vreinterpretq_s32_u32(vsubq_u32(vld1q_u32(&src[i]), vmid)));
+        }
+    } else if (format == PCM_FORMAT_S16) {
+        int16_t * out = (int16_t *) dst;
+        const int32x4_t vshift = vdupq_n_s32(-(int32_t) shift16);
+        for (; i + 8 <= n; i += 8) {
+            const int32x4_t lo = vshlq_s32(vreinterpretq_s32_u32(vsubq_u32(vld1q_u32(&src[i]), vmid)), vshift);
+            const int32x4_t hi = vshlq_s32(vreinterpretq_s32_u32(vsubq_u32(vld1q_u32(&src[i + 4]), vmid)), vshift);
+            vst1q_s16(&out[i], vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+        }
+    } else if (format == PCM_FORMAT_F32) {
+        float * out = (float *) dst;
+        for (; i + 4 <= n; i += 4) {
+            const int32x4_t x = vreinterpretq_s32_u32(vsubq_u32(vld1q_u32(&src[i]), vmid));
+            vst1q_f32(&out[i], vmulq_n_f32(vcvtq_f32_s32(x), scale));
+        }
+    }
+#endif
+
+    // Remaining samples, or everything if no SIMD instructions are available
+    if (format == PCM_FORMAT_S32) {
+        int32_t * out = (int32_t *) dst;
+        for (; i < n; ++i) {
+            out[i] = CONV_S32(src[i]);
+        }
+    } else if (format == PCM_FORMAT_S16) {
+        int16_t * out = (int16_t *) dst;
+        for (; i < n; ++i) {
+            out[i] = CONV_S16(src[i]);
+        }
+    } else if (format == PCM_FORMAT_F32) {
+        float * out = (float *) dst;
+        for (; i < n; ++i) {
+            out[i] = CONV_F32(src[i]);
+        }
+    } else if (format == PCM_FORMAT_S24) {
+        uint8_t * out = (uint8_t *) dst;
+        for (; i < n; ++i) {
+            store_s24(&out[3 * i], src[i], mid, params -> shift24);
+        }
+    }
+}
+
+
+void convert_gather(const uint32_t * src, size_t nframes, size_t nchan, const uint8_t * chans, size_t nsel,
+                    void * dst, pcm_format_t format, const convert_params_t * params)
+{
+    // Reading all channels in order is a plain conversion of the whole array
+    int all_channels = (nsel == nchan);
+    for (size_t c = 0; all_channels && c < nsel; ++c) {
+        all_channels = (chans[c] == c);
+    }
+    if (all_channels) {
+        convert_flat(src, nframes * nchan, dst, format, params);
+        return;
+    }
+
+    switch (format) {
+        case PCM_FORMAT_RAW:
+            gather_raw(src, nframes, nchan, chans, nsel, dst, params);
+            break;
+        case PCM_FORMAT_S32:
+            gather_s32(src, nframes, nchan, chans, nsel, dst, params);
+            break;
+        case PCM_FORMAT_S16:
+            gather_s16(src, nframes, nchan, chans, nsel, dst, params);
+            break;
+        case PCM_FORMAT_F32:
+            gather_f32(src, nframes, nchan, chans, nsel, dst, params);
+            break;
+        case PCM_FORMAT_S24:
+            gather_s24(src, nframes, nchan, chans, nsel, dst, params);
+            break;
+    }
+}
+
+
+void convert_pack(const uint32_t * src, size_t nsamples, void * dst, pcm_format_t format, const convert_params_t * params)
+{
+    convert_flat(src, nsamples, dst, format, params);
+}
+
+
+void convert_unpack(const void * src, size_t nsamples, pcm_format_t format, uint32_t * dst, const convert_params_t * params)
+{
+    const uint32_t mid = params -> mid;
+    switch (format) {
+        case PCM_FORMAT_RAW:
+            memcpy(dst, src, nsamples * sizeof(uint32_t));
+            break;
+        case PCM_FORMAT_S32:
+            for (size_t i = 0; i < nsamples; ++i) {
+                dst[i] = mid + (uint32_t) ((const int32_t *) src)[i];
+            }
+            break;
+        case PCM_FORMAT_S16:
+            for (size_t i = 0; i < nsamples; ++i) {
+                dst[i] = mid + ((uint32_t) (int32_t) ((const int16_t *) src)[i] << params -> shift16);
+            }
+            break;
+        case PCM_FORMAT_F32:
+            for (size_t i = 0; i < nsamples; ++i) {
+                dst[i] = mid + (uint32_t) (int32_t) lrintf(((const float *) src)[i] / params -> scale);
+            }
+            break;
+        case PCM_FORMAT_S24: {
+            const uint8_t * in = (const uint8_t *) src;
+            const int shift24 = params -> shift24;
+            for (size_t i = 0; i < nsamples; ++i) {
+                // Sign extend the 24 bits through the top byte, then undo the scaling of store_s24
+                const int32_t y = (int32_t) ((uint32_t) in[3 * i] << 8 | (uint32_t) in[3 * i + 1] << 16
+                                             | (uint32_t) in[3 * i + 2] << 24) >> 8;
+                dst[i] = mid + (shift24 >= 0 ? (uint32_t) y << shift24 : (uint32_t) (y >> -shift24));
+            }
+            break;
+        }
+    }
+}
+
+
+// Time constants of the adaptive gain in seconds, when it has to decrease and increase respectively
+#define CONVERT_AGC_ATTACK 0.05f
+#define CONVERT_AGC_RELEASE 2.0f
+// Bounds of the adaptive gain
+#define CONVERT_AGC_MIN_GAIN 0.01f
+#define CONVERT_AGC_MAX_GAIN 1000.0f
+
+int convert_stream_init(convert_stream_t * stream, const convert_stream_config_t * config, size_t nchan,
+                        size_t sample_rate, const convert_params_t * params)
+{
+    memset(stream, 0, sizeof(convert_stream_t));
+    if (config -> format != PCM_FORMAT_F32 && config -> format != PCM_FORMAT_S16) {
+        return -1;
+    }
+    stream -> nsel = convert_mask_to_chans(config -> chan_mask, nchan, stream -> chans);
+    if (stream -> nsel == 0 || sample_rate == 0) {
+        return -1;
+    }
+
+    stream -> format = config -> format;
+    stream -> pole = config -> dc_cutoff_hz > 0 ? expf(-2 * (float) M_PI * config -> dc_cutoff_hz / sample_rate) : 0.0f;
+    stream -> gain = config -> gain > 0 ? config -> gain : 1.0f;
+    stream -> adaptive_gain = config -> adaptive_gain;
+    stream -> target_level = config -> target_level > 0 ? config -> target_level : 0.5f;
+    stream -> sample_rate = (float) sample_rate;
+    stream -> params = *params;
+    return 0;
+}
+
+
+// Store one output sample in each format
+#define STORE_F32(i, v) ((float *) dst)[i] = (v)
+#define STORE_S16(i, v) ((int16_t *) dst)[i] = saturate16((int32_t) lrintf((v) * 32768.0f))
+
+// High-pass filter and gain for NSEL channels, NSEL is a constant in the specialized loops.
+// Without the high-pass filter, the pole is 0 and the previous input is not subtracted.
+#define STREAM_LOOP(STORE, NSEL) \
+    for (size_t f = 0; f < nframes; ++f) { \
+        const uint32_t * frame = &src[f * nchan]; \
+        const float g = gain + gain_step * f; \
+        for (size_t c = 0; c < (NSEL); ++c) { \
+            const float x = (float) (int32_t) (frame[chans[c]] - mid) * scale; \
+            const float y = x - hp * last_in[c] + pole * last_out[c]; \
+            last_in[c] = x; \
+            last_out[c] = y; \
+            peak = fabsf(y) > peak ? fabsf(y) : peak; \
+            STORE(f * (NSEL) + c, y * g); \
+        } \
+    }
+
+#define STREAM_KERNEL(STORE) \
+    switch (nsel) { \
+        case 1: STREAM_LOOP(STORE, 1) break; \
+        case 3: STREAM_LOOP(STORE, 3) break; \
+        case 6: STREAM_LOOP(STORE, 6) break; \
+        default: STREAM_LOOP(STORE, nsel) break; \
+    }
+
+#if defined(__SSE2__) || defined(__ARM_NEON)
+// Channels processed at once by stream_simd
+#define STREAM_LANES 4
+
+// Same as STREAM_KERNEL, with the selected channels in the lanes of vectors: the recursion of the high-pass filter is
+// along the frames, but the channels are independent. The last vector is padded with the first channel, whose copies
+// are neither stored nor taken into account in the peak. Returns the peak level before gain.
+static float stream_simd(convert_stream_t * stream, const uint32_t * src, size_t nframes, size_t nchan, void * dst,
+                         float gain, float gain_step)
+{
+    const size_t nsel = stream -> nsel;
+    const size_t nvec = (nsel + STREAM_LANES - 1) / STREAM_LANES;
+    uint8_t chans[CONVERT_MAX_CHAN];
+    for (size_t c = 0; c < nvec * STREAM_LANES; ++c) {
+        chans[c] = c < nsel ? stream -> chans[c] : stream -> chans[0];
+    }
+    const int f32 = stream -> format == PCM_FORMAT_F32;
+    float * out_f32 = (float *) dst;
+    int16_t * out_s16 = (int16_t *) dst;
+    float last_f32[STREAM_LANES];
+    int16_t last_s16[2 * STREAM_LANES];
+
+#if defined(__SSE2__)
+    const __m128i vmid = _mm_set1_epi32((int32_t) stream -> params.mid);
+    const __m128 vscale = _mm_set1_ps(stream -> params.scale);
+    const __m128 vpole = _mm_set1_ps(stream -> pole);
+    const __m128 vhp = _mm_set1_ps(stream -> pole > 0 ? 1.0f : 0.0f);
+    const __m128 vabs = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 v32768 = _mm_set1_ps(32768.0f);
+    __m128 vin[CONVERT_MAX_CHAN / STREAM_LANES];
+    __m128 vout[CONVERT_MAX_CHAN / STREAM_LANES];
+    __m128 vmask[CONVERT_MAX_CHAN / STREAM_LANES];
+    for (size_t k = 0; k < nvec; ++k) {
+        const size_t c = k * STREAM_LANES;
+        vin[k] = _mm_loadu_ps(&(stream -> last_in[c]));
+        vout[k] = _mm_loadu_ps(&(stream -> last_out[c]));
+        vmask[k] = _mm_castsi128_ps(_mm_setr_epi32(-(c < nsel), -(c + 1 < nsel), -(c + 2 < nsel), -(c + 3 < nsel)));
+    }
+    __m128 vpeak = _mm_setzero_ps();
+
+    for (size_t f = 0; f < nframes; ++f) {
+        const uint32_t * frame = &src[f * nchan];
+        const __m128 vg = _mm_set1_ps(gain + gain_step * f);
+        for (size_t k = 0; k < nvec; ++k) {
+            const uint8_t * ch = &chans[k * STREAM_LANES];
+            const __m128i raw = _mm_setr_epi32((int32_t) frame[ch[0]], (int32_t) frame[ch[1]], (int32_t) frame[ch[2]],
+                                               (int32_t) frame[ch[3]]);
+            const __m128 x = _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(raw, vmid)), vscale);
+            const __m128 y = _mm_add_ps(_mm_sub_ps(x, _mm_mul_ps(vhp, vin[k])), _mm_mul_ps(vpole, vout[k]));
+            vin[k] = x;
+            vout[k] = y;
+            vpeak = _mm_max_ps(vpeak, _mm_and_ps(_mm_and_ps(y, vabs), vmask[k]));
+
+            // Vectors are stored whole, the padding lanes are overwritten by the next frame. Only the padded vector
+            // of the last frame goes through a copy, to not write past the output.
+            const size_t first = f * nsel + k * STREAM_LANES;
+            const size_t n = f + 1 < nframes || (nsel - k * STREAM_LANES) >= STREAM_LANES ? STREAM_LANES
+                                                                                         : nsel - k * STREAM_LANES;
+            const __m128 v = _mm_mul_ps(y, vg);
+            if (f32) {
+                if (n == STREAM_LANES) {
+                    _mm_storeu_ps(&out_f32[first], v);
+                } else {
+                    _mm_storeu_ps(last_f32, v);
+                    memcpy(&out_f32[first], last_f32, n * sizeof(float));
+                }
+            } else {
+                // Rounded to nearest even like lrintf, and saturated
+                const __m128i v16 = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(v, v32768)), _mm_setzero_si128());
+                if (n == STREAM_LANES) {
+                    _mm_storel_epi64((__m128i *) &out_s16[first], v16);
+                } else {
+                    _mm_storeu_si128((__m128i *) last_s16, v16);
+                    memcpy(&out_s16[first], last_s16, n * sizeof(int16_t));
+                }
+            }
+        }
+    }
+
+    for (size_t k = 0; k < nvec; ++k) {
+        _mm_storeu_ps(&(stream -> last_in[k * STREAM_LANES]), vin[k]);
+        _mm_storeu_ps(&(stream -> last_out[k * STREAM_LANES]), vout[k]);
+    }
+    float peaks[STREAM_LANES];
+    _mm_storeu_ps(peaks, vpeak);
+#elif defined(__ARM_NEON)
+    const uint32x4_t vmid = vdupq_n_u32(stream -> params.mid);
+    const float scale = stream -> params.scale;
+    const float pole = stream -> pole;
+    const float hp = pole > 0 ? 1.0f : 0.0f;
+#if !defined(__ARM_FEATURE_DIRECTED_ROUNDING)
+    const float32x4_t vround = vdupq_n_f32(12582912.0f);
+#endif
+    float32x4_t vin[CONVERT_MAX_CHAN / STREAM_LANES];
+    float32x4_t vout[CONVERT_MAX_CHAN / STREAM_LANES];
+    uint32x4_t vmask[CONVERT_MAX_CHAN / STREAM_LANES];
+    for (size_t k = 0; k < nvec; ++k) {
+        const size_t c = k * STREAM_LANES;
+        const uint32_t mask[STREAM_LANES] = { -(uint32_t) (c < nsel), -(uint32_t) (c + 1 < nsel),
+                                              -(uint32_t) (c + 2 < nsel), -(uint32_t) (c + 3 < nsel) };
+        vin[k] = vld1q_f32(&(stream -> last_in[c]));
+        vout[k] = vld1q_f32(&(stream -> last_out[c]));
+        vmask[k] = vld1q_u32(mask);
+    }
+    float32x4_t vpeak = vdupq_n_f32(0.0f);
+
+    for (size_t f = 0; f < nframes; ++f) {
+        const uint32_t * frame = &src[f * nchan];
+        const float g = gain + gain_step * f;
+        for (size_t k = 0; k < nvec; ++k) {
+            const uint8_t * ch = &chans[k * STREAM_LANES];
+            const uint32_t lanes[STREAM_LANES] = { frame[ch[0]], frame[ch[1]], frame[ch[2]], frame[ch[3]] };
+            const int32x4_t centered = vreinterpretq_s32_u32(vsubq_u32(vld1q_u32(lanes), vmid));
+            const float32x4_t x = vmulq_n_f32(vcvtq_f32_s32(centered), scale);
+            const float32x4_t y = vaddq_f32(vsubq_f32(x, vmulq_n_f32(vin[k], hp)), vmulq_n_f32(vout[k], pole));
+            vin[k] = x;
+            vout[k] = y;
+            vpeak = vmaxq_f32(vpeak, vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(vabsq_f32(y)), vmask[k])));
+
+            // Vectors are stored whole, the padding lanes are overwritten by the next frame. Only the padded vector
+            // of the last frame goes through a copy, to not write past the output.
+            const size_t first = f * nsel + k * STREAM_LANES;
+            const size_t n = f + 1 < nframes || (nsel - k * STREAM_LANES) >= STREAM_LANES ? STREAM_LANES
+                                                                                         : nsel - k * STREAM_LANES;
+            const float32x4_t v = vmulq_n_f32(y, g);
+            if (f32) {
+                if (n == STREAM_LANES) {
+                    vst1q_f32(&out_f32[first], v);
+                } else {
+                    vst1q_f32(last_f32, v);
+                    memcpy(&out_f32[first], last_f32, n * sizeof(float));
+                }
+            } else {
+                // Rounded to nearest even like lrintf, and saturated. ARMv7 only converts by truncating: adding
+                // and removing 1.5 * 2^23 rounds the values below 2^22 to integers first, the larger ones saturate.
+                const float32x4_t s = vmulq_n_f32(v, 32768.0f);
+#if defined(__ARM_FEATURE_DIRECTED_ROUNDING)
+                const int16x4_t v16 = vqmovn_s32(vcvtnq_s32_f32(s));
+#else
+                const int16x4_t v16 = vqmovn_s32(vcvtq_s32_f32(vsubq_f32(vaddq_f32(s, vround), vround)));
+#endif
+                if (n == STREAM_LANES) {
+                    vst1_s16(&out_s16[first], v16);
+                } else {
+                    vst1_s16(last_s16, v16);
+                    memcpy(&out_s16[first], last_s16, n * sizeof(int16_t));
+                }
+            }
+        }
+    }
+
+    for (size_t k = 0; k < nvec; ++k) {
+        vst1q_f32(&(stream -> last_in[k * STREAM_LANES]), vin[k]);
+        vst1q_f32(&(stream -> last_out[k * STREAM_LANES]), vout[k]);
+    }
+    float peaks[STREAM_LANES];
+    vst1q_f32(peaks, vpeak);
+#endif
+
+    float peak = 0.0f;
+    for (size_t c = 0; c < STREAM_LANES; ++c) {
+        peak = peaks[c] > peak ? peaks[c] : peak;
+    }
+    return peak;
+}
+#endif
+
+void convert_stream_process(convert_stream_t * stream, const uint32_t * src, size_t nframes, size_t nchan, void * dst)
+{
+    if (nframes == 0) {
+        return;
+    }
+
+    // With an adaptive gain, ramp from the current gain to the one computed at the end of the previous block
+    float gain = stream -> gain;
+    float gain_step = 0.0f;
+    float next_gain = gain;
+    if (stream -> adaptive_gain) {
+        const float decay = expf(-(float) nframes / (CONVERT_AGC_RELEASE * stream -> sample_rate));
+        float desired = stream -> target_level / (stream -> envelope > 0 ? stream -> envelope : 1e-9f);
+        desired = desired > CONVERT_AGC_MAX_GAIN ? CONVERT_AGC_MAX_GAIN : (desired < CONVERT_AGC_MIN_GAIN ? CONVERT_AGC_MIN_GAIN : desired);
+        const float tau = desired < gain ? CONVERT_AGC_ATTACK : CONVERT_AGC_RELEASE;
+        next_gain = gain + (desired - gain) * (1.0f - expf(-(float) nframes / (tau * stream -> sample_rate)));
+        gain_step = (next_gain - gain) / nframes;
+        stream -> envelope *= decay;
+    }
+
+#if defined(__SSE2__) || defined(__ARM_NEON)
+    const float peak = stream_simd(stream, src, nframes, nchan, dst, gain, gain_step);
+#else
+    const uint8_t * chans = stream -> chans;
+    const size_t nsel = stream -> nsel;
+    const uint32_t mid = stream -> params.mid;
+    const float scale = stream -> params.scale;
+    const float pole = stream -> pole;
+    const float hp = pole > 0 ? 1.0f : 0.0f;
+    float * last_in = stream -> last_in;
+    float * last_out = stream -> last_out;
+    float peak = 0.0f;
+    if (stream -> format == PCM_FORMAT_F32) {
+        STREAM_KERNEL(STORE_F32)
+    } else {
+        STREAM_KERNEL(STORE_S16)
+    }
+#endif
+
+    stream -> gain = next_gain;
+    stream -> envelope = peak > stream -> envelope ? peak : stream -> envelope;
+}
+
+
+size_t convert_consume(const convert_source_t * src, size_t nframes,
+                       void (*consume)(void * arg, const uint32_t * frames, size_t n, size_t done),
+                       void (*restart)(void * arg), void * arg, uint64_t * first)
+{
+    const size_t frame_size = convert_format_size(src -> format) * src -> nchan;
+    size_t acquired;
+    uint64_t position;
+    int attempt = 0;
+    do {
+        if (attempt++ > 0 && restart != NULL) {
+            restart(arg);
+        }
+        const void * data[2];
+        size_t counts[2];
+        acquired = src -> acquire(src -> ctx, data, counts, nframes, &position);
+        size_t done = 0;
+        for (size_t s = 0; s < 2; ++s) {
+            // Raw frames are passed in place, packed ones unpacked a chunk at a time first
+            for (size_t f = 0; f < counts[s]; ) {
+                const uint8_t * span = &(((const uint8_t *) data[s])[f * frame_size]);
+                const uint32_t * frames = (const uint32_t *) span;
+                size_t n = counts[s] - f;
+                if (src -> format != PCM_FORMAT_RAW) {
+                    n = n < src -> unpack_frames ? n : src -> unpack_frames;
+                    convert_unpack(span, n * src -> nchan, src -> format, src -> unpacked, src -> params);
+                    frames = src -> unpacked;
+                }
+                consume(arg, frames, n, done);
+                f += n;
+                done += n;
+            }
+        }
+    } while (src -> release(src -> ctx, acquired) != 0);
+
+    if (first != NULL) {
+        *first = position;
+    }
+    return acquired;
+}
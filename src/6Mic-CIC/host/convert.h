@@ -0,0 +1,223 @@
+/**
+ * @brief Kernels gathering a subset of channels from interleaved raw CIC frames and converting them
+ *        to the output sample format, in a single pass.
+ * 
+ * @author Loïc Droz <lk.droz@gmail.com>
+ * 
+ */
+
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+// Max number of channels which can be gathered
+#define CONVERT_MAX_CHAN 32
+
+/**
+ * @brief Sample formats of the data output by the read functions.
+ * 
+ */
+typedef enum {
+    // Raw 32 bits words, as written by the PRU. Unsigned, centered around half the CIC gain.
+    PCM_FORMAT_RAW = 0,
+    // Signed 32 bits integers, centered around 0, same scale as the raw words
+    PCM_FORMAT_S32,
+    // Signed 16 bits integers, centered around 0, scaled to the 16 bits range and saturated
+    PCM_FORMAT_S16,
+    // 32 bits floats between -1.0 and 1.0
+    PCM_FORMAT_F32,
+    // Signed 24 bits integers packed in 3 bytes, little endian, scaled to the 24 bits range and saturated
+    PCM_FORMAT_S24,
+} pcm_format_t;
+
+/**
+ * @brief Parameters of the conversion from raw CIC words, derived from the CIC gain.
+ * 
+ */
+typedef struct {
+    // Value of a raw word when the input is silent (half the CIC gain)
+    uint32_t mid;
+    // Right shift bringing a centered sample to 16 bits
+    unsigned int shift16;
+    // Shift bringing a centered sample to 24 bits, to the right if positive, to the left if negative
+    int shift24;
+    // Factor bringing a centered sample between -1.0 and 1.0
+    float scale;
+} convert_params_t;
+
+/**
+ * @brief Compute the conversion parameters for a CIC filter with the given output width.
+ * 
+ * @param params The parameters to initialize.
+ * @param sample_bits Number of bits of the CIC gain, that is N * log2(R).
+ */
+void convert_params_init(convert_params_t * params, unsigned int sample_bits);
+
+/**
+ * @brief Get the size in bytes of one sample in the given format.
+ * 
+ * @param format The sample format.
+ * @return size_t The size of a sample, 0 if the format is unknown.
+ */
+size_t convert_format_size(pcm_format_t format);
+
+/**
+ * @brief Get the list of channels selected by a channel mask.
+ * 
+ * @param mask The mask, bit c selects channel c (0-based).
+ * @param nchan The number of channels available, bits above are ignored.
+ * @param chans The array to which the selected channels are output, in increasing order. Must hold nchan entries.
+ * @return size_t The number of selected channels.
+ */
+size_t convert_mask_to_chans(uint32_t mask, size_t nchan, uint8_t * chans);
+
+/**
+ * @brief Gather the given channels of interleaved raw frames and convert them to the given format.
+ * 
+ * @param src The raw frames, nchan 32 bits words each.
+ * @param nframes The number of frames to convert.
+ * @param nchan The number of channels of the raw frames.
+ * @param chans The channels to gather, in output order.
+ * @param nsel The number of channels to gather.
+ * @param dst The buffer to which the interleaved converted frames are written, nsel samples each.
+ * @param format The output sample format.
+ * @param params The conversion parameters.
+ */
+void convert_gather(const uint32_t * src, size_t nframes, size_t nchan, const uint8_t * chans, size_t nsel,
+                    void * dst, pcm_format_t format, const convert_params_t * params);
+
+/**
+ * @brief Pack raw words into a smaller sample format, to store them, e.g. PCM_FORMAT_S24 or PCM_FORMAT_S16.
+ *        Same as convert_gather of all the channels in order.
+ * 
+ * @param src The raw words.
+ * @param nsamples The number of words.
+ * @param dst The buffer to which the samples are written.
+ * @param format The sample format of the packed samples.
+ * @param params The conversion parameters.
+ */
+void convert_pack(const uint32_t * src, size_t nsamples, void * dst, pcm_format_t format, const convert_params_t * params);
+
+/**
+ * @brief Unpack samples stored with convert_pack back to raw words. This is exact unless the packing saturated the
+ *        samples or dropped their low bits, when the CIC gain has more bits than the packed format.
+ * 
+ * @param src The packed samples.
+ * @param nsamples The number of samples.
+ * @param format The sample format of the packed samples.
+ * @param dst The buffer to which the raw words are written.
+ * @param params The conversion parameters used to pack the samples.
+ */
+void convert_unpack(const void * src, size_t nsamples, pcm_format_t format, uint32_t * dst, const convert_params_t * params);
+
+/**
+ * @brief Configuration of a streaming conversion, see convert_stream_init.
+ * 
+ */
+typedef struct {
+    // The channels to output, bit c selects channel c (0-based)
+    uint32_t chan_mask;
+    // Output format, PCM_FORMAT_F32 or PCM_FORMAT_S16
+    pcm_format_t format;
+    // Cutoff frequency in Hz of the DC blocking high-pass filter, 0 disables it
+    float dc_cutoff_hz;
+    // Gain applied after the high-pass filter, initial gain if it adapts
+    float gain;
+    // If non-zero, the gain slowly adapts so that the peak level of the output reaches target_level
+    int adaptive_gain;
+    // Target peak level of the adaptive gain, as a fraction of the full scale
+    float target_level;
+} convert_stream_config_t;
+
+/**
+ * @brief State of a streaming conversion: raw CIC words to float32 or int16, with a per-channel DC blocking
+ *        high-pass filter (y[n] = x[n] - x[n - 1] + pole * y[n - 1]) and a gain, fixed or slowly adapting.
+ *        The gain is common to all channels so that their relative levels are preserved.
+ * 
+ */
+typedef struct {
+    // Selected channels
+    uint8_t chans[CONVERT_MAX_CHAN];
+    size_t nsel;
+    pcm_format_t format;
+    // Pole of the high-pass filter, 0 if disabled, and its state for each selected channel
+    float pole;
+    float last_in[CONVERT_MAX_CHAN];
+    float last_out[CONVERT_MAX_CHAN];
+    // Current gain and adaptive gain parameters
+    float gain;
+    int adaptive_gain;
+    float target_level;
+    // Envelope of the output peak level before gain, and sample rate for the adaptation time constants
+    float envelope;
+    float sample_rate;
+    // Conversion from raw words
+    convert_params_t params;
+} convert_stream_t;
+
+/**
+ * @brief Initialize a streaming conversion.
+ * 
+ * @param stream The stream state to initialize.
+ * @param config The configuration of the conversion.
+ * @param nchan The number of channels of the raw frames.
+ * @param sample_rate The sample rate of the raw frames, in Hz.
+ * @param params The conversion parameters of the raw frames.
+ * @return int 0 in case of success, non-zero if the configuration is invalid.
+ */
+int convert_stream_init(convert_stream_t * stream, const convert_stream_config_t * config, size_t nchan,
+                        size_t sample_rate, const convert_params_t * params);
+
+/**
+ * @brief Convert a block of raw interleaved frames, keeping the filter and gain state for the next block.
+ * 
+ * @param stream The stream state.
+ * @param src The raw frames, nchan 32 bits words each.
+ * @param nframes The number of frames to convert.
+ * @param nchan The number of channels of the raw frames.
+ * @param dst The buffer to which the interleaved converted frames are written, one sample per selected channel.
+ */
+void convert_stream_process(convert_stream_t * stream, const uint32_t * src, size_t nframes, size_t nchan, void * dst);
+
+/**
+ * @brief Consumer side of a ringbuffer of interleaved frames, raw or packed, read by convert_consume.
+ * 
+ */
+typedef struct {
+    // State of the consumer, passed to acquire and release
+    void * ctx;
+    // Acquire up to nframes of the oldest frames, in two spans if they wrap around. Returns the number of frames
+    // acquired, and the position of the first one in the stream in first. See ringbuf_acquire.
+    size_t (*acquire)(void * ctx, const void * data[2], size_t counts[2], size_t nframes, uint64_t * first);
+    // Release acquired frames. Returns the number of them which were overwritten, and released, 0 if all are valid
+    // and released. See ringbuf_release.
+    size_t (*release)(void * ctx, size_t nframes);
+    // Number of channels, format of the samples in the ringbuffer and their conversion parameters
+    size_t nchan;
+    pcm_format_t format;
+    const convert_params_t * params;
+    // Buffer into which up to unpack_frames frames are unpacked, unused with PCM_FORMAT_RAW
+    uint32_t * unpacked;
+    size_t unpack_frames;
+} convert_source_t;
+
+/**
+ * @brief Acquire up to nframes frames from a source, pass them as raw words to a consumer, unpacked a chunk at a time
+ *        if needed, then release them. If some of them were overwritten in the meantime, they are dropped and the
+ *        valid ones passed again from the start, after calling restart, so that the consumer discards what it got.
+ * 
+ * @param src The source of the frames.
+ * @param nframes The max number of frames to consume.
+ * @param consume Called with arg, n raw frames, and the number of frames passed before them since the last restart.
+ * @param restart Called with arg before passing the frames again, NULL if consume can simply start over.
+ * @param arg The argument of consume and restart.
+ * @param first Set to the position in the stream of the first frame consumed, can be NULL.
+ * @return size_t The number of frames consumed.
+ */
+size_t convert_consume(const convert_source_t * src, size_t nframes,
+                       void (*consume)(void * arg, const uint32_t * frames, size_t n, size_t done),
+                       void (*restart)(void * arg), void * arg, uint64_t * first);
+
+#endif
@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "convert.h"
+
+#define NFRAMES 37
+#define NCHAN 6
+// Streaming tests: 64 kHz, 100 blocks of 1024 frames
+#define STREAM_RATE 64000
+#define STREAM_BLOCK 1024
+#define STREAM_BLOCKS 100
+
+static uint32_t raw_stream[STREAM_BLOCK * NCHAN];
+static float f32_stream[STREAM_BLOCK * NCHAN];
+static int16_t s16_stream[STREAM_BLOCK * NCHAN];
+
+
+// Fill block b of a 1 kHz tone with the given amplitude and DC offset, as fractions of the 16 bits full scale
+static void stream_tone(uint32_t * raw, size_t b, double amplitude, double offset)
+{
+    for (size_t f = 0; f < STREAM_BLOCK; ++f) {
+        const double t = (double) (b * STREAM_BLOCK + f) / STREAM_RATE;
+        const double x = offset + amplitude * sin(2 * M_PI * 1000.0 * t);
+        for (size_t c = 0; c < NCHAN; ++c) {
+            raw[f * NCHAN + c] = (uint32_t) (32768 + lround(32768 * x));
+        }
+    }
+}
+
+
+int main(void) {
+    printf("\nSTARTING CONVERSION TESTING PROGRAM!\n");
+
+    convert_params_t params;
+    convert_params_init(&params, 16);
+
+    // Raw frames covering the whole range of the CIC output, including both ends
+    uint32_t raw[NFRAMES * NCHAN];
+    for (size_t i = 0; i < NFRAMES * NCHAN; ++i) {
+        raw[i] = (uint32_t) ((i * 1777) % 65537);
+    }
+    raw[0] = 0;
+    raw[1] = 65536;
+
+    printf("TEST: Gathering mics 1, 3 and 5 as raw words keeps these channels only, in order: ");
+    uint8_t chans[NCHAN];
+    size_t nsel = convert_mask_to_chans((1 << 0) | (1 << 2) | (1 << 4), NCHAN, chans);
+    uint32_t raw_out[NFRAMES * NCHAN];
+    convert_gather(raw, NFRAMES, NCHAN, chans, nsel, raw_out, PCM_FORMAT_RAW, &params);
+    size_t errors = (nsel == 3) ? 0 : 1;
+    for (size_t f = 0; f < NFRAMES; ++f) {
+        for (size_t c = 0; c < nsel; ++c) {
+            if (raw_out[f * nsel + c] != raw[f * NCHAN + 2 * c]) {
+                errors += 1;
+            }
+        }
+    }
+    if (errors == 0) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! %zu wrong samples\n", errors);
+    }
+
+    printf("TEST: Converting all channels gives centered and scaled samples in every format: ");
+    int32_t s32_out[NFRAMES * NCHAN];
+    int16_t s16_out[NFRAMES * NCHAN];
+    float f32_out[NFRAMES * NCHAN];
+    nsel = convert_mask_to_chans(0x3f, NCHAN, chans);
+    convert_gather(raw, NFRAMES, NCHAN, chans, nsel, s32_out, PCM_FORMAT_S32, &params);
+    convert_gather(raw, NFRAMES, NCHAN, chans, nsel, s16_out, PCM_FORMAT_S16, &params);
+    convert_gather(raw, NFRAMES, NCHAN, chans, nsel, f32_out, PCM_FORMAT_F32, &params);
+    errors = 0;
+    for (size_t i = 0; i < NFRAMES * NCHAN; ++i) {
+        const int32_t centered = (int32_t) raw[i] - 32768;
+        const int16_t expected16 = centered > 32767 ? 32767 : centered;
+        if (s32_out[i] != centered || s16_out[i] != expected16 || fabsf(f32_out[i] - centered / 32768.0f) > 1e-6f) {
+            errors += 1;
+        }
+    }
+    if (errors == 0 && s16_out[0] == -32768 && s16_out[1] == 32767) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! %zu wrong samples\n", errors);
+    }
+
+    printf("TEST: Packed 24 bits samples are scaled to the 24 bits range, little endian, in both paths: ");
+    uint8_t s24_out[NFRAMES * NCHAN * 3];
+    uint8_t s24_sub[NFRAMES * 3];
+    convert_gather(raw, NFRAMES, NCHAN, chans, nsel, s24_out, PCM_FORMAT_S24, &params);
+    chans[0] = 2;
+    convert_gather(raw, NFRAMES, NCHAN, chans, 1, s24_sub, PCM_FORMAT_S24, &params);
+    errors = (convert_format_size(PCM_FORMAT_S24) == 3) ? 0 : 1;
+    for (size_t i = 0; i < NFRAMES * NCHAN; ++i) {
+        // Sign extend the 3 bytes, then compare with the 16 bits sample shifted by 8 bits
+        const int32_t actual = (int32_t) ((uint32_t) s24_out[3 * i] << 8 | (uint32_t) s24_out[3 * i + 1] << 16
+                                          | (uint32_t) s24_out[3 * i + 2] << 24) >> 8;
+        const int32_t centered = ((int32_t) raw[i] - 32768) * 256;
+        if (actual != (centered > 0x7fffff ? 0x7fffff : centered)) {
+            errors += 1;
+        }
+    }
+    for (size_t f = 0; f < NFRAMES; ++f) {
+        errors += memcmp(&s24_sub[3 * f], &s24_out[3 * (f * NCHAN + 2)], 3) != 0;
+    }
+    if (errors == 0 && s24_out[0] == 0x00 && s24_out[2] == 0x80) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! %zu wrong samples\n", errors);
+    }
+
+    printf("TEST: Gathering a subset gives the same samples as converting all channels: ");
+    errors = 0;
+    for (size_t n = 1; n <= NCHAN; ++n) {
+        // Select the last n channels, in reverse order, to avoid the all channels path
+        for (size_t c = 0; c < n; ++c) {
+            chans[c] = (uint8_t) (NCHAN - 1 - c);
+        }
+        int16_t sub16[NFRAMES * NCHAN];
+        float sub32[NFRAMES * NCHAN];
+        convert_gather(raw, NFRAMES, NCHAN, chans, n, sub16, PCM_FORMAT_S16, &params);
+        convert_gather(raw, NFRAMES, NCHAN, chans, n, sub32, PCM_FORMAT_F32, &params);
+        for (size_t f = 0; f < NFRAMES; ++f) {
+            for (size_t c = 0; c < n; ++c) {
+                if (sub16[f * n + c] != s16_out[f * NCHAN + chans[c]] || sub32[f * n + c] != f32_out[f * NCHAN + chans[c]]) {
+                    errors += 1;
+                }
+            }
+        }
+    }
+    if (errors == 0) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! %zu wrong samples\n", errors);
+    }
+
+    printf("TEST: Packing to 24 or 16 bits and unpacking gives the raw words back, but for saturation and dropped bits: ");
+    errors = 0;
+    uint32_t unpacked[NFRAMES * NCHAN];
+    int16_t packed16[NFRAMES * NCHAN];
+    convert_pack(raw, NFRAMES * NCHAN, s24_out, PCM_FORMAT_S24, &params);
+    convert_unpack(s24_out, NFRAMES * NCHAN, PCM_FORMAT_S24, unpacked, &params);
+    for (size_t i = 0; i < NFRAMES * NCHAN; ++i) {
+        // Only the top of the range, 65536, saturates
+        errors += unpacked[i] != (raw[i] > 65535 ? 65535 : raw[i]);
+    }
+    convert_pack(raw, NFRAMES * NCHAN, packed16, PCM_FORMAT_S16, &params);
+    convert_unpack(packed16, NFRAMES * NCHAN, PCM_FORMAT_S16, unpacked, &params);
+    for (size_t i = 0; i < NFRAMES * NCHAN; ++i) {
+        errors += unpacked[i] != (raw[i] > 65535 ? 65535 : raw[i]);
+    }
+    // With a 20 bits CIC gain, 24 bits are exact and 16 bits drop the 4 low bits
+    convert_params_t params20;
+    convert_params_init(&params20, 20);
+    uint32_t raw20[NFRAMES * NCHAN];
+    for (size_t i = 0; i < NFRAMES * NCHAN; ++i) {
+        raw20[i] = (uint32_t) ((i * 17771) % 1048576);
+    }
+    convert_pack(raw20, NFRAMES * NCHAN, s24_out, PCM_FORMAT_S24, &params20);
+    convert_unpack(s24_out, NFRAMES * NCHAN, PCM_FORMAT_S24, unpacked, &params20);
+    errors += memcmp(unpacked, raw20, sizeof(raw20)) != 0;
+    convert_pack(raw20, NFRAMES * NCHAN, packed16, PCM_FORMAT_S16, &params20);
+    convert_unpack(packed16, NFRAMES * NCHAN, PCM_FORMAT_S16, unpacked, &params20);
+    for (size_t i = 0; i < NFRAMES * NCHAN; ++i) {
+        errors += unpacked[i] != (raw20[i] & ~(uint32_t) 0xf);
+    }
+    if (errors == 0) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! %zu wrong samples\n", errors);
+    }
+
+    printf("TEST: Streaming conversion removes a DC offset and keeps the level of a tone: ");
+    // 1 kHz tone at a quarter of the full scale on top of a DC offset, in blocks of STREAM_BLOCK frames
+    convert_stream_t stream;
+    convert_stream_config_t config = {
+        .chan_mask = 0x3f,
+        .format = PCM_FORMAT_F32,
+        .dc_cutoff_hz = 20.0f,
+        .gain = 1.0f,
+        .adaptive_gain = 0,
+    };
+    float mean = 0.0f, peak = 0.0f;
+    if (convert_stream_init(&stream, &config, NCHAN, STREAM_RATE, &params) == 0) {
+        for (size_t b = 0; b < STREAM_BLOCKS; ++b) {
+            stream_tone(raw_stream, b, 0.25, 0.3);
+            convert_stream_process(&stream, raw_stream, STREAM_BLOCK, NCHAN, f32_stream);
+        }
+        // Only look at the last block, once the high-pass filter has settled
+        for (size_t i = 0; i < STREAM_BLOCK * NCHAN; ++i) {
+            mean += f32_stream[i] / (STREAM_BLOCK * NCHAN);
+            peak = fabsf(f32_stream[i]) > peak ? fabsf(f32_stream[i]) : peak;
+        }
+    }
+    if (fabsf(mean) < 1e-3f && fabsf(peak - 0.25f) < 0.01f) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! Mean %f, peak %f\n", mean, peak);
+    }
+
+    printf("TEST: Streaming conversion with adaptive gain brings a quiet tone to the target level in int16: ");
+    config.format = PCM_FORMAT_S16;
+    config.chan_mask = 0x5;
+    config.adaptive_gain = 1;
+    config.target_level = 0.5f;
+    int peak16 = 0;
+    if (convert_stream_init(&stream, &config, NCHAN, STREAM_RATE, &params) == 0) {
+        // The gain increases slowly, with a time constant of a few seconds
+        for (size_t b = 0; b < 6 * STREAM_BLOCKS; ++b) {
+            stream_tone(raw_stream, b, 0.02, 0.0);
+            convert_stream_process(&stream, raw_stream, STREAM_BLOCK, NCHAN, s16_stream);
+        }
+        for (size_t i = 0; i < STREAM_BLOCK * 2; ++i) {
+            peak16 = abs(s16_stream[i]) > peak16 ? abs(s16_stream[i]) : peak16;
+        }
+    }
+    if (abs(peak16 - 16384) < 16384 / 20) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! Peak %d instead of 16384\n", peak16);
+    }
+
+    printf("TEST: Streaming conversion of 5 channels, split across vectors, matches a scalar reference filter: ");
+    // Frames covering the whole range, the reference is the filter written plainly, sample by sample
+    config.format = PCM_FORMAT_F32;
+    config.chan_mask = 0x3e;
+    config.gain = 3.0f;
+    config.adaptive_gain = 0;
+    errors = 0;
+    convert_stream_t stream16;
+    if (convert_stream_init(&stream, &config, NCHAN, STREAM_RATE, &params) == 0) {
+        config.format = PCM_FORMAT_S16;
+        convert_stream_init(&stream16, &config, NCHAN, STREAM_RATE, &params);
+        float last_in[NCHAN] = { 0 }, last_out[NCHAN] = { 0 };
+        for (size_t b = 0; b < 3; ++b) {
+            for (size_t i = 0; i < STREAM_BLOCK * NCHAN; ++i) {
+                raw_stream[i] = (uint32_t) (((b * STREAM_BLOCK * NCHAN + i) * 1777) % 65537);
+            }
+            convert_stream_process(&stream, raw_stream, STREAM_BLOCK, NCHAN, f32_stream);
+            convert_stream_process(&stream16, raw_stream, STREAM_BLOCK, NCHAN, s16_stream);
+            for (size_t f = 0; f < STREAM_BLOCK; ++f) {
+                for (size_t c = 0; c < 5; ++c) {
+                    const float x = (float) ((int32_t) raw_stream[f * NCHAN + c + 1] - 32768) / 32768.0f;
+                    const float y = x - last_in[c] + stream.pole * last_out[c];
+                    last_in[c] = x;
+                    last_out[c] = y;
+                    const float expected16 = fmaxf(-32768.0f, fminf(32767.0f, rintf(3.0f * y * 32768.0f)));
+                    errors += fabsf(f32_stream[f * 5 + c] - 3.0f * y) > 1e-5f;
+                    errors += fabsf(s16_stream[f * 5 + c] - expected16) > 1.0f;
+                }
+            }
+        }
+    }
+    if (errors == 0) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! %zu wrong samples\n", errors);
+    }
+
+    printf("EXITING TESTING PROGRAM\n");
+    return 0;
+}
@@ -0,0 +1,216 @@
+/**
+ * @brief Direction of arrival estimation with GCC-PHAT and SRP-PHAT. Headers in doa.h.
+ *
+ *        The work of an estimate is batched: one forward transform per channel, then one inverse transform
+ *        per pair, then the grid search which only reads the correlations kept around lag 0, through the
+ *        delay table. Its cost does not depend on the number of frames between estimates.
+ *
+ * @author Loïc Droz <lk.droz@gmail.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "doa.h"
+
+// Regularization of the PHAT weighting, for bins with no energy
+#define DOA_PHAT_EPSILON 1e-20f
+
+
+doa_t * doa_create(const beam_mic_t * mics, size_t nchan, size_t sample_rate, const doa_config_t * config, uint32_t mid)
+{
+    const size_t n = config -> fft_size;
+    if (nchan < 2 || nchan > DOA_MAX_CHAN || sample_rate == 0 || mid == 0 || config -> hop == 0 || config -> grid_size == 0) {
+        fprintf(stderr, "Error! Unsupported DOA parameters: %zu channels, hop %zu, FFT size %zu.\n", nchan, config -> hop, n);
+        return NULL;
+    }
+
+    doa_t * doa = calloc(1, sizeof(doa_t));
+    if (doa == NULL) {
+        fprintf(stderr, "Error! Could not allocate memory for DOA estimator.\n");
+        return NULL;
+    }
+    doa -> plan = fft_plan_create(n);
+    if (doa -> plan == NULL) {
+        free(doa);
+        return NULL;
+    }
+    doa -> nchan = nchan;
+    doa -> fft_size = n;
+    doa -> hop = config -> hop;
+    doa -> grid_size = config -> grid_size;
+
+    // All pairs, and the largest distance between two mics
+    double max_distance = 0.0;
+    for (size_t i = 0; i < nchan; ++i) {
+        for (size_t j = i + 1; j < nchan; ++j) {
+            doa -> pairs[doa -> npairs][0] = (uint8_t) i;
+            doa -> pairs[doa -> npairs][1] = (uint8_t) j;
+            doa -> npairs += 1;
+            const double dx = mics[j].x - mics[i].x, dy = mics[j].y - mics[i].y, dz = mics[j].z - mics[i].z;
+            const double distance = sqrt(dx * dx + dy * dy + dz * dz);
+            max_distance = distance > max_distance ? distance : max_distance;
+        }
+    }
+    doa -> max_lag = (int) ceil(max_distance / BEAM_SPEED_OF_SOUND * sample_rate);
+    if (2 * (size_t) doa -> max_lag + 2 > n) {
+        fprintf(stderr, "Error! The FFT size %zu is too small for the array.\n", n);
+        doa_free(doa);
+        return NULL;
+    }
+    const size_t nlags = 2 * doa -> max_lag + 2;
+
+    doa -> bin_min = config -> min_freq > 0 ? (size_t) ceil(config -> min_freq * n / sample_rate) : 1;
+    doa -> bin_max = config -> max_freq > 0 ? (size_t) floor(config -> max_freq * n / sample_rate) : n / 2;
+    doa -> bin_max = doa -> bin_max > n / 2 ? n / 2 : doa -> bin_max;
+    doa -> bin_min = doa -> bin_min < 1 ? 1 : doa -> bin_min;
+
+    doa -> window = calloc(n, sizeof(float));
+    doa -> windowed = calloc(n, sizeof(float));
+    doa -> spectra = calloc(nchan * (n + 2), sizeof(float));
+    doa -> cross = calloc(n + 2, sizeof(float));
+    doa -> corr = calloc(n, sizeof(float));
+    doa -> pair_corr = calloc(doa -> npairs * nlags, sizeof(float));
+    doa -> lag_index = calloc(doa -> grid_size * doa -> npairs, sizeof(int32_t));
+    doa -> lag_frac = calloc(doa -> grid_size * doa -> npairs, sizeof(float));
+    if (doa -> window == NULL || doa -> windowed == NULL || doa -> spectra == NULL
+        || fft_overlap_init(&(doa -> overlap), n, doa -> hop, nchan, NULL, nchan, mid)
+        || doa -> cross == NULL || doa -> corr == NULL || doa -> pair_corr == NULL || doa -> lag_index == NULL
+        || doa -> lag_frac == NULL || doa -> bin_min > doa -> bin_max) {
+        fprintf(stderr, "Error! Could not allocate memory for DOA buffers, or empty band.\n");
+        doa_free(doa);
+        return NULL;
+    }
+
+    for (size_t k = 0; k < n; ++k) {
+        doa -> window[k] = (float) (0.5 - 0.5 * cos(2 * M_PI * k / n));
+    }
+
+    // Correlation of perfectly coherent channels at lag 0, which normalizes the GCC-PHAT to 1
+    for (size_t k = doa -> bin_min; k <= doa -> bin_max; ++k) {
+        doa -> cross[2 * k] = 1.0f;
+    }
+    fft_inverse(doa -> plan, doa -> cross, doa -> corr);
+    doa -> norm = 1.0f / doa -> corr[0];
+
+    // Delay table: channel j receives the wave from the direction u (p_j - p_i).u / c later than channel i,
+    // so the correlation of the pair peaks at this lag
+    for (size_t g = 0; g < doa -> grid_size; ++g) {
+        const double azimuth = 2 * M_PI * g / doa -> grid_size;
+        const double ux = cos(azimuth), uy = sin(azimuth);
+        for (size_t p = 0; p < doa -> npairs; ++p) {
+            const beam_mic_t * mi = &mics[doa -> pairs[p][0]];
+            const beam_mic_t * mj = &mics[doa -> pairs[p][1]];
+            double lag = ((mj -> x - mi -> x) * ux + (mj -> y - mi -> y) * uy) / BEAM_SPEED_OF_SOUND * sample_rate;
+            lag = lag > doa -> max_lag ? doa -> max_lag : (lag < -doa -> max_lag ? -doa -> max_lag : lag);
+            const double base = floor(lag);
+            doa -> lag_index[g * doa -> npairs + p] = (int32_t) base + doa -> max_lag;
+            doa -> lag_frac[g * doa -> npairs + p] = (float) (lag - base);
+        }
+    }
+
+    return doa;
+}
+
+
+void doa_free(doa_t * doa)
+{
+    if (doa -> plan != NULL) {
+        fft_plan_free(doa -> plan);
+    }
+    free(doa -> window);
+    fft_overlap_free(&(doa -> overlap));
+    free(doa -> windowed);
+    free(doa -> spectra);
+    free(doa -> cross);
+    free(doa -> corr);
+    free(doa -> pair_corr);
+    free(doa -> lag_index);
+    free(doa -> lag_frac);
+    free(doa);
+}
+
+
+void doa_reset(doa_t * doa)
+{
+    fft_overlap_reset(&(doa -> overlap));
+}
+
+
+// Compute an estimate from the last fft_size frames
+static void doa_estimate(doa_t * doa, doa_result_t * result)
+{
+    const size_t n = doa -> fft_size;
+    const size_t nlags = 2 * doa -> max_lag + 2;
+
+    // Spectrum of each channel
+    for (size_t c = 0; c < doa -> nchan; ++c) {
+        const float * frames = &(doa -> overlap.frames[c * n]);
+        for (size_t k = 0; k < n; ++k) {
+            doa -> windowed[k] = frames[k] * doa -> window[k];
+        }
+        fft_forward(doa -> plan, doa -> windowed, &(doa -> spectra[c * (n + 2)]));
+    }
+
+    // GCC-PHAT of each pair, the bins outside of the band stay 0 in the cross spectrum
+    for (size_t p = 0; p < doa -> npairs; ++p) {
+        const float * xi = &(doa -> spectra[doa -> pairs[p][0] * (n + 2)]);
+        const float * xj = &(doa -> spectra[doa -> pairs[p][1] * (n + 2)]);
+        for (size_t k = doa -> bin_min; k <= doa -> bin_max; ++k) {
+            // X_i conj(X_j), whitened
+            const float re = xi[2 * k] * xj[2 * k] + xi[2 * k + 1] * xj[2 * k + 1];
+            const float im = xi[2 * k + 1] * xj[2 * k] - xi[2 * k] * xj[2 * k + 1];
+            const float weight = doa -> norm / (sqrtf(re * re + im * im) + DOA_PHAT_EPSILON);
+            doa -> cross[2 * k] = re * weight;
+            doa -> cross[2 * k + 1] = im * weight;
+        }
+        fft_inverse(doa -> plan, doa -> cross, doa -> corr);
+
+        // Keep the lags the array allows, negative lags are at the end of the circular correlation
+        float * pair_corr = &(doa -> pair_corr[p * nlags]);
+        for (int l = -doa -> max_lag; l <= doa -> max_lag; ++l) {
+            pair_corr[l + doa -> max_lag] = doa -> corr[(l + n) % n];
+        }
+        pair_corr[nlags - 1] = pair_corr[nlags - 2];
+    }
+
+    // SRP-PHAT grid search
+    float best = -INFINITY;
+    size_t best_g = 0;
+    for (size_t g = 0; g < doa -> grid_size; ++g) {
+        const int32_t * index = &(doa -> lag_index[g * doa -> npairs]);
+        const float * frac = &(doa -> lag_frac[g * doa -> npairs]);
+        float power = 0.0f;
+        for (size_t p = 0; p < doa -> npairs; ++p) {
+            const float * pair_corr = &(doa -> pair_corr[p * nlags + index[p]]);
+            power += pair_corr[0] + frac[p] * (pair_corr[1] - pair_corr[0]);
+        }
+        if (power > best) {
+            best = power;
+            best_g = g;
+        }
+    }
+
+    result -> azimuth = 360.0f * best_g / doa -> grid_size;
+    result -> confidence = best / doa -> npairs;
+}
+
+
+size_t doa_process(doa_t * doa, const uint32_t * src, size_t nframes, doa_result_t * results, size_t max_results)
+{
+    size_t nresults = 0;
+
+    while (nframes > 0 && nresults < max_results) {
+        int ready;
+        const size_t count = fft_overlap_push(&(doa -> overlap), src, nframes, &ready);
+        src += count * doa -> nchan;
+        nframes -= count;
+
+        if (ready) {
+            doa_estimate(doa, &results[nresults]);
+            nresults += 1;
+        }
+    }
+    return nresults;
+}
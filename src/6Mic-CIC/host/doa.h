@@ -0,0 +1,125 @@
+/**
+ * @brief Streaming direction of arrival estimation with GCC-PHAT and SRP-PHAT.
+ *
+ *        Every hop frames, the last fft_size frames of each channel are windowed and transformed. For each pair
+ *        of microphones, the cross spectrum is whitened (PHAT weighting) and transformed back into the
+ *        generalized cross-correlation (GCC-PHAT) over the lags the array allows. The steered response power
+ *        (SRP-PHAT) of each azimuth of a grid is then the sum over the pairs of their correlation at the delay
+ *        the azimuth implies, read from a precomputed table. The sources are assumed to be far away and in the
+ *        plane of the azimuth, see beamform.h for the conventions.
+ *
+ * @author Loïc Droz <lk.droz@gmail.com>
+ *
+ */
+
+#ifndef DOA_H
+#define DOA_H
+
+#include <stddef.h>
+#include <inttypes.h>
+#include "beamform.h"
+#include "fft.h"
+
+// Max number of channels, and of pairs of channels
+#define DOA_MAX_CHAN 16
+#define DOA_MAX_PAIRS (DOA_MAX_CHAN * (DOA_MAX_CHAN - 1) / 2)
+
+/**
+ * @brief Configuration of a DOA estimator, see doa_create.
+ *
+ */
+typedef struct {
+    // Size of the analysis window in frames, a power of two, e.g. 1024 for 16 ms at 64 kHz
+    size_t fft_size;
+    // Frames between two estimates, e.g. 8000 for 8 estimates per second at 64 kHz
+    size_t hop;
+    // Number of azimuths of the search grid, evenly spread over 360 degrees
+    size_t grid_size;
+    // Band used for the estimation in Hz, 0 for the whole band. Low frequencies carry little spatial information.
+    float min_freq;
+    float max_freq;
+} doa_config_t;
+
+/**
+ * @brief One estimate of the direction of arrival.
+ *
+ */
+typedef struct {
+    // Azimuth of the loudest source, in degrees between 0 and 360
+    float azimuth;
+    // Average over the pairs of the GCC-PHAT at the delays of this azimuth, close to 1 for a single coherent
+    // source and close to 0 for diffuse noise
+    float confidence;
+} doa_result_t;
+
+typedef struct {
+    size_t nchan;
+    size_t npairs;
+    uint8_t pairs[DOA_MAX_PAIRS][2];
+    size_t fft_size;
+    size_t hop;
+    size_t grid_size;
+    // Bins of the band used for the estimation
+    size_t bin_min;
+    size_t bin_max;
+    // Largest delay between two mics in frames, rounded up, the correlation is kept for lags within it
+    int max_lag;
+    fft_plan_t * plan;
+    // Hann window, fft_size floats
+    float * window;
+    // Last fft_size frames of each channel
+    fft_overlap_t overlap;
+    // Work buffers: windowed frame, spectrum of each channel, cross spectrum, correlation
+    float * windowed;
+    float * spectra;
+    float * cross;
+    float * corr;
+    // GCC-PHAT of each pair for lags -max_lag to max_lag, and one more for the interpolation, normalized by
+    // norm so that perfectly coherent channels give 1
+    float * pair_corr;
+    float norm;
+    // Delay table: for each azimuth and pair, the integer part of the lag shifted by max_lag, and its fraction
+    int32_t * lag_index;
+    float * lag_frac;
+} doa_t;
+
+/**
+ * @brief Create a DOA estimator for the given array. All the memory is allocated here, none while processing.
+ *
+ * @param mics The positions of the microphones, one per channel in the order of the frames.
+ * @param nchan The number of channels, at least 2.
+ * @param sample_rate The sample rate of the frames, in Hz.
+ * @param config The analysis parameters.
+ * @param mid Value of a silent raw sample, that is half of the CIC gain, see convert_params_t.
+ * @return doa_t* A pointer to a new estimator in case of success, NULL otherwise.
+ */
+doa_t * doa_create(const beam_mic_t * mics, size_t nchan, size_t sample_rate, const doa_config_t * config, uint32_t mid);
+
+/**
+ * @brief Free the resources allocated for the given estimator.
+ *
+ * @param doa The estimator to free.
+ */
+void doa_free(doa_t * doa);
+
+/**
+ * @brief Forget the frames received so far, e.g. after a gap in the input. The next estimate needs fft_size new frames.
+ *
+ * @param doa The estimator.
+ */
+void doa_reset(doa_t * doa);
+
+/**
+ * @brief Feed a block of raw interleaved frames, and compute an estimate each time hop new frames have been
+ *        received. A stream can be split into blocks of any size.
+ *
+ * @param doa The estimator.
+ * @param src The input frames, nchan raw 32 bits words each.
+ * @param nframes The number of input frames.
+ * @param results The estimates computed from this block, in order.
+ * @param max_results The max number of estimates, the frames past the last one which fits are not used.
+ * @return size_t The number of estimates written to results.
+ */
+size_t doa_process(doa_t * doa, const uint32_t * src, size_t nframes, doa_result_t * results, size_t max_results);
+
+#endif
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "doa.h"
+
+#define NCHAN 6
+#define RATE 64000
+#define MID 32768
+#define NFRAMES 32768
+#define FFT_SIZE 1024
+#define HOP 4096
+// Uniform circular array of 6 mics, radius in meters
+#define RADIUS 0.05
+// Number of tones of the broadband test source
+#define NTONES 40
+
+static uint32_t in[NFRAMES * NCHAN];
+
+
+double seconds_since(const struct timespec * start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start -> tv_sec) + (now.tv_nsec - start -> tv_nsec) * 1e-9;
+}
+
+
+// Broadband source from the given azimuth, made of tones with random phases, plus independent noise on each mic
+void source(const beam_mic_t * mics, double azimuth, double amp, double noise) {
+    double freqs[NTONES], phases[NTONES];
+    for (size_t t = 0; t < NTONES; ++t) {
+        freqs[t] = 300.0 + 150.0 * t + 100.0 * rand() / RAND_MAX;
+        phases[t] = 2 * M_PI * rand() / RAND_MAX;
+    }
+    const double ux = cos(azimuth * M_PI / 180.0);
+    const double uy = sin(azimuth * M_PI / 180.0);
+    for (size_t c = 0; c < NCHAN; ++c) {
+        // Mics closer to the source get the wave earlier
+        const double ahead = (mics[c].x * ux + mics[c].y * uy) / BEAM_SPEED_OF_SOUND;
+        for (size_t f = 0; f < NFRAMES; ++f) {
+            double x = noise * (2.0 * rand() / RAND_MAX - 1.0);
+            for (size_t t = 0; t < NTONES; ++t) {
+                x += amp / NTONES * sin(2 * M_PI * freqs[t] * ((double) f / RATE + ahead) + phases[t]);
+            }
+            in[f * NCHAN + c] = (uint32_t) (MID + lround(x * MID));
+        }
+    }
+}
+
+
+// Feed the input in blocks of odd sizes, returns the number of estimates
+size_t run(doa_t * doa, doa_result_t * results, size_t max_results) {
+    size_t nresults = 0;
+    for (size_t f = 0; f < NFRAMES; f += 999) {
+        const size_t n = (NFRAMES - f) < 999 ? (NFRAMES - f) : 999;
+        nresults += doa_process(doa, &in[f * NCHAN], n, &results[nresults], max_results - nresults);
+    }
+    return nresults;
+}
+
+
+int main(void) {
+    printf("\nSTARTING DOA TESTING PROGRAM!\n");
+    srand(42);
+
+    printf("TEST: The real FFT matches the DFT, and the inverse FFT undoes it: ");
+    fft_plan_t * plan = fft_plan_create(256);
+    float x[256], spectrum[258], back[256];
+    for (size_t i = 0; i < 256; ++i) {
+        x[i] = (float) rand() / RAND_MAX - 0.5f;
+    }
+    fft_forward(plan, x, spectrum);
+    fft_inverse(plan, spectrum, back);
+    double error = 0.0;
+    for (size_t k = 0; k <= 128; ++k) {
+        double re = 0.0, im = 0.0;
+        for (size_t i = 0; i < 256; ++i) {
+            re += x[i] * cos(2 * M_PI * k * i / 256);
+            im -= x[i] * sin(2 * M_PI * k * i / 256);
+        }
+        error = fmax(error, fabs(re - spectrum[2 * k]) + fabs(im - spectrum[2 * k + 1]));
+    }
+    for (size_t i = 0; i < 256; ++i) {
+        error = fmax(error, fabs(back[i] - x[i]));
+    }
+    fft_plan_free(plan);
+    if (error < 1e-4) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! Max error %g\n", error);
+    }
+
+    beam_mic_t mics[NCHAN];
+    for (size_t c = 0; c < NCHAN; ++c) {
+        mics[c].x = (float) (RADIUS * cos(2 * M_PI * c / NCHAN));
+        mics[c].y = (float) (RADIUS * sin(2 * M_PI * c / NCHAN));
+        mics[c].z = 0.0f;
+    }
+    const doa_config_t config = {
+        .fft_size = FFT_SIZE,
+        .hop = HOP,
+        .grid_size = 360,
+        .min_freq = 200.0f,
+        .max_freq = 8000.0f,
+    };
+    doa_result_t results[NFRAMES / HOP];
+
+    printf("TEST: Sources from several directions are located within 3 degrees, with a high confidence: ");
+    const double azimuths[4] = { 0.0, 77.0, 163.0, 290.0 };
+    size_t errors = 0;
+    for (size_t a = 0; a < 4; ++a) {
+        source(mics, azimuths[a], 0.5, 0.01);
+        doa_t * doa = doa_create(mics, NCHAN, RATE, &config, MID);
+        if (doa == NULL) {
+            errors += 1;
+            continue;
+        }
+        const size_t nresults = run(doa, results, NFRAMES / HOP);
+        errors += nresults != NFRAMES / HOP;
+        for (size_t r = 0; r < nresults; ++r) {
+            const double diff = fabs(fmod(results[r].azimuth - azimuths[a] + 540.0, 360.0) - 180.0);
+            if (diff > 3.0 || results[r].confidence < 0.5) {
+                printf("(%.1f instead of %.1f, confidence %.2f) ", results[r].azimuth, azimuths[a], results[r].confidence);
+                errors += 1;
+                break;
+            }
+        }
+        doa_free(doa);
+    }
+    if (errors == 0) {
+        printf("Success!\n");
+    } else {
+        printf("Failure!\n");
+    }
+
+    printf("TEST: Independent noise on each mic gives a low confidence: ");
+    source(mics, 0.0, 0.0, 0.5);
+    doa_t * doa = doa_create(mics, NCHAN, RATE, &config, MID);
+    size_t nresults = run(doa, results, NFRAMES / HOP);
+    float max_confidence = 0.0f;
+    for (size_t r = 0; r < nresults; ++r) {
+        max_confidence = results[r].confidence > max_confidence ? results[r].confidence : max_confidence;
+    }
+    if (nresults > 0 && max_confidence < 0.2f) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! Confidence %.2f\n", max_confidence);
+    }
+
+    // Cost of an estimate, and the share of a core it takes at this rate
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    doa_reset(doa);
+    nresults = run(doa, results, NFRAMES / HOP);
+    const double per_estimate = seconds_since(&start) / nresults;
+    printf("DOA: %zu pairs, %.2f ms per estimate, %.1f %% of a core at %.1f estimates per second\n",
+           doa -> npairs, per_estimate * 1e3, 100.0 * per_estimate * RATE / HOP, (double) RATE / HOP);
+    doa_free(doa);
+
+    printf("EXITING TESTING PROGRAM\n");
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "filter.h"
+
+#define NCHAN 6
+#define MID 32768
+#define NFRAMES 8192
+
+
+// Amplitude of a sine in the last frames output for channel c, once the filter has settled
+double amplitude(const uint32_t * frames, size_t nframes, size_t c) {
+    double power = 0.0;
+    for (size_t f = nframes / 2; f < nframes; ++f) {
+        const double x = (double) (int32_t) (frames[f * NCHAN + c] - MID);
+        power += x * x;
+    }
+    // Never return 0, to keep decibels finite
+    return sqrt(2 * power / (nframes - nframes / 2)) + 1e-3;
+}
+
+
+// Run a sine of normalized frequency freq and given amplitude through a new filter, in blocks of odd sizes
+size_t run_filter(unsigned int decimation, double freq, double amp, uint32_t * out) {
+    static uint32_t in[NFRAMES * NCHAN];
+    for (size_t f = 0; f < NFRAMES; ++f) {
+        for (size_t c = 0; c < NCHAN; ++c) {
+            in[f * NCHAN + c] = (uint32_t) (MID + lround(amp * sin(2 * M_PI * freq * f + c)));
+        }
+    }
+    filter_t * filter = filter_create(NCHAN, 4, 16, decimation, 1000, MID);
+    if (filter == NULL) {
+        return 0;
+    }
+    size_t nout = 0;
+    for (size_t f = 0; f < NFRAMES; f += 777) {
+        const size_t n = (NFRAMES - f) < 777 ? (NFRAMES - f) : 777;
+        nout += filter_process(filter, &in[f * NCHAN], n, &out[nout * NCHAN]);
+    }
+    filter_free(filter);
+    return nout;
+}
+
+
+int main(void) {
+    printf("\nSTARTING DSP TESTING PROGRAM!\n");
+    static uint32_t out[(NFRAMES + 1) * NCHAN];
+
+    printf("TEST: The compensation filter has unity gain at DC: ");
+    size_t errors = 0;
+    static uint32_t in_dc[1000 * NCHAN];
+    for (size_t i = 0; i < 1000 * NCHAN; ++i) {
+        in_dc[i] = MID + 1000;
+    }
+    filter_t * filter = filter_create(NCHAN, 4, 16, 1, 1000, MID);
+    filter_process(filter, in_dc, 1000, out);
+    for (size_t i = 500 * NCHAN; i < 1000 * NCHAN; ++i) {
+        if (abs((int32_t) (out[i] - MID) - 1000) > 1) {
+            errors += 1;
+        }
+    }
+    filter_free(filter);
+    if (errors == 0) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! %zu wrong samples\n", errors);
+    }
+
+    printf("TEST: The compensation filter undoes the CIC droop in the passband: ");
+    const double freq = 0.3;
+    const double x = M_PI * freq / 16;
+    const double droop = pow(sin(16 * x) / (16 * sin(x)), 4);
+    size_t nout = run_filter(1, freq, 8000 * droop, out);
+    const double gain = amplitude(out, nout, 0) / 8000;
+    if (fabs(gain - 1.0) < 0.02) {
+        printf("Success! Gain %.3f\n", gain);
+    } else {
+        printf("Failure! Gain %.3f instead of 1\n", gain);
+    }
+
+    printf("TEST: Decimating by 4 outputs a quarter of the frames and rejects what would alias: ");
+    nout = run_filter(4, 0.2, 8000, out);
+    const double rejection = 20 * log10(amplitude(out, nout, 3) / 8000);
+    const size_t nout_pass = run_filter(4, 0.05, 8000, out);
+    const double pass_gain = amplitude(out, nout_pass, 3) / 8000;
+    if (nout == NFRAMES / 4 && rejection < -40 && pass_gain > 0.95) {
+        printf("Success! Rejection %.1f dB, passband gain %.3f\n", rejection, pass_gain);
+    } else {
+        printf("Failure! %zu frames out, rejection %.1f dB, passband gain %.3f\n", nout, rejection, pass_gain);
+    }
+
+    printf("EXITING TESTING PROGRAM\n");
+    return 0;
+}
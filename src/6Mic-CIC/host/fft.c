@@ -0,0 +1,221 @@
+/**
+ * @brief Real FFT. Headers in fft.h.
+ *
+ *        A real transform of size n is computed with a complex transform of size n / 2 on the even samples as
+ *        real parts and the odd samples as imaginary parts, followed by a split step separating the spectra
+ *        of both. The complex transform is an iterative radix-2 decimation in time.
+ *
+ * @author Loïc Droz <lk.droz@gmail.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "fft.h"
+
+
+fft_plan_t * fft_plan_create(size_t n)
+{
+    if (n < 4 || (n & (n - 1)) != 0) {
+        fprintf(stderr, "Error! Unsupported FFT size: %zu.\n", n);
+        return NULL;
+    }
+
+    fft_plan_t * plan = calloc(1, sizeof(fft_plan_t));
+    if (plan == NULL) {
+        fprintf(stderr, "Error! Could not allocate memory for FFT plan.\n");
+        return NULL;
+    }
+    const size_t half = n / 2;
+    plan -> n = n;
+    plan -> half = half;
+    plan -> twiddles = calloc(half, sizeof(float));
+    plan -> split = calloc(2 * half, sizeof(float));
+    plan -> bitrev = calloc(half, sizeof(size_t));
+    plan -> work = calloc(2 * (half + 1), sizeof(float));
+    if (plan -> twiddles == NULL || plan -> split == NULL || plan -> bitrev == NULL || plan -> work == NULL) {
+        fprintf(stderr, "Error! Could not allocate memory for FFT tables.\n");
+        fft_plan_free(plan);
+        return NULL;
+    }
+
+    for (size_t k = 0; k < half / 2; ++k) {
+        plan -> twiddles[2 * k] = (float) cos(2 * M_PI * k / half);
+        plan -> twiddles[2 * k + 1] = (float) -sin(2 * M_PI * k / half);
+    }
+    for (size_t k = 0; k < half; ++k) {
+        plan -> split[2 * k] = (float) cos(2 * M_PI * k / n);
+        plan -> split[2 * k + 1] = (float) -sin(2 * M_PI * k / n);
+    }
+    unsigned int bits = 0;
+    while (((size_t) 1 << bits) < half) {
+        bits += 1;
+    }
+    for (size_t k = 0; k < half; ++k) {
+        size_t r = 0;
+        for (unsigned int b = 0; b < bits; ++b) {
+            r |= ((k >> b) & 1) << (bits - 1 - b);
+        }
+        plan -> bitrev[k] = r;
+    }
+    return plan;
+}
+
+
+void fft_plan_free(fft_plan_t * plan)
+{
+    free(plan -> twiddles);
+    free(plan -> split);
+    free(plan -> bitrev);
+    free(plan -> work);
+    free(plan);
+}
+
+
+// In-place complex transform of the work buffer, already in bit reversed order. The inverse uses conjugate twiddles.
+static void fft_complex(fft_plan_t * plan, int inverse)
+{
+    const size_t half = plan -> half;
+    const float sign = inverse ? -1.0f : 1.0f;
+    float * z = plan -> work;
+
+    for (size_t len = 2; len <= half; len *= 2) {
+        const size_t stride = half / len;
+        for (size_t start = 0; start < half; start += len) {
+            for (size_t k = 0; k < len / 2; ++k) {
+                const float wr = plan -> twiddles[2 * k * stride];
+                const float wi = sign * plan -> twiddles[2 * k * stride + 1];
+                float * a = &z[2 * (start + k)];
+                float * b = &z[2 * (start + k + len / 2)];
+                const float tr = b[0] * wr - b[1] * wi;
+                const float ti = b[0] * wi + b[1] * wr;
+                b[0] = a[0] - tr;
+                b[1] = a[1] - ti;
+                a[0] += tr;
+                a[1] += ti;
+            }
+        }
+    }
+}
+
+
+void fft_forward(fft_plan_t * plan, const float * in, float * out)
+{
+    const size_t half = plan -> half;
+    float * z = plan -> work;
+
+    // Even samples as real parts, odd samples as imaginary parts
+    for (size_t k = 0; k < half; ++k) {
+        const size_t r = plan -> bitrev[k];
+        z[2 * r] = in[2 * k];
+        z[2 * r + 1] = in[2 * k + 1];
+    }
+    fft_complex(plan, 0);
+    z[2 * half] = z[0];
+    z[2 * half + 1] = z[1];
+
+    // X[k] = E[k] + W^k O[k], with E and O the spectra of the even and odd samples
+    for (size_t k = 0; k <= half; ++k) {
+        const float zr = z[2 * k], zi = z[2 * k + 1];
+        const float cr = z[2 * (half - k)], ci = -z[2 * (half - k) + 1];
+        const float er = 0.5f * (zr + cr), ei = 0.5f * (zi + ci);
+        // O[k] = (Z[k] - conj(Z[half - k])) / 2i
+        const float or_ = 0.5f * (zi - ci), oi = -0.5f * (zr - cr);
+        const float wr = k < half ? plan -> split[2 * k] : -1.0f;
+        const float wi = k < half ? plan -> split[2 * k + 1] : 0.0f;
+        out[2 * k] = er + wr * or_ - wi * oi;
+        out[2 * k + 1] = ei + wr * oi + wi * or_;
+    }
+}
+
+
+void fft_inverse(fft_plan_t * plan, const float * in, float * out)
+{
+    const size_t half = plan -> half;
+    float * z = plan -> work;
+    const float norm = 1.0f / half;
+
+    // Z[k] = E[k] + i O[k], with E[k] = (X[k] + conj(X[half - k])) / 2 and O[k] = (X[k] - conj(X[half - k])) / 2 W^k
+    for (size_t k = 0; k < half; ++k) {
+        const float xr = in[2 * k], xi = k == 0 ? 0.0f : in[2 * k + 1];
+        const float cr = in[2 * (half - k)], ci = (k == 0) ? 0.0f : -in[2 * (half - k) + 1];
+        const float er = 0.5f * (xr + cr), ei = 0.5f * (xi + ci);
+        const float dr = 0.5f * (xr - cr), di = 0.5f * (xi - ci);
+        // Divide by W^k, that is multiply by its conjugate
+        const float wr = plan -> split[2 * k], wi = -plan -> split[2 * k + 1];
+        const float or_ = dr * wr - di * wi, oi = dr * wi + di * wr;
+        const size_t r = plan -> bitrev[k];
+        z[2 * r] = er - oi;
+        z[2 * r + 1] = ei + or_;
+    }
+    fft_complex(plan, 1);
+
+    for (size_t k = 0; k < half; ++k) {
+        out[2 * k] = z[2 * k] * norm;
+        out[2 * k + 1] = z[2 * k + 1] * norm;
+    }
+}
+
+
+int fft_overlap_init(fft_overlap_t * overlap, size_t n, size_t hop, size_t nchan, const uint8_t * chans, size_t nsel,
+                     uint32_t mid)
+{
+    overlap -> n = n;
+    overlap -> hop = hop;
+    overlap -> nchan = nchan;
+    overlap -> chans = chans;
+    overlap -> nsel = nsel;
+    overlap -> mid = mid;
+    overlap -> scale = 1.0f / (float) mid;
+    overlap -> valid = 0;
+    overlap -> fill = 0;
+    overlap -> frames = calloc(nsel * n, sizeof(float));
+    return overlap -> frames == NULL;
+}
+
+
+void fft_overlap_free(fft_overlap_t * overlap)
+{
+    free(overlap -> frames);
+    overlap -> frames = NULL;
+}
+
+
+void fft_overlap_reset(fft_overlap_t * overlap)
+{
+    overlap -> valid = 0;
+    overlap -> fill = 0;
+}
+
+
+size_t fft_overlap_push(fft_overlap_t * overlap, const uint32_t * src, size_t nframes, int * ready)
+{
+    const size_t n = overlap -> n;
+    const size_t nchan = overlap -> nchan;
+
+    // Up to the next analysis frame
+    const size_t count = (overlap -> hop - overlap -> fill) < nframes ? (overlap -> hop - overlap -> fill) : nframes;
+
+    // Shift the frames of each channel, and append the new ones, centered and scaled
+    const size_t skip = count > n ? count - n : 0;
+    const size_t keep = count < n ? count : n;
+    for (size_t s = 0; s < overlap -> nsel; ++s) {
+        const size_t c = overlap -> chans != NULL ? overlap -> chans[s] : s;
+        float * frames = &(overlap -> frames[s * n]);
+        memmove(frames, &frames[keep], (n - keep) * sizeof(float));
+        for (size_t f = 0; f < keep; ++f) {
+            frames[n - keep + f] = (float) (int32_t) (src[(skip + f) * nchan + c] - overlap -> mid) * overlap -> scale;
+        }
+    }
+    overlap -> fill += count;
+    overlap -> valid = (overlap -> valid + count) < n ? (overlap -> valid + count) : n;
+
+    *ready = 0;
+    if (overlap -> fill == overlap -> hop) {
+        overlap -> fill = 0;
+        *ready = overlap -> valid == n;
+    }
+    return count;
+}
@@ -0,0 +1,128 @@
+/**
+ * @brief Real FFT with reusable plans. A plan holds the twiddle factors and the bit reversal table of a
+ *        transform size, so that transforms run without any allocation nor trigonometry.
+ *
+ *        Spectra are stored as n / 2 + 1 complex bins, interleaved real and imaginary parts (n + 2 floats),
+ *        from DC to the Nyquist frequency.
+ *
+ *        The overlap buffer keeps the last n frames of the raw input for analyses sliding over it by a hop of
+ *        frames, like the STFT and the DOA estimation.
+ *
+ * @author Loïc Droz <lk.droz@gmail.com>
+ *
+ */
+
+#ifndef FFT_H
+#define FFT_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+typedef struct {
+    // Size of the real transform, a power of two, and of the complex transform it is computed with
+    size_t n;
+    size_t half;
+    // Twiddle factors of the complex transform, exp(-2 pi i k / half) for k < half / 2, interleaved
+    float * twiddles;
+    // Twiddle factors splitting the complex transform into the real one, exp(-2 pi i k / n) for k < half
+    float * split;
+    // Bit reversal permutation of the complex transform
+    size_t * bitrev;
+    // Complex work buffer, half + 1 complex values
+    float * work;
+} fft_plan_t;
+
+typedef struct {
+    // Size of the analysis frames, and frames between two of them
+    size_t n;
+    size_t hop;
+    // Channels of the raw frames kept in the buffer, the first nsel ones if chans is NULL
+    size_t nchan;
+    const uint8_t * chans;
+    size_t nsel;
+    // Conversion of the raw words, see convert_params_t
+    uint32_t mid;
+    float scale;
+    // Last n frames of each kept channel, centered and scaled, channel after channel, how many of them were
+    // received since the last reset, and the number of new frames since the last analysis frame
+    float * frames;
+    size_t valid;
+    size_t fill;
+} fft_overlap_t;
+
+/**
+ * @brief Create a plan for real transforms of the given size. A plan may be used by one thread at a time.
+ *
+ * @param n The size of the transforms, a power of two, at least 4.
+ * @return fft_plan_t* A pointer to a new plan in case of success, NULL otherwise.
+ */
+fft_plan_t * fft_plan_create(size_t n);
+
+/**
+ * @brief Free the resources allocated for the given plan.
+ *
+ * @param plan The plan to free.
+ */
+void fft_plan_free(fft_plan_t * plan);
+
+/**
+ * @brief Forward transform of n real samples.
+ *
+ * @param plan The plan.
+ * @param in The n real samples.
+ * @param out The n / 2 + 1 complex bins, n + 2 floats. May not overlap the input.
+ */
+void fft_forward(fft_plan_t * plan, const float * in, float * out);
+
+/**
+ * @brief Inverse transform, normalized so that it exactly undoes fft_forward. The imaginary parts of the DC
+ *        and Nyquist bins are ignored.
+ *
+ * @param plan The plan.
+ * @param in The n / 2 + 1 complex bins, n + 2 floats.
+ * @param out The n real samples. May not overlap the input.
+ */
+void fft_inverse(fft_plan_t * plan, const float * in, float * out);
+
+/**
+ * @brief Initialize an overlap buffer, and allocate its frames.
+ *
+ * @param overlap The overlap buffer.
+ * @param n The size of the analysis frames.
+ * @param hop The number of frames between two analysis frames, at least 1.
+ * @param nchan The number of channels of the raw frames.
+ * @param chans The nsel channels to keep, NULL for the first nsel ones. Must outlive the buffer.
+ * @param nsel The number of channels to keep.
+ * @param mid Value of a silent raw sample, that is half of the CIC gain, see convert_params_t.
+ * @return int 0 in case of success, non-zero otherwise.
+ */
+int fft_overlap_init(fft_overlap_t * overlap, size_t n, size_t hop, size_t nchan, const uint8_t * chans, size_t nsel,
+                     uint32_t mid);
+
+/**
+ * @brief Free the frames of an overlap buffer. Does nothing if they were not allocated.
+ *
+ * @param overlap The overlap buffer.
+ */
+void fft_overlap_free(fft_overlap_t * overlap);
+
+/**
+ * @brief Forget the frames received so far. The next analysis frame needs n new frames.
+ *
+ * @param overlap The overlap buffer.
+ */
+void fft_overlap_reset(fft_overlap_t * overlap);
+
+/**
+ * @brief Append raw interleaved frames to the buffer, up to the next analysis frame. With a hop larger than n,
+ *        only the last n frames before an analysis frame are kept.
+ *
+ * @param overlap The overlap buffer.
+ * @param src The input frames, nchan raw 32 bits words each.
+ * @param nframes The number of input frames.
+ * @param ready Set to 1 if the buffer holds a complete analysis frame after this call, to 0 otherwise.
+ * @return size_t The number of input frames consumed, call again with the rest.
+ */
+size_t fft_overlap_push(fft_overlap_t * overlap, const uint32_t * src, size_t nframes, int * ready);
+
+#endif
@@ -0,0 +1,225 @@
+/**
+ * @brief CIC compensation and decimation filter. Headers in filter.h.
+ *
+ *        The FIR filter is designed by frequency sampling of the inverse CIC response, windowed
+ *        with a Blackman window. When decimating, only every decimation-th output frame is computed,
+ *        which is the same amount of work as a polyphase implementation. With SSE2 or NEON, each tap is
+ *        applied to 4 interleaved channels per instruction.
+ *
+ * @author Loïc Droz <lk.droz@gmail.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "filter.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Part of the output band which is compensated, the rest is the transition band
+#define FILTER_PASSBAND 0.8
+// Number of points of the frequency grid used to design the filter
+#define FILTER_DESIGN_GRID 4096
+// Max number of channels the filter can process
+#define FILTER_MAX_CHAN 32
+// Channels filtered at once by FILTER_DOT_SIMD
+#define FILTER_LANES 4
+
+
+// Magnitude response of a CIC filter at frequency f, normalized to the CIC output rate
+static double cic_response(double f, unsigned int order, unsigned int decimation)
+{
+    if (f == 0.0) {
+        return 1.0;
+    }
+    const double x = M_PI * f / decimation;
+    return pow(fabs(sin(decimation * x) / (decimation * sin(x))), order);
+}
+
+
+// Desired response of the compensation filter at frequency f, normalized to the CIC output rate
+static double desired_response(double f, unsigned int order, unsigned int cic_decimation, unsigned int decimation)
+{
+    const double nyquist = 0.5 / decimation;
+    const double pass = FILTER_PASSBAND * nyquist;
+    if (f >= nyquist) {
+        return 0.0;
+    }
+
+    const double boost_at = f < pass ? f : pass;
+    double gain = 1.0 / cic_response(boost_at, order, cic_decimation);
+    gain = gain > FILTER_MAX_BOOST ? FILTER_MAX_BOOST : gain;
+    if (f <= pass) {
+        return gain;
+    }
+    // Raised cosine transition down to the new Nyquist frequency
+    return gain * 0.5 * (1.0 + cos(M_PI * (f - pass) / (nyquist - pass)));
+}
+
+
+filter_t * filter_create(size_t nchan, unsigned int cic_order, unsigned int cic_decimation, unsigned int decimation,
+                         size_t max_frames, uint32_t mid)
+{
+    if (nchan == 0 || nchan > FILTER_MAX_CHAN || (decimation != 1 && decimation != 2 && decimation != 4)) {
+        fprintf(stderr, "Error! Unsupported filter parameters: %zu channels, decimation %u.\n", nchan, decimation);
+        return NULL;
+    }
+
+    filter_t * filter = calloc(1, sizeof(filter_t));
+    if (filter == NULL) {
+        fprintf(stderr, "Error! Could not allocate memory for filter.\n");
+        return NULL;
+    }
+
+    filter -> nchan = nchan;
+    filter -> decimation = decimation;
+    filter -> ntaps = FILTER_TAPS_PER_DECIMATION * decimation - 1;
+    filter -> max_frames = max_frames;
+    filter -> phase = 0;
+    filter -> mid = mid;
+    filter -> taps = calloc(filter -> ntaps, sizeof(float));
+    // Padded so that the vectors of the last frame can be loaded whole, see FILTER_DOT_SIMD
+    filter -> history = calloc((filter -> ntaps - 1 + max_frames) * nchan + FILTER_LANES - 1, sizeof(float));
+    double * h = calloc(filter -> ntaps, sizeof(double));
+    if (filter -> taps == NULL || filter -> history == NULL || h == NULL) {
+        fprintf(stderr, "Error! Could not allocate memory for filter taps and history.\n");
+        free(h);
+        filter_free(filter);
+        return NULL;
+    }
+
+    // Frequency sampling: inverse Fourier transform of the desired (real, even) response, then windowing
+    const size_t ntaps = filter -> ntaps;
+    const double center = (ntaps - 1) / 2.0;
+    double sum = 0.0;
+    for (size_t n = 0; n < ntaps; ++n) {
+        double acc = 0.0;
+        for (size_t i = 0; i <= FILTER_DESIGN_GRID; ++i) {
+            const double f = 0.5 * i / FILTER_DESIGN_GRID;
+            const double weight = (i == 0 || i == FILTER_DESIGN_GRID) ? 0.5 : 1.0;
+            acc += weight * desired_response(f, cic_order, cic_decimation, decimation) * cos(2 * M_PI * f * (n - center));
+        }
+        const double window = 0.42 - 0.5 * cos(2 * M_PI * n / (ntaps - 1)) + 0.08 * cos(4 * M_PI * n / (ntaps - 1));
+        h[n] = acc / FILTER_DESIGN_GRID * window;
+        sum += h[n];
+    }
+
+    // Unity gain at DC, and store the taps in reverse order
+    for (size_t n = 0; n < ntaps; ++n) {
+        filter -> taps[ntaps - 1 - n] = (float) (h[n] / sum);
+    }
+    free(h);
+
+    return filter;
+}
+
+
+void filter_free(filter_t * filter)
+{
+    free(filter -> taps);
+    free(filter -> history);
+    free(filter);
+}
+
+
+// Output frame for the window of ntaps frames starting at w, with a constant number of channels
+#define FILTER_DOT(NCHAN) \
+    for (size_t k = 0; k < ntaps; ++k) { \
+        const float tap = taps[k]; \
+        const float * frame = &w[k * (NCHAN)]; \
+        for (size_t c = 0; c < (NCHAN); ++c) { \
+            acc[c] += tap * frame[c]; \
+        } \
+    }
+
+#if defined(__SSE2__)
+typedef __m128 filter_vec_t;
+#define FILTER_VEC_ZERO() _mm_setzero_ps()
+#define FILTER_VEC_SET(x) _mm_set1_ps(x)
+#define FILTER_VEC_LOAD(p) _mm_loadu_ps(p)
+#define FILTER_VEC_STORE(p, v) _mm_storeu_ps(p, v)
+#define FILTER_VEC_MLA(acc, a, b) _mm_add_ps(acc, _mm_mul_ps(a, b))
+#elif defined(__ARM_NEON)
+typedef float32x4_t filter_vec_t;
+#define FILTER_VEC_ZERO() vdupq_n_f32(0.0f)
+#define FILTER_VEC_SET(x) vdupq_n_f32(x)
+#define FILTER_VEC_LOAD(p) vld1q_f32(p)
+#define FILTER_VEC_STORE(p, v) vst1q_f32(p, v)
+#define FILTER_VEC_MLA(acc, a, b) vmlaq_f32(acc, a, b)
+#endif
+
+// Same as FILTER_DOT, with the channels in the lanes of NVEC vectors. The lanes past the last channel read the next
+// frame, their results are written to acc after the nchan channels and ignored.
+#define FILTER_DOT_SIMD(NVEC) { \
+    filter_vec_t vacc[FILTER_MAX_CHAN / FILTER_LANES]; \
+    for (size_t v = 0; v < (NVEC); ++v) { \
+        vacc[v] = FILTER_VEC_ZERO(); \
+    } \
+    for (size_t k = 0; k < ntaps; ++k) { \
+        const filter_vec_t tap = FILTER_VEC_SET(taps[k]); \
+        const float * frame = &w[k * nchan]; \
+        for (size_t v = 0; v < (NVEC); ++v) { \
+            vacc[v] = FILTER_VEC_MLA(vacc[v], tap, FILTER_VEC_LOAD(&frame[v * FILTER_LANES])); \
+        } \
+    } \
+    for (size_t v = 0; v < (NVEC); ++v) { \
+        FILTER_VEC_STORE(&acc[v * FILTER_LANES], vacc[v]); \
+    } \
+}
+
+size_t filter_process(filter_t * filter, const uint32_t * src, size_t nframes, uint32_t * dst)
+{
+    const size_t nchan = filter -> nchan;
+    const size_t ntaps = filter -> ntaps;
+    const size_t keep = ntaps - 1;
+    const float * taps = filter -> taps;
+    const uint32_t mid = filter -> mid;
+    float * history = filter -> history;
+
+    if (nframes > filter -> max_frames) {
+        nframes = filter -> max_frames;
+    }
+
+    // Center and convert the new frames, after the history
+    float * new_frames = &history[keep * nchan];
+    for (size_t i = 0; i < nframes * nchan; ++i) {
+        new_frames[i] = (float) (int32_t) (src[i] - mid);
+    }
+
+    // Only compute the frames which are kept after decimation
+    size_t out = 0;
+    size_t n = filter -> phase;
+    for (; n < nframes; n += filter -> decimation) {
+        const float * w = &history[n * nchan];
+        float acc[FILTER_MAX_CHAN] = { 0 };
+#if defined(__SSE2__) || defined(__ARM_NEON)
+        switch ((nchan + FILTER_LANES - 1) / FILTER_LANES) {
+            case 1: FILTER_DOT_SIMD(1) break;
+            case 2: FILTER_DOT_SIMD(2) break;
+            case 3: FILTER_DOT_SIMD(3) break;
+            default: FILTER_DOT_SIMD((nchan + FILTER_LANES - 1) / FILTER_LANES) break;
+        }
+#else
+        if (nchan == 6) {
+            FILTER_DOT(6)
+        } else {
+            FILTER_DOT(nchan)
+        }
+#endif
+        for (size_t c = 0; c < nchan; ++c) {
+            dst[out * nchan + c] = (uint32_t) (int32_t) lrintf(acc[c]) + mid;
+        }
+        out += 1;
+    }
+    filter -> phase = (unsigned int) (n - nframes);
+
+    // Keep the last frames as history for the next call
+    memmove(history, &history[nframes * nchan], keep * nchan * sizeof(float));
+    return out;
+}
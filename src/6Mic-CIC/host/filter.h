@@ -0,0 +1,71 @@
+/**
+ * @brief Filter stage between the PRU buffer and the main ringbuffer. Compensates the passband droop
+ *        of the CIC filter and optionally decimates the signal further.
+ *
+ * @author Loïc Droz <lk.droz@gmail.com>
+ *
+ */
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+// Max boost applied by the compensation, in linear gain, to avoid amplifying the PDM noise at the top of the band
+#define FILTER_MAX_BOOST 4.0
+// Number of taps per unit of decimation factor
+#define FILTER_TAPS_PER_DECIMATION 32
+
+typedef struct {
+    // Number of interleaved channels
+    size_t nchan;
+    // Decimation factor of the filter, 1 for compensation only
+    unsigned int decimation;
+    // Taps of the FIR filter, in reverse order so that they line up with the history in memory
+    float * taps;
+    size_t ntaps;
+    // Samples converted to float, for each channel: ntaps - 1 frames of history followed by the new frames
+    float * history;
+    // Max number of input frames per call to filter_process
+    size_t max_frames;
+    // Number of input frames to skip before the next output frame, keeps the decimation phase across calls
+    unsigned int phase;
+    // Value of a silent raw sample, removed before filtering and added back to the output
+    uint32_t mid;
+} filter_t;
+
+/**
+ * @brief Design the compensation filter for the given CIC filter and allocate its state.
+ *
+ * @param nchan The number of interleaved channels.
+ * @param cic_order The order N of the CIC filter.
+ * @param cic_decimation The decimation rate R of the CIC filter.
+ * @param decimation The additional decimation factor, 1, 2 or 4.
+ * @param max_frames The max number of input frames passed to filter_process at once.
+ * @param mid Value of a silent raw sample, that is half of the CIC gain.
+ * @return filter_t* A pointer to a new filter in case of success, NULL otherwise.
+ */
+filter_t * filter_create(size_t nchan, unsigned int cic_order, unsigned int cic_decimation, unsigned int decimation,
+                         size_t max_frames, uint32_t mid);
+
+/**
+ * @brief Free the resources allocated for the given filter.
+ *
+ * @param filter The filter to free.
+ */
+void filter_free(filter_t * filter);
+
+/**
+ * @brief Filter, and decimate, a block of raw interleaved frames. The state is kept between calls.
+ *
+ * @param filter The filter.
+ * @param src The input frames, nchan raw 32 bits words each.
+ * @param nframes The number of input frames, at most max_frames.
+ * @param dst The buffer to which the output frames are written, in the same format as the input. Must hold
+ *        nframes / decimation + 1 frames.
+ * @return size_t The number of output frames.
+ */
+size_t filter_process(filter_t * filter, const uint32_t * src, size_t nframes, uint32_t * dst);
+
+#endif
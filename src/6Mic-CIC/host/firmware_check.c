@@ -0,0 +1,382 @@
+/**
+ * @brief Timing and output check of the PRU1 firmware on the instruction set simulator, see pru_isa.h.
+ *        Plays PDM tones, or a PDM capture, on the input pins of r31 with the clock of the microphones, runs the
+ *        firmware, then reports the worst case number of cycles spent after each edge of the clock, against
+ *        the half period, counts the edges it missed, and compares the frames written to the host memory with
+ *        the software CIC decimator.
+ *        Exits with a non-zero status if an edge was missed, a frame or a sequence number is wrong, or the
+ *        firmware faulted, so that every firmware change can be checked without a BeagleBone.
+ *
+ *        Usage: firmware_check [firmware] [nchan] [decimation] [milliseconds] [pdm file]
+ *               firmware_check -d [firmware]
+ *        Defaults to PRU_DEFAULT_FIRMWARE, 6 channels, a decimation of 16 and 100 ms of tones. The PDM file holds
+ *        one byte per clock period, bit c for channel c, see cic.h. With 12 channels, runs the firmware on PRU1
+ *        and PRU_DEFAULT_FIRMWARE0 on PRU0 together, with tones only, and checks that both capture the same
+ *        frames. With -d, prints the disassembly of the firmware instead, to compare with the listing of pasm.
+ *
+ * @author Loïc Droz <lk.droz@gmail.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pru_isa.h"
+#include "loader.h"
+#include "cic.h"
+#include "pdm.h"
+
+// Layout of the host buffer given to the firmware, small enough to wrap around often
+#define CHECK_PERIOD_FRAMES 64
+#define CHECK_PERIODS 4
+// Physical address of the host buffer, as given by uio_pruss
+#define CHECK_HOST_ADDR 0x9c940000
+// Time after an edge of the clock before the data lines are valid, t_dv of the microphones (125 ns)
+#define CHECK_TDV_CYCLES 25
+// System events raised by the firmware after each period, PRU0_ARM_INTERRUPT from PRU1 and PRU1_ARM_INTERRUPT
+// from PRU0, see pru1.asm
+#define CHECK_EVENT_PRU1 19
+#define CHECK_EVENT_PRU0 20
+// Frequency of the tone of the first channel, the next ones are multiples of it
+#define CHECK_TONE_FREQ 500.0
+#define CHECK_TONE_AMPLITUDE 0.5
+
+// Cycles spent after the edges of one polarity, from the edge until the firmware waits for the clock again,
+// the max apart for the edges after which the firmware raised a period event, and the edges it missed
+typedef struct {
+    uint64_t max;
+    uint64_t max_event;
+    uint64_t sum;
+    uint64_t count;
+    uint64_t missed;
+} edge_stats_t;
+
+// One PRU of the check, with its input, the frames it wrote and the cycles spent after the edges
+typedef struct {
+    pru_cpu_t * cpu;
+    const char * firmware;
+    // Input pins of the clock and of the data lines DAT1 to DAT3, and the system event raised after each period
+    unsigned int pin_clk;
+    unsigned int pin_dat[3];
+    unsigned int event;
+    // PDM input, one byte per clock period
+    const uint8_t * pdm;
+    size_t nbits;
+    // Host memory, frames copied out of it after each period event, and errors of the sequence number or event
+    size_t nchan;
+    uint8_t * host;
+    uint32_t * frames;
+    size_t max_periods;
+    size_t periods;
+    size_t sequence_errors;
+    // Edges of each polarity, and the segment from the last edge taken until the next wait for the clock
+    edge_stats_t edges[2];
+    uint32_t last_pc;
+    int started;
+    int open;
+    int segment_event;
+    uint64_t segment_phase;
+} check_t;
+
+
+// Half periods of the clock elapsed at a cycle, odd while the clock is high
+static uint64_t clock_phase(uint64_t cycle)
+{
+    return cycle * 2 * PRU_PDM_CLOCK_HZ / PRU_ISA_CLOCK_HZ;
+}
+
+
+// First cycle of a half period, the cycle of its edge
+static uint64_t clock_edge(uint64_t phase)
+{
+    return (phase * PRU_ISA_CLOCK_HZ + 2 * PRU_PDM_CLOCK_HZ - 1) / (2 * PRU_PDM_CLOCK_HZ);
+}
+
+
+// Data lines during a half period: channels 1 to 3 after the rising edges, 4 to 6 after the falling ones
+static uint32_t data_pins(const check_t * check, uint64_t phase)
+{
+    if (phase == 0 || (phase - 1) / 2 >= check -> nbits) {
+        return 0;
+    }
+    const uint8_t bits = check -> pdm[(phase - 1) / 2] >> (phase % 2 ? 0 : 3);
+    return ((bits & 1) << check -> pin_dat[0]) | (((bits >> 1) & 1) << check -> pin_dat[1])
+           | (((bits >> 2) & 1) << check -> pin_dat[2]);
+}
+
+
+static uint32_t check_pins(void * ctx, uint64_t cycle, uint64_t * next)
+{
+    const check_t * check = (const check_t *) ctx;
+    const uint64_t phase = clock_phase(cycle);
+    const uint64_t valid = clock_edge(phase) + CHECK_TDV_CYCLES;
+    // The data lines keep the bits of the previous half period until t_dv after the edge
+    if (cycle < valid) {
+        *next = valid;
+        return ((phase & 1) << check -> pin_clk) | (phase > 0 ? data_pins(check, phase - 1) : 0);
+    }
+    *next = clock_edge(phase + 1);
+    return ((phase & 1) << check -> pin_clk) | data_pins(check, phase);
+}
+
+
+// Copy the period the firmware just completed, and check the sequence number it published
+static void check_event(void * ctx, unsigned int event, uint64_t cycle)
+{
+    check_t * check = (check_t *) ctx;
+    const size_t period_words = CHECK_PERIOD_FRAMES * check -> nchan;
+    (void) cycle;
+
+    uint32_t sequence;
+    memcpy(&sequence, &(check -> cpu -> dram[PRU_MEM_SEQUENCE * 4]), sizeof(sequence));
+    check -> sequence_errors += sequence != check -> periods + 1 || event != check -> event;
+    if (check -> periods < check -> max_periods) {
+        memcpy(&(check -> frames[check -> periods * period_words]),
+               &(check -> host[(check -> periods % CHECK_PERIODS) * period_words * 4]), period_words * 4);
+    }
+    check -> periods += 1;
+}
+
+
+// Load the firmware on a PRU, with its host memory and the configuration written to its data RAM by load_program
+static int check_init(check_t * check, pru_cpu_t * cpu, const char * firmware, size_t nchan, unsigned int decimation,
+                      uint32_t host_addr, uint32_t sync)
+{
+    check -> cpu = cpu;
+    check -> firmware = firmware;
+    check -> nchan = nchan;
+    check -> max_periods = check -> nbits / decimation / CHECK_PERIOD_FRAMES + 1;
+    check -> frames = malloc(check -> max_periods * CHECK_PERIOD_FRAMES * nchan * 4);
+    const size_t host_len = CHECK_PERIODS * CHECK_PERIOD_FRAMES * nchan * 4;
+    check -> host = calloc(host_len, 1);
+    check -> last_pc = UINT32_MAX;
+
+    pru_isa_init(cpu, NULL, check_pins, check_event, check);
+    if (pru_isa_load(cpu, firmware)) {
+        return -1;
+    }
+    pru_isa_map_host(cpu, check -> host, host_addr, host_len);
+    const uint32_t mem[PRU_MEM_SYNC + 1] = { host_addr, (uint32_t) host_len, 0, decimation, (uint32_t) nchan,
+                                             CHECK_PERIOD_FRAMES, sync };
+    memcpy(cpu -> dram, mem, sizeof(mem));
+    return 0;
+}
+
+
+// Run one instruction. Each time a wait for the clock lets the firmware go, it takes the edge of the current half
+// period, and the cycles from that edge until the firmware waits for the clock again are counted for it. Once it
+// took its first edge, an edge which no wait took in between was missed: the firmware came back too late.
+static int check_step(check_t * check)
+{
+    pru_cpu_t * cpu = check -> cpu;
+    const uint32_t pc = cpu -> pc;
+    const int wait = pc < cpu -> program_len && pru_isa_wait_pin(cpu -> iram[pc]) == (int) check -> pin_clk;
+    if (wait && pc != check -> last_pc && check -> open) {
+        edge_stats_t * stats = &(check -> edges[check -> segment_phase & 1]);
+        const uint64_t busy = cpu -> cycles - clock_edge(check -> segment_phase);
+        uint64_t * max = check -> segment_event ? &(stats -> max_event) : &(stats -> max);
+        *max = busy > *max ? busy : *max;
+        stats -> sum += busy;
+        stats -> count += 1;
+        check -> open = 0;
+    }
+
+    const uint64_t start = cpu -> cycles;
+    const uint64_t events = cpu -> events;
+    check -> last_pc = pc;
+    if (pru_isa_step(cpu)) {
+        return -1;
+    }
+    const uint64_t phase = clock_phase(start);
+    if (wait && cpu -> pc != pc && phase != check -> segment_phase) {
+        for (uint64_t missed = check -> segment_phase + 1; check -> started && missed < phase; ++missed) {
+            check -> edges[missed & 1].missed += 1;
+        }
+        check -> started = 1;
+        check -> open = 1;
+        check -> segment_event = 0;
+        check -> segment_phase = phase;
+    }
+    check -> segment_event |= cpu -> events != events;
+    return 0;
+}
+
+
+static void print_edge_stats(const char * name, const edge_stats_t * stats, uint64_t budget)
+{
+    printf("%s edge : max %" PRIu64 " cycles, mean %.1f, budget %" PRIu64 ", missed %" PRIu64,
+           name, stats -> max, stats -> count ? (double) stats -> sum / stats -> count : 0.0, budget, stats -> missed);
+    if (stats -> max_event != 0) {
+        printf(", max %" PRIu64 " with a period event", stats -> max_event);
+    }
+    printf("\n");
+}
+
+
+static int disassemble(const char * path)
+{
+    static pru_cpu_t cpu;
+    pru_isa_init(&cpu, NULL, NULL, NULL, NULL);
+    if (pru_isa_load(&cpu, path)) {
+        return 1;
+    }
+    for (uint32_t pc = 0; pc < cpu.program_len; ++pc) {
+        char text[64];
+        pru_isa_disasm(pc, cpu.iram[pc], text, sizeof(text));
+        printf("%4u  %08x  %s\n", pc, cpu.iram[pc], text);
+    }
+    return 0;
+}
+
+
+// Read a PDM capture, at most max_bits clock periods
+static uint8_t * read_pdm(const char * path, size_t max_bits, size_t * nbits)
+{
+    FILE * file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Error! Could not open %s.\n", path);
+        return NULL;
+    }
+    uint8_t * pdm = malloc(max_bits);
+    *nbits = fread(pdm, 1, max_bits, file);
+    fclose(file);
+    return pdm;
+}
+
+
+// Print the results of a PRU, and compare its frames with the software CIC from the first clock period it sampled.
+// Returns non-zero if the check failed.
+static int check_report(const check_t * check, unsigned int decimation, size_t first_bit)
+{
+    const pru_cpu_t * cpu = check -> cpu;
+    const size_t nchan = check -> nchan;
+    cic_t cic;
+    cic_init(&cic, nchan, decimation);
+    uint32_t * ref = malloc((check -> nbits / decimation + 1) * nchan * 4);
+    const size_t nref = cic_process_ref(&cic, &(check -> pdm[first_bit]), check -> nbits - first_bit, ref);
+    const size_t ncaptured = (check -> periods < check -> max_periods ? check -> periods : check -> max_periods)
+                             * CHECK_PERIOD_FRAMES;
+    const size_t ncompared = ncaptured < nref ? ncaptured : nref;
+    size_t nmatching = 0;
+    for (size_t f = 0; f < ncompared; ++f) {
+        nmatching += memcmp(&ref[f * nchan], &(check -> frames[f * nchan]), nchan * 4) == 0;
+    }
+
+    const uint64_t budget = PRU_ISA_CLOCK_HZ / (2 * PRU_PDM_CLOCK_HZ);
+    printf("Firmware %s : %zu instructions\n", check -> firmware, cpu -> program_len);
+    printf("Instructions run : %" PRIu64 ", cycles : %" PRIu64 "\n", cpu -> instructions, cpu -> cycles);
+    print_edge_stats("Rising", &(check -> edges[1]), budget);
+    print_edge_stats("Falling", &(check -> edges[0]), budget);
+    printf("Host memory : %" PRIu64 " bytes written, %zu periods, sequence errors : %zu\n",
+           cpu -> host_bytes_written, check -> periods, check -> sequence_errors);
+    printf("Frames matching the software CIC : %zu / %zu\n", nmatching, nref);
+    free(ref);
+
+    // Only the frames of the last, incomplete period may be missing
+    return cpu -> fault || check -> edges[0].missed || check -> edges[1].missed || check -> sequence_errors
+           || nmatching != ncompared || ncompared + CHECK_PERIOD_FRAMES <= nref;
+}
+
+
+int main(int argc, char ** argv)
+{
+    if (argc > 1 && strcmp(argv[1], "-d") == 0) {
+        return disassemble(argc > 2 ? argv[2] : PRU_DEFAULT_FIRMWARE);
+    }
+    const char * firmware = argc > 1 ? argv[1] : PRU_DEFAULT_FIRMWARE;
+    const size_t nchan = argc > 2 ? (size_t) atoi(argv[2]) : 6;
+    const unsigned int decimation = argc > 3 ? (unsigned int) atoi(argv[3]) : 16;
+    const unsigned int duration_ms = argc > 4 ? (unsigned int) atoi(argv[4]) : 100;
+    if ((nchan != 3 && nchan != 6 && nchan != PRU_DUAL_NCHAN) || decimation < 4 || decimation > 128
+        || (decimation & (decimation - 1))) {
+        fprintf(stderr, "Error! Unsupported configuration: %zu channels, decimation %u.\n", nchan, decimation);
+        return 1;
+    }
+    // With 12 channels, PRU1 captures the first 6 and PRU0 the next 6
+    const size_t npru = nchan == PRU_DUAL_NCHAN ? 2 : 1;
+    const size_t pru_nchan = nchan / npru;
+    if (npru == 2 && argc > 5) {
+        fprintf(stderr, "Error! PDM captures hold at most %d channels.\n", CIC_MAX_CHAN);
+        return 1;
+    }
+
+    // PDM input of each PRU: tones at multiples of CHECK_TONE_FREQ, or a capture
+    size_t nbits = (size_t) duration_ms * PRU_PDM_CLOCK_HZ / 1000;
+    uint8_t * pdm[2] = { NULL, NULL };
+    if (argc > 5) {
+        pdm[0] = read_pdm(argv[5], nbits, &nbits);
+        if (pdm[0] == NULL) {
+            return 1;
+        }
+    } else {
+        for (size_t p = 0; p < npru; ++p) {
+            pdm[p] = calloc(nbits, 1);
+            for (unsigned int c = 0; c < 6; ++c) {
+                pdm_gen_t gen;
+                pdm_init(&gen, CHECK_TONE_FREQ * (6 * p + c + 1), CHECK_TONE_AMPLITUDE, 0.0, PRU_PDM_CLOCK_HZ);
+                pdm_generate(&gen, pdm[p], nbits, c);
+            }
+        }
+    }
+
+    // PRU1 first, then PRU0 with its own pins, event and half of the host memory. PRU1 starts PRU0 after waiting
+    // for a rising edge, so that both sample from the second clock period.
+    static pru_cpu_t cpus[2];
+    check_t checks[2] = {
+        {
+            .pin_clk = CIC_PIN_CLK,
+            .pin_dat = { CIC_PIN_DAT1, CIC_PIN_DAT2, CIC_PIN_DAT3 },
+            .event = CHECK_EVENT_PRU1,
+            .pdm = pdm[0],
+            .nbits = nbits,
+        },
+        {
+            .pin_clk = CIC_PRU0_PIN_CLK,
+            .pin_dat = { CIC_PRU0_PIN_DAT1, CIC_PRU0_PIN_DAT2, CIC_PRU0_PIN_DAT3 },
+            .event = CHECK_EVENT_PRU0,
+            .pdm = pdm[1],
+            .nbits = nbits,
+        },
+    };
+    const uint32_t host_len = CHECK_PERIODS * CHECK_PERIOD_FRAMES * pru_nchan * 4;
+    if (check_init(&checks[0], &cpus[0], firmware, pru_nchan, decimation, CHECK_HOST_ADDR, npru == 2)
+        || (npru == 2 && check_init(&checks[1], &cpus[1], PRU_DEFAULT_FIRMWARE0, pru_nchan, decimation,
+                                    CHECK_HOST_ADDR + host_len, 0))) {
+        return 1;
+    }
+    if (npru == 2) {
+        pru_isa_link(&cpus[1], &cpus[0]);
+    }
+
+    // Run until the last bit was played, and one more clock period, on whose rising edge the firmware writes the
+    // last frames and raises the event of the last period. The PRUs run in lockstep, the one behind goes first.
+    const uint64_t end = clock_edge(2 * nbits + 3) + CHECK_TDV_CYCLES;
+    int running[2] = { 1, npru == 2 };
+    while (running[0] || running[1]) {
+        const size_t p = running[1] && (!running[0] || cpus[1].cycles < cpus[0].cycles);
+        running[p] = cpus[p].cycles < end && check_step(&checks[p]) == 0;
+    }
+
+    printf("%zu channels, decimation %u, %zu clock periods (%.1f ms), data valid %u cycles after the edges\n",
+           nchan, decimation, nbits, 1000.0 * nbits / PRU_PDM_CLOCK_HZ, CHECK_TDV_CYCLES);
+    int failed = 0;
+    for (size_t p = 0; p < npru; ++p) {
+        if (npru == 2) {
+            printf("%s, channels %zu to %zu :\n", p == 0 ? "PRU1" : "PRU0", p * pru_nchan + 1, (p + 1) * pru_nchan);
+        }
+        failed |= check_report(&checks[p], decimation, npru == 2);
+    }
+    // Both PRUs write the same periods, the host merges them by sequence number
+    if (npru == 2 && checks[0].periods != checks[1].periods) {
+        printf("The PRUs wrote %zu and %zu periods\n", checks[0].periods, checks[1].periods);
+        failed = 1;
+    }
+    printf("%s\n", failed ? "Firmware check failed!" : "Firmware check passed.");
+
+    for (size_t p = 0; p < npru; ++p) {
+        free(checks[p].host);
+        free(checks[p].frames);
+        free(pdm[p]);
+    }
+    return failed;
+}
@@ -5,15 +5,25 @@
  * 
  */
 
+// For pthread_setaffinity_np
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sched.h>
 #include "interface.h"
 #include "loader.h"
 
 #define SUB_BUF_NB 50
 
+_Static_assert(sizeof(pcm_stamp_t) == sizeof(shm_stamp_t), "The published stamps must have the layout of pcm_stamp_t");
+
 typedef struct {
     // Pointer to the PCM signal itself
     pcm_t * pcm;
@@ -27,72 +37,596 @@ typedef struct {
 // Global variables for threads
 pthread_t PRU_thread;
 pthread_attr_t PRU_thread_attr;
-pthread_mutex_t ringbuf_mutex = PTHREAD_MUTEX_INITIALIZER;
 processing_routine_args_t args;
 
 
+// Number of complete frames currently in the ringbuffer
+static size_t pcm_frames_available(pcm_t * pcm)
+{
+    return ringbuf_reader_len(pcm -> main_buffer, pcm -> reader) / (pcm -> sample_size * pcm -> nchan);
+}
+
+
+// Signal the event fd of a reader if the watermark is reached, and wake it up if blocked. Called by the capture thread.
+static void pcm_notify_reader(pcm_t * pcm)
+{
+    if (pcm_frames_available(pcm) >= pcm -> watermark && !atomic_exchange(&(pcm -> event_armed), 1)) {
+        const uint64_t one = 1;
+        if (write(pcm -> event_fd, &one, sizeof(one)) != sizeof(one)) {
+            atomic_store(&(pcm -> event_armed), 0);
+        }
+    }
+
+    // Make sure the push is visible before checking for waiters, see pcm_wait
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&(pcm -> waiters)) > 0) {
+        pthread_mutex_lock(&(pcm -> wait_mutex));
+        pthread_cond_broadcast(&(pcm -> wait_cond));
+        pthread_mutex_unlock(&(pcm -> wait_mutex));
+    }
+}
+
+
+// Notify all the readers of the ringbuffer. Called by the capture thread.
+static void pcm_notify(pcm_t * pcm)
+{
+    pthread_mutex_lock(&(pcm -> readers_mutex));
+    for (size_t r = 0; r < RINGBUF_MAX_READERS; ++r) {
+        if (pcm -> readers[r] != NULL) {
+            pcm_notify_reader(pcm -> readers[r]);
+        }
+    }
+    pthread_mutex_unlock(&(pcm -> readers_mutex));
+}
+
+
+// Set up the notifications of a reader, see pcm_wait and pcm_get_fd. Returns 0 on success.
+static int pcm_init_notify(pcm_t * pcm)
+{
+    pcm -> event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (pcm -> event_fd < 0) {
+        fprintf(stderr, "Error! Could not create the event file descriptor.\n");
+        return -1;
+    }
+    atomic_init(&(pcm -> event_armed), 0);
+    atomic_init(&(pcm -> underflows), 0);
+    atomic_init(&(pcm -> waiters), 0);
+    pthread_mutex_init(&(pcm -> wait_mutex), NULL);
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&(pcm -> wait_cond), &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    return 0;
+}
+
+
+// Release the notifications of a reader
+static void pcm_free_notify(pcm_t * pcm)
+{
+    close(pcm -> event_fd);
+    pthread_mutex_destroy(&(pcm -> wait_mutex));
+    pthread_cond_destroy(&(pcm -> wait_cond));
+}
+
+
+// Clear the event fd once the reader went below the watermark. Called by the reader.
+static void pcm_rearm(pcm_t * pcm)
+{
+    if (!atomic_load(&(pcm -> event_armed)) || pcm_frames_available(pcm) >= pcm -> watermark) {
+        return;
+    }
+
+    uint64_t count;
+    atomic_store(&(pcm -> event_armed), 0);
+    while (read(pcm -> event_fd, &count, sizeof(count)) == sizeof(count));
+    // The capture thread may have pushed in between, in which case it did not signal since we were still armed
+    if (pcm_frames_available(pcm) >= pcm -> watermark && !atomic_exchange(&(pcm -> event_armed), 1)) {
+        const uint64_t one = 1;
+        if (write(pcm -> event_fd, &one, sizeof(one)) != sizeof(one)) {
+            atomic_store(&(pcm -> event_armed), 0);
+        }
+    }
+}
+
+
+static int64_t timespec_to_ns(const struct timespec * ts)
+{
+    return (int64_t) ts -> tv_sec * 1000000000 + ts -> tv_nsec;
+}
+
+
+static struct timespec ns_to_timespec(int64_t ns)
+{
+    struct timespec ts = { .tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000 };
+    return ts;
+}
+
+
+// Nominal duration of a period of the PRU buffer
+static int64_t pcm_period_ns(pcm_t * pcm)
+{
+    return (int64_t) pcm -> period_frames * 1000000000 / (PRU_PDM_CLOCK_HZ / pcm -> decimation);
+}
+
+
+// Update the timing of the events with a wakeup at the given time, when the given number of periods have been
+// written since the start. Called by the capture thread.
+static void pcm_update_timing(pcm_t * pcm, const struct timespec * now, uint64_t periods)
+{
+    const int64_t now_ns = timespec_to_ns(now);
+    // Start time of the stream according to this wakeup, the least late wakeup gives the smallest one
+    const int64_t offset = now_ns - (int64_t) periods * pcm_period_ns(pcm);
+    const uint64_t events = atomic_load_explicit(&(pcm -> events), memory_order_relaxed);
+
+    if (events == 0) {
+        pcm -> lateness_ref_ns = offset;
+    } else {
+        const uint64_t interval = (uint64_t) (now_ns - timespec_to_ns(&(pcm -> last_wakeup)));
+        const uint64_t interval_us = interval / 1000;
+        size_t bucket = 0;
+        while (bucket < PCM_INTERVAL_BUCKETS - 1 && (interval_us >> (bucket + 1)) > 0) {
+            bucket += 1;
+        }
+        atomic_fetch_add_explicit(&(pcm -> interval_hist[bucket]), 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&(pcm -> interval_sum_ns), interval, memory_order_relaxed);
+        if (interval < atomic_load_explicit(&(pcm -> interval_min_ns), memory_order_relaxed)) {
+            atomic_store_explicit(&(pcm -> interval_min_ns), interval, memory_order_relaxed);
+        }
+        if (interval > atomic_load_explicit(&(pcm -> interval_max_ns), memory_order_relaxed)) {
+            atomic_store_explicit(&(pcm -> interval_max_ns), interval, memory_order_relaxed);
+        }
+
+        // The reference follows the least late wakeup, and moves forward slowly in case the PRU clock is slower
+        const int64_t ref = pcm -> lateness_ref_ns + (int64_t) (interval * PCM_CLOCK_TOLERANCE);
+        pcm -> lateness_ref_ns = offset < ref ? offset : ref;
+        const uint64_t lateness = (uint64_t) (offset - pcm -> lateness_ref_ns);
+        if (lateness > atomic_load_explicit(&(pcm -> lateness_max_ns), memory_order_relaxed)) {
+            atomic_store_explicit(&(pcm -> lateness_max_ns), lateness, memory_order_relaxed);
+        }
+    }
+
+    pcm -> last_wakeup = *now;
+    atomic_store_explicit(&(pcm -> events), events + 1, memory_order_relaxed);
+}
+
+
+// Capture time of the frame at the given position of the stream, extrapolated from the last stamp before it.
+// Called by the reader.
+static int pcm_frame_time(pcm_t * pcm, uint64_t frame, struct timespec * ts)
+{
+    pcm = pcm -> capture != NULL ? pcm -> capture : pcm;
+    const uint64_t head = atomic_load_explicit(&(pcm -> stamps_head), memory_order_acquire);
+    // The oldest stamp may be being overwritten
+    uint64_t low = head > pcm -> nstamps - 1 ? head - (pcm -> nstamps - 1) : 0;
+    uint64_t high = head;
+    if (low == high || pcm -> stamps[low % pcm -> nstamps].frame > frame) {
+        return -1;
+    }
+
+    // The stamps are in the order of the frames, find the last one at or before the frame
+    while (high - low > 1) {
+        const uint64_t mid = low + (high - low) / 2;
+        if (pcm -> stamps[mid % pcm -> nstamps].frame <= frame) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    const pcm_stamp_t * stamp = &(pcm -> stamps[low % pcm -> nstamps]);
+    const int64_t elapsed_ns = (int64_t) ((frame - stamp -> frame) * 1000000000 / pcm -> sample_rate);
+    *ts = ns_to_timespec(timespec_to_ns(&(stamp -> time)) + elapsed_ns);
+    return 0;
+}
+
+
+// Write a period of frames from the PRU buffer to the ringbuffer, time is the capture time of its first frame.
+// Called by the capture thread.
+static void pcm_push_period(pcm_t * pcm, volatile void * period, const struct timespec * time)
+{
+    int overflow_flag;
+    // Size of one frame of the ringbuffer, nchan samples, in bytes
+    const size_t block_size = pcm -> sample_size * (pcm -> nchan);
+    const uint32_t * frames = (const uint32_t *) period;
+    size_t block_count = pcm -> period_frames;
+
+    // Stamp the first frame before it is visible to the reader
+    const uint64_t stamp = atomic_load_explicit(&(pcm -> stamps_head), memory_order_relaxed);
+    pcm -> stamps[stamp % pcm -> nstamps].frame = atomic_load_explicit(&(pcm -> main_buffer -> head), memory_order_relaxed) / block_size;
+    pcm -> stamps[stamp % pcm -> nstamps].time = *time;
+    atomic_store_explicit(&(pcm -> stamps_head), stamp + 1, memory_order_release);
+    if (pcm -> shm != NULL) {
+        atomic_store_explicit(&(pcm -> shm -> stamps_head), stamp + 1, memory_order_release);
+    }
+    if (pcm -> filter != NULL) {
+        // Filter the new period, then write the result to the ringbuffer
+        block_count = filter_process(pcm -> filter, frames, block_count, pcm -> filter_out);
+        frames = pcm -> filter_out;
+    }
+    if (pcm -> packed != NULL) {
+        // Pack the samples at this first copy, the ringbuffer and all its readers then move fewer bytes
+        convert_pack(frames, block_count * pcm -> nchan, pcm -> packed, pcm -> buffer_format, &(pcm -> convert));
+        frames = (const uint32_t *) pcm -> packed;
+    }
+    // Write data to the ringbuffer, this never waits for the readers
+    ringbuf_push(pcm -> main_buffer, (uint8_t *) frames, block_size, block_count, &overflow_flag);
+
+    if (overflow_flag) {
+        // The readers count the frames they lost, and the ringbuffer those it dropped for the protected readers
+        fprintf(stderr, "Warning! Buffer overflow, some samples have been overwritten or dropped.\n");
+    }
+}
+
+
+// Pass a period of frames from the PRU buffer to the callback, in blocks of block_frames. Called by the capture thread.
+static void pcm_callback_period(pcm_t * pcm, volatile void * period)
+{
+    const size_t nchan = pcm -> nchan;
+    const size_t block_frames = pcm -> block_frames;
+    const uint32_t * frames = (const uint32_t *) period;
+    size_t remaining = pcm -> period_frames;
+
+    // Complete the block started in the previous period
+    if (pcm -> block_pending > 0) {
+        size_t n = block_frames - pcm -> block_pending;
+        if (n > remaining) {
+            n = remaining;
+        }
+        memcpy(&(pcm -> block_staging[pcm -> block_pending * nchan]), frames, n * nchan * SAMPLE_SIZE_BYTES);
+        pcm -> block_pending += n;
+        frames += n * nchan;
+        remaining -= n;
+        if (pcm -> block_pending == block_frames) {
+            pcm -> callback(pcm -> block_staging, block_frames, pcm -> callback_user);
+            pcm -> block_pending = 0;
+        }
+    }
+
+    // Whole blocks straight from the PRU buffer
+    for (; remaining >= block_frames; remaining -= block_frames) {
+        pcm -> callback(frames, block_frames, pcm -> callback_user);
+        frames += block_frames * nchan;
+    }
+
+    // Keep the rest for the next period
+    if (remaining > 0) {
+        memcpy(pcm -> block_staging, frames, remaining * nchan * SAMPLE_SIZE_BYTES);
+        pcm -> block_pending = remaining;
+    }
+}
+
+
+// Interleave the given period of both PRUs into frames of PRU_DUAL_NCHAN channels: channels 1 to 6 from the ring of
+// PRU1 in the first half of the PRU buffer, 7 to 12 from the ring of PRU0 in the second half. Returns the merged
+// period, which is only valid until the next call. Called by the capture thread.
+static volatile void * pcm_merge_period(pcm_t * pcm, unsigned int index)
+{
+    const size_t half = PRU_DUAL_NCHAN / 2;
+    const uint32_t * pru1 = &(((const uint32_t *) pcm -> PRU_buffer)[(size_t) index * pcm -> period_frames * half]);
+    const uint32_t * pru0 = &pru1[(size_t) pcm -> periods * pcm -> period_frames * half];
+    uint32_t * frame = pcm -> merged;
+    for (size_t f = 0; f < pcm -> period_frames; ++f) {
+        memcpy(frame, &pru1[f * half], half * SAMPLE_SIZE_BYTES);
+        memcpy(&frame[half], &pru0[f * half], half * SAMPLE_SIZE_BYTES);
+        frame += PRU_DUAL_NCHAN;
+    }
+    return pcm -> merged;
+}
+
+
 // Handles processing the input samples from the PRU, and outputting the results to the ringbuffer
 // Also takes care of starting the program.
 void *processing_routine(void * __args)
 {
+    pcm_t * pcm = args.pcm;
+    const pru_backend_t * backend = pcm -> backend;
+
     // Load program
-    if (load_program()) {
+    if (backend -> load(&(pcm -> pru_config))) {
         // Disable PRU processing
         pthread_exit(&args);
     }
 
-    int next_evt = PRU_EVTOUT_0;
-    volatile void * new_data_start;
-    int overflow_flag;
-
-    volatile void * buffer_beginning = args.pcm -> PRU_buffer;
-    volatile void * buffer_middle = &(((uint8_t *) args.pcm -> PRU_buffer)[args.pcm -> PRU_buffer_len / 2]);
+    // With both PRUs, the buffer holds two rings of periods of half frames, see pcm_merge_period
+    const size_t period_size = SAMPLE_SIZE_BYTES * pcm -> nchan * pcm -> period_frames;
 
     // Process indefinitely
     while (1) {
-        prussdrv_pru_wait_event(next_evt);
-        if (next_evt == PRU_EVTOUT_0) {
-            // Even though we are using PRU1, I have to use PRU0_ARM_INTERRUPT in this case for it to work.
-            // I truly have no clue of why this is happening.
-            prussdrv_pru_clear_event(next_evt, PRU0_ARM_INTERRUPT);
-            next_evt = PRU_EVTOUT_1;
-            new_data_start = buffer_beginning;
-        } else {
-            prussdrv_pru_clear_event(next_evt, PRU1_ARM_INTERRUPT);
-            next_evt = PRU_EVTOUT_0;
-            new_data_start = buffer_middle;
-        }
-
-        // Write the data to the ringbuffer, only if recording is enabled
-        if (args.recording_flag) {
-            // Size of one 6-channel sample tuple, in bytes
-            const size_t block_size = SAMPLE_SIZE_BYTES * (args.pcm -> nchan);
-            // Number of these blocks to retrieve, must correspond to half of the PRU buffer length
-            const size_t block_count = (args.pcm -> PRU_buffer_len) / block_size / 2;
-            pthread_mutex_lock(&ringbuf_mutex);
-            // Write data to the ringbuffer
-            ringbuf_push(args.pcm -> main_buffer, (uint8_t *) new_data_start, block_size, block_count, &overflow_flag);
-            pthread_mutex_unlock(&ringbuf_mutex);
-
-            if (overflow_flag) {
-                // TODO: Output a warning of some sort
-                fprintf(stderr, "Warning! Buffer overflow, some samples have been overwritten.\n");
+        if (backend -> wait_event(PRU_EVT_PERIOD)) {
+            // The backend has been stopped
+            pthread_exit((void *) &args);
+        }
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (args.stop_thread_flag) {
+            pthread_exit((void *) &args);
+        }
+
+        // The sequence number published by the firmware tells how many periods were written since the last event.
+        // If we were too late, their events collapsed into one, and an event may also still be pending for a period
+        // we already processed. Only the last periods - 1 periods are intact, the firmware is writing the next one.
+        const uint32_t sequence = backend -> sequence();
+        uint32_t new_periods = sequence - pcm -> last_sequence;
+        if (new_periods == 0) {
+            continue;
+        }
+        if (new_periods > pcm -> periods - 1) {
+            const uint32_t lost = new_periods - (pcm -> periods - 1);
+            atomic_fetch_add(&(pcm -> periods_lost), lost);
+            pcm -> next_period = (pcm -> next_period + lost % pcm -> periods) % pcm -> periods;
+            // The next block would not be contiguous
+            pcm -> block_pending = 0;
+            new_periods -= lost;
+        }
+        pcm -> last_sequence = sequence;
+        atomic_fetch_add(&(pcm -> periods_received), new_periods);
+        pcm_update_timing(pcm, &now, atomic_load(&(pcm -> periods_received)) + atomic_load(&(pcm -> periods_lost)));
+
+        // Process the new periods in order, only if recording is enabled. The last one ended about now, the
+        // previous ones one period earlier each.
+        const int64_t now_ns = timespec_to_ns(&now);
+        for (; new_periods > 0; --new_periods) {
+            const unsigned int index = pcm -> next_period;
+            pcm -> next_period = (index + 1) % pcm -> periods;
+            if (args.recording_flag) {
+                volatile void * period = pcm -> merged != NULL ? pcm_merge_period(pcm, index)
+                                         : &(((uint8_t *) pcm -> PRU_buffer)[index * period_size]);
+                if (pcm -> callback != NULL) {
+                    pcm_callback_period(pcm, period);
+                }
+                if (!pcm -> callback_only) {
+                    const struct timespec start = ns_to_timespec(now_ns - (int64_t) new_periods * pcm_period_ns(pcm));
+                    pcm_push_period(pcm, period, &start);
+                }
+            }
+        }
+
+        if (args.recording_flag && !pcm -> callback_only) {
+            // Tell readers new data is available, in this process and the others
+            pcm_notify(pcm);
+            if (pcm -> shm != NULL) {
+                atomic_store(&(pcm -> shm -> sequence), sequence);
+                atomic_store(&(pcm -> shm -> periods_lost), atomic_load(&(pcm -> periods_lost)));
+                shm_wake(pcm -> shm);
             }
         }
 
         // Check if the thread has to terminate
         if (args.stop_thread_flag) {
-            // Disable PRU processing
-            stop_program();
             pthread_exit((void *) &args);
         }
     }
 }
 
 
-// TODO: add the possibility of adding a filter between the PRU buffer and and the main buffer
-pcm_t * pru_processing_init(void)
+// Apply the memory locking options, returns the PCM_RT_* flags of those which failed
+static unsigned int pcm_lock_memory(pcm_t * pcm, unsigned int lock)
+{
+    unsigned int failures = 0;
+    if ((lock & PCM_LOCK_ALL) && mlockall(MCL_CURRENT | MCL_FUTURE)) {
+        perror("Warning! Could not lock the memory of the process");
+        failures |= PCM_RT_LOCK_ALL;
+    }
+
+    if (lock & PCM_LOCK_BUFFERS) {
+        // mlock faults the pages in. If it fails, at least fault them in now rather than in the capture thread,
+        // calloc may have left them unmapped.
+        ringbuffer_t * ringbuf = pcm -> main_buffer;
+        if (mlock(ringbuf -> data, ringbuf -> maxLength) || mlock(pcm -> stamps, pcm -> nstamps * sizeof(pcm_stamp_t))
+            || mlock((const void *) pcm -> PRU_buffer, pcm -> PRU_buffer_len)) {
+            perror("Warning! Could not lock the capture buffers");
+            failures |= PCM_RT_LOCK_BUFFERS;
+            const long page_size = sysconf(_SC_PAGESIZE);
+            for (size_t i = 0; i < ringbuf -> maxLength; i += page_size) {
+                ((volatile uint8_t *) ringbuf -> data)[i] = 0;
+            }
+            for (size_t i = 0; i < pcm -> nstamps * sizeof(pcm_stamp_t); i += page_size) {
+                ((volatile uint8_t *) pcm -> stamps)[i] = 0;
+            }
+        }
+    }
+    return failures;
+}
+
+
+// Undo pcm_lock_memory, before the buffers are freed and the PRU memory is unmapped. The capture thread must be done
+// with the PRU memory.
+static void pcm_unlock_memory(pcm_t * pcm)
+{
+    if (pcm -> lock & PCM_LOCK_BUFFERS) {
+        munlock((const void *) pcm -> PRU_buffer, pcm -> PRU_buffer_len);
+        munlock(pcm -> main_buffer -> data, pcm -> main_buffer -> maxLength);
+        munlock(pcm -> stamps, pcm -> nstamps * sizeof(pcm_stamp_t));
+    }
+    if ((pcm -> lock & PCM_LOCK_ALL) && !(pcm -> rt_failures & PCM_RT_LOCK_ALL)) {
+        munlockall();
+    }
+}
+
+
+// Apply the scheduling options to the capture thread, returns the PCM_RT_* flags of those which failed
+static unsigned int pcm_set_realtime(int rt_priority, uint32_t cpu_mask)
+{
+    unsigned int failures = 0;
+    int err;
+    if (rt_priority > 0) {
+        const struct sched_param param = { .sched_priority = rt_priority };
+        if ((err = pthread_setschedparam(PRU_thread, SCHED_FIFO, &param))) {
+            fprintf(stderr, "Warning! Could not set the capture thread to SCHED_FIFO priority %d: %s\n", rt_priority, strerror(err));
+            failures |= PCM_RT_PRIORITY;
+        }
+    }
+
+    if (cpu_mask != 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (int c = 0; c < 32; ++c) {
+            if (cpu_mask & (1u << c)) {
+                CPU_SET(c, &cpus);
+            }
+        }
+        if ((err = pthread_setaffinity_np(PRU_thread, sizeof(cpus), &cpus))) {
+            fprintf(stderr, "Warning! Could not pin the capture thread to CPUs 0x%x: %s\n", cpu_mask, strerror(err));
+            failures |= PCM_RT_AFFINITY;
+        }
+    }
+    return failures;
+}
+
+
+// Frames of a span in the raw format, from the given frame on: straight from the span if the ringbuffer holds raw
+// words, otherwise up to PCM_UNPACK_FRAMES frames unpacked into the buffer of the reader. Returns their number.
+static size_t pcm_span_raw(pcm_t * pcm, const pcm_span_t * span, size_t first, const uint32_t ** frames)
+{
+    if (pcm -> unpacked == NULL) {
+        *frames = &(((const uint32_t *) span -> data)[first * pcm -> nchan]);
+        return span -> nframes - first;
+    }
+    const size_t n = (span -> nframes - first) < PCM_UNPACK_FRAMES ? (span -> nframes - first) : PCM_UNPACK_FRAMES;
+    convert_unpack(&(((const uint8_t *) span -> data)[first * pcm -> sample_size * pcm -> nchan]), n * pcm -> nchan,
+                   pcm -> buffer_format, pcm -> unpacked, &(pcm -> convert));
+    *frames = pcm -> unpacked;
+    return n;
+}
+
+
+// Allocate the buffer into which a reader unpacks the frames, if the ringbuffer holds packed samples.
+// Returns 0 on success.
+static int pcm_alloc_unpacked(pcm_t * pcm)
+{
+    pcm -> unpacked = NULL;
+    if (pcm -> buffer_format == PCM_FORMAT_RAW) {
+        return 0;
+    }
+    pcm -> unpacked = calloc(PCM_UNPACK_FRAMES * pcm -> nchan, SAMPLE_SIZE_BYTES);
+    if (pcm -> unpacked == NULL) {
+        fprintf(stderr, "Error! Memory for unpacking the samples could not be allocated.\n");
+        return -1;
+    }
+    return 0;
+}
+
+
+// Allocate the ringbuffer of the given number of frames and the capture timestamps, in a shared memory segment
+// published under the given name if it is not NULL, and the buffers to merge, pack and unpack the samples.
+// Returns 0 on success.
+static int pcm_alloc_buffers(pcm_t * pcm, size_t nframes, const char * shm_name)
+{
+    // One stamp per push, enough for the ringbuffer full of the shortest pushes, those of the filter stage
+    const size_t frame_size = pcm -> sample_size * pcm -> nchan;
+    const size_t length = nframes * frame_size;
+    const size_t push_frames = pcm -> period_frames / 8 > 0 ? pcm -> period_frames / 8 : 1;
+    pcm -> nstamps = nframes / push_frames + 2;
+
+    pcm -> packed = NULL;
+    pcm -> merged = NULL;
+    if (pcm_alloc_unpacked(pcm)) {
+        return -1;
+    }
+    if (pcm -> buffer_format != PCM_FORMAT_RAW) {
+        // A filtered period may hold one more frame than a period
+        pcm -> packed = calloc((pcm -> period_frames + 1) * pcm -> nchan, pcm -> sample_size);
+        if (pcm -> packed == NULL) {
+            fprintf(stderr, "Error! Memory for packing the samples could not be allocated.\n");
+            free(pcm -> unpacked);
+            return -1;
+        }
+    }
+    if (pcm -> nchan == PRU_DUAL_NCHAN) {
+        pcm -> merged = calloc(pcm -> period_frames * pcm -> nchan, SAMPLE_SIZE_BYTES);
+        if (pcm -> merged == NULL) {
+            fprintf(stderr, "Error! Memory for merging the periods of both PRUs could not be allocated.\n");
+            free(pcm -> packed);
+            free(pcm -> unpacked);
+            return -1;
+        }
+    }
+
+    if (shm_name != NULL) {
+        shm_header_t * shm = shm_create(shm_name, length, pcm -> nstamps);
+        if (shm == NULL) {
+            free(pcm -> merged);
+            free(pcm -> packed);
+            free(pcm -> unpacked);
+            return -1;
+        }
+        shm -> nchan = pcm -> nchan;
+        shm -> sample_rate = pcm -> sample_rate;
+        shm -> sample_format = pcm -> buffer_format;
+        shm -> frame_size = frame_size;
+        shm -> period_frames = pcm -> period_frames;
+        shm -> convert = pcm -> convert;
+        pcm -> shm = shm;
+        pcm -> main_buffer = &(shm -> ring);
+        pcm -> stamps = (pcm_stamp_t *) &(((uint8_t *) shm)[shm -> stamps_offset]);
+        shm_publish(shm);
+        return 0;
+    }
+
+    pcm -> shm = NULL;
+    pcm -> main_buffer = ringbuf_create(length, 1);
+    if (pcm -> main_buffer == NULL) {
+        free(pcm -> merged);
+        free(pcm -> packed);
+        free(pcm -> unpacked);
+        return -1;
+    }
+    pcm -> stamps = calloc(pcm -> nstamps, sizeof(pcm_stamp_t));
+    if (pcm -> stamps == NULL) {
+        fprintf(stderr, "Error! Memory for the capture timestamps could not be allocated.\n");
+        ringbuf_free(pcm -> main_buffer);
+        free(pcm -> merged);
+        free(pcm -> packed);
+        free(pcm -> unpacked);
+        return -1;
+    }
+    return 0;
+}
+
+
+// Free the ringbuffer and the timestamps, or remove the shared memory segment holding them, and the buffers to
+// merge, pack and unpack the samples
+static void pcm_free_buffers(pcm_t * pcm)
+{
+    free(pcm -> merged);
+    free(pcm -> packed);
+    free(pcm -> unpacked);
+    if (pcm -> shm != NULL) {
+        shm_destroy(pcm -> shm);
+    } else {
+        ringbuf_free(pcm -> main_buffer);
+        free(pcm -> stamps);
+    }
+}
+
+
+pcm_t * pru_processing_init(const pcm_config_t * config)
 {
+    const pcm_config_t default_config = PCM_CONFIG_DEFAULT;
+    if (config == NULL) {
+        config = &default_config;
+    }
+
+    // The firmware supports 3 or 6 channels, 12 with both PRUs, and the decimation rate sets the output width log2(R^N)
+    unsigned int log2_decimation = 0;
+    while (log2_decimation < 31 && (2u << log2_decimation) <= config -> decimation) {
+        log2_decimation += 1;
+    }
+    if ((config -> nchan != 3 && config -> nchan != 6 && config -> nchan != PRU_DUAL_NCHAN)
+        || config -> decimation != (1u << log2_decimation) || config -> decimation < CIC_MIN_DECIMATION || config -> decimation > CIC_MAX_DECIMATION) {
+        fprintf(stderr, "Error! Unsupported configuration: %u channels, decimation %u.\n", config -> nchan, config -> decimation);
+        return NULL;
+    }
+    if (config -> buffer_format != PCM_FORMAT_RAW && config -> buffer_format != PCM_FORMAT_S24
+        && config -> buffer_format != PCM_FORMAT_S16) {
+        fprintf(stderr, "Error! Unsupported sample format for the ringbuffer.\n");
+        return NULL;
+    }
+    if (config -> rt_priority < 0 || config -> rt_priority > sched_get_priority_max(SCHED_FIFO)) {
+        fprintf(stderr, "Error! Unsupported SCHED_FIFO priority %d.\n", config -> rt_priority);
+        return NULL;
+    }
+
     // Allocate memory for the PCM
     pcm_t * pcm = calloc(1, sizeof(pcm_t));
     if (pcm == NULL) {
@@ -101,42 +635,118 @@ pcm_t * pru_processing_init(void)
     }
 
     // Initialize memory mappings to get PRU buffer address and length
-    if (PRU_proc_init(&(pcm -> PRU_buffer), &(pcm -> PRU_buffer_len))) {
+    pcm -> backend = &PRU_DEFAULT_BACKEND;
+    unsigned int mapped_len;
+    if (pcm -> backend -> init(&(pcm -> PRU_buffer), &mapped_len)) {
         free(pcm);
         return NULL;
     }
 
-    // Initialize ringbuffer
-    ringbuffer_t * ringbuf = ringbuf_create(pcm -> PRU_buffer_len, SUB_BUF_NB);
-    if (ringbuf == NULL) {
-        stop_program();
+    // Split the mapped memory into periods, the firmware uses whole periods only
+    const unsigned int frame_size = SAMPLE_SIZE_BYTES * config -> nchan;
+    const unsigned int buffer_frames = mapped_len / frame_size;
+    unsigned int periods = config -> periods;
+    unsigned int period_frames = config -> period_frames;
+    if (period_frames == 0) {
+        period_frames = buffer_frames / (periods == 0 ? 2 : periods);
+        if (period_frames > PRU_MAX_PERIOD_FRAMES) {
+            period_frames = PRU_MAX_PERIOD_FRAMES;
+        }
+        period_frames -= period_frames % PRU_BURST_FRAMES;
+    }
+    if (periods == 0 && period_frames != 0) {
+        periods = buffer_frames / period_frames;
+    }
+    if (periods < 2 || period_frames == 0 || period_frames > PRU_MAX_PERIOD_FRAMES
+        || period_frames % PRU_BURST_FRAMES != 0 || (size_t) periods * period_frames > buffer_frames) {
+        fprintf(stderr, "Error! Unsupported PRU buffer layout: %u periods of %u frames, %u frames available.\n",
+                periods, period_frames, buffer_frames);
+        pcm -> backend -> stop();
         free(pcm);
         return NULL;
     }
+    pcm -> periods = periods;
+    pcm -> period_frames = period_frames;
+    pcm -> next_period = 0;
+    pcm -> PRU_buffer_len = periods * period_frames * frame_size;
+    pcm -> pru_config.nchan = config -> nchan;
+    pcm -> pru_config.decimation = config -> decimation;
+    pcm -> pru_config.period_frames = period_frames;
+    pcm -> pru_config.periods = periods;
+    pcm -> pru_config.firmware = config -> firmware;
+    pcm -> pru_config.firmware0 = config -> firmware0;
 
     // Initialize PCM parameters
-    /* TODO: For now, we have a fixed number of channels and sample rate on the PRU. This could be changed in the future.
-    However, for now because it is fixed, it makes no sense to allow the user to set these. */
-    //pcm -> nchan = nchan;
-    //pcm -> sample_rate = sample_rate;
-    pcm -> nchan = 6;
-    pcm -> sample_rate = 64000;
-    pcm -> main_buffer = ringbuf;
+    pcm -> nchan = config -> nchan;
+    pcm -> decimation = config -> decimation;
+    pcm -> sample_rate = PRU_PDM_CLOCK_HZ / config -> decimation;
+    pcm -> watermark = period_frames;
+    convert_params_init(&(pcm -> convert), CIC_ORDER * log2_decimation);
+
+    // Initialize ringbuffer, as many frames as the mapped memory holds raw whatever the period size and the format
+    // of the samples, and the capture timestamps
+    pcm -> buffer_format = config -> buffer_format;
+    pcm -> sample_size = convert_format_size(config -> buffer_format);
+    if (pcm_alloc_buffers(pcm, (size_t) mapped_len * SUB_BUF_NB / frame_size, config -> shm_name)) {
+        pcm -> backend -> stop();
+        free(pcm);
+        return NULL;
+    }
+
+    // Initialize the reader notifications, the pcm is the default reader of the ringbuffer
+    pcm -> reader = 0;
+    pcm -> capture = NULL;
+    pcm -> readers[0] = pcm;
+    if (pcm_init_notify(pcm)) {
+        pcm -> backend -> stop();
+        pcm_free_buffers(pcm);
+        free(pcm);
+        return NULL;
+    }
+    pthread_mutex_init(&(pcm -> readers_mutex), NULL);
+    pcm -> last_sequence = 0;
+    atomic_init(&(pcm -> periods_received), 0);
+    atomic_init(&(pcm -> periods_lost), 0);
+    atomic_init(&(pcm -> stamps_head), 0);
+    atomic_init(&(pcm -> events), 0);
+    for (size_t b = 0; b < PCM_INTERVAL_BUCKETS; ++b) {
+        atomic_init(&(pcm -> interval_hist[b]), 0);
+    }
+    atomic_init(&(pcm -> interval_min_ns), UINT64_MAX);
+    atomic_init(&(pcm -> interval_max_ns), 0);
+    atomic_init(&(pcm -> interval_sum_ns), 0);
+    atomic_init(&(pcm -> lateness_max_ns), 0);
 
     args.pcm = pcm;
     args.recording_flag = 0; // Do not output to ringbuffer at first
     args.stop_thread_flag = 0;
 
+    // Lock the memory before the capture thread starts, so that its stack is locked too with PCM_LOCK_ALL
+    pcm -> lock = config -> lock;
+    pcm -> rt_failures = pcm_lock_memory(pcm, config -> lock);
+
     // Start processing in a separate thread!
+    pthread_attr_init(&PRU_thread_attr);
     if (pthread_create(&PRU_thread, &PRU_thread_attr, processing_routine, NULL)) {
         fprintf(stderr, "Error! Audio capture thread could not be created.\n");
         pthread_attr_destroy(&PRU_thread_attr);
-        stop_program();
-        ringbuf_free(ringbuf);
+        pcm_unlock_memory(pcm);
+        pcm -> backend -> stop();
+        pcm_free_notify(pcm);
+        pthread_mutex_destroy(&(pcm -> readers_mutex));
+        pcm_free_buffers(pcm);
         free(pcm);
         return NULL;
     }
 
+    // The capture thread only loads the firmware before its first wait, it does not need to be real-time before
+    pcm -> rt_failures |= pcm_set_realtime(config -> rt_priority, config -> cpu_mask);
+    if (pcm -> rt_failures != 0 && config -> rt_required) {
+        fprintf(stderr, "Error! Some real-time options could not be applied (0x%x).\n", pcm -> rt_failures);
+        pru_processing_close(pcm);
+        return NULL;
+    }
+
     // TODO: maybe wait for some time until the ringbuffer has some samples
 
     return pcm;
@@ -151,44 +761,374 @@ size_t pcm_read(pcm_t * src, void * dst, size_t nsamples, size_t nchan)
         return 0;
     }
 
-    // Extract raw data to temporary buffer
-    const size_t block_size = SAMPLE_SIZE_BYTES * (args.pcm -> nchan);
-    // TODO: use stack or heap for this ?
-    uint8_t * raw_data = calloc(nsamples, block_size);
-    if (raw_data == NULL) {
-        fprintf(stderr, "Error! Could not allocate temporary buffer for raw data.\n");
+    // Only extract the first nchan channels
+    const uint32_t chan_mask = (nchan >= 32) ? 0xffffffff : (((uint32_t) 1 << nchan) - 1);
+    return pcm_read_mask(src, dst, nsamples, chan_mask, PCM_FORMAT_RAW);
+}
+
+
+// Acquire frames of the reader of a pcm for convert_consume, and get the position of the first one in the stream
+static size_t pcm_source_acquire(void * ctx, const void * data[2], size_t counts[2], size_t nframes, uint64_t * first)
+{
+    pcm_t * pcm = (pcm_t *) ctx;
+    pcm_span_t spans[2];
+    const size_t acquired = pcm_acquire(pcm, spans, nframes);
+    *first = atomic_load(&(pcm -> main_buffer -> readers[pcm -> reader].tail)) / (pcm -> sample_size * pcm -> nchan);
+    for (size_t s = 0; s < 2; ++s) {
+        data[s] = spans[s].data;
+        counts[s] = spans[s].nframes;
+    }
+    return acquired;
+}
+
+
+static size_t pcm_source_release(void * ctx, size_t nframes)
+{
+    return pcm_release((pcm_t *) ctx, nframes);
+}
+
+
+// The reader of a pcm as a source of raw frames, see convert_consume
+static convert_source_t pcm_source(pcm_t * pcm)
+{
+    const convert_source_t source = {
+        .ctx = pcm,
+        .acquire = pcm_source_acquire,
+        .release = pcm_source_release,
+        .nchan = pcm -> nchan,
+        .format = pcm -> buffer_format,
+        .params = &(pcm -> convert),
+        .unpacked = pcm -> unpacked,
+        .unpack_frames = PCM_UNPACK_FRAMES,
+    };
+    return source;
+}
+
+
+// Gathers and converts the selected channels of the frames passed by convert_consume
+typedef struct {
+    size_t nchan;
+    const uint8_t * chans;
+    size_t nsel;
+    pcm_format_t format;
+    const convert_params_t * params;
+    uint8_t * dst;
+    size_t out_size;
+} pcm_gather_t;
+
+
+static void pcm_gather(void * arg, const uint32_t * frames, size_t n, size_t done)
+{
+    const pcm_gather_t * gather = (const pcm_gather_t *) arg;
+    convert_gather(frames, n, gather -> nchan, gather -> chans, gather -> nsel, &(gather -> dst[gather -> out_size * done]),
+                   gather -> format, gather -> params);
+}
+
+
+// Read and convert frames, see pcm_read_mask, and get the capture time of the first frame read if ts is not NULL
+static size_t pcm_read_frames(pcm_t * src, void * dst, size_t nframes, uint32_t chan_mask, pcm_format_t format, struct timespec * ts)
+{
+    uint8_t chans[CONVERT_MAX_CHAN];
+    const size_t nsel = convert_mask_to_chans(chan_mask, src -> nchan, chans);
+    if (nsel == 0 || convert_format_size(format) == 0) {
+        fprintf(stderr, "Error! Invalid channel mask or sample format.\n");
         return 0;
     }
 
-    pthread_mutex_lock(&ringbuf_mutex);
-    // Read data from the ringbuffer
-    const size_t read = ringbuf_pop(args.pcm -> main_buffer, raw_data, block_size, nsamples);
-    pthread_mutex_unlock(&ringbuf_mutex);
+    // Gather and convert straight from the ringbuffer. If the capture thread overwrote some frames while we were
+    // converting them, they are skipped and we convert the valid and the most recent frames instead.
+    const convert_source_t source = pcm_source(src);
+    pcm_gather_t gather = { .nchan = src -> nchan, .chans = chans, .nsel = nsel, .format = format,
+                            .params = &(src -> convert), .dst = (uint8_t *) dst,
+                            .out_size = convert_format_size(format) * nsel };
+    uint64_t first_frame;
+    const size_t read = convert_consume(&source, nframes, pcm_gather, NULL, &gather, &first_frame);
 
-    if (read != nsamples) {
-        fprintf(stderr, "Warning! Buffer underflow, some samples could not be read. Expected: %zu, actual: %zu\n", nsamples, read);
+    if (read != nframes) {
+        atomic_fetch_add(&(src -> underflows), 1);
+        fprintf(stderr, "Warning! Buffer underflow, some samples could not be read. Expected: %zu, actual: %zu\n", nframes, read);
     }
 
-    // Extract only the channels we are interested in, and apply some filter
-    uint8_t * dst_bytes = (uint8_t *) dst;
-    for (size_t s = 0; s < read; ++s) {
-        // Only extract the first nchan channels
-        memcpy(&dst_bytes[SAMPLE_SIZE_BYTES * nchan * s], &raw_data[block_size * s], SAMPLE_SIZE_BYTES * nchan);
+    if (ts != NULL && read > 0 && pcm_frame_time(src, first_frame, ts) != 0) {
+        fprintf(stderr, "Warning! No capture time for the frames read.\n");
+    }
+
+    pcm_rearm(src);
+    return read;
+}
+
+
+size_t pcm_read_mask(pcm_t * src, void * dst, size_t nframes, uint32_t chan_mask, pcm_format_t format)
+{
+    return pcm_read_frames(src, dst, nframes, chan_mask, format, NULL);
+}
+
+
+size_t pcm_read_timestamp(pcm_t * src, void * dst, size_t nframes, uint32_t chan_mask, pcm_format_t format, struct timespec * ts)
+{
+    return pcm_read_frames(src, dst, nframes, chan_mask, format, ts);
+}
+
+
+int pcm_stream_init(pcm_t * src, convert_stream_t * stream, const convert_stream_config_t * config)
+{
+    if (convert_stream_init(stream, config, src -> nchan, src -> sample_rate, &(src -> convert))) {
+        fprintf(stderr, "Error! Invalid stream configuration.\n");
+        return -1;
     }
+    return 0;
+}
+
+
+// Converts the frames passed by convert_consume through a stream, whose state is rolled back on a restart
+typedef struct {
+    convert_stream_t * stream;
+    convert_stream_t saved;
+    size_t nchan;
+    uint8_t * dst;
+    size_t out_size;
+} pcm_stream_read_t;
+
+
+static void pcm_stream_consume(void * arg, const uint32_t * frames, size_t n, size_t done)
+{
+    pcm_stream_read_t * read = (pcm_stream_read_t *) arg;
+    convert_stream_process(read -> stream, frames, n, read -> nchan, &(read -> dst[read -> out_size * done]));
+}
 
-    // TODO: filter
 
-    free(raw_data);
+static void pcm_stream_restart(void * arg)
+{
+    pcm_stream_read_t * read = (pcm_stream_read_t *) arg;
+    *(read -> stream) = read -> saved;
+}
+
+
+size_t pcm_read_stream(pcm_t * src, convert_stream_t * stream, void * dst, size_t nframes)
+{
+    // Same as pcm_read_mask, but the filter state must also be rolled back when the frames are overwritten
+    // while converting them, so that the retry continues from the state of the previous read
+    const convert_source_t source = pcm_source(src);
+    pcm_stream_read_t consumer = { .stream = stream, .saved = *stream, .nchan = src -> nchan, .dst = (uint8_t *) dst,
+                                   .out_size = convert_format_size(stream -> format) * stream -> nsel };
+    const size_t read = convert_consume(&source, nframes, pcm_stream_consume, pcm_stream_restart, &consumer, NULL);
+
+    if (read != nframes) {
+        atomic_fetch_add(&(src -> underflows), 1);
+        fprintf(stderr, "Warning! Buffer underflow, some samples could not be read. Expected: %zu, actual: %zu\n", nframes, read);
+    }
+
+    pcm_rearm(src);
     return read;
 }
 
 
+size_t pcm_wait(pcm_t * src, size_t nframes, int timeout_ms)
+{
+    size_t available = pcm_frames_available(src);
+    if (available >= nframes || timeout_ms == 0) {
+        return available;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    if (timeout_ms > 0) {
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long) (timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    pthread_mutex_lock(&(src -> wait_mutex));
+    atomic_fetch_add(&(src -> waiters), 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    // The capture thread only takes the mutex after pushing, so checking under the mutex cannot miss a wakeup
+    while ((available = pcm_frames_available(src)) < nframes && !args.stop_thread_flag) {
+        if (timeout_ms < 0) {
+            pthread_cond_wait(&(src -> wait_cond), &(src -> wait_mutex));
+        } else if (pthread_cond_timedwait(&(src -> wait_cond), &(src -> wait_mutex), &deadline) == ETIMEDOUT) {
+            available = pcm_frames_available(src);
+            break;
+        }
+    }
+    atomic_fetch_sub(&(src -> waiters), 1);
+    pthread_mutex_unlock(&(src -> wait_mutex));
+    return available;
+}
+
+
+size_t pcm_read_timeout(pcm_t * src, void * dst, size_t nframes, uint32_t chan_mask, pcm_format_t format, int timeout_ms)
+{
+    const size_t available = pcm_wait(src, nframes, timeout_ms);
+    if (available == 0) {
+        return 0;
+    }
+    return pcm_read_mask(src, dst, available < nframes ? available : nframes, chan_mask, format);
+}
+
+
+recorder_t * pcm_recorder_open(pcm_t * src, const char * path, const recorder_config_t * config)
+{
+    return recorder_open(path, config, src -> nchan, src -> sample_rate, &(src -> convert));
+}
+
+
+// Stages the frames passed by convert_consume in the current buffer of a recorder
+static void pcm_record_stage(void * arg, const uint32_t * frames, size_t n, size_t done)
+{
+    recorder_stage((recorder_t *) arg, frames, n, done);
+}
+
+
+size_t pcm_record(pcm_t * src, recorder_t * rec, size_t nframes, int timeout_ms)
+{
+    size_t available = pcm_wait(src, nframes, timeout_ms);
+    available = available < nframes ? available : nframes;
+    size_t recorded = 0;
+
+    const convert_source_t source = pcm_source(src);
+    while (recorded < available) {
+        // Stay within the current buffer of the recorder, so that a retry can stage the frames again
+        const size_t room = recorder_room(rec);
+        const size_t count = (available - recorded) < room ? (available - recorded) : room;
+        const size_t read = convert_consume(&source, count, pcm_record_stage, NULL, rec, NULL);
+        recorder_commit(rec, read);
+        recorded += read;
+        if (read < count) {
+            break;
+        }
+    }
+
+    pcm_rearm(src);
+    return recorded;
+}
+
+
+size_t pcm_read_doa(pcm_t * src, doa_t * doa, size_t nframes, doa_result_t * results, size_t max_results, int timeout_ms)
+{
+    size_t available = pcm_wait(src, nframes, timeout_ms);
+    available = available < nframes ? available : nframes;
+
+    pcm_span_t spans[2];
+    const size_t read = pcm_acquire(src, spans, available);
+    size_t nresults = 0;
+    for (size_t s = 0; s < 2; ++s) {
+        for (size_t f = 0; f < spans[s].nframes; ) {
+            const uint32_t * frames;
+            const size_t n = pcm_span_raw(src, &spans[s], f, &frames);
+            nresults += doa_process(doa, frames, n, &results[nresults], max_results - nresults);
+            f += n;
+        }
+    }
+    if (pcm_release(src, read) != 0) {
+        // Some frames were overwritten while in use, the estimates computed from them are meaningless
+        doa_reset(doa);
+        nresults = 0;
+    }
+
+    pcm_rearm(src);
+    return nresults;
+}
+
+
+size_t pcm_read_stft(pcm_t * src, stft_t * stft, size_t nframes, float * dst, size_t max_out, int timeout_ms)
+{
+    size_t available = pcm_wait(src, nframes, timeout_ms);
+    available = available < nframes ? available : nframes;
+
+    pcm_span_t spans[2];
+    const size_t read = pcm_acquire(src, spans, available);
+    const size_t out_size = stft -> nsel * stft -> nfeatures;
+    size_t nout = 0;
+    for (size_t s = 0; s < 2; ++s) {
+        for (size_t f = 0; f < spans[s].nframes; ) {
+            const uint32_t * frames;
+            const size_t n = pcm_span_raw(src, &spans[s], f, &frames);
+            nout += stft_process(stft, frames, n, &dst[nout * out_size], max_out - nout);
+            f += n;
+        }
+    }
+    if (pcm_release(src, read) != 0) {
+        // Some frames were overwritten while in use, the output frames computed from them are meaningless
+        stft_reset(stft);
+        nout = 0;
+    }
+
+    pcm_rearm(src);
+    return nout;
+}
+
+
+int pcm_get_fd(pcm_t * src)
+{
+    return src -> event_fd;
+}
+
+
+void pcm_set_watermark(pcm_t * src, size_t nframes)
+{
+    src -> watermark = nframes > 0 ? nframes : 1;
+    pcm_rearm(src);
+}
+
+
+size_t pcm_acquire(pcm_t * src, pcm_span_t spans[2], size_t nframes)
+{
+    const size_t block_size = src -> sample_size * (src -> nchan);
+    ringbuf_span_t ring_spans[2];
+    const size_t acquired = ringbuf_reader_acquire(src -> main_buffer, src -> reader, ring_spans, block_size, nframes);
+
+    for (size_t i = 0; i < 2; ++i) {
+        spans[i].data = ring_spans[i].data;
+        spans[i].nframes = ring_spans[i].count;
+    }
+    return acquired;
+}
+
+
+size_t pcm_release(pcm_t * src, size_t nframes)
+{
+    return ringbuf_reader_release(src -> main_buffer, src -> reader, src -> sample_size * (src -> nchan), nframes);
+}
+
+
 size_t pcm_buffer_length(void)
 {
-    pthread_mutex_lock(&ringbuf_mutex);
-    size_t length = ringbuf_len(args.pcm -> main_buffer);
-    pthread_mutex_unlock(&ringbuf_mutex);
-    return length;
+    return ringbuf_len(args.pcm -> main_buffer);
+}
+
+
+void pcm_get_stats(pcm_t * src, pcm_stats_t * stats)
+{
+    const pcm_t * capture = src -> capture != NULL ? src -> capture : src;
+    const size_t frame_size = src -> sample_size * src -> nchan;
+    ringbuf_reader_stats_t reader_stats;
+    ringbuf_reader_get_stats(src -> main_buffer, src -> reader, &reader_stats);
+
+    stats -> periods_received = atomic_load(&(capture -> periods_received));
+    stats -> periods_lost = atomic_load(&(capture -> periods_lost));
+    stats -> frames_overwritten = reader_stats.overwritten / frame_size;
+    stats -> frames_dropped = atomic_load(&(src -> main_buffer -> dropped)) / frame_size;
+    stats -> underflows = atomic_load(&(src -> underflows));
+}
+
+
+void pcm_get_timing(pcm_t * src, pcm_timing_t * timing)
+{
+    src = src -> capture != NULL ? src -> capture : src;
+    timing -> events = atomic_load(&(src -> events));
+    uint64_t intervals = 0;
+    for (size_t b = 0; b < PCM_INTERVAL_BUCKETS; ++b) {
+        timing -> interval_hist[b] = atomic_load(&(src -> interval_hist[b]));
+        intervals += timing -> interval_hist[b];
+    }
+    timing -> min_interval_us = intervals > 0 ? atomic_load(&(src -> interval_min_ns)) * 1e-3 : 0.0;
+    timing -> mean_interval_us = intervals > 0 ? atomic_load(&(src -> interval_sum_ns)) * 1e-3 / intervals : 0.0;
+    timing -> max_interval_us = atomic_load(&(src -> interval_max_ns)) * 1e-3;
+    timing -> period_us = pcm_period_ns(src) * 1e-3;
+    timing -> max_lateness_us = atomic_load(&(src -> lateness_max_ns)) * 1e-3;
 }
 
 
@@ -212,13 +1152,148 @@ void disable_recording(void)
 }
 
 
+int pcm_enable_filter(pcm_t * pcm, unsigned int decimation)
+{
+    if (pcm -> filter != NULL || args.recording_flag || pcm -> capture != NULL) {
+        fprintf(stderr, "Error! The filter must be enabled once on the capture, before recording is enabled.\n");
+        return -1;
+    }
+
+    // The filter processes one period at a time
+    filter_t * filter = filter_create(pcm -> nchan, CIC_ORDER, pcm -> decimation, decimation, pcm -> period_frames, pcm -> convert.mid);
+    if (filter == NULL) {
+        return -1;
+    }
+    uint32_t * filter_out = calloc((pcm -> period_frames / decimation + 1) * pcm -> nchan, SAMPLE_SIZE_BYTES);
+    if (filter_out == NULL) {
+        fprintf(stderr, "Error! Could not allocate the filter output buffer.\n");
+        filter_free(filter);
+        return -1;
+    }
+
+    pcm -> filter_out = filter_out;
+    pcm -> filter = filter;
+    pcm -> sample_rate /= decimation;
+    if (pcm -> shm != NULL) {
+        // The clients which opened the segment before keep the old rate
+        pcm -> shm -> sample_rate = pcm -> sample_rate;
+    }
+    pcm -> watermark = pcm -> watermark / decimation > 0 ? pcm -> watermark / decimation : 1;
+    return 0;
+}
+
+
+int pcm_set_callback(pcm_t * pcm, pcm_callback_t callback, void * user, size_t block_frames, int callback_only)
+{
+    if (pcm -> callback != NULL || args.recording_flag || callback == NULL || pcm -> capture != NULL) {
+        fprintf(stderr, "Error! The callback must be set once on the capture, before recording is enabled.\n");
+        return -1;
+    }
+
+    if (block_frames == 0) {
+        block_frames = pcm -> period_frames;
+    }
+    uint32_t * block_staging = calloc(block_frames * pcm -> nchan, SAMPLE_SIZE_BYTES);
+    if (block_staging == NULL) {
+        fprintf(stderr, "Error! Could not allocate the callback block buffer.\n");
+        return -1;
+    }
+
+    pcm -> block_staging = block_staging;
+    pcm -> block_pending = 0;
+    pcm -> block_frames = block_frames;
+    pcm -> callback_user = user;
+    pcm -> callback_only = callback_only;
+    pcm -> callback = callback;
+    return 0;
+}
+
+
+pcm_t * pcm_reader_open(pcm_t * pcm, int policy)
+{
+    if (pcm -> capture != NULL) {
+        fprintf(stderr, "Error! Readers must be opened on the pcm of the capture.\n");
+        return NULL;
+    }
+    pcm_t * reader = calloc(1, sizeof(pcm_t));
+    if (reader == NULL) {
+        fprintf(stderr, "Error! Memory for pcm reader could not be allocated.\n");
+        return NULL;
+    }
+
+    // Same stream as the capture, only the fields used to read it
+    reader -> nchan = pcm -> nchan;
+    reader -> sample_rate = pcm -> sample_rate;
+    reader -> decimation = pcm -> decimation;
+    reader -> period_frames = pcm -> period_frames;
+    reader -> periods = pcm -> periods;
+    reader -> main_buffer = pcm -> main_buffer;
+    reader -> backend = pcm -> backend;
+    reader -> convert = pcm -> convert;
+    reader -> buffer_format = pcm -> buffer_format;
+    reader -> sample_size = pcm -> sample_size;
+    reader -> stamps = pcm -> stamps;
+    reader -> nstamps = pcm -> nstamps;
+    reader -> watermark = pcm -> watermark;
+    reader -> capture = pcm;
+    if (pcm_alloc_unpacked(reader)) {
+        free(reader);
+        return NULL;
+    }
+    if (pcm_init_notify(reader)) {
+        free(reader -> unpacked);
+        free(reader);
+        return NULL;
+    }
+    reader -> reader = ringbuf_reader_add(pcm -> main_buffer, policy);
+    if (reader -> reader < 0) {
+        pcm_free_notify(reader);
+        free(reader -> unpacked);
+        free(reader);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&(pcm -> readers_mutex));
+    pcm -> readers[reader -> reader] = reader;
+    pthread_mutex_unlock(&(pcm -> readers_mutex));
+    return reader;
+}
+
+
+void pcm_reader_close(pcm_t * reader)
+{
+    pcm_t * pcm = reader -> capture;
+    pthread_mutex_lock(&(pcm -> readers_mutex));
+    pcm -> readers[reader -> reader] = NULL;
+    pthread_mutex_unlock(&(pcm -> readers_mutex));
+
+    ringbuf_reader_remove(reader -> main_buffer, reader -> reader);
+    pcm_free_notify(reader);
+    free(reader -> unpacked);
+    free(reader);
+}
+
+
 void pru_processing_close(pcm_t * pcm)
 {
-    stop_program();
-    // Stop PRU processing thread
+    // Request the PRU processing thread to stop and wake it up, it must be done with the PRU memory before the
+    // backend unmaps it
     args.stop_thread_flag = 1;
+    pcm -> backend -> wake();
+    pthread_join(PRU_thread, NULL);
+    pcm_unlock_memory(pcm);
+    pcm -> backend -> stop();
+    // No reader may still be blocked in pcm_wait at this point
+    pcm_free_notify(pcm);
+    pthread_mutex_destroy(&(pcm -> readers_mutex));
     // Destroy its attribute
     pthread_attr_destroy(&PRU_thread_attr);
-    // Then free the pcm ringbuffer
-    ringbuf_free(pcm -> main_buffer);
+    // Then free the pcm ringbuffer and filter
+    pcm_free_buffers(pcm);
+    if (pcm -> filter != NULL) {
+        filter_free(pcm -> filter);
+        free(pcm -> filter_out);
+    }
+    free(pcm -> block_staging);
+    free(pcm);
 }
\ No newline at end of file
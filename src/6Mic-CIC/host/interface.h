@@ -5,36 +5,324 @@
  * 
  */
 
+#ifndef INTERFACE_H
+#define INTERFACE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
 #include "ringbuffer.h"
 #include "loader.h"
+#include "convert.h"
+#include "filter.h"
+#include "recorder.h"
+#include "doa.h"
+#include "stft.h"
+#include "shm.h"
 
 #define SAMPLE_SIZE_BYTES 4
 
+// Order of the CIC filter implemented by the firmware, and its default decimation rate
+#define CIC_ORDER 4
+#define CIC_DECIMATION 16
+// Bounds of the decimation rate, the CIC gain R^N must fit in the 32 bits words of the firmware
+#define CIC_MIN_DECIMATION 4
+#define CIC_MAX_DECIMATION 128
+
+// Bit of a channel mask selecting microphone n, numbered from 1
+#define PCM_CHAN(n) (1u << ((n) - 1))
+
+// Max number of frames unpacked at once by the readers of a ringbuffer holding packed samples, see buffer_format
+#define PCM_UNPACK_FRAMES 1024
+
+// Number of buckets of the histogram of the intervals between events, see pcm_timing_t
+#define PCM_INTERVAL_BUCKETS 24
+// Max drift of the PRU clock relative to the host clock, which the lateness of the events tolerates
+#define PCM_CLOCK_TOLERANCE 200e-6
+
+// Memory locking options of pcm_config_t: lock all the memory of the process, current and future (mlockall),
+// or only fault in and lock the ringbuffer, the capture timestamps and the PRU buffer
+#define PCM_LOCK_ALL 1
+#define PCM_LOCK_BUFFERS 2
+
+// Real-time options which could not be applied, see pcm_t
+#define PCM_RT_PRIORITY 1
+#define PCM_RT_AFFINITY 2
+#define PCM_RT_LOCK_ALL 4
+#define PCM_RT_LOCK_BUFFERS 8
+
+/**
+ * @brief Callback receiving the raw frames of the capture, see pcm_set_callback. Called from the capture thread,
+ *        so it must return well before the firmware writes the next period.
+ * 
+ * @param frames The interleaved raw frames, nchan 32 bits words each, read-only. Only valid during the call.
+ * @param nframes The number of frames, the block size given to pcm_set_callback.
+ * @param user The user pointer given to pcm_set_callback.
+ */
+typedef void (*pcm_callback_t)(const uint32_t * frames, size_t nframes, void * user);
+
+/**
+ * @brief Capture time of the first frame of a push to the ringbuffer, see pcm_read_timestamp.
+ * 
+ */
+typedef struct {
+    // Position of the frame in the stream: number of frames pushed to the ringbuffer before it
+    uint64_t frame;
+    // CLOCK_MONOTONIC time at which the frame was captured
+    struct timespec time;
+} pcm_stamp_t;
+
 typedef struct pcm_t {
     // Number of channels
     size_t nchan;
     // *Per-channel* sample rate of the PCM signal in Hz
     size_t sample_rate;
+    // Decimation rate of the CIC filter of the firmware
+    unsigned int decimation;
     // The buffer accessed by the PRU, mapped by prussdrv, and its length
     volatile void * PRU_buffer;
-    // Length of the aforementioned buffer
+    // Length of the aforementioned buffer, the part of the mapped memory used by the firmware
     unsigned int PRU_buffer_len;
+    // The PRU buffer is a ring of periods, the firmware raises an event after writing each of them
+    unsigned int period_frames;
+    unsigned int periods;
+    // Index of the next period the capture thread processes
+    unsigned int next_period;
+    // With PRU_DUAL_NCHAN channels, a period of the frames of both PRUs merged by the capture thread, NULL otherwise
+    uint32_t * merged;
+    // Configuration passed to the firmware when the capture thread starts
+    pru_config_t pru_config;
     // The ring buffer which is the main place for storing data
     ringbuffer_t * main_buffer;
-    // Function pointer to an optional filter
-    // TODO:
+    // The shared memory segment holding the ringbuffer and the stamps if the capture is published, NULL otherwise
+    shm_header_t * shm;
+    // Reader of the ringbuffer used by this pcm, 0 for the pcm returned by pru_processing_init
+    int reader;
+    // For a pcm opened with pcm_reader_open, the pcm of the capture, NULL otherwise
+    struct pcm_t * capture;
+    // The pcms reading the ringbuffer, indexed by reader, which the capture thread notifies, and their mutex
+    struct pcm_t * readers[RINGBUF_MAX_READERS];
+    pthread_mutex_t readers_mutex;
+    // The backend driving the PRU, real or simulated
+    const pru_backend_t * backend;
+    // Parameters for converting the raw CIC output to the other sample formats
+    convert_params_t convert;
+    // eventfd readable while at least watermark frames are in the ringbuffer, and whether it is currently signalled
+    int event_fd;
+    size_t watermark;
+    atomic_int event_armed;
+    // Wakes up readers blocked in pcm_read_timeout, the capture thread only takes the mutex when there are waiters
+    pthread_mutex_t wait_mutex;
+    pthread_cond_t wait_cond;
+    atomic_int waiters;
+    // Optional filter between the PRU buffer and the ringbuffer, and the buffer holding its output
+    filter_t * filter;
+    uint32_t * filter_out;
+    // Format of the samples in the ringbuffer and their size, see pcm_config_t. If they are packed, the buffers into
+    // which the capture thread packs a period, and into which the reader unpacks up to PCM_UNPACK_FRAMES frames.
+    pcm_format_t buffer_format;
+    size_t sample_size;
+    void * packed;
+    uint32_t * unpacked;
+    // Optional callback receiving blocks of block_frames frames, and whether the frames still go to the ringbuffer
+    pcm_callback_t callback;
+    void * callback_user;
+    size_t block_frames;
+    int callback_only;
+    // Frames of a block spanning two periods, which cannot be passed straight from the PRU buffer, and their number
+    uint32_t * block_staging;
+    size_t block_pending;
+    // Sequence number of the last period of the PRU buffer seen by the capture thread
+    uint32_t last_sequence;
+    // Ring of the capture times of the last pushes to the ringbuffer, at least as many as the ringbuffer holds,
+    // and the number of them ever written. Written by the capture thread only.
+    pcm_stamp_t * stamps;
+    size_t nstamps;
+    _Atomic uint64_t stamps_head;
+    // Time of the previous wakeup of the capture thread, and reference time of the events for their lateness,
+    // only used by the capture thread
+    struct timespec last_wakeup;
+    int64_t lateness_ref_ns;
+    // Timing of the events returned by pcm_get_timing, in nanoseconds
+    _Atomic uint64_t events;
+    _Atomic uint64_t interval_hist[PCM_INTERVAL_BUCKETS];
+    _Atomic uint64_t interval_min_ns;
+    _Atomic uint64_t interval_max_ns;
+    _Atomic uint64_t interval_sum_ns;
+    _Atomic uint64_t lateness_max_ns;
+    // Real-time options of the capture thread which could not be applied, PCM_RT_* flags
+    unsigned int rt_failures;
+    // Memory locking options requested, PCM_LOCK_* flags, those which were applied are undone when closing
+    unsigned int lock;
+    // Counters returned by pcm_get_stats, the others come from the ringbuffer
+    _Atomic uint64_t periods_received;
+    _Atomic uint64_t periods_lost;
+    _Atomic uint64_t underflows;
 } pcm_t;
 
+/**
+ * @brief Cumulative counters of the data lost between the PRU and the reader, since pru_processing_init.
+ * 
+ */
+typedef struct {
+    // Periods of the PRU buffer processed by the capture thread
+    uint64_t periods_received;
+    // Periods of the PRU buffer written by the firmware but missed by the capture thread, because it was late
+    uint64_t periods_lost;
+    // Frames overwritten in the ringbuffer before the reader got them, because it was late
+    uint64_t frames_overwritten;
+    // Frames the capture thread dropped because a protected reader had no room left, see pcm_reader_open
+    uint64_t frames_dropped;
+    // Reads which returned fewer frames than requested, because the ringbuffer did not hold enough
+    uint64_t underflows;
+} pcm_stats_t;
+
+/**
+ * @brief Timing of the events of the PRU as seen by the capture thread, since pru_processing_init. A capture thread
+ *        which gets starved shows long intervals and a large lateness.
+ * 
+ */
+typedef struct {
+    // Number of wakeups of the capture thread
+    uint64_t events;
+    // Histogram of the intervals between consecutive wakeups: bucket b counts the intervals from 2^b to 2^(b+1)
+    // microseconds, the first one also counts shorter intervals and the last one longer intervals
+    uint64_t interval_hist[PCM_INTERVAL_BUCKETS];
+    // Shortest, average and longest interval between consecutive wakeups, in microseconds
+    double min_interval_us;
+    double mean_interval_us;
+    double max_interval_us;
+    // Nominal duration of a period, in microseconds
+    double period_us;
+    // Worst lateness of a wakeup, in microseconds: how much later than the least late wakeup it came, relative to
+    // the nominal duration of the periods elapsed in between. Absorbs a drift of the PRU clock of up to
+    // PCM_CLOCK_TOLERANCE.
+    double max_lateness_us;
+} pcm_timing_t;
+
+/**
+ * @brief Configuration of the capture, see pru_processing_init.
+ * 
+ */
+typedef struct {
+    // Number of channels, 6, or 3 to only sample the microphones on the rising edge of the clock, or PRU_DUAL_NCHAN
+    // to capture 6 more on the pins of PRU0, see loader.h
+    unsigned int nchan;
+    // Decimation rate of the CIC filter of the firmware, a power of two between CIC_MIN_DECIMATION and
+    // CIC_MAX_DECIMATION. The sample rate is PRU_PDM_CLOCK_HZ / decimation, e.g. 64 kHz for 16, 16 kHz for 64.
+    unsigned int decimation;
+    // Frames per period of the PRU buffer, the capture thread wakes up once per period. Smaller periods lower the
+    // latency at the cost of more wakeups, at most PRU_MAX_PERIOD_FRAMES and a multiple of PRU_BURST_FRAMES.
+    // 0 splits the buffer into the given periods.
+    unsigned int period_frames;
+    // Number of periods in the PRU buffer, at least 2. 0 uses as many periods as fit in the buffer,
+    // or 2 if period_frames is 0 too, which is the double buffering of the original firmware.
+    unsigned int periods;
+    // Path of the firmware image, NULL for PRU_DEFAULT_FIRMWARE, and of the image of PRU0 with PRU_DUAL_NCHAN
+    // channels, NULL for PRU_DEFAULT_FIRMWARE0
+    const char * firmware;
+    const char * firmware0;
+    // SCHED_FIFO priority of the capture thread, from 1 to 99, 0 keeps the default scheduling. Needs CAP_SYS_NICE.
+    int rt_priority;
+    // CPUs on which the capture thread may run, bit c for CPU c, 0 for all of them
+    uint32_t cpu_mask;
+    // Memory locking, PCM_LOCK_* flags, 0 for none, undone when closing. Locking more than RLIMIT_MEMLOCK needs
+    // CAP_IPC_LOCK.
+    unsigned int lock;
+    // If non-zero, pru_processing_init fails when one of the real-time options above cannot be applied.
+    // Otherwise it prints a warning, and the options which failed are in the rt_failures field of the pcm.
+    int rt_required;
+    // Name of a POSIX shared memory segment in which the ringbuffer is published to other processes, e.g.
+    // SHM_DEFAULT_NAME, see shm.h. NULL keeps the ringbuffer private to the process.
+    const char * shm_name;
+    // Format of the samples in the ringbuffer: PCM_FORMAT_RAW keeps the 32 bits words of the PRU, PCM_FORMAT_S24 or
+    // PCM_FORMAT_S16 packs them when the capture thread copies them, see convert_pack. This cuts the memory needed
+    // per second of buffering and the bandwidth of the copies by 25 or 50 %. Packing is exact as long as the CIC
+    // gain G is at most 2^24 or 2^16, with one exception: the raw words range from 0 to G included, and a raw word
+    // equal to G, the positive full scale, may saturate to the largest code, 1 LSB lower. It does at the default
+    // decimation, where G is exactly 2^16. With a larger gain, the low bits are dropped. The read functions unpack
+    // the samples.
+    pcm_format_t buffer_format;
+} pcm_config_t;
+
+// Configuration used when none is given: 6 channels at 64 kHz, no real-time options, not published
+#define PCM_CONFIG_DEFAULT { .nchan = 6, .decimation = CIC_DECIMATION, .period_frames = 0, .periods = 0, .firmware = NULL, \
+                             .firmware0 = NULL, .rt_priority = 0, .cpu_mask = 0, .lock = 0, .rt_required = 0, \
+                             .shm_name = NULL, .buffer_format = PCM_FORMAT_RAW }
+
+/**
+ * @brief A contiguous run of interleaved frames, pointing straight into the ringbuffer.
+ * 
+ */
+typedef struct {
+    // First frame of the span, each frame holds nchan samples of sample_size bytes, in the buffer_format of the pcm
+    const void * data;
+    // Number of frames in the span
+    size_t nframes;
+} pcm_span_t;
+
 /**
  * @brief Initialize PRU processing. Must be called before any other function of this file.
+ *        The configuration is passed to the firmware, fewer channels or a higher decimation rate
+ *        reduce the memory bandwidth and the host CPU usage.
  * 
+ * @param config The configuration of the capture, NULL for PCM_CONFIG_DEFAULT.
  * @return pcm_t* A pointer to a new pcm object in case of success, NULL otherwise.
  */
-//pcm_t * pru_processing_init(size_t nchan, size_t sample_rate);
-pcm_t * pru_processing_init(void);
+pcm_t * pru_processing_init(const pcm_config_t * config);
+
+/**
+ * @brief Enable the filter stage between the PRU buffer and the ringbuffer. It compensates the passband droop of
+ *        the CIC filter, and optionally decimates the signal further, which divides the sample rate of the pcm.
+ *        The filter is designed for the CIC filter of the firmware. Must be called at most once, before enable_recording.
+ * 
+ * @param pcm The pcm to which the filter is added.
+ * @param decimation The additional decimation factor: 1 (compensation only), 2 or 4.
+ * @return int 0 in case of success, non-zero otherwise.
+ */
+int pcm_enable_filter(pcm_t * pcm, unsigned int decimation);
+
+/**
+ * @brief Register a callback which the capture thread calls with each new block of raw frames, straight from the
+ *        PRU buffer, before writing them to the ringbuffer. Blocks lying within one period are not copied; the
+ *        frames of a block spanning two periods are gathered in an internal buffer first. If periods are lost,
+ *        the partial block is dropped so that a block never holds discontinuous frames. The callback sees the
+ *        frames before the filter stage, and is only called while recording is enabled.
+ *        Must be called at most once, before enable_recording.
+ * 
+ * @param pcm The pcm to which the callback is added.
+ * @param callback The callback.
+ * @param user A pointer passed to each call of the callback.
+ * @param block_frames The number of frames of each block, 0 for one period of the PRU buffer.
+ * @param callback_only If non-zero, the frames are not written to the ringbuffer, which saves a copy when the
+ *        callback is the only consumer.
+ * @return int 0 in case of success, non-zero otherwise.
+ */
+int pcm_set_callback(pcm_t * pcm, pcm_callback_t callback, void * user, size_t block_frames, int callback_only);
+
+/**
+ * @brief Open another reader of the frames of the capture. It gets all the frames captured from now on, straight
+ *        from the ringbuffer, independently of the other readers: it has its own position, watermark, event fd and
+ *        counters. All the read functions, e.g. pcm_read_mask or pcm_read_doa, accept it in place of the pcm.
+ *        Must be called after pcm_enable_filter if the filter is used.
+ * 
+ * @param pcm The pcm returned by pru_processing_init.
+ * @param policy What happens when the reader is too late: RINGBUF_READER_SKIP to skip the frames the capture thread
+ *        overwrote, or RINGBUF_READER_PROTECT for the capture thread to drop the new frames instead, e.g. for a
+ *        recorder which must not have holes in the middle of a file. Protected readers stall all the others.
+ * @return pcm_t* The new reader in case of success, NULL otherwise. Close it with pcm_reader_close.
+ */
+pcm_t * pcm_reader_open(pcm_t * pcm, int policy);
+
+/**
+ * @brief Close a reader opened with pcm_reader_open. Must be called before pru_processing_close, and no other thread
+ *        may still be using the reader.
+ * 
+ * @param reader The reader to close.
+ */
+void pcm_reader_close(pcm_t * reader);
 
 /**
- * @brief Stop processing and free/close all resources.
+ * @brief Stop processing and free/close all resources. No other thread may still be using the pcm, e.g. blocked in pcm_wait.
  * 
  * @param pcm The pcm object containing the resources.
  */
@@ -51,6 +339,178 @@ void pru_processing_close(pcm_t * pcm);
  */
 size_t pcm_read(pcm_t * src, void * dst, size_t nsamples, size_t nchan);
 
+/**
+ * @brief Read a given number of frames, keeping only the channels selected by a mask, converted to the given format.
+ *        The channels are gathered and converted in a single pass straight from the ringbuffer.
+ * 
+ * @param src The source pcm from which to read.
+ * @param dst The buffer to which we want to write data, interleaved, one sample per selected channel for each frame.
+ * @param nframes The number of frames to read.
+ * @param chan_mask The channels to read, bit c selects channel c (0-based), see PCM_CHAN. E.g. mics 1, 3 and 5 are
+ *        PCM_CHAN(1) | PCM_CHAN(3) | PCM_CHAN(5).
+ * @param format The sample format of the output.
+ * @return size_t The number of frames effectively written.
+ */
+size_t pcm_read_mask(pcm_t * src, void * dst, size_t nframes, uint32_t chan_mask, pcm_format_t format);
+
+/**
+ * @brief Same as pcm_read_mask, and also get the capture time of the first frame read. Each period is stamped with
+ *        CLOCK_MONOTONIC when the capture thread wakes up for it, so the time includes the wakeup latency of the
+ *        capture thread, but not the delay of the filter stage if enabled.
+ * 
+ * @param src The source pcm from which to read.
+ * @param dst The buffer to which we want to write data, see pcm_read_mask.
+ * @param nframes The number of frames to read.
+ * @param chan_mask The channels to read, see pcm_read_mask.
+ * @param format The sample format of the output.
+ * @param ts The CLOCK_MONOTONIC time at which the first frame read was captured. Unchanged if no frame was read.
+ * @return size_t The number of frames effectively written.
+ */
+size_t pcm_read_timestamp(pcm_t * src, void * dst, size_t nframes, uint32_t chan_mask, pcm_format_t format, struct timespec * ts);
+
+/**
+ * @brief Initialize a streaming conversion of the frames of the given pcm, see convert_stream_t.
+ * 
+ * @param src The pcm whose frames will be converted.
+ * @param stream The stream state to initialize.
+ * @param config The channels, format, DC blocking filter and gain of the conversion.
+ * @return int 0 in case of success, non-zero if the configuration is invalid.
+ */
+int pcm_stream_init(pcm_t * src, convert_stream_t * stream, const convert_stream_config_t * config);
+
+/**
+ * @brief Read a given number of frames through a streaming conversion: DC blocking high-pass filter and gain,
+ *        to float32 or int16. The filter and gain state is kept in the stream between calls, so consecutive
+ *        reads produce a continuous signal.
+ * 
+ * @param src The source pcm from which to read.
+ * @param stream The stream state, initialized with pcm_stream_init.
+ * @param dst The buffer to which we want to write data, interleaved, one sample per selected channel for each frame.
+ * @param nframes The number of frames to read.
+ * @return size_t The number of frames effectively written.
+ */
+size_t pcm_read_stream(pcm_t * src, convert_stream_t * stream, void * dst, size_t nframes);
+
+/**
+ * @brief Like pcm_read_mask, but first waits until nframes frames are in the ringbuffer or the timeout expires.
+ *        Then reads as many frames as available, up to nframes.
+ * 
+ * @param src The source pcm from which to read.
+ * @param dst The buffer to which we want to write data, see pcm_read_mask.
+ * @param nframes The number of frames to read.
+ * @param chan_mask The channels to read, see pcm_read_mask.
+ * @param format The sample format of the output.
+ * @param timeout_ms The max time to wait in milliseconds, negative to wait forever.
+ * @return size_t The number of frames effectively written, less than nframes if the timeout expired.
+ */
+size_t pcm_read_timeout(pcm_t * src, void * dst, size_t nframes, uint32_t chan_mask, pcm_format_t format, int timeout_ms);
+
+/**
+ * @brief Create a recorder writing the frames of the given pcm to WAV files, see recorder_open.
+ * 
+ * @param src The pcm whose frames will be recorded.
+ * @param path The path of the WAV file, see recorder_open.
+ * @param config The channels, format and buffering of the recording.
+ * @return recorder_t* A pointer to a new recorder in case of success, NULL otherwise. Close it with recorder_close.
+ */
+recorder_t * pcm_recorder_open(pcm_t * src, const char * path, const recorder_config_t * config);
+
+/**
+ * @brief Wait until nframes frames are in the ringbuffer or the timeout expires, then move as many frames as
+ *        available, up to nframes, to the recorder. The frames are converted straight from the ringbuffer into
+ *        the buffers of the recorder, the files are written by its writer thread.
+ * 
+ * @param src The source pcm from which to read.
+ * @param rec The recorder, created with pcm_recorder_open.
+ * @param nframes The number of frames to record.
+ * @param timeout_ms The max time to wait in milliseconds, negative to wait forever.
+ * @return size_t The number of frames recorded.
+ */
+size_t pcm_record(pcm_t * src, recorder_t * rec, size_t nframes, int timeout_ms);
+
+/**
+ * @brief Wait until nframes frames are in the ringbuffer or the timeout expires, then feed as many frames as
+ *        available, up to nframes, straight from the ringbuffer to a DOA estimator.
+ *        If frames were overwritten while in use, the estimates are dropped and the estimator is reset.
+ * 
+ * @param src The source pcm from which to read.
+ * @param doa The estimator, created with the sample rate and mid value of the pcm.
+ * @param nframes The number of frames to read.
+ * @param results The estimates computed from these frames, see doa_process.
+ * @param max_results The max number of estimates, should be at least nframes / hop + 1 not to drop frames.
+ * @param timeout_ms The max time to wait in milliseconds, negative to wait forever.
+ * @return size_t The number of estimates written to results.
+ */
+size_t pcm_read_doa(pcm_t * src, doa_t * doa, size_t nframes, doa_result_t * results, size_t max_results, int timeout_ms);
+
+/**
+ * @brief Wait until nframes frames are in the ringbuffer or the timeout expires, then feed as many frames as
+ *        available, up to nframes, straight from the ringbuffer to a STFT.
+ *        If frames were overwritten while in use, the output frames are dropped and the STFT is reset.
+ * 
+ * @param src The source pcm from which to read.
+ * @param stft The STFT, created with the number of channels, sample rate and mid value of the pcm.
+ * @param nframes The number of frames to read.
+ * @param dst The output frames computed from these frames, see stft_process.
+ * @param max_out The max number of output frames, should be at least nframes / hop + 1 not to drop frames.
+ * @param timeout_ms The max time to wait in milliseconds, negative to wait forever.
+ * @return size_t The number of output frames written to dst.
+ */
+size_t pcm_read_stft(pcm_t * src, stft_t * stft, size_t nframes, float * dst, size_t max_out, int timeout_ms);
+
+/**
+ * @brief Wait until the ringbuffer holds at least nframes frames or the timeout expires.
+ * 
+ * @param src The pcm to wait for.
+ * @param nframes The number of frames to wait for.
+ * @param timeout_ms The max time to wait in milliseconds, negative to wait forever.
+ * @return size_t The number of frames in the ringbuffer when the function returns.
+ */
+size_t pcm_wait(pcm_t * src, size_t nframes, int timeout_ms);
+
+/**
+ * @brief Get a file descriptor which becomes readable once the ringbuffer holds at least the watermark number of
+ *        frames, to be used with poll, select or epoll. It stops being readable once the frames have been read
+ *        below the watermark. The descriptor belongs to the pcm, it must not be read nor closed by the caller.
+ * 
+ * @param src The pcm.
+ * @return int The file descriptor.
+ */
+int pcm_get_fd(pcm_t * src);
+
+/**
+ * @brief Set the number of frames in the ringbuffer from which the file descriptor returned by pcm_get_fd is readable.
+ * 
+ * @param src The pcm.
+ * @param nframes The watermark, in frames. Defaults to one period of the PRU buffer.
+ */
+void pcm_set_watermark(pcm_t * src, size_t nframes);
+
+/**
+ * @brief Get direct access to up to nframes of the oldest frames of the ringbuffer, without copying them.
+ *        The frames are returned in up to two spans (the ringbuffer wraps around), to be processed in place.
+ *        They stay in the ringbuffer until pcm_release is called. The samples are in the buffer_format of the
+ *        pcm, convert_unpack gives the raw words back if they are packed.
+ * 
+ * @param src The source pcm from which to read.
+ * @param spans The spans pointing to the frames. The second one has 0 frames if the data does not wrap around.
+ * @param nframes The max number of frames to acquire.
+ * @return size_t The number of frames acquired, sum of the frames of both spans.
+ */
+size_t pcm_acquire(pcm_t * src, pcm_span_t spans[2], size_t nframes);
+
+/**
+ * @brief Release frames acquired with pcm_acquire. In case of an overflow, the capture thread may have overwritten
+ *        some of them while they were in use. The caller must then discard what it computed from these frames,
+ *        only the overwritten ones are released and the valid ones can be acquired again.
+ * 
+ * @param src The source pcm from which frames were acquired.
+ * @param nframes The number of frames to release, at most the number of frames acquired.
+ * @return size_t The number of frames, from the first acquired one, which may have been overwritten, and which were
+ *         released. 0 if all are valid and all were released.
+ */
+size_t pcm_release(pcm_t * src, size_t nframes);
+
 /**
  * @brief Get the current length of the circular buffer holding the recorded samples.
  * 
@@ -59,6 +519,23 @@ size_t pcm_read(pcm_t * src, void * dst, size_t nsamples, size_t nchan);
  */
 size_t pcm_buffer_length(void);
 
+/**
+ * @brief Get the counters of lost data. Can be called from any thread.
+ * 
+ * @param src The pcm.
+ * @param stats The structure to which the counters are written.
+ */
+void pcm_get_stats(pcm_t * src, pcm_stats_t * stats);
+
+/**
+ * @brief Get the timing of the events of the PRU: histogram of the intervals between them, and worst lateness of the
+ *        capture thread. Can be called from any thread.
+ * 
+ * @param src The pcm.
+ * @param timing The structure to which the timing is written.
+ */
+void pcm_get_timing(pcm_t * src, pcm_timing_t * timing);
+
 /**
  * @brief Get the max length of the circular buffer holding the recorded samples.
  * 
@@ -85,4 +562,6 @@ void enable_recording(void);
  * This means only the samples remaining in the ringbuffer after this function was called can be read.
  * 
  */
-void disable_recording(void);
\ No newline at end of file
+void disable_recording(void);
+
+#endif
@@ -12,13 +12,23 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <prussdrv.h>
+#include <pruss_intc_mapping.h>
 
 #include "loader.h"
 
 #define PRU_NUM0 0
 #define PRU_NUM1 1
 
-#define PROGRAM_NAME "pru1.bin"
+// PRU1 and PRU0 data RAMs, kept to pass the configuration and read the sequence numbers published by the firmwares
+static volatile uint32_t * PRU_data_mem = NULL;
+static volatile uint32_t * PRU0_data_mem = NULL;
+// Physical address of the host buffer, PRU0 writes to its second half with PRU_DUAL_NCHAN channels
+static unsigned int HOST_phys_addr = 0;
+// Whether both PRUs are running
+static int dual = 0;
+// Set by wake_program, wait_event returns non-zero once it is set
+static volatile int waking = 0;
 
 
 int setup_mmaps(volatile uint32_t ** pru_mem, volatile void ** host_mem, unsigned int * host_mem_len, unsigned int * host_mem_phys_addr) {
@@ -42,7 +52,7 @@ int setup_mmaps(volatile uint32_t ** pru_mem, volatile void ** host_mem, unsigne
     // The PRU needs the physical address of the memory it will write to
     unsigned int HOST_mem_phys_addr = prussdrv_get_phys_addr((void *) HOST_mem);
 
-    // Trim HOST_mem_len down so that it is a multiple of 48. This will ensure that HOST_mem_len / 2 is a multiple of 24 = 6 * 4, which allows the PRU to check if it has reached half if the buffer by doing a simple equality check (24 because it is writing 6 * 4 B at a time)
+    // Trim HOST_mem_len down so that it is a multiple of 48, a whole number of pairs of frames with 6 or 3 channels of 4 B. The firmware only uses the periods which fit in it, see load_program
     HOST_mem_len = HOST_mem_len - (HOST_mem_len % 48);
 
     printf("%u bytes of Host memory available.\n", HOST_mem_len);
@@ -50,8 +60,10 @@ int setup_mmaps(volatile uint32_t ** pru_mem, volatile void ** host_mem, unsigne
     printf("Virtual (Host-side) address: %p\n\n", HOST_mem);
 
     // Use the first 8 bytes of PRU memory to tell it where the shared segment of Host memory is
-    PRU_mem[0] = HOST_mem_phys_addr;
-    PRU_mem[1] = HOST_mem_len;
+    PRU_mem[PRU_MEM_HOST_ADDR] = HOST_mem_phys_addr;
+    PRU_mem[PRU_MEM_HOST_LEN] = HOST_mem_len;
+    // The firmware resets it when it starts, but do not let the host read a stale value before that
+    PRU_mem[PRU_MEM_SEQUENCE] = 0;
 
     *pru_mem = PRU_mem;
     *host_mem = HOST_mem;
@@ -64,6 +76,10 @@ int setup_mmaps(volatile uint32_t ** pru_mem, volatile void ** host_mem, unsigne
 
 void stop_program(void) {
     prussdrv_pru_disable(PRU_NUM1);
+    if (dual) {
+        prussdrv_pru_disable(PRU_NUM0);
+        dual = 0;
+    }
     prussdrv_exit();
 }
 
@@ -71,7 +87,7 @@ void stop_program(void) {
 int PRU_proc_init(volatile void ** buf, unsigned int * buf_len) {
     // ##### Prussdrv setup #####
     prussdrv_init();
-	if (prussdrv_open(PRU_EVTOUT_0) || prussdrv_open(PRU_EVTOUT_1)) {
+	if (prussdrv_open(PRU_EVTOUT_0)) {
         fprintf(stderr, "PRU1 : prussdrv_open failed\n");
         prussdrv_exit();
         return -1;
@@ -93,20 +109,128 @@ int PRU_proc_init(volatile void ** buf, unsigned int * buf_len) {
         stop_program();
         return -1;
     }
+    PRU_data_mem = PRU_mem;
+    HOST_phys_addr = buf_phys_addr;
+
+    // PRU0 data RAM, only used with PRU_DUAL_NCHAN channels
+    void * PRU0_mem_void = NULL;
+    if (prussdrv_map_prumem(PRUSS0_PRU0_DATARAM, &PRU0_mem_void)) {
+        stop_program();
+        return -1;
+    }
+    PRU0_data_mem = (volatile uint32_t *) PRU0_mem_void;
 
     return 0;
 }
 
 
-int load_program(void) {
+int load_program(const pru_config_t * config) {
+    const char * program_name = config -> firmware != NULL ? config -> firmware : PRU_DEFAULT_FIRMWARE;
+    waking = 0;
+    // With 12 channels, each PRU captures 6 of them to its own half of the host buffer
+    dual = config -> nchan == PRU_DUAL_NCHAN;
+    const unsigned int nchan = dual ? PRU_DUAL_NCHAN / 2 : config -> nchan;
+    const unsigned int used_len = config -> periods * config -> period_frames * 4 * nchan;
+
+    // Pass the configuration to the firmware, next to the host memory address. Only the periods are used.
+    PRU_data_mem[PRU_MEM_HOST_LEN] = used_len;
+    PRU_data_mem[PRU_MEM_DECIMATION] = config -> decimation;
+    PRU_data_mem[PRU_MEM_NCHAN] = nchan;
+    PRU_data_mem[PRU_MEM_PERIOD] = config -> period_frames;
+    PRU_data_mem[PRU_MEM_SYNC] = dual;
+
+    if (dual) {
+        const char * program0_name = config -> firmware0 != NULL ? config -> firmware0 : PRU_DEFAULT_FIRMWARE0;
+
+        // PRU0 writes to the second half of the host buffer, and waits for PRU1 to start it
+        PRU0_data_mem[PRU_MEM_HOST_ADDR] = HOST_phys_addr + used_len;
+        PRU0_data_mem[PRU_MEM_HOST_LEN] = used_len;
+        PRU0_data_mem[PRU_MEM_SEQUENCE] = 0;
+        PRU0_data_mem[PRU_MEM_DECIMATION] = config -> decimation;
+        PRU0_data_mem[PRU_MEM_NCHAN] = nchan;
+        PRU0_data_mem[PRU_MEM_PERIOD] = config -> period_frames;
+        PRU0_data_mem[PRU_MEM_SYNC] = 0;
+        PRU0_data_mem[PRU_MEM_START] = 0;
+
+        // PRU0 raises its events on PRU_EVTOUT_1
+        if (prussdrv_open(PRU_EVTOUT_1)) {
+            fprintf(stderr, "PRU0 : prussdrv_open failed\n");
+            stop_program();
+            return -1;
+        }
+
+        printf("Loading \"%s\" program on PRU0\n", program0_name);
+        int ret = prussdrv_exec_program(PRU_NUM0, program0_name);
+        if (ret) {
+            fprintf(stderr, "ERROR: could not open %s\n", program0_name);
+            stop_program();
+            return ret;
+        }
+    }
+
     // Load the PRU program(s)
-    printf("Loading \"%s\" program on PRU1\n", PROGRAM_NAME);
-    int ret = prussdrv_exec_program(PRU_NUM1, PROGRAM_NAME);
+    printf("Loading \"%s\" program on PRU1\n", program_name);
+    int ret = prussdrv_exec_program(PRU_NUM1, program_name);
     if (ret) {
-    	fprintf(stderr, "ERROR: could not open %s\n", PROGRAM_NAME);
+    	fprintf(stderr, "ERROR: could not open %s\n", program_name);
         stop_program();
     	return ret;
     }
     
     return 0;
 }
+
+
+int wait_event(unsigned int evt) {
+    (void) evt;
+    prussdrv_pru_wait_event(PRU_EVTOUT_0);
+    // Even though we are using PRU1, I have to use PRU0_ARM_INTERRUPT in this case for it to work.
+    // I truly have no clue of why this is happening.
+    prussdrv_pru_clear_event(PRU_EVTOUT_0, PRU0_ARM_INTERRUPT);
+    if (waking) {
+        return -1;
+    }
+    if (dual) {
+        // PRU0 raises its event on the same clock edge, the other way around
+        prussdrv_pru_wait_event(PRU_EVTOUT_1);
+        prussdrv_pru_clear_event(PRU_EVTOUT_1, PRU1_ARM_INTERRUPT);
+        if (waking) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+void wake_program(void) {
+    // Raise the events of the firmware from the ARM side. The uio device counts the interrupts, so the wait returns
+    // even if the thread only blocks after this.
+    waking = 1;
+    prussdrv_pru_send_event(PRU0_ARM_INTERRUPT);
+    if (dual) {
+        prussdrv_pru_send_event(PRU1_ARM_INTERRUPT);
+    }
+}
+
+
+uint32_t read_sequence(void) {
+    const uint32_t sequence = PRU_data_mem[PRU_MEM_SEQUENCE];
+    if (!dual) {
+        return sequence;
+    }
+    // Only the periods written by both PRUs are complete, the sequence numbers wrap around
+    const uint32_t sequence0 = PRU0_data_mem[PRU_MEM_SEQUENCE];
+    return (int32_t) (sequence0 - sequence) < 0 ? sequence0 : sequence;
+}
+
+
+const pru_backend_t pru_backend_prussdrv = {
+    .name = "prussdrv",
+    .init = PRU_proc_init,
+    .load = load_program,
+    .wait_event = wait_event,
+    .sequence = read_sequence,
+    .wake = wake_program,
+    .stop = stop_program,
+};
@@ -4,10 +4,103 @@
  * @author Loïc Droz <lk.droz@gmail.com>
  */
 
+#ifndef LOADER_H
+#define LOADER_H
 
 #include <stddef.h>
-#include <prussdrv.h>
-#include <pruss_intc_mapping.h>
+#include <inttypes.h>
+#include <time.h>
+
+// Host event raised by the firmware each time it has written a period of frames to the host buffer.
+// The host buffer is a ring of periods, the firmware wraps around at its end. With PRU_DUAL_NCHAN channels,
+// the backend waits for the events of both PRUs.
+#define PRU_EVT_PERIOD 0
+
+// Words of the PRU1 data RAM shared with the firmware. The host writes the physical address and length of
+// the host buffer before starting the firmware. The firmware counts the periods it has written since it
+// started, and updates the count before raising each event.
+#define PRU_MEM_HOST_ADDR 0
+#define PRU_MEM_HOST_LEN 1
+#define PRU_MEM_SEQUENCE 2
+// Configuration read by the firmware when it starts, see pru_config_t
+#define PRU_MEM_DECIMATION 3
+#define PRU_MEM_NCHAN 4
+#define PRU_MEM_PERIOD 5
+// With 12 channels, the host sets PRU_MEM_SYNC in the data RAM of PRU1, which then sets PRU_MEM_START in the data
+// RAM of PRU0 right after a rising edge of the clock. PRU0 waits for it, so that both start on the same edge.
+#define PRU_MEM_SYNC 6
+#define PRU_MEM_START 7
+
+// Number of channels captured by both PRUs: PRU1 captures channels 1 to 6 and writes them to the first half of
+// the host buffer, PRU0 captures channels 7 to 12 on its own pins and writes them to the second half. Each half
+// is a ring of periods of 6 channel frames, the host merges them into frames of 12 channels.
+#define PRU_DUAL_NCHAN 12
+
+// Max number of frames in a period, the firmware counts them in 16 bits
+#define PRU_MAX_PERIOD_FRAMES 65535
+// The firmware writes the frames to the host buffer by bursts of this many frames, periods are whole bursts
+#define PRU_BURST_FRAMES 2
+
+// Frequency of the PDM clock generated for the microphones, see utils/PWMsetup.sh
+#define PRU_PDM_CLOCK_HZ 1024000
+// Firmware image loaded when none is given, and the one of PRU0, assembled with -DPRU0
+#define PRU_DEFAULT_FIRMWARE "pru1.bin"
+#define PRU_DEFAULT_FIRMWARE0 "pru0.bin"
+
+
+/**
+ * @brief Configuration of the firmware, passed to it through its data RAM.
+ * 
+ */
+typedef struct {
+    // Number of channels, 6 (both clock edges), 3 (rising edge only) or PRU_DUAL_NCHAN (6 on each PRU)
+    unsigned int nchan;
+    // Decimation rate R of the CIC filter, a power of two between 4 and 128
+    unsigned int decimation;
+    // Number of frames per period, and number of periods in the host buffer, at least 2
+    unsigned int period_frames;
+    unsigned int periods;
+    // Path of the firmware image, NULL for PRU_DEFAULT_FIRMWARE, and of the image of PRU0 with PRU_DUAL_NCHAN
+    // channels, NULL for PRU_DEFAULT_FIRMWARE0
+    const char * firmware;
+    const char * firmware0;
+} pru_config_t;
+
+
+/**
+ * @brief Set of functions the interface uses to drive the PRU. Allows running the whole host stack
+ *        either on the real PRUSS (prussdrv) or on a simulated PRU.
+ * 
+ */
+typedef struct pru_backend_t {
+    // Name of the backend, for logging purposes
+    const char * name;
+    // Initialize the driver and memory maps, see PRU_proc_init
+    int (*init)(volatile void ** HOST_PRU_buf, unsigned int * HOST_PRU_buf_len);
+    // Pass the configuration to the firmware, then load and start it, see load_program
+    int (*load)(const pru_config_t * config);
+    // Block until the given host event (PRU_EVT_*) is raised, then clear it. Returns 0 on success, non-zero once
+    // the backend is woken up by wake.
+    int (*wait_event)(unsigned int evt);
+    // Read the number of periods written by the firmware, by both PRUs with PRU_DUAL_NCHAN channels, see read_sequence
+    uint32_t (*sequence)(void);
+    // Wake up the thread blocked in wait_event so that it can be joined before stop, see wake_program
+    void (*wake)(void);
+    // Stop the firmware and release the driver, see stop_program
+    void (*stop)(void);
+} pru_backend_t;
+
+// Backend using the real PRUSS through prussdrv, implemented in loader.c
+extern const pru_backend_t pru_backend_prussdrv;
+// Backend simulating the PRU firmware with a thread, implemented in loader_sim.c
+extern const pru_backend_t pru_backend_sim;
+
+// The backend used by pru_processing_init, chosen at compile time
+#ifdef PRU_SIM
+#define PRU_DEFAULT_BACKEND pru_backend_sim
+#else
+#define PRU_DEFAULT_BACKEND pru_backend_prussdrv
+#endif
 
 
 /**
@@ -21,16 +114,87 @@
 int PRU_proc_init(volatile void ** HOST_PRU_buf, unsigned int * HOST_PRU_buf_len);
 
 /**
- * @brief Loads and starts the PRU firmware.
+ * @brief Passes the configuration to the firmware through its data RAM, then loads and starts it.
+ *        The firmware only uses the first periods * period_frames frames of the host buffer.
+ *        With PRU_DUAL_NCHAN channels, starts the firmware of PRU0 first, PRU1 then starts PRU0 on a clock edge.
+ * 
+ * @param config The configuration of the firmware. Must be valid and fit in the host buffer, it is not checked.
+ * @return int 0 in case of success, non-zero otherwise.
+ */
+int load_program(const pru_config_t * config);
+
+/**
+ * @brief Waits for the given host event from the PRU and clears it, from both PRUs with PRU_DUAL_NCHAN channels.
  * 
- * @param void 
+ * @param evt The event to wait for, PRU_EVT_PERIOD.
  * @return int 0 in case of success, non-zero otherwise.
  */
-int load_program(void);
+int wait_event(unsigned int evt);
+
+/**
+ * @brief Reads the sequence number published by the firmware: the number of periods written since it started.
+ *        With PRU_DUAL_NCHAN channels, the number of periods both PRUs have written.
+ * 
+ * @param void
+ * @return uint32_t The sequence number, wraps around after 2^32 periods.
+ */
+uint32_t read_sequence(void);
+
+/**
+ * @brief Wakes up the thread blocked in wait_event, which then returns non-zero, as well as all the later calls.
+ *        Closing the driver does not wake up a read blocked on the uio device, so this must be called, and the
+ *        waiting thread joined, before stop_program.
+ * 
+ * @param void
+ */
+void wake_program(void);
 
 /**
  * @brief Stops the PRU firware and the PRUSS driver.
  * 
  * @param void
  */
-void stop_program(void);
\ No newline at end of file
+void stop_program(void);
+
+
+/**
+ * @brief Parameters of the simulated PRU. The number of channels and the decimation rate come from the firmware
+ *        configuration, like on the real PRU.
+ * 
+ */
+typedef struct {
+    // Length of the simulated host buffer in bytes, trimmed like the real one. 0 means the uio_pruss default.
+    unsigned int buffer_len;
+    // Speed relative to real time, e.g. 10.0 produces samples 10 times faster. 0 means as fast as possible.
+    double speed;
+    // Content of the samples, one of PRU_SIM_SIGNAL_*
+    int signal;
+} pru_sim_config_t;
+
+// Each sample is a counter: frame_index * nchan + channel, useful to check data integrity
+#define PRU_SIM_SIGNAL_COUNTER 0
+// Each channel is a sine around the CIC output mid-scale, with a per-channel phase shift
+#define PRU_SIM_SIGNAL_SINE 1
+// Each channel is a PDM tone from a sigma-delta modulator, decimated by the software CIC exactly like the firmware
+#define PRU_SIM_SIGNAL_PDM 2
+
+/**
+ * @brief Configure the simulated PRU. Must be called before pru_processing_init to have any effect.
+ *        If it is never called, defaults are used, with the speed optionally set by the PRU_SIM_SPEED
+ *        environment variable, and the signal by PRU_SIM_SIGNAL (counter, sine or pdm).
+ * 
+ * @param config The configuration to use.
+ */
+void pru_sim_configure(const pru_sim_config_t * config);
+
+/**
+ * @brief Get the time at which the simulated PRU raised the event of a period, e.g. to measure the latency from
+ *        the event to the data in the hands of a reader. Only the times of the last events are kept.
+ * 
+ * @param sequence The sequence number published with the event, see read_sequence.
+ * @param ts The CLOCK_MONOTONIC time at which the event was raised.
+ * @return int 0 in case of success, non-zero if the event was not raised yet or is too old.
+ */
+int pru_sim_event_time(uint32_t sequence, struct timespec * ts);
+
+#endif
@@ -0,0 +1,357 @@
+/**
+ * @brief Simulated PRU backend. A producer thread plays the role of the PRU firmware: it writes
+ *        interleaved 32 bits samples to a host buffer laid out like the one mapped by prussdrv,
+ *        and raises the same half-buffer events. With PRU_DUAL_NCHAN channels, it also plays PRU0 and
+ *        writes channels 7 to 12 to the second half of the buffer. Headers in loader.h.
+ * 
+ * @author Loïc Droz <lk.droz@gmail.com>
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "loader.h"
+#include "cic.h"
+#include "pdm.h"
+
+// Default size of the memory mapped by uio_pruss
+#define SIM_DEFAULT_BUFFER_LEN 0x40000
+// Size of the PRU1 data RAM
+#define SIM_PRU_MEM_LEN 8192
+// Number of frames written between two pacing checks of the producer
+#define SIM_CHUNK_FRAMES 64
+// Frequency of the simulated tones, at half of the full scale
+#define SIM_SINE_FREQ 1000.0
+// Order of the CIC filter of the firmware
+#define SIM_CIC_ORDER 4
+// The host buffer length is trimmed to a multiple of this, like setup_mmaps does
+#define SIM_BUFFER_ALIGN 48
+// Max decimation rate, to size the PDM buffer
+#define SIM_MAX_DECIMATION 128
+// Number of events whose time is kept, see pru_sim_event_time
+#define SIM_EVENT_HISTORY 1024
+
+
+static pru_sim_config_t sim_config = {
+    .buffer_len = 0,
+    .speed = 1.0,
+    .signal = PRU_SIM_SIGNAL_SINE,
+};
+static int sim_configured = 0;
+
+// Firmware configuration, read from the data RAM when starting, and the resulting sample rate and mid-scale
+static unsigned int sim_nchan;
+static unsigned int sim_decimation;
+static unsigned int sim_period_frames;
+static unsigned int sim_sample_rate;
+static uint32_t sim_mid;
+
+// Modulators and decimators of the PDM signal, one decimator per PRU
+static pdm_gen_t sim_pdm_gen[PRU_DUAL_NCHAN];
+static cic_t sim_cic[2];
+static unsigned int sim_ncic;
+
+// Simulated PRU1 and PRU0 data RAMs and host buffer
+static volatile uint32_t sim_pru_mem[SIM_PRU_MEM_LEN / 4];
+static volatile uint32_t sim_pru0_mem[SIM_PRU_MEM_LEN / 4];
+static uint8_t * sim_host_mem = NULL;
+static unsigned int sim_host_mem_len = 0;
+
+// Producer thread state, and pending event. Like with uio, several occurrences of the
+// event collapse into a single one if the host does not wait for them in time.
+static pthread_t sim_thread;
+static pthread_mutex_t sim_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sim_cond = PTHREAD_COND_INITIALIZER;
+static int sim_pending;
+static volatile int sim_running = 0;
+static int sim_thread_started = 0;
+
+// Time at which the event of each of the last periods was raised, indexed by sequence number
+static struct timespec sim_event_times[SIM_EVENT_HISTORY];
+
+
+void pru_sim_configure(const pru_sim_config_t * config)
+{
+    sim_config = *config;
+    sim_configured = 1;
+}
+
+
+int pru_sim_event_time(uint32_t sequence, struct timespec * ts)
+{
+    // Only the last events are kept, and the oldest one may be being overwritten
+    const uint32_t age = sim_pru_mem[PRU_MEM_SEQUENCE] - sequence;
+    if (age >= SIM_EVENT_HISTORY - 1) {
+        return -1;
+    }
+    *ts = sim_event_times[sequence % SIM_EVENT_HISTORY];
+    return 0;
+}
+
+
+static void sim_raise_event(void)
+{
+    pthread_mutex_lock(&sim_mutex);
+    sim_pending = 1;
+    pthread_cond_broadcast(&sim_cond);
+    pthread_mutex_unlock(&sim_mutex);
+}
+
+
+// Fill one frame of samples, according to the configured signal
+static void sim_fill_frame(uint32_t * frame, uint64_t frame_index)
+{
+    const unsigned int nchan = sim_nchan;
+    if (sim_config.signal == PRU_SIM_SIGNAL_COUNTER) {
+        for (unsigned int c = 0; c < nchan; ++c) {
+            frame[c] = (uint32_t) (frame_index * nchan + c);
+        }
+    } else if (sim_config.signal == PRU_SIM_SIGNAL_PDM) {
+        // Each PRU decimates its channels from the bits of its own PDM input
+        const unsigned int cic_nchan = nchan / sim_ncic;
+        for (unsigned int k = 0; k < sim_ncic; ++k) {
+            uint8_t pdm[SIM_MAX_DECIMATION];
+            for (unsigned int c = 0; c < cic_nchan; ++c) {
+                pdm_generate(&sim_pdm_gen[k * cic_nchan + c], pdm, sim_decimation, c);
+            }
+            cic_process(&sim_cic[k], pdm, sim_decimation, &frame[k * cic_nchan]);
+        }
+    } else {
+        const double t = (double) frame_index / sim_sample_rate;
+        for (unsigned int c = 0; c < nchan; ++c) {
+            const double phase = 2 * M_PI * SIM_SINE_FREQ * t + c * M_PI / 3;
+            frame[c] = (uint32_t) (sim_mid + lround(sim_mid / 2 * sin(phase)));
+        }
+    }
+}
+
+
+// Plays the role of the firmware, writes frames to the host buffer and raises the events
+static void * sim_routine(void * arg)
+{
+    (void) arg;
+    // With both PRUs, each writes its half of the frame to its own half of the buffer
+    const int dual = sim_nchan == PRU_DUAL_NCHAN;
+    const size_t frame_size = 4 * sim_pru_mem[PRU_MEM_NCHAN];
+    const unsigned int used_len = sim_pru_mem[PRU_MEM_HOST_LEN];
+    uint8_t * const host0 = &sim_host_mem[used_len];
+    const size_t chunk = sim_period_frames < SIM_CHUNK_FRAMES ? sim_period_frames : SIM_CHUNK_FRAMES;
+    unsigned int byte_counter = 0;
+    unsigned int period_counter = sim_period_frames;
+    uint64_t frame_index = 0;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (sim_running) {
+        for (size_t i = 0; i < chunk; ++i) {
+            uint32_t frame[PRU_DUAL_NCHAN];
+            sim_fill_frame(frame, frame_index++);
+            memcpy(&sim_host_mem[byte_counter], frame, frame_size);
+            if (dual) {
+                memcpy(&host0[byte_counter], &frame[PRU_DUAL_NCHAN / 2], frame_size);
+            }
+            byte_counter += frame_size;
+            if (byte_counter == used_len) {
+                byte_counter = 0;
+            }
+
+            // Like the firmware, publish the sequence number of the period before raising its event
+            period_counter -= 1;
+            if (period_counter == 0) {
+                period_counter = sim_period_frames;
+                const uint32_t sequence = sim_pru_mem[PRU_MEM_SEQUENCE] + 1;
+                clock_gettime(CLOCK_MONOTONIC, &sim_event_times[sequence % SIM_EVENT_HISTORY]);
+                if (dual) {
+                    sim_pru0_mem[PRU_MEM_SEQUENCE] = sequence;
+                }
+                sim_pru_mem[PRU_MEM_SEQUENCE] = sequence;
+                sim_raise_event();
+            }
+        }
+
+        // Pace the producer so that it runs at the requested speed
+        if (sim_config.speed > 0) {
+            const double elapsed = frame_index / (sim_sample_rate * sim_config.speed);
+            struct timespec deadline = start;
+            deadline.tv_sec += (time_t) elapsed;
+            deadline.tv_nsec += (long) ((elapsed - (time_t) elapsed) * 1e9);
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec += 1;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+        }
+    }
+
+    return NULL;
+}
+
+
+static int sim_init(volatile void ** buf, unsigned int * buf_len)
+{
+    if (!sim_configured) {
+        const char * speed = getenv("PRU_SIM_SPEED");
+        if (speed != NULL) {
+            sim_config.speed = atof(speed);
+        }
+        const char * signal = getenv("PRU_SIM_SIGNAL");
+        if (signal != NULL) {
+            sim_config.signal = strcmp(signal, "counter") == 0 ? PRU_SIM_SIGNAL_COUNTER :
+                                strcmp(signal, "pdm") == 0 ? PRU_SIM_SIGNAL_PDM : PRU_SIM_SIGNAL_SINE;
+        }
+    }
+
+    unsigned int len = sim_config.buffer_len ? sim_config.buffer_len : SIM_DEFAULT_BUFFER_LEN;
+    // Trim the length like setup_mmaps does, so that it holds a whole number of frames
+    len -= len % SIM_BUFFER_ALIGN;
+    if (len == 0) {
+        fprintf(stderr, "Error! Simulated host buffer is too small.\n");
+        return -1;
+    }
+
+    // The buffer can still be in use by the host after a previous stop, only release it now
+    free(sim_host_mem);
+    sim_host_mem = calloc(len, 1);
+    if (sim_host_mem == NULL) {
+        fprintf(stderr, "Error! Could not allocate the simulated host buffer.\n");
+        return -1;
+    }
+    sim_host_mem_len = len;
+
+    printf("%u bytes of simulated Host memory available.\n", len);
+    printf("Virtual (Host-side) address: %p\n\n", (void *) sim_host_mem);
+
+    // Like on the real PRU, the first 8 bytes of data RAM hold the host buffer address and length
+    memset((void *) sim_pru_mem, 0, sizeof(sim_pru_mem));
+    memset((void *) sim_pru0_mem, 0, sizeof(sim_pru0_mem));
+    sim_pru_mem[PRU_MEM_HOST_ADDR] = (uint32_t) (uintptr_t) sim_host_mem;
+    sim_pru_mem[PRU_MEM_HOST_LEN] = len;
+    sim_pending = 0;
+
+    *buf = sim_host_mem;
+    *buf_len = len;
+    return 0;
+}
+
+
+static int sim_load(const pru_config_t * config)
+{
+    const unsigned int used_len = config -> periods * config -> period_frames * 4 * config -> nchan;
+    const int dual = config -> nchan == PRU_DUAL_NCHAN;
+    if (config -> nchan == 0 || (config -> nchan > CIC_MAX_CHAN && !dual) || config -> decimation == 0
+        || config -> decimation > SIM_MAX_DECIMATION || config -> period_frames == 0 || used_len > sim_host_mem_len) {
+        fprintf(stderr, "Error! Invalid simulated PRU configuration.\n");
+        return -1;
+    }
+    sim_nchan = config -> nchan;
+    sim_decimation = config -> decimation;
+    sim_period_frames = config -> period_frames;
+    sim_sample_rate = PRU_PDM_CLOCK_HZ / config -> decimation;
+    sim_mid = 1;
+    for (unsigned int s = 0; s < SIM_CIC_ORDER; ++s) {
+        sim_mid *= config -> decimation;
+    }
+    sim_mid /= 2;
+
+    sim_ncic = dual ? 2 : 1;
+    if (sim_config.signal == PRU_SIM_SIGNAL_PDM) {
+        for (unsigned int k = 0; k < sim_ncic; ++k) {
+            if (cic_init(&sim_cic[k], sim_nchan / sim_ncic, sim_decimation)) {
+                return -1;
+            }
+        }
+        // Same tones as the sine signal
+        for (unsigned int c = 0; c < sim_nchan; ++c) {
+            pdm_init(&sim_pdm_gen[c], SIM_SINE_FREQ, 0.5, 0.0, PRU_PDM_CLOCK_HZ);
+            sim_pdm_gen[c].phase = c * M_PI / 3;
+        }
+    }
+
+    // Like load_program, pass the configuration through the data RAM, only the periods are used. With both PRUs,
+    // each one gets half of the channels and of the buffer.
+    const unsigned int ndram = dual ? 2 : 1;
+    volatile uint32_t * const drams[2] = { sim_pru_mem, sim_pru0_mem };
+    for (unsigned int k = 0; k < ndram; ++k) {
+        drams[k][PRU_MEM_HOST_LEN] = used_len / ndram;
+        drams[k][PRU_MEM_DECIMATION] = config -> decimation;
+        drams[k][PRU_MEM_NCHAN] = config -> nchan / ndram;
+        drams[k][PRU_MEM_PERIOD] = config -> period_frames;
+    }
+    sim_pru_mem[PRU_MEM_SYNC] = dual;
+
+    printf("Starting simulated PRU (%u channels at %u Hz, periods of %u frames, speed %g)\n", sim_nchan, sim_sample_rate,
+           sim_period_frames, sim_config.speed);
+    sim_running = 1;
+    if (pthread_create(&sim_thread, NULL, sim_routine, NULL)) {
+        fprintf(stderr, "Error! Simulated PRU thread could not be created.\n");
+        sim_running = 0;
+        return -1;
+    }
+    sim_thread_started = 1;
+    return 0;
+}
+
+
+static int sim_wait_event(unsigned int evt)
+{
+    (void) evt;
+    pthread_mutex_lock(&sim_mutex);
+    while (!sim_pending && sim_running) {
+        pthread_cond_wait(&sim_cond, &sim_mutex);
+    }
+    const int ret = sim_pending ? 0 : -1;
+    sim_pending = 0;
+    pthread_mutex_unlock(&sim_mutex);
+    return ret;
+}
+
+
+static uint32_t sim_sequence(void)
+{
+    // Like read_sequence, only the periods written by both PRUs are complete
+    const uint32_t sequence = sim_pru_mem[PRU_MEM_SEQUENCE];
+    if (sim_nchan != PRU_DUAL_NCHAN) {
+        return sequence;
+    }
+    const uint32_t sequence0 = sim_pru0_mem[PRU_MEM_SEQUENCE];
+    return (int32_t) (sequence0 - sequence) < 0 ? sequence0 : sequence;
+}
+
+
+static void sim_wake(void)
+{
+    // Stopping the producer also wakes up the waiting thread
+    pthread_mutex_lock(&sim_mutex);
+    sim_running = 0;
+    pthread_cond_broadcast(&sim_cond);
+    pthread_mutex_unlock(&sim_mutex);
+}
+
+
+static void sim_stop(void)
+{
+    sim_wake();
+
+    if (sim_thread_started) {
+        pthread_join(sim_thread, NULL);
+        sim_thread_started = 0;
+    }
+}
+
+
+const pru_backend_t pru_backend_sim = {
+    .name = "sim",
+    .init = sim_init,
+    .load = sim_load,
+    .wait_event = sim_wait_event,
+    .sequence = sim_sequence,
+    .wake = sim_wake,
+    .stop = sim_stop,
+};
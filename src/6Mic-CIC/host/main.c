@@ -10,50 +10,65 @@
 #include <time.h>
 #include "interface.h"
 
-#define OUTFILE "../output/interface.pcm"
+#define OUTFILE "../output/interface.wav"
 #define NSAMPLES 64000 * 1
 #define NCHANNELS 6
 
 int main(void) {
     printf("\nStarting testing program!\n");
 
-    printf("Open output PCM file...\n");
-    FILE * outfile = fopen(OUTFILE, "w");
-    if (outfile == NULL) {
-        fprintf(stderr, "Error: Could not open output PCM file.\n");
-        return 1;
-    }
-
-    void * tmp_buffer = calloc(NSAMPLES, NCHANNELS * SAMPLE_SIZE_BYTES);
-    if (tmp_buffer == NULL) {
-        fprintf(stderr, "Error: Could not allocate enough memory for the testing buffer.\n");
-        fclose(outfile);
-        return 1;
-    }
-
     printf("Initialize PRU processing...\n");
-    pcm_t * pcm = pru_processing_init();
+    const pcm_config_t config = PCM_CONFIG_DEFAULT;
+    pcm_t * pcm = pru_processing_init(&config);
     if (pcm == NULL) {
-        free(tmp_buffer);
-        fclose(outfile);
         return 1;
     }
 
-    struct timespec delay = { 0, 250000000 };  // Wait 250 ms
     const size_t limit = 35;
+    printf("Open output WAV file...\n");
+    const recorder_config_t rec_config = {
+        .chan_mask = (1 << NCHANNELS) - 1,
+        .format = PCM_FORMAT_S24,
+        .per_channel = 0,
+        .buffer_frames = 0,
+        .prealloc_frames = limit * NSAMPLES / 4,
+    };
+    recorder_t * recorder = pcm_recorder_open(pcm, OUTFILE, &rec_config);
+    if (recorder == NULL) {
+        pru_processing_close(pcm);
+        return 1;
+    }
+
     enable_recording();
-        nanosleep(&delay, NULL);
         for (size_t i = 0; i < limit; ++i) {
-            nanosleep(&delay, NULL);
-            size_t read = pcm_read(pcm, tmp_buffer, 16500, NCHANNELS);
-            fwrite(tmp_buffer, NCHANNELS * SAMPLE_SIZE_BYTES, read, outfile);
+            // Block until 250 ms of audio are available, for at most 1 s, the recorder writes them in the background
+            pcm_record(pcm, recorder, NSAMPLES / 4, 1000);
             printf("Buffer size : %zu, max = %zu\n", pcm_buffer_length(), pcm_buffer_maxlength());
             printf("Read : %zu/%zu\n", i, limit);
         }
     disable_recording();
 
+    recorder_stats_t rec_stats;
+    recorder_get_stats(recorder, &rec_stats);
+    printf("Frames written : %" PRIu64 ", writer lag : %" PRIu64 " (max %" PRIu64 "), stalls : %" PRIu64 "\n",
+           rec_stats.frames_written, rec_stats.lag_frames, rec_stats.max_lag_frames, rec_stats.stalls);
+    if (recorder_close(recorder)) {
+        fprintf(stderr, "Error: The recording is incomplete.\n");
+    }
+
+    pcm_stats_t stats;
+    pcm_get_stats(pcm, &stats);
+    printf("Periods received : %" PRIu64 ", lost : %" PRIu64 ", frames overwritten : %" PRIu64 ", dropped : %" PRIu64
+           ", underflows : %" PRIu64 "\n",
+           stats.periods_received, stats.periods_lost, stats.frames_overwritten, stats.frames_dropped, stats.underflows);
+
+    pcm_timing_t timing;
+    pcm_get_timing(pcm, &timing);
+    printf("Events : %" PRIu64 ", interval : %.0f/%.0f/%.0f us (min/mean/max, period %.0f us), max lateness : %.0f us\n",
+           timing.events, timing.min_interval_us, timing.mean_interval_us, timing.max_interval_us, timing.period_us,
+           timing.max_lateness_us);
+
     printf("Closing PRU processing...\n");
-    fclose(outfile);
-    free(tmp_buffer);
+    pru_processing_close(pcm);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,44 @@
+/**
+ * @brief Sigma-delta PDM tone generator. Headers in pdm.h.
+ *
+ * @author Loïc Droz <lk.droz@gmail.com>
+ *
+ */
+
+#include <math.h>
+#include "pdm.h"
+
+
+void pdm_init(pdm_gen_t * gen, double freq, double amplitude, double offset, double pdm_rate)
+{
+    const double peak = fabs(amplitude) + fabs(offset);
+    const double clamp = peak > PDM_MAX_AMPLITUDE ? PDM_MAX_AMPLITUDE / peak : 1.0;
+
+    gen -> phase = 0.0;
+    gen -> phase_step = 2 * M_PI * freq / pdm_rate;
+    gen -> amplitude = amplitude * clamp;
+    gen -> offset = offset * clamp;
+    gen -> int1 = 0.0;
+    gen -> int2 = 0.0;
+    gen -> last = -1.0;
+}
+
+
+void pdm_generate(pdm_gen_t * gen, uint8_t * pdm, size_t nbits, unsigned int chan)
+{
+    const uint8_t mask = (uint8_t) (1u << chan);
+    for (size_t i = 0; i < nbits; ++i) {
+        const double x = gen -> offset + gen -> amplitude * sin(gen -> phase);
+        gen -> phase += gen -> phase_step;
+        if (gen -> phase > 2 * M_PI) {
+            gen -> phase -= 2 * M_PI;
+        }
+
+        // Two integrators in cascade, both fed back with the quantized output
+        gen -> int1 += x - gen -> last;
+        gen -> int2 += gen -> int1 - gen -> last;
+        gen -> last = gen -> int2 >= 0 ? 1.0 : -1.0;
+
+        pdm[i] = gen -> last > 0 ? (pdm[i] | mask) : (pdm[i] & ~mask);
+    }
+}
@@ -0,0 +1,54 @@
+/**
+ * @brief Second order sigma-delta modulator generating PDM test tones, like the output of a PDM microphone.
+ *        The PDM bits go to the input format of the software CIC decimator, see cic.h.
+ *
+ * @author Loïc Droz <lk.droz@gmail.com>
+ *
+ */
+
+#ifndef PDM_H
+#define PDM_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+// Max amplitude for which the second order modulator stays stable
+#define PDM_MAX_AMPLITUDE 0.7
+
+typedef struct {
+    // Phase of the sine and its increment per PDM period, in radians
+    double phase;
+    double phase_step;
+    // Amplitude and offset of the tone, as fractions of the full scale
+    double amplitude;
+    double offset;
+    // Integrators of the modulator, and last output (+1 or -1)
+    double int1;
+    double int2;
+    double last;
+} pdm_gen_t;
+
+/**
+ * @brief Initialize a PDM tone generator.
+ *
+ * @param gen The generator to initialize.
+ * @param freq The frequency of the tone in Hz.
+ * @param amplitude The amplitude of the tone, as a fraction of the full scale. The sum of the amplitude and offset
+ *        is clamped to PDM_MAX_AMPLITUDE.
+ * @param offset A constant added to the tone, as a fraction of the full scale.
+ * @param pdm_rate The PDM clock frequency in Hz.
+ */
+void pdm_init(pdm_gen_t * gen, double freq, double amplitude, double offset, double pdm_rate);
+
+/**
+ * @brief Generate PDM bits for one channel. Only the bit of that channel is modified in the output bytes,
+ *        so that several generators can fill the channels of the same buffer.
+ *
+ * @param gen The generator.
+ * @param pdm The PDM bytes, one per clock period.
+ * @param nbits The number of clock periods to generate.
+ * @param chan The channel, bit of the PDM bytes, to write.
+ */
+void pdm_generate(pdm_gen_t * gen, uint8_t * pdm, size_t nbits, unsigned int chan);
+
+#endif
@@ -0,0 +1,601 @@
+/**
+ * @brief Instruction set simulator of a PRU. Headers in pru_isa.h.
+ *
+ *        Formats of the instructions, from the top bits:
+ *        ALU          000 op(4) io op2(8) rs1(8) rd(8)
+ *        Others       001 subop(4) ..., JMP/JAL/LDI with a 16 bits immediate in bits 23-8, XFR below
+ *        XIN/XOUT     0010111 op(2) device(8) 0 len-1(7) rdb(2) rd(5)
+ *        QBxx         01 test(3) off[9:8] io op2(8) rs1(8) off[7:0]
+ *        LBCO/SBCO    100 load len[6:4] io ro(8) len[3:1] cb(5) len[0] rdb(2) rd(5)
+ *        QBBC/QBBS    110 test(2) off[9:8] io op2(8) rs1(8) off[7:0]
+ *        LBBO/SBBO    111 load len[6:4] io ro(8) len[3:1] rb(5) len[0] rdb(2) rd(5)
+ *        A register field is sel(3) reg(5), sel 0-3 for .b0-.b3, 4-6 for .w0-.w2 and 7 for the whole register.
+ *
+ * @author Loïc Droz <lk.droz@gmail.com>
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "pru_isa.h"
+
+// Operations of the ALU format
+enum { ALU_ADD, ALU_ADC, ALU_SUB, ALU_SUC, ALU_LSL, ALU_LSR, ALU_RSB, ALU_RSC,
+       ALU_AND, ALU_OR, ALU_XOR, ALU_NOT, ALU_MIN, ALU_MAX, ALU_CLR, ALU_SET };
+// Sub-operations of the 001 format
+enum { OP_JMP = 0, OP_JAL = 1, OP_LDI = 2, OP_LMBD = 3, OP_HALT = 5, OP_XFR = 7, OP_SLP = 15 };
+// Operations of XFR
+enum { XFR_XIN = 1, XFR_XOUT = 2, XFR_XCHG = 3 };
+// Tests of QBxx, op2 compared to rs1, and of QBBC/QBBS
+#define QB_GT 1
+#define QB_EQ 2
+#define QB_LT 4
+#define QBB_BC 1
+#define QBB_BS 2
+// Burst lengths 124 to 127 give the length in r0.b0 to r0.b3
+#define BURST_LEN_R0 124
+// Reset value of SYSCFG: STANDBY_INIT set, the host memory is not accessible yet
+#define SYSCFG_RESET 0x1a
+
+static const char * alu_names[16] = {
+    "ADD", "ADC", "SUB", "SUC", "LSL", "LSR", "RSB", "RSC", "AND", "OR", "XOR", "NOT", "MIN", "MAX", "CLR", "SET"
+};
+static const char * qb_names[8] = { "QBNONE", "QBGT", "QBEQ", "QBGE", "QBLT", "QBNE", "QBLE", "QBA" };
+
+// Constant table of PRU1, C24 and C25 pointing to its own data RAM and to the one of PRU0
+static const uint32_t constants[32] = {
+    0x00020000, 0x48040000, 0x4802a000, 0x00030000, 0x00026000, 0x48060000, 0x48030000, 0x00028000,
+    0x46000000, 0x4a100000, 0x48318000, 0x48022000, 0x48024000, 0x48310000, 0x481cc000, 0x481d0000,
+    0x481a0000, 0x4819c000, 0x48300000, 0x48302000, 0x48304000, 0x00032400, 0x480c8000, 0x480ca000,
+    PRU_ISA_DRAM_ADDR, PRU_ISA_OTHER_DRAM_ADDR, 0x0002e000, 0x00032000, PRU_ISA_SHARED_ADDR, 0x49000000,
+    0x40000000, 0x80000000,
+};
+
+
+void pru_isa_init(pru_cpu_t * cpu, const pru_isa_timing_t * timing, pru_isa_pins_t pins, pru_isa_event_t on_event,
+                  void * ctx)
+{
+    const pru_isa_timing_t default_timing = PRU_ISA_TIMING_DEFAULT;
+    memset(cpu, 0, sizeof(pru_cpu_t));
+    cpu -> timing = timing != NULL ? *timing : default_timing;
+    cpu -> pins = pins;
+    cpu -> on_event = on_event;
+    cpu -> ctx = ctx;
+    cpu -> cfg[PRU_ISA_CFG_SYSCFG] = SYSCFG_RESET;
+    cpu -> other = cpu -> other_dram;
+}
+
+
+void pru_isa_link(pru_cpu_t * pru0, pru_cpu_t * pru1)
+{
+    pru0 -> other = pru1 -> dram;
+    pru1 -> other = pru0 -> dram;
+}
+
+
+int pru_isa_load(pru_cpu_t * cpu, const char * path)
+{
+    FILE * file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Error! Could not open the firmware %s.\n", path);
+        return -1;
+    }
+    uint8_t word[4];
+    size_t n = 0;
+    while (fread(word, 1, 4, file) == 4) {
+        if (n == PRU_ISA_IRAM_WORDS) {
+            fprintf(stderr, "Error! The firmware %s does not fit in the instruction RAM.\n", path);
+            fclose(file);
+            return -1;
+        }
+        cpu -> iram[n++] = word[0] | (word[1] << 8) | (word[2] << 16) | ((uint32_t) word[3] << 24);
+    }
+    fclose(file);
+    cpu -> program_len = n;
+    cpu -> pc = 0;
+    return n == 0;
+}
+
+
+void pru_isa_map_host(pru_cpu_t * cpu, uint8_t * mem, uint32_t addr, size_t len)
+{
+    cpu -> host = mem;
+    cpu -> host_addr = addr;
+    cpu -> host_len = len;
+}
+
+
+static int fault(pru_cpu_t * cpu, const char * what, uint32_t value)
+{
+    fprintf(stderr, "Error! PRU fault at pc %u, cycle %" PRIu64 ": %s 0x%08x.\n", cpu -> pc, cpu -> cycles, what, value);
+    cpu -> fault = 1;
+    cpu -> halted = 1;
+    return -1;
+}
+
+
+static uint32_t read_pins(pru_cpu_t * cpu, uint64_t * next)
+{
+    *next = UINT64_MAX;
+    if (cpu -> pins == NULL) {
+        return 0;
+    }
+    return cpu -> pins(cpu -> ctx, cpu -> cycles, next) & PRU_ISA_R31_PINS;
+}
+
+
+static unsigned int field_width(unsigned int field)
+{
+    const unsigned int sel = field >> 5;
+    return sel < 4 ? 8 : (sel < 7 ? 16 : 32);
+}
+
+
+static unsigned int field_shift(unsigned int field)
+{
+    const unsigned int sel = field >> 5;
+    return sel < 4 ? 8 * sel : (sel < 7 ? 8 * (sel - 4) : 0);
+}
+
+
+static uint32_t reg_read(pru_cpu_t * cpu, unsigned int field)
+{
+    uint64_t next;
+    const unsigned int reg = field & 31;
+    const uint32_t value = reg == 31 ? read_pins(cpu, &next) : cpu -> regs[reg];
+    const uint32_t mask = (uint32_t) ((1ULL << field_width(field)) - 1);
+    return (value >> field_shift(field)) & mask;
+}
+
+
+static void reg_write(pru_cpu_t * cpu, unsigned int field, uint32_t value)
+{
+    const unsigned int reg = field & 31;
+    const unsigned int shift = field_shift(field);
+    const uint32_t mask = (uint32_t) ((1ULL << field_width(field)) - 1) << shift;
+    if (reg != 31) {
+        cpu -> regs[reg] = (cpu -> regs[reg] & ~mask) | ((value << shift) & mask);
+        return;
+    }
+    // Writes to r31 do not stick, they raise an event if the strobe bit is set
+    cpu -> regs[31] = (value << shift) & mask;
+    if ((cpu -> regs[31] >> PRU_ISA_R31_EVENT_STROBE) & 1) {
+        const unsigned int event = PRU_ISA_EVENT_BASE + (cpu -> regs[31] & 0xf);
+        cpu -> events += 1;
+        if (cpu -> on_event != NULL) {
+            cpu -> on_event(cpu -> ctx, event, cpu -> cycles);
+        }
+    }
+}
+
+
+// Operand 2 of the instruction: an 8 bits immediate, or a register field
+static uint32_t op2_read(pru_cpu_t * cpu, uint32_t instr)
+{
+    const unsigned int op2 = (instr >> 16) & 0xff;
+    return (instr >> 24) & 1 ? op2 : reg_read(cpu, op2);
+}
+
+
+static uint8_t reg_byte(const pru_cpu_t * cpu, unsigned int n)
+{
+    return (uint8_t) (cpu -> regs[n / 4] >> (8 * (n % 4)));
+}
+
+
+static void set_reg_byte(pru_cpu_t * cpu, unsigned int n, uint8_t byte)
+{
+    const unsigned int shift = 8 * (n % 4);
+    cpu -> regs[n / 4] = (cpu -> regs[n / 4] & ~(0xffu << shift)) | ((uint32_t) byte << shift);
+}
+
+
+// Locate len bytes at addr in the memory map, NULL if they are not all mapped in the same memory
+static uint8_t * mem_map(pru_cpu_t * cpu, uint32_t addr, size_t len, int * host)
+{
+    *host = 0;
+    if (addr >= PRU_ISA_DRAM_ADDR && addr + len <= PRU_ISA_DRAM_ADDR + PRU_ISA_DRAM_LEN) {
+        return &(cpu -> dram[addr - PRU_ISA_DRAM_ADDR]);
+    }
+    if (addr >= PRU_ISA_OTHER_DRAM_ADDR && addr + len <= PRU_ISA_OTHER_DRAM_ADDR + PRU_ISA_DRAM_LEN) {
+        return &(cpu -> other[addr - PRU_ISA_OTHER_DRAM_ADDR]);
+    }
+    if (addr >= PRU_ISA_SHARED_ADDR && addr + len <= PRU_ISA_SHARED_ADDR + PRU_ISA_SHARED_LEN) {
+        return &(cpu -> shared[addr - PRU_ISA_SHARED_ADDR]);
+    }
+    if (addr >= PRU_ISA_CFG_ADDR && addr + len <= PRU_ISA_CFG_ADDR + PRU_ISA_CFG_LEN) {
+        return &(cpu -> cfg[addr - PRU_ISA_CFG_ADDR]);
+    }
+    if (cpu -> host != NULL && addr >= cpu -> host_addr && (uint64_t) addr + len <= cpu -> host_addr + cpu -> host_len) {
+        *host = 1;
+        return &(cpu -> host[addr - cpu -> host_addr]);
+    }
+    return NULL;
+}
+
+
+// LBBO, SBBO, LBCO and SBCO, with the base address already resolved. Returns the cycles taken, 0 on a fault.
+static unsigned int burst(pru_cpu_t * cpu, uint32_t instr, uint32_t base)
+{
+    const int load = (instr >> 28) & 1;
+    const unsigned int len_field = (((instr >> 25) & 7) << 4) | (((instr >> 13) & 7) << 1) | ((instr >> 7) & 1);
+    const unsigned int len = len_field < BURST_LEN_R0 ? len_field + 1 : reg_byte(cpu, len_field - BURST_LEN_R0);
+    const unsigned int start = (instr & 31) * 4 + ((instr >> 5) & 3);
+    const uint32_t addr = base + op2_read(cpu, instr);
+    if (start + len > 4 * 32) {
+        fault(cpu, "burst past r31, length", len);
+        return 0;
+    }
+
+    int host;
+    uint8_t * mem = mem_map(cpu, addr, len, &host);
+    if (mem == NULL) {
+        fault(cpu, "access to unmapped memory at", addr);
+        return 0;
+    }
+    if (host && (cpu -> cfg[PRU_ISA_CFG_SYSCFG] >> PRU_ISA_SYSCFG_STANDBY_INIT) & 1) {
+        fault(cpu, "host memory access with the OCP master port disabled, at", addr);
+        return 0;
+    }
+    for (unsigned int i = 0; i < len; ++i) {
+        if (load) {
+            set_reg_byte(cpu, start + i, mem[i]);
+        } else {
+            mem[i] = reg_byte(cpu, start + i);
+        }
+    }
+
+    const pru_isa_timing_t * t = &(cpu -> timing);
+    const unsigned int words = (len + 3) / 4;
+    if (host) {
+        cpu -> host_bytes_written += load ? 0 : len;
+        return (load ? t -> host_load : t -> host_store) + words * t -> per_word;
+    }
+    return (load ? t -> local_load : t -> local_store) + words * t -> per_word;
+}
+
+
+// XIN, XOUT and XCHG with the scratchpad banks, ZERO and FILL. Returns non-zero on a fault.
+static int xfr(pru_cpu_t * cpu, uint32_t instr)
+{
+    const unsigned int op = (instr >> 23) & 3;
+    const unsigned int device = (instr >> 15) & 0xff;
+    const unsigned int len = ((instr >> 7) & 0x7f) + 1;
+    const unsigned int start = (instr & 31) * 4 + ((instr >> 5) & 3);
+    if (start + len > 4 * PRU_ISA_BANK_REGS) {
+        return fault(cpu, "transfer past r29, length", len);
+    }
+
+    if (op == XFR_XIN && (device == PRU_ISA_XFR_ZERO || device == PRU_ISA_XFR_FILL)) {
+        for (unsigned int i = 0; i < len; ++i) {
+            set_reg_byte(cpu, start + i, device == PRU_ISA_XFR_ZERO ? 0x00 : 0xff);
+        }
+        return 0;
+    }
+    if (op == 0 || device < PRU_ISA_BANK_FIRST || device >= PRU_ISA_BANK_FIRST + PRU_ISA_NBANKS) {
+        return fault(cpu, "unsupported transfer with device", device);
+    }
+
+    // With the shift enabled, register n of the PRU goes to register (n + r0.b0) mod 30 of the bank
+    uint8_t * bank = (uint8_t *) cpu -> banks[device - PRU_ISA_BANK_FIRST];
+    const unsigned int shift = (cpu -> cfg[PRU_ISA_CFG_SPP] >> PRU_ISA_SPP_XFR_SHIFT_EN) & 1 ? cpu -> regs[0] & 0xff : 0;
+    for (unsigned int i = 0; i < len; ++i) {
+        const unsigned int n = start + i;
+        uint8_t * byte = &bank[((n / 4 + shift) % PRU_ISA_BANK_REGS) * 4 + n % 4];
+        const uint8_t reg = reg_byte(cpu, n);
+        if (op != XFR_XOUT) {
+            set_reg_byte(cpu, n, *byte);
+        }
+        if (op != XFR_XIN) {
+            *byte = reg;
+        }
+    }
+    return 0;
+}
+
+
+static uint32_t alu(pru_cpu_t * cpu, uint32_t instr)
+{
+    const unsigned int op = (instr >> 25) & 0xf;
+    const uint64_t a = reg_read(cpu, (instr >> 8) & 0xff);
+    const uint64_t b = op2_read(cpu, instr);
+    const unsigned int width = field_width(instr & 0xff);
+    uint64_t r = 0;
+    switch (op) {
+        case ALU_ADD: r = a + b; break;
+        case ALU_ADC: r = a + b + cpu -> carry; break;
+        case ALU_SUB: r = a - b; break;
+        case ALU_SUC: r = a - b - cpu -> carry; break;
+        case ALU_RSB: r = b - a; break;
+        case ALU_RSC: r = b - a - cpu -> carry; break;
+        case ALU_LSL: r = a << (b & 31); break;
+        case ALU_LSR: r = a >> (b & 31); break;
+        case ALU_AND: r = a & b; break;
+        case ALU_OR: r = a | b; break;
+        case ALU_XOR: r = a ^ b; break;
+        case ALU_NOT: r = ~a; break;
+        case ALU_MIN: r = a < b ? a : b; break;
+        case ALU_MAX: r = a > b ? a : b; break;
+        case ALU_CLR: r = a & ~(1ULL << (b & 31)); break;
+        case ALU_SET: r = a | (1ULL << (b & 31)); break;
+    }
+    // Arithmetic operations set the carry, or the borrow, out of the destination
+    if (op <= ALU_SUC || op == ALU_RSB || op == ALU_RSC) {
+        cpu -> carry = (r >> width) & 1;
+    }
+    return (uint32_t) r;
+}
+
+
+// Left-most bit of value equal to bit, 32 if there is none
+static uint32_t lmbd(uint32_t value, unsigned int width, unsigned int bit)
+{
+    for (int n = (int) width - 1; n >= 0; --n) {
+        if (((value >> n) & 1) == bit) {
+            return (uint32_t) n;
+        }
+    }
+    return 32;
+}
+
+
+static int32_t branch_offset(uint32_t instr)
+{
+    const int32_t offset = (int32_t) ((((instr >> 25) & 3) << 8) | (instr & 0xff));
+    return offset & 0x200 ? offset - 0x400 : offset;
+}
+
+
+int pru_isa_step(pru_cpu_t * cpu)
+{
+    if (cpu -> halted) {
+        return -1;
+    }
+    if (cpu -> pc >= cpu -> program_len) {
+        return fault(cpu, "jump out of the program, pc", cpu -> pc);
+    }
+
+    const uint32_t instr = cpu -> iram[cpu -> pc];
+    uint32_t next_pc = cpu -> pc + 1;
+    unsigned int cycles = 1;
+    cpu -> instructions += 1;
+
+    switch (instr >> 29) {
+        case 0:
+            reg_write(cpu, instr & 0xff, alu(cpu, instr));
+            break;
+
+        case 1:
+            switch ((instr >> 25) & 0xf) {
+                case OP_JAL:
+                    reg_write(cpu, instr & 0xff, cpu -> pc + 1);
+                    // fall through
+                case OP_JMP:
+                    next_pc = ((instr >> 24) & 1 ? instr >> 8 : reg_read(cpu, (instr >> 16) & 0xff)) & 0xffff;
+                    break;
+                case OP_LDI:
+                    reg_write(cpu, instr & 0xff, (instr >> 8) & 0xffff);
+                    break;
+                case OP_LMBD:
+                    reg_write(cpu, instr & 0xff, lmbd(reg_read(cpu, (instr >> 8) & 0xff), field_width((instr >> 8) & 0xff),
+                                                      op2_read(cpu, instr) & 1));
+                    break;
+                case OP_HALT:
+                    cpu -> halted = 1;
+                    next_pc = cpu -> pc;
+                    break;
+                case OP_XFR:
+                    if (xfr(cpu, instr)) {
+                        return -1;
+                    }
+                    break;
+                default:
+                    return fault(cpu, "unsupported instruction", instr);
+            }
+            break;
+
+        case 2:
+        case 3: {
+            const unsigned int test = (instr >> 27) & 7;
+            const uint32_t op2 = op2_read(cpu, instr);
+            const uint32_t rs1 = reg_read(cpu, (instr >> 8) & 0xff);
+            if (((test & QB_GT) && op2 > rs1) || ((test & QB_EQ) && op2 == rs1) || ((test & QB_LT) && op2 < rs1)) {
+                next_pc = cpu -> pc + branch_offset(instr);
+            }
+            break;
+        }
+
+        case 4:
+            cycles = burst(cpu, instr, constants[(instr >> 8) & 31]);
+            if (cycles == 0) {
+                return -1;
+            }
+            break;
+
+        case 6: {
+            const unsigned int test = (instr >> 27) & 3;
+            const unsigned int rs1 = (instr >> 8) & 0xff;
+            uint64_t next = UINT64_MAX;
+            const uint32_t value = (rs1 & 31) == 31 ? (read_pins(cpu, &next) >> field_shift(rs1)) : reg_read(cpu, rs1);
+            const unsigned int bit = (value >> (op2_read(cpu, instr) & 31)) & 1;
+            if ((test == QBB_BC && bit == 0) || (test == QBB_BS && bit == 1)) {
+                next_pc = cpu -> pc + branch_offset(instr);
+                // Waiting for a pin, nothing changes until the pins do
+                if (next_pc == cpu -> pc && next != UINT64_MAX && next > cpu -> cycles + 1) {
+                    cpu -> instructions += next - cpu -> cycles - 1;
+                    cycles = (unsigned int) (next - cpu -> cycles);
+                }
+            } else if (test != QBB_BC && test != QBB_BS) {
+                return fault(cpu, "unsupported instruction", instr);
+            }
+            break;
+        }
+
+        case 7:
+            cycles = burst(cpu, instr, cpu -> regs[(instr >> 8) & 31]);
+            if (cycles == 0) {
+                return -1;
+            }
+            break;
+
+        default:
+            return fault(cpu, "unsupported instruction", instr);
+    }
+
+    cpu -> cycles += cycles;
+    cpu -> pc = next_pc;
+    return cpu -> halted;
+}
+
+
+int pru_isa_run(pru_cpu_t * cpu, uint64_t until)
+{
+    while (cpu -> cycles < until) {
+        if (pru_isa_step(cpu)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+int pru_isa_wait_pin(uint32_t instr)
+{
+    const unsigned int test = (instr >> 27) & 3;
+    if (instr >> 29 != 6 || (test != QBB_BC && test != QBB_BS) || branch_offset(instr) != 0
+        || ((instr >> 8) & 31) != 31 || !((instr >> 24) & 1)) {
+        return -1;
+    }
+    return (int) (((instr >> 16) & 31) + field_shift((instr >> 8) & 0xff));
+}
+
+
+// Print a register field, e.g. r0.w2
+static void field_name(unsigned int field, char * buf, size_t len)
+{
+    const unsigned int sel = field >> 5;
+    if (sel == 7) {
+        snprintf(buf, len, "r%u", field & 31);
+    } else if (sel < 4) {
+        snprintf(buf, len, "r%u.b%u", field & 31, sel);
+    } else {
+        snprintf(buf, len, "r%u.w%u", field & 31, sel - 4);
+    }
+}
+
+
+static void op2_name(uint32_t instr, char * buf, size_t len)
+{
+    if ((instr >> 24) & 1) {
+        snprintf(buf, len, "%u", (instr >> 16) & 0xff);
+    } else {
+        field_name((instr >> 16) & 0xff, buf, len);
+    }
+}
+
+
+void pru_isa_disasm(uint32_t pc, uint32_t instr, char * buf, size_t len)
+{
+    char rd[16], rs1[16], op2[16];
+    field_name(instr & 0xff, rd, sizeof(rd));
+    field_name((instr >> 8) & 0xff, rs1, sizeof(rs1));
+    op2_name(instr, op2, sizeof(op2));
+    const unsigned int start = (instr & 31) * 4 + ((instr >> 5) & 3);
+    char burst_reg[16];
+    if (start % 4 == 0) {
+        snprintf(burst_reg, sizeof(burst_reg), "r%u", start / 4);
+    } else {
+        snprintf(burst_reg, sizeof(burst_reg), "r%u.b%u", start / 4, start % 4);
+    }
+    const unsigned int len_field = (((instr >> 25) & 7) << 4) | (((instr >> 13) & 7) << 1) | ((instr >> 7) & 1);
+    char burst_len[16];
+    if (len_field < BURST_LEN_R0) {
+        snprintf(burst_len, sizeof(burst_len), "%u", len_field + 1);
+    } else {
+        snprintf(burst_len, sizeof(burst_len), "r0.b%u", len_field - BURST_LEN_R0);
+    }
+
+    switch (instr >> 29) {
+        case 0:
+            if (((instr >> 25) & 0xf) == ALU_NOT) {
+                snprintf(buf, len, "NOT %s, %s", rd, rs1);
+            } else {
+                snprintf(buf, len, "%s %s, %s, %s", alu_names[(instr >> 25) & 0xf], rd, rs1, op2);
+            }
+            return;
+
+        case 1:
+            switch ((instr >> 25) & 0xf) {
+                case OP_JMP:
+                case OP_JAL: {
+                    char target[16];
+                    if ((instr >> 24) & 1) {
+                        snprintf(target, sizeof(target), "%u", (instr >> 8) & 0xffff);
+                    } else {
+                        field_name((instr >> 16) & 0xff, target, sizeof(target));
+                    }
+                    if (((instr >> 25) & 0xf) == OP_JMP) {
+                        snprintf(buf, len, "JMP %s", target);
+                    } else {
+                        snprintf(buf, len, "JAL %s, %s", rd, target);
+                    }
+                    return;
+                }
+                case OP_LDI:
+                    snprintf(buf, len, "LDI %s, %u", rd, (instr >> 8) & 0xffff);
+                    return;
+                case OP_LMBD:
+                    snprintf(buf, len, "LMBD %s, %s, %s", rd, rs1, op2);
+                    return;
+                case OP_HALT:
+                    snprintf(buf, len, "HALT");
+                    return;
+                case OP_XFR: {
+                    static const char * names[4] = { "XFR?", "XIN", "XOUT", "XCHG" };
+                    const unsigned int device = (instr >> 15) & 0xff;
+                    const unsigned int xfr_len = ((instr >> 7) & 0x7f) + 1;
+                    if (((instr >> 23) & 3) == XFR_XIN && device >= PRU_ISA_XFR_FILL) {
+                        snprintf(buf, len, "%s %s, %u", device == PRU_ISA_XFR_ZERO ? "ZERO" : "FILL", burst_reg, xfr_len);
+                    } else {
+                        snprintf(buf, len, "%s %u, %s, %u", names[(instr >> 23) & 3], device, burst_reg, xfr_len);
+                    }
+                    return;
+                }
+            }
+            break;
+
+        case 2:
+        case 3:
+            if (((instr >> 27) & 7) == (QB_GT | QB_EQ | QB_LT)) {
+                snprintf(buf, len, "QBA %d", (int) pc + branch_offset(instr));
+            } else {
+                snprintf(buf, len, "%s %d, %s, %s", qb_names[(instr >> 27) & 7], (int) pc + branch_offset(instr), rs1,
+                         op2);
+            }
+            return;
+
+        case 4:
+            snprintf(buf, len, "%s %s, C%u, %s, %s", (instr >> 28) & 1 ? "LBCO" : "SBCO", burst_reg, (instr >> 8) & 31,
+                     op2, burst_len);
+            return;
+
+        case 6:
+            if (branch_offset(instr) == 0 && (((instr >> 27) & 3) == QBB_BC || ((instr >> 27) & 3) == QBB_BS)) {
+                // Branching to itself while the bit is clear waits for it to be set
+                snprintf(buf, len, "%s %s, %s", ((instr >> 27) & 3) == QBB_BC ? "WBS" : "WBC", rs1, op2);
+                return;
+            }
+            if (((instr >> 27) & 3) == QBB_BC || ((instr >> 27) & 3) == QBB_BS) {
+                snprintf(buf, len, "%s %d, %s, %s", ((instr >> 27) & 3) == QBB_BC ? "QBBC" : "QBBS",
+                         (int) pc + branch_offset(instr), rs1, op2);
+                return;
+            }
+            break;
+
+        case 7:
+            snprintf(buf, len, "%s %s, r%u, %s, %s", (instr >> 28) & 1 ? "LBBO" : "SBBO", burst_reg, (instr >> 8) & 31,
+                     op2, burst_len);
+            return;
+    }
+    snprintf(buf, len, ".u32 0x%08x", instr);
+}
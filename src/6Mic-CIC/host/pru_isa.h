@@ -0,0 +1,211 @@
+/**
+ * @brief Instruction set simulator of a PRU, to check the timing and the output of the firmware (pru/pru1.asm)
+ *        on any Linux box, without a BeagleBone and an oscilloscope. Runs the binary image assembled by pasm,
+ *        gen/pru1.bin, with the memory map seen by PRU1: its data RAM, the data RAM of PRU0, the shared RAM,
+ *        the PRU-ICSS configuration registers, the scratchpad banks and the host buffer in DDR. The input pins
+ *        of r31 come from a callback, and the system events raised by writing r31 are passed to another one.
+ *        Two PRUs can be linked to see each other's data RAM, to run the firmwares of PRU0 and PRU1 together.
+ *
+ *        Covers the instructions the firmware uses: the ALU operations, LDI, LMBD, JMP/JAL, QBxx, QBBC/QBBS
+ *        (thus WBC/WBS), LBBO/SBBO, LBCO/SBCO, XIN/XOUT/XCHG with the scratchpad shift, ZERO/FILL and HALT.
+ *        Every instruction takes one cycle, but the memory accesses, whose cost is set by pru_isa_timing_t.
+ *
+ *        The encodings follow the PRU instruction set reference. When in doubt, compare pru_isa_disasm with
+ *        the listing of pasm -L.
+ *
+ * @author Loïc Droz <lk.droz@gmail.com>
+ *
+ */
+
+#ifndef PRU_ISA_H
+#define PRU_ISA_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+// Clock of the PRU cores
+#define PRU_ISA_CLOCK_HZ 200000000
+// Size of the instruction RAM of a PRU, in 32 bits words
+#define PRU_ISA_IRAM_WORDS 2048
+// Memory map of PRU1: its own data RAM, the data RAM of PRU0, the shared RAM and the configuration registers
+#define PRU_ISA_DRAM_ADDR 0x0
+#define PRU_ISA_DRAM_LEN 0x2000
+#define PRU_ISA_OTHER_DRAM_ADDR 0x2000
+#define PRU_ISA_SHARED_ADDR 0x10000
+#define PRU_ISA_SHARED_LEN 0x3000
+#define PRU_ISA_CFG_ADDR 0x26000
+#define PRU_ISA_CFG_LEN 0x100
+// Configuration registers used by the firmware: SYSCFG, whose STANDBY_INIT bit blocks the OCP master port
+// to the host memory, and SPP, whose XFR_SHIFT_EN bit enables the scratchpad shift
+#define PRU_ISA_CFG_SYSCFG 0x4
+#define PRU_ISA_SYSCFG_STANDBY_INIT 4
+#define PRU_ISA_CFG_SPP 0x34
+#define PRU_ISA_SPP_XFR_SHIFT_EN 1
+// Scratchpad banks, XIN/XOUT device ids BANK0 to BANK2, of 30 registers each
+#define PRU_ISA_BANK_FIRST 10
+#define PRU_ISA_NBANKS 3
+#define PRU_ISA_BANK_REGS 30
+// Pseudo devices of XIN, used by ZERO and FILL
+#define PRU_ISA_XFR_ZERO 255
+#define PRU_ISA_XFR_FILL 254
+// r31: the input pins when read, bits 0 to 29, and the system events when written, bit 5 and the event - 16
+#define PRU_ISA_R31_PINS 0x3fffffff
+#define PRU_ISA_R31_EVENT_STROBE 5
+#define PRU_ISA_EVENT_BASE 16
+
+/**
+ * @brief Cost of the memory accesses in cycles. An access of n bytes takes load or store + ceil(n / 4) * per_word
+ *        cycles, with the values for the PRU-ICSS memories or for the host memory, through the OCP master port.
+ *        Writes to the host memory are posted, reads wait for the DDR. Only estimates, measure on the PRU when
+ *        the margin is small.
+ *
+ */
+typedef struct {
+    unsigned int local_load;
+    unsigned int local_store;
+    unsigned int host_load;
+    unsigned int host_store;
+    unsigned int per_word;
+} pru_isa_timing_t;
+
+#define PRU_ISA_TIMING_DEFAULT { \
+    .local_load = 2, \
+    .local_store = 1, \
+    .host_load = 40, \
+    .host_store = 1, \
+    .per_word = 1, \
+}
+
+/**
+ * @brief Get the value of the input pins of r31 at a cycle.
+ *
+ * @param ctx The context given to pru_isa_init.
+ * @param cycle The cycle at which r31 is read.
+ * @param next Receives the first cycle at which the pins may change, so that waiting for a pin can be skipped.
+ * @return uint32_t The pins, bit n for r31 bit n.
+ */
+typedef uint32_t (*pru_isa_pins_t)(void * ctx, uint64_t cycle, uint64_t * next);
+
+/**
+ * @brief Called when the firmware raises a system event by writing r31.
+ *
+ * @param ctx The context given to pru_isa_init.
+ * @param event The system event, 16 to 31.
+ * @param cycle The cycle at which it was raised.
+ */
+typedef void (*pru_isa_event_t)(void * ctx, unsigned int event, uint64_t cycle);
+
+typedef struct {
+    // Registers r0 to r31, r31 holding the last value written, the carry and the program counter, in words
+    uint32_t regs[32];
+    int carry;
+    uint32_t pc;
+    // Scratchpad banks
+    uint32_t banks[PRU_ISA_NBANKS][PRU_ISA_BANK_REGS];
+    // Program loaded in the instruction RAM
+    uint32_t iram[PRU_ISA_IRAM_WORDS];
+    size_t program_len;
+    // Data memories and configuration registers. The data RAM of the other PRU is other_dram, or the dram of the
+    // PRU given to pru_isa_link.
+    uint8_t dram[PRU_ISA_DRAM_LEN];
+    uint8_t other_dram[PRU_ISA_DRAM_LEN];
+    uint8_t * other;
+    uint8_t shared[PRU_ISA_SHARED_LEN];
+    uint8_t cfg[PRU_ISA_CFG_LEN];
+    // Host memory, at its physical address
+    uint8_t * host;
+    uint32_t host_addr;
+    size_t host_len;
+    // Counters since pru_isa_init
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t host_bytes_written;
+    uint64_t events;
+    // Non-zero once a HALT was run, or after an invalid instruction or access
+    int halted;
+    int fault;
+    pru_isa_timing_t timing;
+    pru_isa_pins_t pins;
+    pru_isa_event_t on_event;
+    void * ctx;
+} pru_cpu_t;
+
+/**
+ * @brief Reset a PRU: all registers and memories zeroed, configuration registers at their reset values,
+ *        no program and no host memory.
+ *
+ * @param cpu The PRU.
+ * @param timing The cost of the memory accesses, NULL for PRU_ISA_TIMING_DEFAULT.
+ * @param pins The callback giving the input pins, NULL to read them as 0.
+ * @param on_event The callback called on each system event, may be NULL.
+ * @param ctx The context passed to the callbacks.
+ */
+void pru_isa_init(pru_cpu_t * cpu, const pru_isa_timing_t * timing, pru_isa_pins_t pins, pru_isa_event_t on_event,
+                  void * ctx);
+
+/**
+ * @brief Let two PRUs access each other's data RAM at PRU_ISA_OTHER_DRAM_ADDR, like PRU0 and PRU1 of the PRU-ICSS.
+ *        Both must have been initialized.
+ *
+ * @param pru0 The first PRU.
+ * @param pru1 The second PRU.
+ */
+void pru_isa_link(pru_cpu_t * pru0, pru_cpu_t * pru1);
+
+/**
+ * @brief Load a binary image assembled by pasm -b (little endian 32 bits words) at address 0 of the instruction RAM.
+ *
+ * @param cpu The PRU.
+ * @param path The path of the image, e.g. gen/pru1.bin.
+ * @return int 0 in case of success, non-zero otherwise.
+ */
+int pru_isa_load(pru_cpu_t * cpu, const char * path);
+
+/**
+ * @brief Map the host memory, which the PRU accesses at its physical address through the OCP master port.
+ *
+ * @param cpu The PRU.
+ * @param mem The memory, owned by the caller.
+ * @param addr Its physical address, as passed to the firmware.
+ * @param len Its length in bytes.
+ */
+void pru_isa_map_host(pru_cpu_t * cpu, uint8_t * mem, uint32_t addr, size_t len);
+
+/**
+ * @brief Run a single instruction. Spinning on a pin of r31 (WBS/WBC) is skipped to the next change of the pins,
+ *        with the cycles it takes on the PRU.
+ *
+ * @param cpu The PRU.
+ * @return int 0 in case of success, non-zero once the PRU halted or faulted.
+ */
+int pru_isa_step(pru_cpu_t * cpu);
+
+/**
+ * @brief Run until the given cycle, or until the PRU halts or faults.
+ *
+ * @param cpu The PRU.
+ * @param until The cycle at which to stop, the last instruction may end a few cycles after it.
+ * @return int 0 if the cycle was reached, non-zero if the PRU halted or faulted.
+ */
+int pru_isa_run(pru_cpu_t * cpu, uint64_t until);
+
+/**
+ * @brief Tell whether an instruction waits for a pin of r31 like WBS and WBC do: a QBBC or QBBS on r31 branching
+ *        to itself.
+ *
+ * @param instr The instruction.
+ * @return int The pin waited for, -1 if it is another instruction.
+ */
+int pru_isa_wait_pin(uint32_t instr);
+
+/**
+ * @brief Disassemble an instruction, in the syntax of pasm, with the targets of the branches as addresses.
+ *
+ * @param pc The address of the instruction, in words.
+ * @param instr The instruction.
+ * @param buf The buffer to which the text is written.
+ * @param len The length of the buffer.
+ */
+void pru_isa_disasm(uint32_t pc, uint32_t instr, char * buf, size_t len);
+
+#endif
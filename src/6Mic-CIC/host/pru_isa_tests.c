@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pru_isa.h"
+
+// Register fields: whole register, byte and word
+#define R(n) (0xe0 | (n))
+#define B(n, b) (((b) << 5) | (n))
+#define W(n, w) (((4 + (w)) << 5) | (n))
+#define HALT 0x2a000000
+#define HOST_ADDR 0x80001000
+#define HOST_LEN 256
+#define CLK_PIN 11
+#define CLK_CYCLE 1000
+
+static pru_cpu_t cpu;
+static pru_cpu_t peer;
+static uint8_t host[HOST_LEN];
+static unsigned int last_event;
+
+
+static uint32_t alu(unsigned int op, unsigned int rd, unsigned int rs1, unsigned int op2, int imm)
+{
+    return (op << 25) | ((imm ? 1u : 0u) << 24) | (op2 << 16) | (rs1 << 8) | rd;
+}
+
+
+static uint32_t ldi(unsigned int rd, unsigned int imm)
+{
+    return (1u << 29) | (2u << 25) | (imm << 8) | rd;
+}
+
+
+static uint32_t branch(int offset)
+{
+    const uint32_t off = (uint32_t) offset & 0x3ff;
+    return ((off >> 8) << 25) | (off & 0xff);
+}
+
+
+// QBxx with an immediate op2, test 5 for QBNE
+static uint32_t qb(unsigned int test, int offset, unsigned int rs1, unsigned int imm)
+{
+    return (1u << 30) | (test << 27) | (1u << 24) | (imm << 16) | (rs1 << 8) | branch(offset);
+}
+
+
+// LBBO/SBBO or LBCO/SBCO, from the register byte rd_byte, with an immediate offset
+static uint32_t burst(int constant, int load, unsigned int rd_byte, unsigned int base, unsigned int offset,
+                      unsigned int len)
+{
+    const uint32_t l = len - 1;
+    return ((constant ? 4u : 7u) << 29) | ((uint32_t) load << 28) | (((l >> 4) & 7) << 25) | (1u << 24) | (offset << 16)
+           | (((l >> 1) & 7) << 13) | (base << 8) | ((l & 1) << 7) | ((rd_byte % 4) << 5) | (rd_byte / 4);
+}
+
+
+// XIN (1), XOUT (2) or XCHG (3) of len bytes from register rd
+static uint32_t xfr(unsigned int op, unsigned int device, unsigned int rd, unsigned int len)
+{
+    return (0x17u << 25) | (op << 23) | (device << 15) | ((len - 1) << 7) | rd;
+}
+
+
+// WBS or WBC on r31
+static uint32_t wait(int set, unsigned int pin)
+{
+    return (6u << 29) | ((set ? 1u : 2u) << 27) | (1u << 24) | (pin << 16) | (R(31) << 8);
+}
+
+
+static void load(const uint32_t * program, size_t n)
+{
+    memcpy(cpu.iram, program, n * sizeof(uint32_t));
+    cpu.program_len = n;
+    cpu.pc = 0;
+}
+
+
+// The clock pin goes high at CLK_CYCLE
+static uint32_t pins(void * ctx, uint64_t cycle, uint64_t * next)
+{
+    (void) ctx;
+    *next = cycle < CLK_CYCLE ? CLK_CYCLE : UINT64_MAX;
+    return cycle < CLK_CYCLE ? 0 : 1u << CLK_PIN;
+}
+
+
+static void on_event(void * ctx, unsigned int event, uint64_t cycle)
+{
+    (void) ctx;
+    (void) cycle;
+    last_event = event;
+}
+
+
+int main(void) {
+    printf("\nSTARTING PRU SIMULATOR TESTING PROGRAM!\n");
+
+    printf("TEST: ALU operations write the selected part of the register and set the carry: ");
+    pru_isa_init(&cpu, NULL, NULL, NULL, NULL);
+    const uint32_t arith[] = {
+        ldi(R(1), 0xffff), ldi(W(1, 1), 0xabcd),  // r1 = 0x00abcdff
+        alu(0, B(1, 0), B(1, 0), 2, 1),           // r1.b0 = 0xff + 2, carry out
+        alu(1, R(2), R(2), 0, 1),                 // r2 = carry
+        alu(5, R(3), R(1), 8, 1),                 // r3 = r1 >> 8
+        alu(15, R(4), R(4), 31, 1),               // r4 |= 1 << 31
+        HALT,
+    };
+    load(arith, sizeof(arith) / sizeof(arith[0]));
+    pru_isa_run(&cpu, 100);
+    if (cpu.halted && !cpu.fault && cpu.regs[1] == 0x00abcd01 && cpu.regs[2] == 1 && cpu.regs[3] == 0x0000abcd
+        && cpu.regs[4] == 0x80000000 && cpu.cycles == 7) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! r1 0x%08x, r2 %u, %" PRIu64 " cycles\n", cpu.regs[1], cpu.regs[2], cpu.cycles);
+    }
+
+    printf("TEST: A delay loop of QBNE takes 2 cycles per iteration: ");
+    pru_isa_init(&cpu, NULL, NULL, NULL, NULL);
+    const uint32_t delay[] = { ldi(W(0, 2), 11), alu(2, W(0, 2), W(0, 2), 1, 1), qb(5, -1, W(0, 2), 0), HALT };
+    load(delay, sizeof(delay) / sizeof(delay[0]));
+    pru_isa_run(&cpu, 100);
+    if (cpu.halted && cpu.cycles == 1 + 2 * 11 + 1 && cpu.regs[0] == 0) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! %" PRIu64 " cycles\n", cpu.cycles);
+    }
+
+    printf("TEST: The host memory is only written once the OCP master port is enabled, with the burst cost: ");
+    pru_isa_init(&cpu, NULL, NULL, NULL, NULL);
+    pru_isa_map_host(&cpu, host, HOST_ADDR, HOST_LEN);
+    memset(host, 0, sizeof(host));
+    cpu.regs[27] = HOST_ADDR;
+    cpu.regs[23] = 0x11111111;
+    cpu.regs[24] = 0x22222222;
+    cpu.regs[25] = 0x33333333;
+    const uint32_t store[] = { burst(0, 0, 23 * 4, 27, 16, 12), HALT };
+    load(store, 2);
+    const int faulted = pru_isa_run(&cpu, 100) != 0 && cpu.fault && host[16] == 0;
+    pru_isa_init(&cpu, NULL, NULL, NULL, NULL);
+    pru_isa_map_host(&cpu, host, HOST_ADDR, HOST_LEN);
+    cpu.regs[27] = HOST_ADDR;
+    cpu.regs[23] = 0x11111111;
+    cpu.regs[24] = 0x22222222;
+    cpu.regs[25] = 0x33333333;
+    const uint32_t enabled_store[] = {
+        burst(1, 1, 0, 4, 4, 4), alu(14, R(0), R(0), 4, 1), burst(1, 0, 0, 4, 4, 4),  // Clear STANDBY_INIT
+        burst(0, 0, 23 * 4, 27, 16, 12), HALT,
+    };
+    load(enabled_store, sizeof(enabled_store) / sizeof(enabled_store[0]));
+    pru_isa_run(&cpu, 100);
+    uint32_t written[3];
+    memcpy(written, &host[16], sizeof(written));
+    // LBCO 3 + CLR 1 + SBCO 2 + SBBO 4 + HALT 1
+    if (faulted && !cpu.fault && written[0] == 0x11111111 && written[2] == 0x33333333 && cpu.host_bytes_written == 12
+        && cpu.cycles == 11) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! %" PRIu64 " cycles, %" PRIu64 " bytes\n", cpu.cycles, cpu.host_bytes_written);
+    }
+
+    printf("TEST: Byte loads from the data RAM go to the selected bytes of the registers: ");
+    pru_isa_init(&cpu, NULL, NULL, NULL, NULL);
+    const uint32_t config[] = { 0, 0, 0, 16, 6, 64 };
+    memcpy(cpu.dram, config, sizeof(config));
+    const uint32_t loads[] = { burst(0, 1, 29 * 4, 0, 12, 1), burst(0, 1, 29 * 4 + 1, 0, 16, 1),
+                               burst(0, 1, 29 * 4 + 2, 0, 20, 2), HALT };
+    load(loads, sizeof(loads) / sizeof(loads[0]));
+    pru_isa_run(&cpu, 100);
+    if (cpu.regs[29] == (64u << 16 | 6u << 8 | 16u)) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! r29 0x%08x\n", cpu.regs[29]);
+    }
+
+    printf("TEST: XOUT and XIN with the scratchpad shift wrap around the 30 registers of a bank: ");
+    pru_isa_init(&cpu, NULL, NULL, NULL, NULL);
+    cpu.cfg[PRU_ISA_CFG_SPP] = 1 << PRU_ISA_SPP_XFR_SHIFT_EN;
+    for (unsigned int r = 1; r <= 11; ++r) {
+        cpu.regs[r] = 100 + r;
+    }
+    const uint32_t shift[] = {
+        ldi(B(0, 0), 19), xfr(2, 12, 12, 4 * 11),  // r12-r22 zeros to bank registers 1-11
+        ldi(B(0, 0), 11), xfr(2, 12, 1, 4 * 11),   // r1-r11 to bank registers 12-22
+        ldi(B(0, 0), 0), xfr(1, 12, 12, 4 * 11),   // bank registers 12-22 to r12-r22
+        HALT,
+    };
+    load(shift, sizeof(shift) / sizeof(shift[0]));
+    pru_isa_run(&cpu, 100);
+    if (cpu.banks[2][12] == 101 && cpu.banks[2][22] == 111 && cpu.banks[2][1] == 0 && cpu.regs[12] == 101
+        && cpu.regs[22] == 111 && cpu.cycles == 7) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! r12 %u\n", cpu.regs[12]);
+    }
+
+    printf("TEST: Waiting for a pin is skipped to its change, with the cycles it takes: ");
+    pru_isa_init(&cpu, NULL, pins, NULL, NULL);
+    const uint32_t wait_clk[] = { wait(1, CLK_PIN), HALT };
+    load(wait_clk, 2);
+    const int waits = pru_isa_wait_pin(wait_clk[0]) == CLK_PIN && pru_isa_wait_pin(HALT) == -1;
+    pru_isa_step(&cpu);
+    const uint64_t after_wait = cpu.cycles;
+    pru_isa_run(&cpu, 2 * CLK_CYCLE);
+    if (waits && after_wait == CLK_CYCLE && cpu.pc == 1 && cpu.halted && cpu.cycles == CLK_CYCLE + 2) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! %" PRIu64 " cycles\n", after_wait);
+    }
+
+    printf("TEST: Writing r31 with the strobe bit raises a system event: ");
+    pru_isa_init(&cpu, NULL, NULL, on_event, NULL);
+    const uint32_t event[] = { ldi(B(31, 0), 32 + 3), ldi(B(31, 0), 3), HALT };
+    load(event, 3);
+    pru_isa_run(&cpu, 100);
+    if (cpu.events == 1 && last_event == PRU_ISA_EVENT_BASE + 3) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! %" PRIu64 " events\n", cpu.events);
+    }
+
+    printf("TEST: Linked PRUs write to each other's data RAM through C25: ");
+    pru_isa_init(&cpu, NULL, NULL, NULL, NULL);
+    cpu.regs[0] = 0x12345678;
+    const uint32_t start[] = { burst(1, 0, 0, 25, 28, 4), HALT };
+    load(start, 2);
+    pru_isa_run(&cpu, 100);
+    uint32_t alone;
+    memcpy(&alone, &(cpu.other_dram[28]), sizeof(alone));
+    pru_isa_init(&peer, NULL, NULL, NULL, NULL);
+    pru_isa_init(&cpu, NULL, NULL, NULL, NULL);
+    pru_isa_link(&peer, &cpu);
+    cpu.regs[0] = 0x12345678;
+    load(start, 2);
+    pru_isa_run(&cpu, 100);
+    uint32_t linked;
+    memcpy(&linked, &(peer.dram[28]), sizeof(linked));
+    if (alone == 0x12345678 && linked == 0x12345678 && !cpu.fault) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! 0x%08x, 0x%08x\n", alone, linked);
+    }
+
+    printf("TEST: Jumping out of the program and accessing unmapped memory fault: ");
+    pru_isa_init(&cpu, NULL, NULL, NULL, NULL);
+    const uint32_t out[] = { qb(7, 5, 0, 0) };
+    load(out, 1);
+    const int jump_fault = pru_isa_run(&cpu, 100) != 0 && cpu.fault;
+    pru_isa_init(&cpu, NULL, NULL, NULL, NULL);
+    cpu.regs[1] = 0x40000000;
+    const uint32_t unmapped[] = { burst(0, 1, 0, 1, 0, 4), HALT };
+    load(unmapped, 2);
+    if (jump_fault && pru_isa_run(&cpu, 100) != 0 && cpu.fault && cpu.pc == 0) {
+        printf("Success!\n");
+    } else {
+        printf("Failure!\n");
+    }
+
+    printf("TEST: Instructions are disassembled in the syntax of pasm: ");
+    char text[4][64];
+    pru_isa_disasm(10, qb(5, -1, W(0, 2), 0), text[0], sizeof(text[0]));
+    pru_isa_disasm(0, burst(1, 1, 0, 24, 8, 4), text[1], sizeof(text[1]));
+    pru_isa_disasm(0, burst(0, 0, 23 * 4, 27, 16, 12), text[2], sizeof(text[2]));
+    pru_isa_disasm(0, wait(0, CLK_PIN), text[3], sizeof(text[3]));
+    if (strcmp(text[0], "QBNE 9, r0.w2, 0") == 0 && strcmp(text[1], "LBCO r0, C24, 8, 4") == 0
+        && strcmp(text[2], "SBBO r23, r27, 16, 12") == 0 && strcmp(text[3], "WBC r31, 11") == 0) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! %s / %s / %s / %s\n", text[0], text[1], text[2], text[3]);
+    }
+
+    printf("EXITING TESTING PROGRAM\n");
+    return 0;
+}
@@ -0,0 +1,405 @@
+/**
+ * @brief Recorder writing WAV files from a writer thread. Headers in recorder.h.
+ *
+ *        The caller fills one buffer while the writer thread writes the other. The buffers are page aligned,
+ *        and with per-channel files each one is split into one region per channel, written with a single
+ *        write each. The WAV headers are written with placeholder sizes, fixed when the recorder is closed.
+ *
+ * @author Loïc Droz <lk.droz@gmail.com>
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "recorder.h"
+
+// Alignment of the buffers, a page
+#define RECORDER_ALIGN 4096
+// Size of the WAVE_FORMAT_EXTENSIBLE header: RIFF chunk header, fmt chunk of 40 bytes, data chunk header
+#define WAV_HEADER_SIZE 68
+#define WAV_RIFF_SIZE_OFFSET 4
+#define WAV_DATA_SIZE_OFFSET 64
+#define WAVE_FORMAT_PCM 0x0001
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003
+#define WAVE_FORMAT_EXTENSIBLE 0xfffe
+
+struct recorder_t {
+    // Conversion of the raw frames
+    size_t nchan;
+    uint8_t chans[CONVERT_MAX_CHAN];
+    size_t nsel;
+    pcm_format_t format;
+    convert_params_t params;
+    size_t sample_rate;
+    // One file per selected channel, or a single one
+    int fds[CONVERT_MAX_CHAN];
+    size_t nfiles;
+    // Bytes of a frame in each file, and bytes of each file in a buffer
+    size_t file_frame_size;
+    size_t region_size;
+    // The two buffers, the one being filled and its number of committed frames
+    uint8_t * buffers[2];
+    size_t buffer_frames;
+    int current;
+    size_t fill;
+    // Buffer handed to the writer thread and its number of frames, -1 if none
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int pending;
+    size_t pending_frames;
+    int stop;
+    // Counters returned by recorder_get_stats
+    _Atomic uint64_t frames_committed;
+    _Atomic uint64_t frames_written;
+    _Atomic uint64_t max_lag_frames;
+    _Atomic uint64_t stalls;
+    _Atomic uint64_t write_errors;
+};
+
+
+static void put16(uint8_t * p, uint16_t x)
+{
+    p[0] = (uint8_t) x;
+    p[1] = (uint8_t) (x >> 8);
+}
+
+
+static void put32(uint8_t * p, uint32_t x)
+{
+    put16(p, (uint16_t) x);
+    put16(&p[2], (uint16_t) (x >> 16));
+}
+
+
+// Write the whole buffer, retrying after partial writes and signals
+static int write_all(int fd, const uint8_t * data, size_t len)
+{
+    while (len > 0) {
+        const ssize_t written = write(fd, data, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        len -= (size_t) written;
+    }
+    return 0;
+}
+
+
+// Write a WAVE_FORMAT_EXTENSIBLE header with the given data size. An odd data chunk is followed by a pad byte,
+// which counts in the size of the RIFF chunk.
+static int write_header(int fd, size_t nchan, size_t sample_rate, pcm_format_t format, uint32_t data_size)
+{
+    // KSDATAFORMAT_SUBTYPE_PCM or _IEEE_FLOAT, after the format code in the first 2 bytes
+    static const uint8_t guid_tail[14] = { 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 };
+    const size_t sample_size = convert_format_size(format);
+    const uint64_t riff_size = (uint64_t) data_size + (data_size & 1) + WAV_HEADER_SIZE - 8;
+    uint8_t header[WAV_HEADER_SIZE];
+
+    memcpy(&header[0], "RIFF", 4);
+    put32(&header[WAV_RIFF_SIZE_OFFSET], riff_size > UINT32_MAX ? UINT32_MAX : (uint32_t) riff_size);
+    memcpy(&header[8], "WAVE", 4);
+    memcpy(&header[12], "fmt ", 4);
+    put32(&header[16], 40);
+    put16(&header[20], WAVE_FORMAT_EXTENSIBLE);
+    put16(&header[22], (uint16_t) nchan);
+    put32(&header[24], (uint32_t) sample_rate);
+    put32(&header[28], (uint32_t) (sample_rate * nchan * sample_size));
+    put16(&header[32], (uint16_t) (nchan * sample_size));
+    put16(&header[34], (uint16_t) (8 * sample_size));
+    put16(&header[36], 22);
+    // Valid bits per sample, and no speaker positions for the microphones
+    put16(&header[38], (uint16_t) (8 * sample_size));
+    put32(&header[40], 0);
+    put16(&header[44], format == PCM_FORMAT_F32 ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM);
+    memcpy(&header[46], guid_tail, sizeof(guid_tail));
+    memcpy(&header[60], "data", 4);
+    put32(&header[WAV_DATA_SIZE_OFFSET], data_size);
+
+    if (pwrite(fd, header, sizeof(header), 0) != sizeof(header)) {
+        return -1;
+    }
+    return lseek(fd, WAV_HEADER_SIZE, SEEK_SET) == WAV_HEADER_SIZE ? 0 : -1;
+}
+
+
+// Writes the buffers handed over by recorder_commit until the recorder is closed
+static void * recorder_routine(void * arg)
+{
+    recorder_t * rec = (recorder_t *) arg;
+
+    pthread_mutex_lock(&(rec -> mutex));
+    while (1) {
+        while (rec -> pending < 0 && !rec -> stop) {
+            pthread_cond_wait(&(rec -> cond), &(rec -> mutex));
+        }
+        if (rec -> pending < 0) {
+            break;
+        }
+        const uint8_t * buffer = rec -> buffers[rec -> pending];
+        const size_t nframes = rec -> pending_frames;
+        pthread_mutex_unlock(&(rec -> mutex));
+
+        // Stop writing after an error, so that the files stay consistent with their header
+        if (atomic_load(&(rec -> write_errors)) == 0) {
+            for (size_t k = 0; k < rec -> nfiles; ++k) {
+                if (write_all(rec -> fds[k], &buffer[k * rec -> region_size], nframes * rec -> file_frame_size)) {
+                    atomic_fetch_add(&(rec -> write_errors), 1);
+                    fprintf(stderr, "Error! Could not write the recording: %s\n", strerror(errno));
+                    break;
+                }
+            }
+        }
+        atomic_fetch_add(&(rec -> frames_written), nframes);
+
+        pthread_mutex_lock(&(rec -> mutex));
+        rec -> pending = -1;
+        pthread_cond_broadcast(&(rec -> cond));
+    }
+    pthread_mutex_unlock(&(rec -> mutex));
+    return NULL;
+}
+
+
+// Open the k-th file and write its header, with per-channel files the channel number is inserted in the path
+static int recorder_open_file(recorder_t * rec, const char * path, const recorder_config_t * config, size_t k)
+{
+    char file_path[4096];
+    if (config -> per_channel) {
+        // Insert _<channel> before the extension, if any after the last directory
+        const char * slash = strrchr(path, '/');
+        const char * dot = strrchr(path, '.');
+        const size_t stem = (dot != NULL && (slash == NULL || dot > slash)) ? (size_t) (dot - path) : strlen(path);
+        snprintf(file_path, sizeof(file_path), "%.*s_%u%s", (int) stem, path, rec -> chans[k] + 1, &path[stem]);
+    } else {
+        snprintf(file_path, sizeof(file_path), "%s", path);
+    }
+
+    const int fd = open(file_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error! Could not open %s: %s\n", file_path, strerror(errno));
+        return -1;
+    }
+    rec -> fds[k] = fd;
+
+    if (config -> prealloc_frames > 0) {
+        // Allocating the space up front avoids fragmenting the file, failing only makes the writes slower
+        const int err = posix_fallocate(fd, 0, WAV_HEADER_SIZE + (off_t) (config -> prealloc_frames * rec -> file_frame_size));
+        if (err != 0) {
+            fprintf(stderr, "Warning! Could not preallocate %s: %s\n", file_path, strerror(err));
+        }
+    }
+
+    if (write_header(fd, rec -> file_frame_size / convert_format_size(rec -> format), rec -> sample_rate, rec -> format, 0)) {
+        fprintf(stderr, "Error! Could not write the header of %s: %s\n", file_path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+
+static void recorder_free(recorder_t * rec)
+{
+    for (size_t k = 0; k < rec -> nfiles; ++k) {
+        if (rec -> fds[k] >= 0) {
+            close(rec -> fds[k]);
+        }
+    }
+    free(rec -> buffers[0]);
+    free(rec -> buffers[1]);
+    free(rec);
+}
+
+
+recorder_t * recorder_open(const char * path, const recorder_config_t * config, size_t nchan, size_t sample_rate,
+                           const convert_params_t * params)
+{
+    const pcm_format_t format = config -> format;
+    if (format != PCM_FORMAT_S16 && format != PCM_FORMAT_S24 && format != PCM_FORMAT_S32 && format != PCM_FORMAT_F32) {
+        fprintf(stderr, "Error! Unsupported recording format.\n");
+        return NULL;
+    }
+
+    recorder_t * rec = calloc(1, sizeof(recorder_t));
+    if (rec == NULL) {
+        fprintf(stderr, "Error! Memory for the recorder could not be allocated.\n");
+        return NULL;
+    }
+    rec -> nchan = nchan;
+    rec -> nsel = convert_mask_to_chans(config -> chan_mask, nchan, rec -> chans);
+    rec -> format = format;
+    rec -> params = *params;
+    rec -> sample_rate = sample_rate;
+    rec -> nfiles = config -> per_channel ? rec -> nsel : 1;
+    rec -> file_frame_size = convert_format_size(format) * (config -> per_channel ? 1 : rec -> nsel);
+    rec -> buffer_frames = config -> buffer_frames > 0 ? config -> buffer_frames : sample_rate / 2;
+    rec -> region_size = (rec -> buffer_frames * rec -> file_frame_size + RECORDER_ALIGN - 1) / RECORDER_ALIGN * RECORDER_ALIGN;
+    rec -> pending = -1;
+    for (size_t k = 0; k < CONVERT_MAX_CHAN; ++k) {
+        rec -> fds[k] = -1;
+    }
+    if (rec -> nsel == 0 || rec -> buffer_frames == 0) {
+        fprintf(stderr, "Error! No channel to record.\n");
+        free(rec);
+        return NULL;
+    }
+
+    for (int b = 0; b < 2; ++b) {
+        void * buffer;
+        if (posix_memalign(&buffer, RECORDER_ALIGN, rec -> region_size * rec -> nfiles)) {
+            fprintf(stderr, "Error! Could not allocate the recording buffers.\n");
+            recorder_free(rec);
+            return NULL;
+        }
+        rec -> buffers[b] = buffer;
+    }
+
+    for (size_t k = 0; k < rec -> nfiles; ++k) {
+        if (recorder_open_file(rec, path, config, k)) {
+            recorder_free(rec);
+            return NULL;
+        }
+    }
+
+    atomic_init(&(rec -> frames_committed), 0);
+    atomic_init(&(rec -> frames_written), 0);
+    atomic_init(&(rec -> max_lag_frames), 0);
+    atomic_init(&(rec -> stalls), 0);
+    atomic_init(&(rec -> write_errors), 0);
+    pthread_mutex_init(&(rec -> mutex), NULL);
+    pthread_cond_init(&(rec -> cond), NULL);
+    if (pthread_create(&(rec -> thread), NULL, recorder_routine, rec)) {
+        fprintf(stderr, "Error! Could not start the writer thread.\n");
+        pthread_mutex_destroy(&(rec -> mutex));
+        pthread_cond_destroy(&(rec -> cond));
+        recorder_free(rec);
+        return NULL;
+    }
+    return rec;
+}
+
+
+size_t recorder_room(const recorder_t * rec)
+{
+    return rec -> buffer_frames - rec -> fill;
+}
+
+
+void recorder_stage(recorder_t * rec, const uint32_t * src, size_t nframes, size_t offset)
+{
+    uint8_t * buffer = rec -> buffers[rec -> current];
+    const size_t position = (rec -> fill + offset) * rec -> file_frame_size;
+    if (rec -> nfiles == 1) {
+        convert_gather(src, nframes, rec -> nchan, rec -> chans, rec -> nsel, &buffer[position], rec -> format, &(rec -> params));
+        return;
+    }
+    // Per-channel files, each channel goes to its own region
+    for (size_t k = 0; k < rec -> nfiles; ++k) {
+        convert_gather(src, nframes, rec -> nchan, &(rec -> chans[k]), 1, &buffer[k * rec -> region_size + position],
+                       rec -> format, &(rec -> params));
+    }
+}
+
+
+// Hand the current buffer to the writer thread, waiting if it is still busy with the other one
+static void recorder_flush(recorder_t * rec)
+{
+    pthread_mutex_lock(&(rec -> mutex));
+    if (rec -> pending >= 0) {
+        atomic_fetch_add(&(rec -> stalls), 1);
+        do {
+            pthread_cond_wait(&(rec -> cond), &(rec -> mutex));
+        } while (rec -> pending >= 0);
+    }
+    rec -> pending = rec -> current;
+    rec -> pending_frames = rec -> fill;
+    pthread_cond_broadcast(&(rec -> cond));
+    pthread_mutex_unlock(&(rec -> mutex));
+
+    rec -> current ^= 1;
+    rec -> fill = 0;
+}
+
+
+void recorder_commit(recorder_t * rec, size_t nframes)
+{
+    rec -> fill += nframes;
+    const uint64_t committed = atomic_fetch_add(&(rec -> frames_committed), nframes) + nframes;
+    const uint64_t lag = committed - atomic_load(&(rec -> frames_written));
+    if (lag > atomic_load(&(rec -> max_lag_frames))) {
+        atomic_store(&(rec -> max_lag_frames), lag);
+    }
+
+    if (rec -> fill == rec -> buffer_frames) {
+        recorder_flush(rec);
+    }
+}
+
+
+void recorder_write(recorder_t * rec, const uint32_t * src, size_t nframes)
+{
+    while (nframes > 0) {
+        const size_t room = recorder_room(rec);
+        const size_t n = nframes < room ? nframes : room;
+        recorder_stage(rec, src, n, 0);
+        recorder_commit(rec, n);
+        src += n * rec -> nchan;
+        nframes -= n;
+    }
+}
+
+
+void recorder_get_stats(recorder_t * rec, recorder_stats_t * stats)
+{
+    const uint64_t written = atomic_load(&(rec -> frames_written));
+    stats -> frames_written = written;
+    stats -> lag_frames = atomic_load(&(rec -> frames_committed)) - written;
+    stats -> max_lag_frames = atomic_load(&(rec -> max_lag_frames));
+    stats -> stalls = atomic_load(&(rec -> stalls));
+    stats -> write_errors = atomic_load(&(rec -> write_errors));
+}
+
+
+int recorder_close(recorder_t * rec)
+{
+    // Write the last partial buffer, then wait for the writer thread to finish
+    if (rec -> fill > 0) {
+        recorder_flush(rec);
+    }
+    pthread_mutex_lock(&(rec -> mutex));
+    rec -> stop = 1;
+    pthread_cond_broadcast(&(rec -> cond));
+    pthread_mutex_unlock(&(rec -> mutex));
+    pthread_join(rec -> thread, NULL);
+    pthread_mutex_destroy(&(rec -> mutex));
+    pthread_cond_destroy(&(rec -> cond));
+
+    int result = atomic_load(&(rec -> write_errors)) != 0;
+    if (!result) {
+        // Fix the sizes in the headers, and drop the preallocated space which was not used. Truncating past the
+        // data of an odd size writes the zero pad byte.
+        const uint64_t data_size = atomic_load(&(rec -> frames_written)) * rec -> file_frame_size;
+        const uint32_t header_size = data_size > UINT32_MAX ? UINT32_MAX : (uint32_t) data_size;
+        const size_t file_nchan = rec -> file_frame_size / convert_format_size(rec -> format);
+        for (size_t k = 0; k < rec -> nfiles; ++k) {
+            if (ftruncate(rec -> fds[k], WAV_HEADER_SIZE + (off_t) (data_size + (data_size & 1)))
+                || write_header(rec -> fds[k], file_nchan, rec -> sample_rate, rec -> format, header_size)) {
+                result = -1;
+            }
+        }
+    }
+
+    recorder_free(rec);
+    return result;
+}
@@ -0,0 +1,125 @@
+/**
+ * @brief Recorder writing raw CIC frames to WAV files from a dedicated writer thread, so that slow storage
+ *        does not stall the thread reading the audio.
+ *
+ *        The frames are converted into one of two large aligned buffers. Once it is full, the buffer is handed
+ *        to the writer thread, which writes it with a few large writes while the other one fills up. The output
+ *        is a single multichannel WAV file, or one WAV file per channel, in the WAVE_FORMAT_EXTENSIBLE format.
+ *
+ * @author Loïc Droz <lk.droz@gmail.com>
+ *
+ */
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stddef.h>
+#include <inttypes.h>
+#include "convert.h"
+
+/**
+ * @brief Configuration of a recorder, see recorder_open.
+ *
+ */
+typedef struct {
+    // The channels to record, bit c selects channel c (0-based)
+    uint32_t chan_mask;
+    // Sample format of the files: PCM_FORMAT_S16, PCM_FORMAT_S24, PCM_FORMAT_S32 or PCM_FORMAT_F32
+    pcm_format_t format;
+    // If non-zero, each channel is written to its own mono file
+    int per_channel;
+    // Frames per buffer, 0 for half a second. The writer may fall behind by up to one buffer without stalling.
+    size_t buffer_frames;
+    // Frames for which file space is allocated when the file is created, 0 to let the file grow
+    size_t prealloc_frames;
+} recorder_config_t;
+
+/**
+ * @brief Counters of a recorder, see recorder_get_stats.
+ *
+ */
+typedef struct {
+    // Frames written to the files
+    uint64_t frames_written;
+    // Frames given to the recorder but not written yet, how far behind the writer currently is
+    uint64_t lag_frames;
+    // Highest value of lag_frames so far
+    uint64_t max_lag_frames;
+    // Times a full buffer had to wait for the writer to finish the other one, which blocks the caller
+    uint64_t stalls;
+    // Failed writes, the recorder stops writing after the first one
+    uint64_t write_errors;
+} recorder_stats_t;
+
+typedef struct recorder_t recorder_t;
+
+/**
+ * @brief Create the output files and start the writer thread.
+ *
+ * @param path The path of the WAV file. With per_channel, the 1-based channel number is inserted before the
+ *        extension, e.g. out.wav gives out_1.wav, out_2.wav, ...
+ * @param config The channels and format to record.
+ * @param nchan The number of channels of the raw frames.
+ * @param sample_rate The sample rate of the raw frames, in Hz.
+ * @param params The conversion parameters of the raw frames.
+ * @return recorder_t* A pointer to a new recorder in case of success, NULL otherwise.
+ */
+recorder_t * recorder_open(const char * path, const recorder_config_t * config, size_t nchan, size_t sample_rate,
+                           const convert_params_t * params);
+
+/**
+ * @brief Get the number of frames which can be staged before the current buffer is full. Never 0.
+ *
+ * @param rec The recorder.
+ * @return size_t The number of frames.
+ */
+size_t recorder_room(const recorder_t * rec);
+
+/**
+ * @brief Convert raw frames into the current buffer, after the frames already staged, without committing them.
+ *        Staging the same frames again overwrites them, which lets a reader retry when its frames were
+ *        overwritten while it was converting them, see pcm_record.
+ *
+ * @param rec The recorder.
+ * @param src The raw frames, nchan 32 bits words each.
+ * @param nframes The number of frames, at most recorder_room minus offset.
+ * @param offset The number of frames already staged since the last commit, the frames are staged after them.
+ */
+void recorder_stage(recorder_t * rec, const uint32_t * src, size_t nframes, size_t offset);
+
+/**
+ * @brief Commit staged frames. If the current buffer is full, it is handed to the writer thread, waiting
+ *        for it to finish the other buffer first if needed.
+ *
+ * @param rec The recorder.
+ * @param nframes The number of staged frames to commit.
+ */
+void recorder_commit(recorder_t * rec, size_t nframes);
+
+/**
+ * @brief Convert and record raw frames, staging and committing them as many times as needed.
+ *
+ * @param rec The recorder.
+ * @param src The raw frames, nchan 32 bits words each.
+ * @param nframes The number of frames.
+ */
+void recorder_write(recorder_t * rec, const uint32_t * src, size_t nframes);
+
+/**
+ * @brief Get the counters of the recorder. Can be called from any thread.
+ *
+ * @param rec The recorder.
+ * @param stats The structure to which the counters are written.
+ */
+void recorder_get_stats(recorder_t * rec, recorder_stats_t * stats);
+
+/**
+ * @brief Write the remaining frames, stop the writer thread, then fix the sizes in the WAV headers and trim
+ *        the preallocated space. The sizes saturate for files larger than 4 GiB.
+ *
+ * @param rec The recorder to close and free.
+ * @return int 0 in case of success, non-zero if some data could not be written.
+ */
+int recorder_close(recorder_t * rec);
+
+#endif
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "recorder.h"
+
+#define NCHAN 6
+#define RATE 64000
+// Not a multiple of the buffer size, so that the last buffer is partial
+#define NFRAMES 10000
+#define BUFFER_FRAMES 1536
+#define HEADER_SIZE 68
+
+static uint32_t raw[NFRAMES * NCHAN];
+static uint8_t file[HEADER_SIZE + NFRAMES * NCHAN * 4 + 1];
+static uint8_t expected[NFRAMES * NCHAN * 4];
+
+
+static uint32_t get32(const uint8_t * p)
+{
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+
+static uint16_t get16(const uint8_t * p)
+{
+    return (uint16_t) (p[0] | p[1] << 8);
+}
+
+
+// Read a whole file, returns its size
+static size_t read_file(const char * path)
+{
+    FILE * f = fopen(path, "rb");
+    if (f == NULL) {
+        return 0;
+    }
+    const size_t len = fread(file, 1, sizeof(file), f);
+    fclose(f);
+    return len;
+}
+
+
+// Check the header of a WAV file of nframes frames, and compare its data with the expected samples. An odd data
+// chunk must be followed by a zero pad byte.
+static size_t check_file(const char * path, size_t nchan, pcm_format_t format, size_t nframes, const uint8_t * data)
+{
+    const size_t sample_size = convert_format_size(format);
+    const size_t data_size = nframes * nchan * sample_size;
+    const size_t pad = data_size & 1;
+    size_t errors = 0;
+    if (read_file(path) != HEADER_SIZE + data_size + pad) {
+        return 1;
+    }
+    errors += pad && file[HEADER_SIZE + data_size] != 0;
+    errors += memcmp(file, "RIFF", 4) != 0 || get32(&file[4]) != HEADER_SIZE - 8 + data_size + pad;
+    errors += memcmp(&file[8], "WAVEfmt ", 8) != 0 || get32(&file[16]) != 40 || get16(&file[20]) != 0xfffe;
+    errors += get16(&file[22]) != nchan || get32(&file[24]) != RATE || get32(&file[28]) != RATE * nchan * sample_size;
+    errors += get16(&file[32]) != nchan * sample_size || get16(&file[34]) != 8 * sample_size;
+    errors += get16(&file[44]) != (format == PCM_FORMAT_F32 ? 3 : 1);
+    errors += memcmp(&file[60], "data", 4) != 0 || get32(&file[64]) != data_size;
+    errors += memcmp(&file[HEADER_SIZE], data, data_size) != 0;
+    return errors;
+}
+
+
+int main(void) {
+    printf("\nSTARTING RECORDER TESTING PROGRAM!\n");
+
+    convert_params_t params;
+    convert_params_init(&params, 16);
+    for (size_t i = 0; i < NFRAMES * NCHAN; ++i) {
+        raw[i] = (uint32_t) ((i * 7919) % 65536);
+    }
+    char dir[] = "/tmp/recorder_testsXXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        printf("Could not create a temporary directory\n");
+        return 1;
+    }
+    char path[256];
+    uint8_t chans[NCHAN];
+
+    printf("TEST: A multichannel int16 recording written in blocks of any size has the expected header and samples: ");
+    snprintf(path, sizeof(path), "%s/all.wav", dir);
+    recorder_config_t config = {
+        .chan_mask = 0x3f,
+        .format = PCM_FORMAT_S16,
+        .per_channel = 0,
+        .buffer_frames = BUFFER_FRAMES,
+        .prealloc_frames = 2 * NFRAMES,
+    };
+    recorder_t * rec = recorder_open(path, &config, NCHAN, RATE, &params);
+    size_t errors = (rec == NULL);
+    if (rec != NULL) {
+        for (size_t i = 0, block = 1; i < NFRAMES; i += block, block = (block * 5 + 3) % 701) {
+            recorder_write(rec, &raw[i * NCHAN], (NFRAMES - i) < block ? (NFRAMES - i) : block);
+        }
+        errors += recorder_close(rec) != 0;
+        size_t nsel = convert_mask_to_chans(0x3f, NCHAN, chans);
+        convert_gather(raw, NFRAMES, NCHAN, chans, nsel, expected, PCM_FORMAT_S16, &params);
+        errors += check_file(path, NCHAN, PCM_FORMAT_S16, NFRAMES, expected);
+    }
+    if (errors == 0) {
+        printf("Success!\n");
+    } else {
+        printf("Failure!\n");
+    }
+
+    printf("TEST: Per-channel recordings in int24 and float32 hold one channel each: ");
+    const pcm_format_t formats[2] = { PCM_FORMAT_S24, PCM_FORMAT_F32 };
+    errors = 0;
+    for (size_t k = 0; k < 2; ++k) {
+        snprintf(path, sizeof(path), "%s/mic.wav", dir);
+        config.chan_mask = (1 << 1) | (1 << 4);
+        config.format = formats[k];
+        config.per_channel = 1;
+        config.prealloc_frames = 0;
+        rec = recorder_open(path, &config, NCHAN, RATE, &params);
+        if (rec == NULL) {
+            errors += 1;
+            continue;
+        }
+        recorder_write(rec, raw, NFRAMES);
+        recorder_stats_t stats;
+        recorder_get_stats(rec, &stats);
+        errors += recorder_close(rec) != 0;
+        // Only full buffers are written before closing
+        errors += stats.frames_written > NFRAMES || stats.frames_written + stats.lag_frames != NFRAMES;
+        for (size_t c = 1; c < NCHAN; c += 3) {
+            chans[0] = (uint8_t) c;
+            convert_gather(raw, NFRAMES, NCHAN, chans, 1, expected, formats[k], &params);
+            snprintf(path, sizeof(path), "%s/mic_%zu.wav", dir, c + 1);
+            errors += check_file(path, 1, formats[k], NFRAMES, expected);
+            unlink(path);
+        }
+    }
+    if (errors == 0) {
+        printf("Success!\n");
+    } else {
+        printf("Failure!\n");
+    }
+
+    printf("TEST: An int24 recording with an odd data size ends with a pad byte counted in the RIFF size: ");
+    snprintf(path, sizeof(path), "%s/odd.wav", dir);
+    config.chan_mask = 0x7;
+    config.format = PCM_FORMAT_S24;
+    config.per_channel = 0;
+    rec = recorder_open(path, &config, NCHAN, RATE, &params);
+    errors = (rec == NULL);
+    if (rec != NULL) {
+        recorder_write(rec, raw, NFRAMES - 1);
+        errors += recorder_close(rec) != 0;
+        size_t nsel = convert_mask_to_chans(0x7, NCHAN, chans);
+        convert_gather(raw, NFRAMES - 1, NCHAN, chans, nsel, expected, PCM_FORMAT_S24, &params);
+        errors += check_file(path, nsel, PCM_FORMAT_S24, NFRAMES - 1, expected);
+    }
+    unlink(path);
+    if (errors == 0) {
+        printf("Success!\n");
+    } else {
+        printf("Failure!\n");
+    }
+
+    printf("TEST: The preallocated space is trimmed when the recorder is closed: ");
+    snprintf(path, sizeof(path), "%s/all.wav", dir);
+    struct stat st;
+    if (stat(path, &st) == 0 && st.st_size == HEADER_SIZE + NFRAMES * NCHAN * 2) {
+        printf("Success!\n");
+    } else {
+        printf("Failure!\n");
+    }
+    unlink(path);
+    rmdir(dir);
+
+    printf("EXITING TESTING PROGRAM\n");
+    return 0;
+}
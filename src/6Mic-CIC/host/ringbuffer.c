@@ -1,5 +1,5 @@
 /**
- * @brief Simple implementation of a single-threaded ringbuffer/queue.
+ * @brief Simple implementation of a single-producer/single-consumer ringbuffer/queue.
  *        Inspired by : https://embedjournal.com/implementing-circular-buffer-embedded-c/
  * 
  * @author Loïc Droz <lk.droz@gmail.com>
@@ -30,97 +30,234 @@ ringbuffer_t * ringbuf_create(size_t blocksize, size_t nelem)
     }
 
     // Finally, set the ringbuffer's parameters
-    ringbuf -> data = data;
-    ringbuf -> head = 0;
-    ringbuf -> tail = 0;
-    ringbuf -> maxLength = nelem * blocksize;
-    ringbuf -> is_full = 0;
-
+    ringbuf_init(ringbuf, data, nelem * blocksize);
     return ringbuf;
 }
 
 
+void ringbuf_init(ringbuffer_t * ringbuf, uint8_t * data, size_t length)
+{
+    ringbuf -> data = data;
+    atomic_init(&(ringbuf -> head), 0);
+    atomic_init(&(ringbuf -> reserve), 0);
+    atomic_init(&(ringbuf -> dropped), 0);
+    ringbuf -> maxLength = length;
+    for (size_t r = 0; r < RINGBUF_MAX_READERS; ++r) {
+        atomic_init(&(ringbuf -> readers[r].tail), 0);
+        atomic_init(&(ringbuf -> readers[r].active), 0);
+        atomic_init(&(ringbuf -> readers[r].overflows), 0);
+        atomic_init(&(ringbuf -> readers[r].overwritten), 0);
+    }
+    // The default reader
+    ringbuf -> readers[0].policy = RINGBUF_READER_SKIP;
+    atomic_store(&(ringbuf -> readers[0].active), 1);
+}
+
+
 size_t ringbuf_push(ringbuffer_t * dst, uint8_t * data, size_t block_size, size_t block_count, int * overflow_flag)
 {
     if (block_size == 0 || block_count == 0) {
         return 0;
     }
 
-    // Get the distance between the tail and head pointers, and check we aren't trying to push too much data.
-    size_t free_bytes;
-    if (dst -> is_full) {
-        free_bytes = 0;
-    } else if (dst -> head >= dst -> tail) {
-        free_bytes = (dst -> maxLength) - (dst -> head) + (dst -> tail);
-    } else {
-        free_bytes = (dst -> tail) - (dst -> head);
+    // If more data than the buffer can hold is pushed, only the most recent blocks would survive anyway
+    const size_t max_blocks = dst -> maxLength / block_size;
+    if (block_count > max_blocks) {
+        data = &data[(block_count - max_blocks) * block_size];
+        block_count = max_blocks;
+    }
+
+    // Only the producer writes head, the tails are read to check if an overflow will occur
+    const uint64_t head = atomic_load_explicit(&(dst -> head), memory_order_relaxed);
+    size_t used = 0, protected_used = 0;
+    for (size_t r = 0; r < RINGBUF_MAX_READERS; ++r) {
+        const ringbuf_reader_t * reader = &(dst -> readers[r]);
+        if (atomic_load_explicit(&(reader -> active), memory_order_acquire) != 1) {
+            continue;
+        }
+        size_t reader_used = (size_t) (head - atomic_load_explicit(&(reader -> tail), memory_order_acquire));
+        if (reader_used > dst -> maxLength) {
+            // The reader has not yet skipped past data overwritten by a previous push
+            reader_used = dst -> maxLength;
+        }
+        used = reader_used > used ? reader_used : used;
+        if (reader -> policy == RINGBUF_READER_PROTECT && reader_used > protected_used) {
+            protected_used = reader_used;
+        }
     }
 
     size_t to_write = block_size * block_count;
+    // Never overwrite what a protected reader has not read yet, drop the newest blocks instead
+    const size_t room = dst -> maxLength - protected_used;
+    int dropped = 0;
+    if (to_write > room) {
+        const size_t kept = room - room % block_size;
+        atomic_fetch_add_explicit(&(dst -> dropped), to_write - kept, memory_order_relaxed);
+        to_write = kept;
+        dropped = 1;
+    }
     // Check if an overflow will occur or not.
-    *overflow_flag = (free_bytes < to_write) ? 1 : 0;
+    *overflow_flag = (dst -> maxLength - used < to_write || dropped) ? 1 : 0;
+    if (to_write == 0) {
+        return 0;
+    }
+
+    // Announce the range we are about to write before touching the data, the consumer checks it after copying
+    atomic_store_explicit(&(dst -> reserve), head + to_write, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
 
     // Copy the data
     // DO NOT COPY EVERYTHING AT ONCE, we need to copy in 2 parts if we have to loop back to the beginning of the actual buffer in memory
-    if ((dst -> maxLength - dst -> head) > to_write) {
+    const size_t head_idx = (size_t) (head % dst -> maxLength);
+    if ((dst -> maxLength - head_idx) > to_write) {
         // Can copy everything at once
-        memcpy(&(dst -> data[dst -> head]), data, to_write);
+        memcpy(&(dst -> data[head_idx]), data, to_write);
     } else {
         // Copy the first half up to the end of the actual buffer in memory from head, then copy the rest to the beginning of the said buffer
-        const size_t first_half_len = dst -> maxLength - dst -> head;
-        memcpy(&(dst -> data[dst -> head]), data, first_half_len);
+        const size_t first_half_len = dst -> maxLength - head_idx;
+        memcpy(&(dst -> data[head_idx]), data, first_half_len);
         memcpy(dst -> data, &data[first_half_len], to_write - first_half_len);
     }
 
-    // Adjust head pointer
-    dst -> head += to_write;
-    dst -> head %= dst -> maxLength;
-    // In case of an overflow, adjust tail pointer as well
-    if (*overflow_flag) {
-        dst -> tail = dst -> head;
-    }
-    
-    // Check if the buffer is now full
-    dst -> is_full = (dst -> head == dst -> tail) ? 1 : 0;
+    // Publish the new data
+    atomic_store_explicit(&(dst -> head), head + to_write, memory_order_release);
     return to_write / block_size;
 }
 
 
+// Skip a reader ahead to the given position, past data which was overwritten. Called by the consumer of the reader.
+static uint64_t ringbuf_skip(ringbuf_reader_t * reader, uint64_t tail, uint64_t new_tail)
+{
+    atomic_fetch_add_explicit(&(reader -> overflows), 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&(reader -> overwritten), new_tail - tail, memory_order_relaxed);
+    return new_tail;
+}
+
+
 size_t ringbuf_pop(ringbuffer_t * src, uint8_t * data, size_t block_size, size_t block_count)
 {
-    // Get the distance between the tail and head pointers, check we aren't trying to pop too much data.
-    size_t available_bytes;
-    if ((src -> head == src -> tail) && src -> is_full) {
-        available_bytes = src -> maxLength;
-    } else if (src -> head >= src -> tail) {
-        available_bytes = (src -> head) - (src -> tail);
-    } else {
-        available_bytes = (src -> maxLength) - (src -> tail) + (src -> head);
+    return ringbuf_reader_pop(src, 0, data, block_size, block_count);
+}
+
+
+size_t ringbuf_reader_pop(ringbuffer_t * src, int reader_index, uint8_t * data, size_t block_size, size_t block_count)
+{
+    if (block_size == 0 || block_count == 0) {
+        return 0;
     }
 
-    // Read only the maximum amount of data possible such that no block is partially read
-    size_t to_read = (block_size * block_count) > available_bytes ? available_bytes : (block_size * block_count);
-    to_read -= to_read % block_size;
-    
-    // Copy the data
-    // DO NOT COPY EVERYTHING AT ONCE, we need to copy in 2 parts if we have to loop back to the beginning of the actual buffer in memory
-    if ((src -> maxLength - src -> tail) > to_read) {
-        memcpy(data, &(src -> data[src -> tail]), to_read);
-    } else {
-        // Copy the first half up to the end of the actual buffer in memory from head, then copy the rest from the beginning of the said buffer
-        const size_t first_half_len = src -> maxLength - src -> tail;
-        memcpy(data, &(src -> data[src -> tail]), first_half_len);
-        memcpy(&data[first_half_len], src -> data, to_read - first_half_len);
+    ringbuf_reader_t * reader = &(src -> readers[reader_index]);
+    uint64_t tail = atomic_load_explicit(&(reader -> tail), memory_order_relaxed);
+    size_t to_read;
+
+    while (1) {
+        const uint64_t head = atomic_load_explicit(&(src -> head), memory_order_acquire);
+        // In case of an overflow, skip the data which has been overwritten
+        if (head - tail > src -> maxLength) {
+            tail = ringbuf_skip(reader, tail, head - src -> maxLength);
+        }
+
+        // Read only the maximum amount of data possible such that no block is partially read
+        const size_t available_bytes = (size_t) (head - tail);
+        to_read = (block_size * block_count) > available_bytes ? available_bytes : (block_size * block_count);
+        to_read -= to_read % block_size;
+
+        // Copy the data
+        // DO NOT COPY EVERYTHING AT ONCE, we need to copy in 2 parts if we have to loop back to the beginning of the actual buffer in memory
+        const size_t tail_idx = (size_t) (tail % src -> maxLength);
+        if ((src -> maxLength - tail_idx) > to_read) {
+            memcpy(data, &(src -> data[tail_idx]), to_read);
+        } else {
+            // Copy the first half up to the end of the actual buffer in memory from head, then copy the rest from the beginning of the said buffer
+            const size_t first_half_len = src -> maxLength - tail_idx;
+            memcpy(data, &(src -> data[tail_idx]), first_half_len);
+            memcpy(&data[first_half_len], src -> data, to_read - first_half_len);
+        }
+
+        // Check the producer did not overwrite what we just copied, otherwise start again from the oldest valid data
+        atomic_thread_fence(memory_order_acquire);
+        const uint64_t reserve = atomic_load_explicit(&(src -> reserve), memory_order_relaxed);
+        if (reserve <= tail + src -> maxLength) {
+            break;
+        }
+        tail = ringbuf_skip(reader, tail, reserve - src -> maxLength);
     }
 
     // Adjust tail pointer
-    src -> tail += to_read;
-    src -> tail %= src -> maxLength;
-    src -> is_full = src -> is_full && (to_read == 0);
+    atomic_store_explicit(&(reader -> tail), tail + to_read, memory_order_release);
     return to_read / block_size;
 }
 
 
+size_t ringbuf_acquire(ringbuffer_t * src, ringbuf_span_t spans[2], size_t block_size, size_t block_count)
+{
+    return ringbuf_reader_acquire(src, 0, spans, block_size, block_count);
+}
+
+
+size_t ringbuf_reader_acquire(ringbuffer_t * src, int reader_index, ringbuf_span_t spans[2], size_t block_size, size_t block_count)
+{
+    spans[0].data = spans[1].data = src -> data;
+    spans[0].count = spans[1].count = 0;
+    if (block_size == 0 || block_count == 0) {
+        return 0;
+    }
+
+    ringbuf_reader_t * reader = &(src -> readers[reader_index]);
+    uint64_t tail = atomic_load_explicit(&(reader -> tail), memory_order_relaxed);
+    const uint64_t head = atomic_load_explicit(&(src -> head), memory_order_acquire);
+    const uint64_t reserve = atomic_load_explicit(&(src -> reserve), memory_order_relaxed);
+    // Skip the data which has been, or is being, overwritten
+    if (reserve - tail > src -> maxLength) {
+        tail = ringbuf_skip(reader, tail, reserve - src -> maxLength);
+        atomic_store_explicit(&(reader -> tail), tail, memory_order_release);
+    }
+
+    const size_t available_bytes = (size_t) (head - tail);
+    size_t to_acquire = (block_size * block_count) > available_bytes ? available_bytes : (block_size * block_count);
+    to_acquire -= to_acquire % block_size;
+
+    // Split the data in 2 if it loops back to the beginning of the actual buffer in memory
+    const size_t tail_idx = (size_t) (tail % src -> maxLength);
+    const size_t first_half_len = (src -> maxLength - tail_idx) > to_acquire ? to_acquire : (src -> maxLength - tail_idx);
+    spans[0].data = &(src -> data[tail_idx]);
+    spans[0].count = first_half_len / block_size;
+    spans[1].count = (to_acquire - first_half_len) / block_size;
+    return to_acquire / block_size;
+}
+
+
+size_t ringbuf_release(ringbuffer_t * src, size_t block_size, size_t block_count)
+{
+    return ringbuf_reader_release(src, 0, block_size, block_count);
+}
+
+
+size_t ringbuf_reader_release(ringbuffer_t * src, int reader_index, size_t block_size, size_t block_count)
+{
+    ringbuf_reader_t * reader = &(src -> readers[reader_index]);
+    const uint64_t tail = atomic_load_explicit(&(reader -> tail), memory_order_relaxed);
+    const size_t to_release = block_size * block_count;
+
+    // Check whether the producer went past the released data while the consumer was using it. If so, only release
+    // the blocks it overwrote, the consumer acquires the valid ones again.
+    atomic_thread_fence(memory_order_acquire);
+    const uint64_t reserve = atomic_load_explicit(&(src -> reserve), memory_order_relaxed);
+    if (reserve > tail + src -> maxLength) {
+        size_t overwritten = (size_t) (reserve - src -> maxLength - tail);
+        overwritten = overwritten > to_release ? to_release : overwritten;
+        overwritten += (block_size - overwritten % block_size) % block_size;
+        atomic_fetch_add_explicit(&(reader -> overflows), 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&(reader -> overwritten), overwritten, memory_order_relaxed);
+        atomic_store_explicit(&(reader -> tail), tail + overwritten, memory_order_release);
+        return overwritten / block_size;
+    }
+
+    atomic_store_explicit(&(reader -> tail), tail + to_release, memory_order_release);
+    return 0;
+}
+
+
 void ringbuf_free(ringbuffer_t * ringbuf)
 {
     // First free the ringbuffer's data buffer
@@ -132,16 +269,53 @@ void ringbuf_free(ringbuffer_t * ringbuf)
 
 size_t ringbuf_len(ringbuffer_t * buf)
 {
-    if (buf -> is_full) {
+    return ringbuf_reader_len(buf, 0);
+}
+
+
+size_t ringbuf_reader_len(ringbuffer_t * buf, int reader)
+{
+    const uint64_t tail = atomic_load_explicit(&(buf -> readers[reader].tail), memory_order_acquire);
+    const uint64_t head = atomic_load_explicit(&(buf -> head), memory_order_acquire);
+
+    // The consumer may not have noticed an overflow yet
+    if (head - tail > buf -> maxLength) {
         return buf -> maxLength;
     }
-    
-    const size_t head = buf -> head;
-    const size_t tail = buf -> tail;
+    return (size_t) (head - tail);
+}
 
-    if (head >= tail) {
-        return head - tail;
-    } else {
-        return head + (buf -> maxLength - tail);
+
+int ringbuf_reader_add(ringbuffer_t * buf, int policy)
+{
+    for (int r = 0; r < RINGBUF_MAX_READERS; ++r) {
+        ringbuf_reader_t * reader = &(buf -> readers[r]);
+        // Claim a free slot, the producer ignores it until it is fully set up
+        int expected = 0;
+        if (!atomic_compare_exchange_strong(&(reader -> active), &expected, 2)) {
+            continue;
+        }
+        reader -> policy = policy;
+        atomic_store(&(reader -> overflows), 0);
+        atomic_store(&(reader -> overwritten), 0);
+        atomic_store(&(reader -> tail), atomic_load(&(buf -> head)));
+        atomic_store(&(reader -> active), 1);
+        return r;
     }
-}
\ No newline at end of file
+    fprintf(stderr, "Error! No more than %d readers per ringbuffer.\n", RINGBUF_MAX_READERS);
+    return -1;
+}
+
+
+void ringbuf_reader_remove(ringbuffer_t * buf, int reader)
+{
+    atomic_store(&(buf -> readers[reader].active), 0);
+}
+
+
+void ringbuf_reader_get_stats(ringbuffer_t * buf, int reader, ringbuf_reader_stats_t * stats)
+{
+    stats -> lag = ringbuf_reader_len(buf, reader);
+    stats -> overflows = atomic_load(&(buf -> readers[reader].overflows));
+    stats -> overwritten = atomic_load(&(buf -> readers[reader].overwritten));
+}
@@ -1,26 +1,83 @@
 /**
- * @brief Simple implementation of a single-threaded ringbuffer/queue.
+ * @brief Simple implementation of a ringbuffer/queue, safe to use with one producer thread and one consumer thread.
  * 
  * @author Loïc Droz <lk.droz@gmail.com>
  * 
  */
 
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
 #include <stdlib.h>
 #include <inttypes.h>
+#include <stdatomic.h>
+
+// Max number of readers of a ringbuffer, including the default one
+#define RINGBUF_MAX_READERS 8
+
+// Policies of a reader, when the producer has no room left for new data:
+// the producer overwrites the data the reader has not read yet, and the reader skips ahead when it notices,
+#define RINGBUF_READER_SKIP 0
+// or the producer never overwrites the data the reader has not read yet, and drops the new data instead.
+#define RINGBUF_READER_PROTECT 1
 
+/**
+ * @brief A reader of a ringbuffer, with its own position and overflow accounting. Each reader is used by a single
+ *        consumer thread.
+ * 
+ */
+typedef struct {
+    // Position of the reader, the total number of bytes it ever read or skipped. Written by its consumer.
+    _Atomic uint64_t tail;
+    // Whether the reader is registered, and its policy, RINGBUF_READER_*
+    _Atomic int active;
+    int policy;
+    // Number of times the reader was skipped ahead, and the number of bytes it lost, because they were overwritten
+    _Atomic uint64_t overflows;
+    _Atomic uint64_t overwritten;
+} ringbuf_reader_t;
+
+/**
+ * @brief Single-producer/multi-reader ringbuffer. ringbuf_push must only be called by the producer, the functions of
+ *        a reader by its consumer, ringbuf_len by either of them. None of them ever block. Every reader sees all the
+ *        data, straight from the buffer, there is no copy per reader.
+ * 
+ *        Head and tails are the total number of bytes ever written and read, the actual indices in
+ *        the data buffer are these modulo maxLength. In case of an overflow, the producer never waits
+ *        for the readers: it overwrites the oldest data, and the readers skip ahead when they notice,
+ *        unless one of them is protected, in which case the producer drops the data which does not fit.
+ * 
+ *        Reader 0 is registered when the ringbuffer is created, with the RINGBUF_READER_SKIP policy. The functions
+ *        without a reader argument, e.g. ringbuf_pop, use it.
+ * 
+ */
 typedef struct {
     // Pointer to the main buffer
     uint8_t * data;
-    // Head and tail indices
-    size_t head;
-    size_t tail;
+    // Head position, written by the producer
+    _Atomic uint64_t head;
+    // The readers, written by their consumers
+    ringbuf_reader_t readers[RINGBUF_MAX_READERS];
+    // Number of bytes the producer dropped because a protected reader had not read the data yet
+    _Atomic uint64_t dropped;
+    // Position up to which the producer may be writing. Lets the consumer detect data which got
+    // overwritten while it was copying it.
+    _Atomic uint64_t reserve;
     // Max length of the buffer
     size_t maxLength;
-    // Flag for checking if the buffer is full
-    // Needed because if the buffer is full or empty, the head and tail indexes will be the same
-    int is_full;
 } ringbuffer_t;
 
+/**
+ * @brief A contiguous part of the ringbuffer's data, as returned by ringbuf_acquire.
+ * 
+ */
+typedef struct {
+    // First byte of the span, inside the ringbuffer's data buffer
+    uint8_t * data;
+    // Number of blocks in the span
+    size_t count;
+} ringbuf_span_t;
+
 /**
  * @brief Create a new ringbuffer containing the given number of blocks of given length.
  * 
@@ -30,6 +87,16 @@ typedef struct {
  */
 ringbuffer_t * ringbuf_create(size_t nelem, size_t blocksize);
 
+/**
+ * @brief Initialize a ringbuffer in memory provided by the caller, e.g. shared with other processes, instead of
+ *        allocating it like ringbuf_create. Such a ringbuffer must not be freed with ringbuf_free.
+ * 
+ * @param ringbuf The ringbuffer structure to initialize.
+ * @param data The data buffer of the ringbuffer, zeroed.
+ * @param length The length of the data buffer, in bytes.
+ */
+void ringbuf_init(ringbuffer_t * ringbuf, uint8_t * data, size_t length);
+
 /**
  * @brief Free the resources allocated for the given ringbuffer.
  * 
@@ -40,7 +107,20 @@ void ringbuf_free(ringbuffer_t * ringbuf);
 // TODO: return the number of samples actually written/read
 
 /**
- * @brief Push data to the ringbuffer. Overwrites oldest data in case of an overflow.
+ * @brief Statistics of a reader, see ringbuf_reader_get_stats.
+ * 
+ */
+typedef struct {
+    // Number of bytes the reader has not read yet
+    size_t lag;
+    // Number of times the reader was skipped ahead, and the number of bytes it lost, because they were overwritten
+    uint64_t overflows;
+    uint64_t overwritten;
+} ringbuf_reader_stats_t;
+
+/**
+ * @brief Push data to the ringbuffer. Overwrites oldest data in case of an overflow, except the data a protected
+ *        reader has not read yet: the blocks which do not fit are dropped instead. Producer side.
  * 
  * @param dst The ringbuffer to which data must be pushed.
  * @param data The data to push.
@@ -52,7 +132,7 @@ void ringbuf_free(ringbuffer_t * ringbuf);
 size_t ringbuf_push(ringbuffer_t * dst, uint8_t * data, size_t block_size, size_t block_count, int * overflow_flag);
 
 /**
- * @brief Pop data from the ringbuffer.
+ * @brief Pop data from the ringbuffer. Consumer side. If the producer overwrote the oldest data, it is skipped.
  * 
  * @param src The ringbuffer from which data must be popped.
  * @param data The buffer to which output the data. Has to be large enough.
@@ -62,10 +142,89 @@ size_t ringbuf_push(ringbuffer_t * dst, uint8_t * data, size_t block_size, size_
  */
 size_t ringbuf_pop(ringbuffer_t * src, uint8_t * data, size_t block_size, size_t block_count);
 
+/**
+ * @brief Get direct access to the oldest data of the ringbuffer, without copying it. Consumer side.
+ *        The data is split in up to two spans if it wraps around the end of the buffer. It stays in the
+ *        ringbuffer until ringbuf_release is called.
+ * 
+ * @param src The ringbuffer from which data must be acquired.
+ * @param spans The spans pointing to the data. The second one has a count of 0 if the data does not wrap around.
+ * @param block_size The size of each block of data.
+ * @param block_count The max number of blocks to acquire.
+ * @return size_t The number of blocks acquired, sum of the counts of both spans.
+ */
+size_t ringbuf_acquire(ringbuffer_t * src, ringbuf_span_t spans[2], size_t block_size, size_t block_count);
+
+/**
+ * @brief Release data previously acquired with ringbuf_acquire, making room for the producer. Consumer side.
+ *        Since the producer never waits, it may have overwritten the acquired data in the meantime in case of an
+ *        overflow, the caller must then discard the data it got from the spans. Only the overwritten blocks are
+ *        released then, the valid ones stay in the ringbuffer to be acquired again.
+ * 
+ * @param src The ringbuffer from which data was acquired.
+ * @param block_size The size of each block of data.
+ * @param block_count The number of blocks to release, at most the number of blocks acquired.
+ * @return size_t The number of blocks, starting from the first one, which may have been overwritten, and which were
+ *         released. 0 if all are valid and all were released.
+ */
+size_t ringbuf_release(ringbuffer_t * src, size_t block_size, size_t block_count);
+
 /**
  * @brief Get the length of a ringbuffer.
  * 
  * @param buf The ringbuffer of which we seek the length.
  * @return size_t The length of the ringbuffer. 0 if empty, buf -> maxLength if it is full.
  */
-size_t ringbuf_len(ringbuffer_t * buf);
\ No newline at end of file
+size_t ringbuf_len(ringbuffer_t * buf);
+
+/**
+ * @brief Register a new reader, which starts at the current end of the data. Can be called from any thread.
+ * 
+ * @param buf The ringbuffer.
+ * @param policy What happens when the producer has no room left, RINGBUF_READER_SKIP or RINGBUF_READER_PROTECT.
+ * @return int The reader, to pass to the ringbuf_reader_* functions, or -1 if RINGBUF_MAX_READERS are registered.
+ */
+int ringbuf_reader_add(ringbuffer_t * buf, int policy);
+
+/**
+ * @brief Unregister a reader, the producer no longer takes it into account. Its consumer must no longer use it.
+ * 
+ * @param buf The ringbuffer.
+ * @param reader The reader.
+ */
+void ringbuf_reader_remove(ringbuffer_t * buf, int reader);
+
+/**
+ * @brief Same as ringbuf_pop, for the given reader.
+ * 
+ */
+size_t ringbuf_reader_pop(ringbuffer_t * src, int reader, uint8_t * data, size_t block_size, size_t block_count);
+
+/**
+ * @brief Same as ringbuf_acquire, for the given reader.
+ * 
+ */
+size_t ringbuf_reader_acquire(ringbuffer_t * src, int reader, ringbuf_span_t spans[2], size_t block_size, size_t block_count);
+
+/**
+ * @brief Same as ringbuf_release, for the given reader.
+ * 
+ */
+size_t ringbuf_reader_release(ringbuffer_t * src, int reader, size_t block_size, size_t block_count);
+
+/**
+ * @brief Same as ringbuf_len, for the given reader.
+ * 
+ */
+size_t ringbuf_reader_len(ringbuffer_t * buf, int reader);
+
+/**
+ * @brief Get the statistics of a reader. Can be called from any thread.
+ * 
+ * @param buf The ringbuffer.
+ * @param reader The reader.
+ * @param stats The structure to which the statistics are written.
+ */
+void ringbuf_reader_get_stats(ringbuffer_t * buf, int reader, ringbuf_reader_stats_t * stats);
+
+#endif
@@ -2,8 +2,32 @@
 #include <stdlib.h>
 #include <time.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
 #include "ringbuffer.h"
 
+#define SPSC_NBLOCKS 200000
+#define SPSC_CHAN 6
+
+
+// Producer for the SPSC test, pushes blocks of SPSC_CHAN words all equal to the block index
+void * spsc_producer(void * arg) {
+    ringbuffer_t * ringbuf = (ringbuffer_t *) arg;
+    int overflow;
+    uint32_t block[SPSC_CHAN];
+    for (uint32_t i = 0; i < SPSC_NBLOCKS; ++i) {
+        for (size_t c = 0; c < SPSC_CHAN; ++c) {
+            block[c] = i;
+        }
+        ringbuf_push(ringbuf, (uint8_t *) block, sizeof(block), 1, &overflow);
+        // Give the consumer a chance to run, even on a single core
+        if (i % 32 == 0) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
 
 int main(void) {
     int overflow;
@@ -135,6 +159,170 @@ int main(void) {
     }
     
     ringbuf_free(huge_buffer);
+
+    printf("TEST: Popping after an overflow returns the most recent data, in order: ");
+    ringbuffer_t * small_buffer = ringbuf_create(4, 10);
+    if (small_buffer == NULL) {
+        fprintf(stderr, "\nERROR: ringbuffer could not be created for test.\n");
+        return 1;
+    }
+    uint32_t words[12];
+    for (uint32_t i = 0; i < 12; ++i) {
+        words[i] = i;
+    }
+    ringbuf_push(small_buffer, (uint8_t *) words, 4, 7, &overflow);
+    ringbuf_push(small_buffer, (uint8_t *) &words[7], 4, 5, &overflow);
+    uint32_t out_words[12];
+    read = ringbuf_pop(small_buffer, (uint8_t *) out_words, 4, 12);
+    success = overflow && read == 10;
+    for (size_t i = 0; i < read; ++i) {
+        if (out_words[i] != i + 2) {
+            success = 0;
+        }
+    }
+    if (success) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! Read %zu words, overflow flag: %d\n", read, overflow);
+    }
+    ringbuf_free(small_buffer);
+
+    printf("TEST: Acquiring data which wraps around gives two spans over the same data, releasing frees it: ");
+    ringbuffer_t * span_buffer = ringbuf_create(4, 10);
+    if (span_buffer == NULL) {
+        fprintf(stderr, "\nERROR: ringbuffer could not be created for test.\n");
+        return 1;
+    }
+    ringbuf_push(span_buffer, (uint8_t *) words, 4, 6, &overflow);
+    ringbuf_pop(span_buffer, (uint8_t *) out_words, 4, 6);
+    ringbuf_push(span_buffer, (uint8_t *) words, 4, 8, &overflow);
+    ringbuf_span_t spans[2];
+    size_t acquired = ringbuf_acquire(span_buffer, spans, 4, 12);
+    success = acquired == 8 && spans[0].count == 4 && spans[1].count == 4;
+    for (size_t i = 0; success && i < 8; ++i) {
+        const uint32_t * span_words = (const uint32_t *) spans[i / 4].data;
+        if (span_words[i % 4] != i) {
+            success = 0;
+        }
+    }
+    success = success && ringbuf_release(span_buffer, 4, acquired) == 0 && ringbuf_len(span_buffer) == 0;
+    if (success) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! Acquired %zu blocks in spans of %zu and %zu\n", acquired, spans[0].count, spans[1].count);
+    }
+
+    printf("TEST: Releasing acquired data which got overwritten in the meantime reports it, and keeps the valid data: ");
+    ringbuf_push(span_buffer, (uint8_t *) words, 4, 10, &overflow);
+    acquired = ringbuf_acquire(span_buffer, spans, 4, 10);
+    ringbuf_push(span_buffer, (uint8_t *) words, 4, 3, &overflow);
+    const size_t overwritten = ringbuf_release(span_buffer, 4, acquired);
+    ringbuf_reader_stats_t span_stats;
+    ringbuf_reader_get_stats(span_buffer, 0, &span_stats);
+    const size_t reacquired = ringbuf_acquire(span_buffer, spans, 4, 10);
+    if (acquired == 10 && overwritten == 3 && span_stats.overwritten == 3 * 4 && reacquired == 10
+        && ((const uint32_t *) spans[0].data)[0] == 3) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! Acquired %zu blocks, %zu reported overwritten, %zu acquired again\n", acquired, overwritten, reacquired);
+    }
+    ringbuf_free(span_buffer);
+
+    printf("TEST: Several readers each get all the data, independently of each other: ");
+    ringbuffer_t * multi_buffer = ringbuf_create(4, 10);
+    if (multi_buffer == NULL) {
+        fprintf(stderr, "\nERROR: ringbuffer could not be created for test.\n");
+        return 1;
+    }
+    const int second = ringbuf_reader_add(multi_buffer, RINGBUF_READER_SKIP);
+    ringbuf_push(multi_buffer, (uint8_t *) words, 4, 6, &overflow);
+    uint32_t second_words[12];
+    success = second > 0 && ringbuf_pop(multi_buffer, (uint8_t *) out_words, 4, 6) == 6
+              && ringbuf_reader_pop(multi_buffer, second, (uint8_t *) second_words, 4, 2) == 2
+              && ringbuf_reader_pop(multi_buffer, second, (uint8_t *) &second_words[2], 4, 6) == 4
+              && ringbuf_len(multi_buffer) == 0 && ringbuf_reader_len(multi_buffer, second) == 0;
+    for (size_t i = 0; success && i < 6; ++i) {
+        success = out_words[i] == i && second_words[i] == i;
+    }
+    if (success) {
+        printf("Success!\n");
+    } else {
+        printf("Failure!\n");
+    }
+
+    printf("TEST: A protected reader is never overwritten, the producer drops what does not fit and skips other readers: ");
+    const int protected = ringbuf_reader_add(multi_buffer, RINGBUF_READER_PROTECT);
+    ringbuf_push(multi_buffer, (uint8_t *) words, 4, 10, &overflow);
+    ringbuf_reader_pop(multi_buffer, protected, (uint8_t *) out_words, 4, 4);
+    // Only 4 of these fit without overwriting what the protected reader has not read yet
+    const size_t pushed = ringbuf_push(multi_buffer, (uint8_t *) words, 4, 8, &overflow);
+    read = ringbuf_reader_pop(multi_buffer, protected, (uint8_t *) out_words, 4, 12);
+    ringbuf_reader_stats_t stats, protected_stats;
+    ringbuf_reader_get_stats(multi_buffer, second, &stats);
+    const size_t second_read = ringbuf_reader_pop(multi_buffer, second, (uint8_t *) second_words, 4, 12);
+    ringbuf_reader_get_stats(multi_buffer, second, &stats);
+    ringbuf_reader_get_stats(multi_buffer, protected, &protected_stats);
+    success = protected > 0 && pushed == 4 && overflow == 1 && read == 10 && second_read == 10
+              && atomic_load(&(multi_buffer -> dropped)) == 16 && stats.overflows == 1 && stats.overwritten == 16
+              && protected_stats.overflows == 0 && protected_stats.lag == 0;
+    // Both readers get the last 6 words of the first push, then the first 4 words of the second one
+    for (size_t i = 0; success && i < 10; ++i) {
+        const uint32_t expected = i < 6 ? i + 4 : i - 6;
+        success = out_words[i] == expected && second_words[i] == expected;
+    }
+    if (success) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! Pushed %zu, read %zu and %zu, %" PRIu64 " bytes overwritten\n", pushed, read, second_read, stats.overwritten);
+    }
+    printf("TEST: A removed reader no longer holds the producer back: ");
+    ringbuf_reader_remove(multi_buffer, protected);
+    ringbuf_push(multi_buffer, (uint8_t *) words, 4, 12, &overflow);
+    if (ringbuf_len(multi_buffer) == 40 && ringbuf_reader_add(multi_buffer, RINGBUF_READER_PROTECT) == protected) {
+        printf("Success!\n");
+    } else {
+        printf("Failure!\n");
+    }
+    ringbuf_free(multi_buffer);
+
+    printf("TEST: Concurrent producer and consumer never give out torn or reordered blocks: ");
+    ringbuffer_t * spsc_buffer = ringbuf_create(SPSC_CHAN * 4, 64);
+    if (spsc_buffer == NULL) {
+        fprintf(stderr, "\nERROR: ringbuffer could not be created for test.\n");
+        return 1;
+    }
+    pthread_t producer;
+    if (pthread_create(&producer, NULL, spsc_producer, spsc_buffer)) {
+        fprintf(stderr, "\nERROR: producer thread could not be created for test.\n");
+        return 1;
+    }
+    uint32_t blocks[16][SPSC_CHAN];
+    int64_t last = -1;
+    size_t torn = 0, reordered = 0, received = 0;
+    while (last < SPSC_NBLOCKS - 1) {
+        // Vary the amount popped at once to exercise wrap-arounds
+        read = ringbuf_pop(spsc_buffer, (uint8_t *) blocks, SPSC_CHAN * 4, 1 + received % 16);
+        for (size_t b = 0; b < read; ++b) {
+            for (size_t c = 1; c < SPSC_CHAN; ++c) {
+                if (blocks[b][c] != blocks[b][0]) {
+                    torn += 1;
+                }
+            }
+            if ((int64_t) blocks[b][0] <= last) {
+                reordered += 1;
+            }
+            last = blocks[b][0];
+        }
+        received += read;
+    }
+    pthread_join(producer, NULL);
+    if (torn == 0 && reordered == 0) {
+        printf("Success! Received %zu/%d blocks\n", received, SPSC_NBLOCKS);
+    } else {
+        printf("Failure! %zu torn and %zu reordered blocks\n", torn, reordered);
+    }
+    ringbuf_free(spsc_buffer);
+
     printf("EXITING TESTING PROGRAM\n");
     
     return 0;
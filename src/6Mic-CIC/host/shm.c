@@ -0,0 +1,385 @@
+/**
+ * @brief Publishing of the capture through a POSIX shared memory segment, see shm.h.
+ *
+ * @author Loïc Droz <lk.droz@gmail.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "shm.h"
+
+
+static size_t round_up(size_t size, size_t page_size)
+{
+    return (size + page_size - 1) / page_size * page_size;
+}
+
+
+static int64_t timespec_to_ns(const struct timespec * ts)
+{
+    return (int64_t) ts -> tv_sec * 1000000000 + ts -> tv_nsec;
+}
+
+
+static struct timespec ns_to_timespec(int64_t ns)
+{
+    struct timespec ts = { .tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000 };
+    return ts;
+}
+
+
+// The futex is shared between processes, so no FUTEX_PRIVATE_FLAG
+static long futex(_Atomic uint32_t * word, int op, uint32_t val, const struct timespec * timeout)
+{
+    return syscall(SYS_futex, (uint32_t *) word, op, val, timeout, NULL, 0);
+}
+
+
+shm_header_t * shm_create(const char * name, size_t data_len, size_t nstamps)
+{
+    if (name == NULL || name[0] != '/' || strlen(name) >= SHM_NAME_MAX) {
+        fprintf(stderr, "Error! Invalid shared memory segment name.\n");
+        return NULL;
+    }
+
+    // Header, frames and stamps each start on a page
+    const size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    const size_t data_offset = round_up(sizeof(shm_header_t), page_size);
+    const size_t stamps_offset = data_offset + round_up(data_len, page_size);
+    const size_t map_len = stamps_offset + round_up(nstamps * sizeof(shm_stamp_t), page_size);
+
+    // Replace the segment a crashed capture may have left, its clients keep their mapping of the old one
+    shm_unlink(name);
+    const int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error! Could not create the shared memory segment %s.\n", name);
+        return NULL;
+    }
+    if (ftruncate(fd, (off_t) map_len)) {
+        fprintf(stderr, "Error! Could not allocate %zu bytes of shared memory.\n", map_len);
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    void * map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error! Could not map the shared memory segment %s.\n", name);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    // The segment is zeroed, the magic number stays 0 until shm_publish
+    shm_header_t * shm = (shm_header_t *) map;
+    strcpy(shm -> name, name);
+    shm -> version = SHM_VERSION;
+    shm -> map_len = map_len;
+    shm -> data_offset = data_offset;
+    shm -> data_len = data_len;
+    shm -> stamps_offset = stamps_offset;
+    shm -> nstamps = nstamps;
+    ringbuf_init(&(shm -> ring), &(((uint8_t *) map)[data_offset]), data_len);
+    return shm;
+}
+
+
+void shm_publish(shm_header_t * shm)
+{
+    atomic_store(&(shm -> alive), 1);
+    atomic_store_explicit(&(shm -> magic), SHM_MAGIC, memory_order_release);
+}
+
+
+void shm_wake(shm_header_t * shm)
+{
+    // The clients cannot write to the segment to tell whether they wait, so always wake them up. This is one
+    // syscall per batch of periods.
+    atomic_fetch_add_explicit(&(shm -> wakeup), 1, memory_order_release);
+    futex(&(shm -> wakeup), FUTEX_WAKE, INT_MAX, NULL);
+}
+
+
+void shm_destroy(shm_header_t * shm)
+{
+    atomic_store(&(shm -> alive), 0);
+    shm_wake(shm);
+    shm_unlink(shm -> name);
+    munmap(shm, shm -> map_len);
+}
+
+
+shm_client_t * shm_client_open(const char * name)
+{
+    const int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Error! Could not open the shared memory segment %s, is the capture running?\n", name);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || (size_t) st.st_size < sizeof(shm_header_t)) {
+        fprintf(stderr, "Error! The shared memory segment %s is not ready.\n", name);
+        close(fd);
+        return NULL;
+    }
+    void * map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error! Could not map the shared memory segment %s.\n", name);
+        return NULL;
+    }
+
+    const shm_header_t * header = (const shm_header_t *) map;
+    if (atomic_load_explicit(&(header -> magic), memory_order_acquire) != SHM_MAGIC || header -> version != SHM_VERSION
+        || header -> map_len > (uint64_t) st.st_size) {
+        fprintf(stderr, "Error! The shared memory segment %s is not a published capture of this version.\n", name);
+        munmap(map, (size_t) st.st_size);
+        return NULL;
+    }
+
+    shm_client_t * client = calloc(1, sizeof(shm_client_t));
+    if (client == NULL) {
+        fprintf(stderr, "Error! Memory for shared memory client could not be allocated.\n");
+        munmap(map, (size_t) st.st_size);
+        return NULL;
+    }
+    client -> header = header;
+    client -> map_len = (size_t) st.st_size;
+    client -> data = &(((const uint8_t *) map)[header -> data_offset]);
+    client -> stamps = (const shm_stamp_t *) &(((const uint8_t *) map)[header -> stamps_offset]);
+    if (header -> sample_format != PCM_FORMAT_RAW) {
+        client -> unpacked = calloc(SHM_UNPACK_FRAMES * header -> nchan, sizeof(uint32_t));
+        if (client -> unpacked == NULL) {
+            fprintf(stderr, "Error! Memory for unpacking the samples could not be allocated.\n");
+            munmap(map, (size_t) st.st_size);
+            free(client);
+            return NULL;
+        }
+    }
+    client -> tail = atomic_load_explicit(&(header -> ring.head), memory_order_acquire);
+    return client;
+}
+
+
+void shm_client_close(shm_client_t * client)
+{
+    munmap((void *) client -> header, client -> map_len);
+    free(client -> unpacked);
+    free(client);
+}
+
+
+size_t shm_client_available(shm_client_t * client)
+{
+    const ringbuffer_t * ring = &(client -> header -> ring);
+    const uint64_t head = atomic_load_explicit(&(ring -> head), memory_order_acquire);
+    size_t available = (size_t) (head - client -> tail);
+    // The client may not have noticed an overflow yet
+    if (available > ring -> maxLength) {
+        available = ring -> maxLength;
+    }
+    return available / client -> header -> frame_size;
+}
+
+
+size_t shm_client_wait(shm_client_t * client, size_t nframes, int timeout_ms)
+{
+    const shm_header_t * header = client -> header;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const int64_t deadline = timespec_to_ns(&now) + (int64_t) timeout_ms * 1000000;
+
+    while (1) {
+        // Read the futex word before checking, a wakeup in between makes the wait return at once
+        const uint32_t wakeup = atomic_load_explicit(&(header -> wakeup), memory_order_acquire);
+        const size_t available = shm_client_available(client);
+        if (available >= nframes || !atomic_load(&(header -> alive))) {
+            return available;
+        }
+
+        struct timespec timeout;
+        const struct timespec * timeout_ptr = NULL;
+        if (timeout_ms >= 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            const int64_t remaining = deadline - timespec_to_ns(&now);
+            if (remaining <= 0) {
+                return available;
+            }
+            timeout = ns_to_timespec(remaining);
+            timeout_ptr = &timeout;
+        }
+        futex((_Atomic uint32_t *) &(header -> wakeup), FUTEX_WAIT, wakeup, timeout_ptr);
+    }
+}
+
+
+// Skip the client ahead to the given position, past frames which were overwritten
+static void shm_client_skip(shm_client_t * client, uint64_t new_tail)
+{
+    client -> overflows += 1;
+    client -> overwritten += new_tail - client -> tail;
+    client -> tail = new_tail;
+}
+
+
+size_t shm_client_acquire(shm_client_t * client, shm_span_t spans[2], size_t nframes)
+{
+    const ringbuffer_t * ring = &(client -> header -> ring);
+    const size_t frame_size = client -> header -> frame_size;
+    const uint64_t head = atomic_load_explicit(&(ring -> head), memory_order_acquire);
+    const uint64_t reserve = atomic_load_explicit(&(ring -> reserve), memory_order_relaxed);
+    // Skip the frames which have been, or are being, overwritten
+    if (reserve - client -> tail > ring -> maxLength) {
+        shm_client_skip(client, reserve - ring -> maxLength);
+    }
+
+    const size_t available_bytes = (size_t) (head - client -> tail);
+    size_t to_acquire = nframes * frame_size > available_bytes ? available_bytes : nframes * frame_size;
+    to_acquire -= to_acquire % frame_size;
+
+    // Split the frames in 2 if they loop back to the beginning of the buffer
+    const size_t tail_idx = (size_t) (client -> tail % ring -> maxLength);
+    const size_t first_half_len = (ring -> maxLength - tail_idx) > to_acquire ? to_acquire : (ring -> maxLength - tail_idx);
+    spans[0].data = &(client -> data[tail_idx]);
+    spans[0].nframes = first_half_len / frame_size;
+    spans[1].data = client -> data;
+    spans[1].nframes = (to_acquire - first_half_len) / frame_size;
+    return to_acquire / frame_size;
+}
+
+
+size_t shm_client_release(shm_client_t * client, size_t nframes)
+{
+    const ringbuffer_t * ring = &(client -> header -> ring);
+    const size_t frame_size = client -> header -> frame_size;
+    const size_t to_release = nframes * frame_size;
+
+    // Check whether the capture went past the released frames while the client was using them, like
+    // ringbuf_release only release the overwritten frames then
+    atomic_thread_fence(memory_order_acquire);
+    const uint64_t reserve = atomic_load_explicit(&(ring -> reserve), memory_order_relaxed);
+    if (reserve > client -> tail + ring -> maxLength) {
+        size_t overwritten = (size_t) (reserve - ring -> maxLength - client -> tail);
+        overwritten = overwritten > to_release ? to_release : overwritten;
+        overwritten += (frame_size - overwritten % frame_size) % frame_size;
+        client -> overflows += 1;
+        client -> overwritten += overwritten;
+        client -> tail += overwritten;
+        return overwritten / frame_size;
+    }
+
+    client -> tail += to_release;
+    return 0;
+}
+
+
+// Capture time of the frame at the given position of the stream, like pcm_read_timestamp
+static int shm_frame_time(const shm_client_t * client, uint64_t frame, struct timespec * ts)
+{
+    const shm_header_t * header = client -> header;
+    const uint64_t nstamps = header -> nstamps;
+    const uint64_t head = atomic_load_explicit(&(header -> stamps_head), memory_order_acquire);
+    // The oldest stamp may be being overwritten
+    uint64_t low = head > nstamps - 1 ? head - (nstamps - 1) : 0;
+    uint64_t high = head;
+    if (low == high || client -> stamps[low % nstamps].frame > frame) {
+        return -1;
+    }
+
+    // The stamps are in the order of the frames, find the last one at or before the frame
+    while (high - low > 1) {
+        const uint64_t mid = low + (high - low) / 2;
+        if (client -> stamps[mid % nstamps].frame <= frame) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    const shm_stamp_t * stamp = &(client -> stamps[low % nstamps]);
+    const int64_t elapsed_ns = (int64_t) ((frame - stamp -> frame) * 1000000000 / header -> sample_rate);
+    *ts = ns_to_timespec(timespec_to_ns(&(stamp -> time)) + elapsed_ns);
+    return 0;
+}
+
+
+// Acquire and release frames of a client for convert_consume
+static size_t shm_source_acquire(void * ctx, const void * data[2], size_t counts[2], size_t nframes, uint64_t * first)
+{
+    shm_client_t * client = (shm_client_t *) ctx;
+    shm_span_t spans[2];
+    const size_t acquired = shm_client_acquire(client, spans, nframes);
+    *first = client -> tail / client -> header -> frame_size;
+    for (size_t s = 0; s < 2; ++s) {
+        data[s] = spans[s].data;
+        counts[s] = spans[s].nframes;
+    }
+    return acquired;
+}
+
+
+static size_t shm_source_release(void * ctx, size_t nframes)
+{
+    return shm_client_release((shm_client_t *) ctx, nframes);
+}
+
+
+// Gathers and converts the selected channels of the frames passed by convert_consume
+typedef struct {
+    const shm_header_t * header;
+    const uint8_t * chans;
+    size_t nsel;
+    pcm_format_t format;
+    uint8_t * dst;
+    size_t out_size;
+} shm_gather_t;
+
+
+static void shm_gather(void * arg, const uint32_t * frames, size_t n, size_t done)
+{
+    const shm_gather_t * gather = (const shm_gather_t *) arg;
+    convert_gather(frames, n, gather -> header -> nchan, gather -> chans, gather -> nsel,
+                   &(gather -> dst[gather -> out_size * done]), gather -> format, &(gather -> header -> convert));
+}
+
+
+size_t shm_client_read(shm_client_t * client, void * dst, size_t nframes, uint32_t chan_mask, pcm_format_t format,
+                       struct timespec * ts)
+{
+    const shm_header_t * header = client -> header;
+    uint8_t chans[CONVERT_MAX_CHAN];
+    const size_t nsel = convert_mask_to_chans(chan_mask, header -> nchan, chans);
+    if (nsel == 0 || convert_format_size(format) == 0) {
+        fprintf(stderr, "Error! Invalid channel mask or sample format.\n");
+        return 0;
+    }
+
+    // Gather and convert straight from the segment, if the capture overwrote some frames in the meantime the valid
+    // and the most recent frames are converted instead
+    const convert_source_t source = {
+        .ctx = client,
+        .acquire = shm_source_acquire,
+        .release = shm_source_release,
+        .nchan = header -> nchan,
+        .format = header -> sample_format,
+        .params = &(header -> convert),
+        .unpacked = client -> unpacked,
+        .unpack_frames = SHM_UNPACK_FRAMES,
+    };
+    shm_gather_t gather = { .header = header, .chans = chans, .nsel = nsel, .format = format, .dst = (uint8_t *) dst,
+                            .out_size = convert_format_size(format) * nsel };
+    uint64_t first_frame;
+    const size_t read = convert_consume(&source, nframes, shm_gather, NULL, &gather, &first_frame);
+
+    if (ts != NULL && read > 0 && shm_frame_time(client, first_frame, ts) != 0) {
+        fprintf(stderr, "Warning! No capture time for the frames read.\n");
+    }
+    return read;
+}
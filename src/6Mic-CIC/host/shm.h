@@ -0,0 +1,217 @@
+/**
+ * @brief Publishing of the capture to other processes through a POSIX shared memory segment, and the client side
+ *        used by those processes to read the frames in place.
+ *
+ *        The segment holds a header, the ringbuffer of the capture and the capture timestamps. The capture process
+ *        creates it with shm_create and its ringbuffer lives in it, see pcm_config_t.shm_name, so publishing costs
+ *        no copy at all. Clients map it read-only with shm_client_open and follow the writes with their own
+ *        position, like a RINGBUF_READER_SKIP reader: the capture never waits for them, a client which falls
+ *        behind skips the frames which were overwritten. The capture wakes the clients up through a futex in the
+ *        header after each batch of periods.
+ *
+ *        The client side only needs shm.c, convert.c and their headers.
+ *
+ * @author Loïc Droz <lk.droz@gmail.com>
+ *
+ */
+
+#ifndef SHM_H
+#define SHM_H
+
+#include <stddef.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "ringbuffer.h"
+#include "convert.h"
+
+// Identifies a segment of this layout, "PRUA", and the version of the layout
+#define SHM_MAGIC 0x50525541
+#define SHM_VERSION 2
+// Name of the segment published by the capture daemon, see /dev/shm
+#define SHM_DEFAULT_NAME "/pru-audio"
+// Max length of the name of a segment, including the leading '/'
+#define SHM_NAME_MAX 64
+// Max number of frames unpacked at once by shm_client_read, if the samples are packed
+#define SHM_UNPACK_FRAMES 1024
+
+/**
+ * @brief Capture time of a frame, see pcm_read_timestamp. Same layout as pcm_stamp_t.
+ *
+ */
+typedef struct {
+    // Position of the frame in the stream
+    uint64_t frame;
+    // CLOCK_MONOTONIC time at which the frame was captured
+    struct timespec time;
+} shm_stamp_t;
+
+/**
+ * @brief Header at the start of the segment. Written by the capture process only, the clients map it read-only.
+ *
+ */
+typedef struct {
+    // SHM_MAGIC and SHM_VERSION, set last by shm_create
+    _Atomic uint32_t magic;
+    uint32_t version;
+    // Name of the segment
+    char name[SHM_NAME_MAX];
+    // Format of the frames: nchan interleaved samples in sample_format, raw or packed, see pcm_config_t.buffer_format
+    uint32_t nchan;
+    uint32_t sample_rate;
+    pcm_format_t sample_format;
+    uint32_t frame_size;
+    uint32_t period_frames;
+    convert_params_t convert;
+    // Layout of the segment: frames of the ringbuffer and capture timestamps, from the start of the segment
+    uint64_t map_len;
+    uint64_t data_offset;
+    uint64_t data_len;
+    uint64_t stamps_offset;
+    uint64_t nstamps;
+    // Number of stamps ever written, the last one at stamps_head - 1
+    _Atomic uint64_t stamps_head;
+    // Sequence number of the last period published by the firmware, and the number of periods lost so far
+    _Atomic uint32_t sequence;
+    _Atomic uint64_t periods_lost;
+    // Futex word, incremented after each batch of periods and when the capture closes
+    _Atomic uint32_t wakeup;
+    // Non-zero while the capture process publishes
+    _Atomic uint32_t alive;
+    // The ringbuffer of the capture. Its data pointer is only valid in the capture process, clients use data_offset.
+    ringbuffer_t ring;
+} shm_header_t;
+
+/**
+ * @brief Create a segment and map it read-write, for the capture process. Its ringbuffer is initialized empty,
+ *        the caller fills in the format of the frames, then calls shm_publish. A stale segment of the same name,
+ *        left by a capture process which crashed, is replaced.
+ *
+ * @param name The name of the segment, starting with '/', e.g. SHM_DEFAULT_NAME.
+ * @param data_len The size of the ringbuffer in bytes.
+ * @param nstamps The number of capture timestamps kept.
+ * @return shm_header_t* The header of the mapped segment in case of success, NULL otherwise.
+ */
+shm_header_t * shm_create(const char * name, size_t data_len, size_t nstamps);
+
+/**
+ * @brief Let clients open the segment, once the format of the frames is filled in.
+ *
+ * @param shm The segment.
+ */
+void shm_publish(shm_header_t * shm);
+
+/**
+ * @brief Wake up the clients waiting for frames. Called by the capture thread after each batch of periods.
+ *
+ * @param shm The segment.
+ */
+void shm_wake(shm_header_t * shm);
+
+/**
+ * @brief Tell the clients the capture is over, then unmap and remove the segment. The clients keep their mapping
+ *        until they close it.
+ *
+ * @param shm The segment.
+ */
+void shm_destroy(shm_header_t * shm);
+
+/**
+ * @brief A client of a segment, used by a single thread.
+ *
+ */
+typedef struct {
+    // The read-only mapping of the segment
+    const shm_header_t * header;
+    size_t map_len;
+    const uint8_t * data;
+    const shm_stamp_t * stamps;
+    // Position of the client, the number of bytes it ever read or skipped
+    uint64_t tail;
+    // Number of times the client was skipped ahead, and the number of bytes it lost, because they were overwritten
+    uint64_t overflows;
+    uint64_t overwritten;
+    // Buffer into which shm_client_read unpacks up to SHM_UNPACK_FRAMES frames, if the samples are packed
+    uint32_t * unpacked;
+} shm_client_t;
+
+/**
+ * @brief A contiguous run of interleaved frames, pointing straight into the segment, as returned by shm_client_acquire.
+ *
+ */
+typedef struct {
+    const void * data;
+    size_t nframes;
+} shm_span_t;
+
+/**
+ * @brief Map a segment read-only. The client starts at the current end of the frames.
+ *
+ * @param name The name of the segment, e.g. SHM_DEFAULT_NAME.
+ * @return shm_client_t* A new client in case of success, NULL if the segment does not exist or is not published yet.
+ */
+shm_client_t * shm_client_open(const char * name);
+
+/**
+ * @brief Unmap the segment and free the client.
+ *
+ * @param client The client.
+ */
+void shm_client_close(shm_client_t * client);
+
+/**
+ * @brief Get the number of frames the client has not read yet.
+ *
+ * @param client The client.
+ * @return size_t The number of frames available.
+ */
+size_t shm_client_available(shm_client_t * client);
+
+/**
+ * @brief Block until at least nframes frames are available, the timeout expires or the capture closes.
+ *
+ * @param client The client.
+ * @param nframes The number of frames to wait for.
+ * @param timeout_ms The max time to wait in milliseconds, negative to wait forever.
+ * @return size_t The number of frames available, may be less than nframes.
+ */
+size_t shm_client_wait(shm_client_t * client, size_t nframes, int timeout_ms);
+
+/**
+ * @brief Get direct access to the oldest frames the client has not read, without copying them. Same as
+ *        ringbuf_acquire: the frames may be overwritten while the client uses them, shm_client_release tells.
+ *        The samples are in the sample_format of the header, convert_unpack gives the raw words back.
+ *
+ * @param client The client.
+ * @param spans The spans pointing to the frames. The second one has 0 frames if they do not wrap around.
+ * @param nframes The max number of frames to acquire.
+ * @return size_t The number of frames acquired.
+ */
+size_t shm_client_acquire(shm_client_t * client, shm_span_t spans[2], size_t nframes);
+
+/**
+ * @brief Release frames acquired with shm_client_acquire. Like ringbuf_release, if some of them were overwritten,
+ *        only those are released, and the client must discard what it got from all of them.
+ *
+ * @param client The client.
+ * @param nframes The number of frames to release, at most the number of frames acquired.
+ * @return size_t The number of frames, starting from the first one, which may have been overwritten, and which were
+ *         released. 0 if all are valid and all were released.
+ */
+size_t shm_client_release(shm_client_t * client, size_t nframes);
+
+/**
+ * @brief Read frames and convert the selected channels, like pcm_read_timestamp.
+ *
+ * @param client The client.
+ * @param dst The output buffer, nframes frames of the selected channels in the given format.
+ * @param nframes The max number of frames to read.
+ * @param chan_mask The channels to read, bit c selects channel c (0-based).
+ * @param format The output sample format.
+ * @param ts If not NULL, receives the capture time of the first frame read.
+ * @return size_t The number of frames read.
+ */
+size_t shm_client_read(shm_client_t * client, void * dst, size_t nframes, uint32_t chan_mask, pcm_format_t format,
+                       struct timespec * ts);
+
+#endif
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "shm.h"
+
+#define NAME "/pru-audio-tests"
+#define NCHAN 6
+#define FRAME_SIZE (NCHAN * 4)
+#define RING_FRAMES 1000
+#define PUSH_FRAMES 100
+#define CHILD_FRAMES 20000
+
+static uint32_t frames[RING_FRAMES * NCHAN];
+static uint32_t out[RING_FRAMES * NCHAN];
+
+
+// Frames holding their position in the stream in each sample
+static void fill(uint64_t first, size_t nframes)
+{
+    for (size_t f = 0; f < nframes; ++f) {
+        for (size_t c = 0; c < NCHAN; ++c) {
+            frames[f * NCHAN + c] = (uint32_t) (first + f);
+        }
+    }
+}
+
+
+// Push frames and their stamp like the capture thread does, the frame at position n was captured at n ms
+static void push(shm_header_t * shm, size_t nframes)
+{
+    int overflow;
+    const uint64_t first = atomic_load(&(shm -> ring.head)) / FRAME_SIZE;
+    const uint64_t stamp = atomic_load(&(shm -> stamps_head));
+    shm_stamp_t * stamps = (shm_stamp_t *) &(((uint8_t *) shm)[shm -> stamps_offset]);
+    stamps[stamp % shm -> nstamps].frame = first;
+    stamps[stamp % shm -> nstamps].time.tv_sec = first / 1000;
+    stamps[stamp % shm -> nstamps].time.tv_nsec = (first % 1000) * 1000000;
+    atomic_store(&(shm -> stamps_head), stamp + 1);
+    fill(first, nframes);
+    ringbuf_push(&(shm -> ring), (uint8_t *) frames, FRAME_SIZE, nframes, &overflow);
+}
+
+
+static void * late_pusher(void * arg)
+{
+    shm_header_t * shm = (shm_header_t *) arg;
+    usleep(50000);
+    push(shm, PUSH_FRAMES);
+    shm_wake(shm);
+    return NULL;
+}
+
+
+// Read the stream from another process, returns the number of frames which did not hold their position
+static int child(void)
+{
+    shm_client_t * client = shm_client_open(NAME);
+    if (client == NULL) {
+        return 1;
+    }
+    uint64_t expected = client -> tail / FRAME_SIZE;
+    size_t errors = 0, nread = 0;
+    while (nread < CHILD_FRAMES) {
+        if (shm_client_wait(client, PUSH_FRAMES, 2000) == 0) {
+            errors += 1;
+            break;
+        }
+        shm_span_t spans[2];
+        const size_t n = shm_client_acquire(client, spans, RING_FRAMES);
+        for (size_t s = 0; s < 2; ++s) {
+            const uint32_t * span = (const uint32_t *) spans[s].data;
+            for (size_t f = 0; f < spans[s].nframes; ++f) {
+                errors += span[f * NCHAN + NCHAN - 1] != (uint32_t) expected++;
+            }
+        }
+        errors += shm_client_release(client, n) != 0;
+        nread += n;
+    }
+    shm_client_close(client);
+    return errors != 0;
+}
+
+
+int main(void) {
+    printf("\nSTARTING SHARED MEMORY TESTING PROGRAM!\n");
+
+    printf("TEST: A segment cannot be opened before it is published: ");
+    shm_header_t * shm = shm_create(NAME, RING_FRAMES * FRAME_SIZE, 64);
+    shm -> nchan = NCHAN;
+    shm -> sample_rate = 1000;
+    shm -> frame_size = FRAME_SIZE;
+    convert_params_init(&(shm -> convert), 16);
+    shm_client_t * client = shm_client_open(NAME);
+    if (shm != NULL && client == NULL) {
+        printf("Success!\n");
+    } else {
+        printf("Failure!\n");
+    }
+
+    printf("TEST: A client reads the frames pushed after it opened the segment, with their capture time: ");
+    push(shm, PUSH_FRAMES);
+    shm_publish(shm);
+    client = shm_client_open(NAME);
+    push(shm, PUSH_FRAMES);
+    push(shm, PUSH_FRAMES);
+    struct timespec ts;
+    size_t read = shm_client_read(client, out, RING_FRAMES, 0x3F, PCM_FORMAT_RAW, &ts);
+    fill(PUSH_FRAMES, 2 * PUSH_FRAMES);
+    if (read == 2 * PUSH_FRAMES && memcmp(out, frames, read * FRAME_SIZE) == 0
+        && ts.tv_sec == 0 && ts.tv_nsec == PUSH_FRAMES * 1000000) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! %zu frames read\n", read);
+    }
+
+    printf("TEST: A client which falls behind skips the overwritten frames: ");
+    for (size_t p = 0; p < 15; ++p) {
+        push(shm, PUSH_FRAMES);
+    }
+    read = shm_client_read(client, out, RING_FRAMES, 0x20, PCM_FORMAT_RAW, &ts);
+    // 3 + 15 pushes in total, the last 10 fit in the ringbuffer
+    if (read == RING_FRAMES && out[0] == 8 * PUSH_FRAMES && client -> overwritten == 5 * PUSH_FRAMES * FRAME_SIZE
+        && ts.tv_sec == 0 && ts.tv_nsec == 8 * PUSH_FRAMES * 1000000) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! %zu frames read, first %u\n", read, out[0]);
+    }
+
+    printf("TEST: Waiting clients are woken up by new frames, and time out without: ");
+    pthread_t thread;
+    pthread_create(&thread, NULL, late_pusher, shm);
+    const size_t woken = shm_client_wait(client, PUSH_FRAMES, 1000);
+    pthread_join(thread, NULL);
+    shm_client_read(client, out, RING_FRAMES, 0x3F, PCM_FORMAT_RAW, NULL);
+    const size_t timed_out = shm_client_wait(client, 1, 20);
+    if (woken == PUSH_FRAMES && timed_out == 0) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! %zu and %zu frames\n", woken, timed_out);
+    }
+
+    printf("TEST: Another process reads the frames in place while they are pushed: ");
+    fflush(stdout);
+    const pid_t pid = fork();
+    if (pid == 0) {
+        _exit(child());
+    }
+    // Let the child open the segment, then push at about 200 periods per second
+    usleep(100000);
+    for (size_t p = 0; p < CHILD_FRAMES / PUSH_FRAMES + 10; ++p) {
+        push(shm, PUSH_FRAMES);
+        shm_wake(shm);
+        usleep(5000);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        printf("Success!\n");
+    } else {
+        printf("Failure!\n");
+    }
+
+    printf("TEST: Clients stop waiting once the segment is destroyed, and it can no longer be opened: ");
+    shm_client_read(client, out, RING_FRAMES, 0x3F, PCM_FORMAT_RAW, NULL);
+    shm_destroy(shm);
+    const size_t after_close = shm_client_wait(client, 1, -1);
+    shm_client_t * other = shm_client_open(NAME);
+    if (after_close == 0 && other == NULL) {
+        printf("Success!\n");
+    } else {
+        printf("Failure!\n");
+    }
+    shm_client_close(client);
+
+    printf("EXITING TESTING PROGRAM\n");
+    return 0;
+}
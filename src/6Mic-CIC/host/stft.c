@@ -0,0 +1,197 @@
+/**
+ * @brief Streaming STFT and log-mel features. Headers in stft.h.
+ *
+ *        The mel filterbank is stored as a sparse matrix, since each triangular band only covers a few bins:
+ *        applying it costs about two multiply-adds per bin instead of one per bin and band.
+ *
+ * @author Loïc Droz <lk.droz@gmail.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "stft.h"
+
+
+static double hz_to_mel(double f)
+{
+    return 2595.0 * log10(1.0 + f / 700.0);
+}
+
+
+static double mel_to_hz(double m)
+{
+    return 700.0 * (pow(10.0, m / 2595.0) - 1.0);
+}
+
+
+// Triangular mel bands between min_freq and max_freq, evenly spaced on the mel scale
+static int stft_mel_init(stft_t * stft, const stft_config_t * config, size_t sample_rate)
+{
+    const size_t nbins = stft -> fft_size / 2 + 1;
+    const double max_freq = config -> max_freq > 0 ? config -> max_freq : sample_rate / 2.0;
+    const double mel_min = hz_to_mel(config -> min_freq);
+    const double mel_max = hz_to_mel(max_freq);
+    const double bin_hz = (double) sample_rate / stft -> fft_size;
+
+    // Each bin belongs to at most two bands
+    stft -> mel_weights = calloc(2 * nbins, sizeof(float));
+    if (stft -> mel_weights == NULL) {
+        return -1;
+    }
+
+    size_t offset = 0;
+    for (size_t m = 0; m < stft -> nmels; ++m) {
+        const double left = mel_to_hz(mel_min + (mel_max - mel_min) * m / (stft -> nmels + 1));
+        const double center = mel_to_hz(mel_min + (mel_max - mel_min) * (m + 1) / (stft -> nmels + 1));
+        const double right = mel_to_hz(mel_min + (mel_max - mel_min) * (m + 2) / (stft -> nmels + 1));
+        size_t first = (size_t) ceil(left / bin_hz);
+        size_t last = (size_t) floor(right / bin_hz);
+        last = last < nbins - 1 ? last : nbins - 1;
+        stft -> mel_start[m] = first;
+        stft -> mel_offset[m] = offset;
+        stft -> mel_len[m] = 0;
+        for (size_t k = first; k <= last && offset < 2 * nbins; ++k) {
+            const double f = k * bin_hz;
+            const double weight = f <= center ? (f - left) / (center - left) : (right - f) / (right - center);
+            stft -> mel_weights[offset++] = (float) (weight > 0 ? weight : 0);
+            stft -> mel_len[m] += 1;
+        }
+    }
+    return 0;
+}
+
+
+stft_t * stft_create(const stft_config_t * config, size_t nchan, size_t sample_rate, uint32_t mid)
+{
+    if (config -> hop == 0 || config -> nmels > STFT_MAX_MELS || sample_rate == 0 || mid == 0) {
+        fprintf(stderr, "Error! Unsupported STFT parameters: hop %zu, %zu mel bands.\n", config -> hop, config -> nmels);
+        return NULL;
+    }
+
+    stft_t * stft = calloc(1, sizeof(stft_t));
+    if (stft == NULL) {
+        fprintf(stderr, "Error! Could not allocate memory for STFT.\n");
+        return NULL;
+    }
+    stft -> nsel = convert_mask_to_chans(config -> chan_mask, nchan, stft -> chans);
+    stft -> plan = stft -> nsel > 0 ? fft_plan_create(config -> fft_size) : NULL;
+    if (stft -> plan == NULL) {
+        fprintf(stderr, "Error! No channel selected, or unsupported FFT size.\n");
+        free(stft);
+        return NULL;
+    }
+    const size_t n = config -> fft_size;
+    stft -> nchan = nchan;
+    stft -> fft_size = n;
+    stft -> hop = config -> hop;
+    stft -> nmels = config -> nmels;
+    stft -> nfeatures = config -> nmels > 0 ? config -> nmels : n / 2 + 1;
+
+    stft -> window = calloc(n, sizeof(float));
+    stft -> windowed = calloc(n, sizeof(float));
+    stft -> spectrum = calloc(n + 2, sizeof(float));
+    stft -> power = calloc(n / 2 + 1, sizeof(float));
+    if (stft -> window == NULL || stft -> windowed == NULL || stft -> spectrum == NULL || stft -> power == NULL
+        || fft_overlap_init(&(stft -> overlap), n, stft -> hop, nchan, stft -> chans, stft -> nsel, mid)
+        || (stft -> nmels > 0 && stft_mel_init(stft, config, sample_rate))) {
+        fprintf(stderr, "Error! Could not allocate memory for STFT buffers.\n");
+        stft_free(stft);
+        return NULL;
+    }
+
+    double sum = 0.0;
+    for (size_t k = 0; k < n; ++k) {
+        double w = 1.0;
+        if (config -> window == STFT_WINDOW_HANN) {
+            w = 0.5 - 0.5 * cos(2 * M_PI * k / n);
+        } else if (config -> window == STFT_WINDOW_HAMMING) {
+            w = 0.54 - 0.46 * cos(2 * M_PI * k / n);
+        }
+        stft -> window[k] = (float) w;
+        sum += w;
+    }
+    // A sine of amplitude A gives a peak of A sum / 2 in the spectrum
+    for (size_t k = 0; k < n; ++k) {
+        stft -> window[k] *= (float) (2.0 / sum);
+    }
+    return stft;
+}
+
+
+void stft_free(stft_t * stft)
+{
+    if (stft -> plan != NULL) {
+        fft_plan_free(stft -> plan);
+    }
+    free(stft -> window);
+    fft_overlap_free(&(stft -> overlap));
+    free(stft -> windowed);
+    free(stft -> spectrum);
+    free(stft -> power);
+    free(stft -> mel_weights);
+    free(stft);
+}
+
+
+void stft_reset(stft_t * stft)
+{
+    fft_overlap_reset(&(stft -> overlap));
+}
+
+
+// Compute an output frame from the last fft_size frames
+static void stft_frame(stft_t * stft, float * dst)
+{
+    const size_t n = stft -> fft_size;
+    const size_t nbins = n / 2 + 1;
+
+    for (size_t s = 0; s < stft -> nsel; ++s) {
+        const float * frames = &(stft -> overlap.frames[s * n]);
+        for (size_t k = 0; k < n; ++k) {
+            stft -> windowed[k] = frames[k] * stft -> window[k];
+        }
+        fft_forward(stft -> plan, stft -> windowed, stft -> spectrum);
+
+        float * out = &dst[s * stft -> nfeatures];
+        float * power = stft -> nmels > 0 ? stft -> power : out;
+        for (size_t k = 0; k < nbins; ++k) {
+            const float re = stft -> spectrum[2 * k], im = stft -> spectrum[2 * k + 1];
+            power[k] = re * re + im * im;
+        }
+        if (stft -> nmels == 0) {
+            continue;
+        }
+
+        // Sparse matrix-vector product with the mel filterbank
+        for (size_t m = 0; m < stft -> nmels; ++m) {
+            const float * weights = &(stft -> mel_weights[stft -> mel_offset[m]]);
+            const float * bins = &power[stft -> mel_start[m]];
+            float energy = 0.0f;
+            for (size_t k = 0; k < stft -> mel_len[m]; ++k) {
+                energy += weights[k] * bins[k];
+            }
+            out[m] = logf(energy + STFT_LOG_FLOOR);
+        }
+    }
+}
+
+
+size_t stft_process(stft_t * stft, const uint32_t * src, size_t nframes, float * dst, size_t max_out)
+{
+    size_t nout = 0;
+
+    while (nframes > 0 && nout < max_out) {
+        int ready;
+        const size_t count = fft_overlap_push(&(stft -> overlap), src, nframes, &ready);
+        src += count * stft -> nchan;
+        nframes -= count;
+
+        if (ready) {
+            stft_frame(stft, &dst[nout * stft -> nsel * stft -> nfeatures]);
+            nout += 1;
+        }
+    }
+    return nout;
+}
@@ -0,0 +1,119 @@
+/**
+ * @brief Streaming short-time Fourier transform and log-mel features of the selected channels.
+ *
+ *        Every hop frames, the last fft_size frames of each channel are windowed and transformed. The output
+ *        is either the power spectrum, scaled so that a sine of amplitude A (as a fraction of the full scale)
+ *        gives A^2 in its bin, or the natural logarithm of this power spectrum summed in mel bands.
+ *
+ * @author Loïc Droz <lk.droz@gmail.com>
+ *
+ */
+
+#ifndef STFT_H
+#define STFT_H
+
+#include <stddef.h>
+#include <inttypes.h>
+#include "fft.h"
+#include "convert.h"
+
+// Max number of mel bands
+#define STFT_MAX_MELS 256
+// Floor added to the mel energies before the logarithm, about -100 dB
+#define STFT_LOG_FLOOR 1e-10f
+
+/**
+ * @brief Analysis windows.
+ *
+ */
+typedef enum {
+    STFT_WINDOW_HANN = 0,
+    STFT_WINDOW_HAMMING,
+    STFT_WINDOW_RECT,
+} stft_window_t;
+
+/**
+ * @brief Configuration of a STFT, see stft_create.
+ *
+ */
+typedef struct {
+    // The channels to analyze, bit c selects channel c (0-based)
+    uint32_t chan_mask;
+    // Size of the window in frames, a power of two
+    size_t fft_size;
+    // Frames between two output frames
+    size_t hop;
+    stft_window_t window;
+    // Number of mel bands, 0 to output the power spectrum
+    size_t nmels;
+    // Band covered by the mel filterbank in Hz, max_freq 0 for half the sample rate
+    float min_freq;
+    float max_freq;
+} stft_config_t;
+
+typedef struct {
+    // Selected channels
+    uint8_t chans[CONVERT_MAX_CHAN];
+    size_t nsel;
+    size_t nchan;
+    size_t fft_size;
+    size_t hop;
+    // Number of values per channel in an output frame, fft_size / 2 + 1 bins or nmels bands
+    size_t nfeatures;
+    fft_plan_t * plan;
+    // Window, with the scaling of the power spectrum folded in
+    float * window;
+    // Last fft_size frames of each selected channel
+    fft_overlap_t overlap;
+    // Work buffers: windowed frame, spectrum and power spectrum
+    float * windowed;
+    float * spectrum;
+    float * power;
+    // Mel filterbank as a sparse matrix: band m covers mel_len[m] bins from mel_start[m], with its weights
+    // starting at mel_offset[m] in mel_weights
+    size_t nmels;
+    size_t mel_start[STFT_MAX_MELS];
+    size_t mel_len[STFT_MAX_MELS];
+    size_t mel_offset[STFT_MAX_MELS];
+    float * mel_weights;
+} stft_t;
+
+/**
+ * @brief Create a STFT. All the memory is allocated here, none while processing.
+ *
+ * @param config The analysis parameters.
+ * @param nchan The number of channels of the raw frames.
+ * @param sample_rate The sample rate of the raw frames, in Hz.
+ * @param mid Value of a silent raw sample, that is half of the CIC gain, see convert_params_t.
+ * @return stft_t* A pointer to a new STFT in case of success, NULL otherwise.
+ */
+stft_t * stft_create(const stft_config_t * config, size_t nchan, size_t sample_rate, uint32_t mid);
+
+/**
+ * @brief Free the resources allocated for the given STFT.
+ *
+ * @param stft The STFT to free.
+ */
+void stft_free(stft_t * stft);
+
+/**
+ * @brief Forget the frames received so far, e.g. after a gap in the input. The next output frame needs fft_size new frames.
+ *
+ * @param stft The STFT.
+ */
+void stft_reset(stft_t * stft);
+
+/**
+ * @brief Feed a block of raw interleaved frames, and compute an output frame each time hop new frames have been
+ *        received. A stream can be split into blocks of any size, e.g. the blocks of pcm_set_callback.
+ *
+ * @param stft The STFT.
+ * @param src The input frames, nchan raw 32 bits words each.
+ * @param nframes The number of input frames.
+ * @param dst The buffer to which the output frames are written, nsel * nfeatures floats each, channel after channel.
+ * @param max_out The max number of output frames, the frames past the last one which fits are not used.
+ * @return size_t The number of output frames written to dst.
+ */
+size_t stft_process(stft_t * stft, const uint32_t * src, size_t nframes, float * dst, size_t max_out);
+
+#endif
@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "stft.h"
+
+#define NCHAN 6
+#define RATE 64000
+#define MID 32768
+#define NFRAMES 16384
+#define FFT_SIZE 1024
+#define HOP 256
+#define NOUT ((NFRAMES - FFT_SIZE) / HOP + 1)
+#define NBINS (FFT_SIZE / 2 + 1)
+#define NMELS 40
+
+static uint32_t in[NFRAMES * NCHAN];
+static float out[NOUT * NCHAN * NBINS];
+static float out_blocks[NOUT * NCHAN * NBINS];
+
+
+double seconds_since(const struct timespec * start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start -> tv_sec) + (now.tv_nsec - start -> tv_nsec) * 1e-9;
+}
+
+
+// The same tone on every channel, with a different amplitude on each
+void tone(double freq, double amp) {
+    for (size_t f = 0; f < NFRAMES; ++f) {
+        for (size_t c = 0; c < NCHAN; ++c) {
+            const double x = amp * (c + 1) / NCHAN * sin(2 * M_PI * freq * f / RATE);
+            in[f * NCHAN + c] = (uint32_t) (MID + lround(x * MID));
+        }
+    }
+}
+
+
+// Feed the input in blocks of odd sizes, returns the number of output frames
+size_t run(stft_t * stft, float * dst) {
+    const size_t out_size = stft -> nsel * stft -> nfeatures;
+    size_t nout = 0;
+    for (size_t f = 0; f < NFRAMES; f += 333) {
+        const size_t n = (NFRAMES - f) < 333 ? (NFRAMES - f) : 333;
+        nout += stft_process(stft, &in[f * NCHAN], n, &dst[nout * out_size], NOUT - nout);
+    }
+    return nout;
+}
+
+
+int main(void) {
+    printf("\nSTARTING STFT TESTING PROGRAM!\n");
+
+    stft_config_t config = {
+        .chan_mask = 0x3F,
+        .fft_size = FFT_SIZE,
+        .hop = HOP,
+        .window = STFT_WINDOW_HANN,
+        .nmels = 0,
+    };
+    stft_t * stft = stft_create(&config, NCHAN, RATE, MID);
+
+    printf("TEST: A tone centered on a bin gives the square of its amplitude in this bin, and little elsewhere: ");
+    // Bin 64 is 4 kHz
+    tone(4000.0, 0.8);
+    size_t nout = stft_process(stft, in, NFRAMES, out, NOUT);
+    size_t errors = nout != NOUT;
+    for (size_t o = 0; o < nout; ++o) {
+        for (size_t c = 0; c < NCHAN; ++c) {
+            const float * power = &out[(o * NCHAN + c) * NBINS];
+            const double amp = 0.8 * (c + 1) / NCHAN;
+            errors += fabs(power[64] - amp * amp) > 0.01 * amp * amp;
+            for (size_t k = 0; k < NBINS; ++k) {
+                errors += (k < 62 || k > 66) && power[k] > 1e-6;
+            }
+        }
+    }
+    if (errors == 0) {
+        printf("Success!\n");
+    } else {
+        printf("Failure!\n");
+    }
+
+    printf("TEST: Blocks of any size give the same output frames as a single block: ");
+    stft_reset(stft);
+    nout = run(stft, out_blocks);
+    if (nout == NOUT && memcmp(out, out_blocks, NOUT * NCHAN * NBINS * sizeof(float)) == 0) {
+        printf("Success!\n");
+    } else {
+        printf("Failure! %zu output frames\n", nout);
+    }
+    stft_free(stft);
+
+    printf("TEST: The selected channels are output in order, and a hop larger than the window skips frames: ");
+    config.chan_mask = 0x24;
+    config.hop = 3000;
+    stft = stft_create(&config, NCHAN, RATE, MID);
+    nout = run(stft, out_blocks);
+    errors = nout != NFRAMES / 3000 || stft -> nsel != 2;
+    for (size_t o = 0; o < nout; ++o) {
+        errors += fabs(out_blocks[(o * 2) * NBINS + 64] - out[2 * NBINS + 64]) > 1e-4;
+        errors += fabs(out_blocks[(o * 2 + 1) * NBINS + 64] - out[5 * NBINS + 64]) > 1e-4;
+    }
+    stft_free(stft);
+    if (errors == 0) {
+        printf("Success!\n");
+    } else {
+        printf("Failure!\n");
+    }
+
+    printf("TEST: The loudest mel band follows the frequency of a tone, and silence gives the log floor: ");
+    config.chan_mask = 0x3F;
+    config.hop = HOP;
+    config.nmels = NMELS;
+    config.min_freq = 100.0f;
+    config.max_freq = 16000.0f;
+    stft = stft_create(&config, NCHAN, RATE, MID);
+    errors = 0;
+    size_t last_band = 0;
+    const double freqs[5] = { 300.0, 900.0, 2500.0, 6000.0, 12000.0 };
+    for (size_t t = 0; t < 5; ++t) {
+        tone(freqs[t], 0.5);
+        stft_reset(stft);
+        nout = run(stft, out_blocks);
+        size_t band = 0;
+        for (size_t m = 1; m < NMELS; ++m) {
+            band = out_blocks[m] > out_blocks[band] ? m : band;
+        }
+        errors += nout != NOUT || (t > 0 && band <= last_band);
+        last_band = band;
+    }
+    tone(1000.0, 0.0);
+    stft_reset(stft);
+    nout = run(stft, out_blocks);
+    for (size_t m = 0; m < NMELS; ++m) {
+        errors += fabsf(out_blocks[m] - logf(STFT_LOG_FLOOR)) > 0.1f;
+    }
+    if (errors == 0) {
+        printf("Success!\n");
+    } else {
+        printf("Failure!\n");
+    }
+
+    // Cost of an output frame, and the share of a core it takes at this rate
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    stft_reset(stft);
+    nout = run(stft, out_blocks);
+    const double per_frame = seconds_since(&start) / nout;
+    printf("STFT: %zu channels, %d mel bands, %.1f us per output frame, %.1f %% of a core at %.0f output frames per second\n",
+           stft -> nsel, NMELS, per_frame * 1e6, 100.0 * per_frame * RATE / HOP, (double) RATE / HOP);
+    stft_free(stft);
+
+    printf("EXITING TESTING PROGRAM\n");
+    return 0;
+}
@@ -1,11 +1,19 @@
 /**
- * @brief Code for the CIC Filter on PRU1 with 6 channels.
+ * @brief Code for the CIC Filter on PRU1 with 6 channels, or 3 channels on the rising edge only.
+ *        Assembled with -DPRU0 for PRU0, which captures channels 7 to 12 on its own pins in the 12 channels mode.
+ *        PRU1 then starts PRU0 on an edge of the clock, so that both write the same frames, each to its own half
+ *        of the host buffer.
+ *        The number of channels, the decimation rate and the period size are written by the host to the data RAM.
+ *        The host buffer is a ring of periods, the host is interrupted after each period.
+ *        The frames are staged in the scratchpad and written to the host by bursts of BURST_FRAMES frames, on the
+ *        first rising edge of the next frame, which has time to spare, with the buffer and period bookkeeping.
  *        Instruction set :
  *        http://processors.Wiki.ti.com/index.php/PRU_Assembly_Instructions
  * 
- *        Current timings:
- *        Rising edge data : 57 cycles (max = 72 at f_s = 1.028 MHz)
- *        Falling edge data : 63 cycles (max = 72 at f_s = 1.028 MHz)
+ *        Timings: the work after each edge of the clock must be done within half a period, 97.7 cycles at
+ *        1.024 MHz. The timings of this version are unchecked: it has not been assembled with pasm, so neither
+ *        firmware_check nor an oscilloscope has measured it. Run gen/firmware_check after make pru1, and compare
+ *        firmware_check -d with the listing of pasm -L, before deploying it.
  * 
  * @author Loïc Droz <lk.droz@gmail.com>
  * 
@@ -58,19 +66,40 @@
 #define HOST_MEM r27
 #define HOST_MEM_SIZE r26
 #define XFR_OFFSET r0.b0
+// Configuration, read from the local memory at start
+#define DECIM r29.b0
+#define NCHAN r29.b1
+// Number of frames left before the end of the period
+#define PERIOD_COUNTER r29.w2
 
 // # Temporary "registers"
 #define DELAY_COUNTER r0.w2
 #define TMP r0.w2
 
 // ## Input pins offsets
+#ifdef PRU0
+// CLK on P9.25, DATA1 to DATA3 on P9.29, P9.30 and P9.28
+#define CLK_OFFSET 7
+#define DAT_OFFSET1 1
+#define DAT_OFFSET2 2
+#define DAT_OFFSET3 3
+#else
 #define CLK_OFFSET 11
 #define DAT_OFFSET1 10
 #define DAT_OFFSET2 8
 #define DAT_OFFSET3 9
+#endif
 
-// ## Decimation rate
-#define R 16
+// ## Offsets of the configuration in the local memory (PRU_MEM_* on the host)
+#define DECIMATION_OFFSET 12
+#define NCHAN_OFFSET 16
+#define PERIOD_OFFSET 20
+// Non-zero when PRU1 has to start PRU0, and set in the data RAM of PRU0 by PRU1 to start it
+#define SYNC_OFFSET 24
+#define START_OFFSET 28
+
+// ## Frames per write to the host memory, 2 frames fit in R23-R28 of BANK0 and BANK1 (PRU_BURST_FRAMES on the host)
+#define BURST_FRAMES 2
 
 // ## Scratchpad register banks numbers
 #define BANK0 10
@@ -80,7 +109,17 @@
 
 // ## Defined in the PRU ref. guide
 #define LOCAL_MEM_ADDR 0x0
+// C24 points to the local data RAM, offset of the half-buffer sequence number in it (PRU_MEM_SEQUENCE on the host)
+#define SEQUENCE_OFFSET 8
+#define PRU0_ARM_INTERRUPT 19
 #define PRU1_ARM_INTERRUPT 20
+// Writing 32 + n to r31 raises the system event 16 + n. PRU1 raises PRU0_ARM_INTERRUPT, which the host gets on
+// PRU_EVTOUT_0, and PRU0 raises PRU1_ARM_INTERRUPT, on PRU_EVTOUT_1
+#ifdef PRU0
+#define PERIOD_EVENT PRU1_ARM_INTERRUPT + 16
+#else
+#define PERIOD_EVENT PRU0_ARM_INTERRUPT + 16
+#endif
 
 // ## DEBUG (assumes LED or oscilloscope connected to P8.45)
 #define SET_LED SET r30, r30, 0
@@ -128,7 +167,7 @@
         ADD     INT3_CHAN2, INT3_CHAN2, INT2_CHAN2
 
         // Jump to start working on the 3rd input pin data.
-        QBNE    jmp_addr, SAMPLE_COUNTER, R
+        QBNE    jmp_addr, SAMPLE_COUNTER, DECIM
 
         // Comb stages
         SUB     COMB0_CHAN1, INT3_CHAN1, LAST_INT_CHAN1
@@ -160,7 +199,7 @@
  *        on falling edge, channel 6. If the oversampling rate is not reached, will jump to jmp_addr.
  * 
  */
-.macro int_comb_chan3  // <= 15 + t(SBBO) + 1 stages, 21 cycles ??
+.macro int_comb_chan3  // <= 15 cycles
 .mparam jmp_addr
         // Retrieve data for channel 3 and iterate the integrator stages.
         LSR     TMP, IN_PINS, DAT_OFFSET3
@@ -172,7 +211,7 @@
         ADD     INT3_CHAN1, INT3_CHAN1, INT2_CHAN1
 
         // Work on the 3 other channels
-        QBNE    jmp_addr, SAMPLE_COUNTER, R
+        QBNE    jmp_addr, SAMPLE_COUNTER, DECIM
 
         // Comb stages
         SUB     COMB0_CHAN1, INT3_CHAN1, LAST_INT_CHAN1
@@ -186,11 +225,35 @@
         MOV     LAST_COMB0_CHAN1, COMB0_CHAN1
         MOV     LAST_COMB1_CHAN1, COMB1_CHAN1
         MOV     LAST_COMB2_CHAN1, COMB2_CHAN1
+.endm
 
-        // Store output for 3 channels in memory
-        SBBO    OUTPUT1, HOST_MEM, BYTE_COUNTER, 4 * 3  // 3 + 2 = 5 cycles ??
-        // Increment the written bytes counter by 3 * 4 after writing 3 results
-        ADD     BYTE_COUNTER, BYTE_COUNTER, 3 * 4
+
+/**
+ * @brief Stage the outputs of 3 channels in the scratchpad until flush_frames writes them to the host memory.
+ *        Frames with an even number of frames left in the period go to BANK0, the others to BANK1, channels 1-3
+ *        to R23-R25 with an XFR offset of 0, channels 4-6 to R26-R28 with an offset of 3.
+ * 
+ */
+.macro stage_outputs  // 2 - 3 cycles
+        QBBS    stage_odd, PERIOD_COUNTER, 0
+        XOUT    BANK0, OUTPUT1, 4 * 3
+        QBA     staged
+    stage_odd:
+        XOUT    BANK1, OUTPUT1, 4 * 3
+    staged:
+.endm
+
+
+/**
+ * @brief Increment the period sequence number in the local data RAM, which lets the host detect
+ *        the periods it missed. Must be done before interrupting the host. Uses OUTPUT1 as a temporary,
+ *        its value has already been written to the host memory.
+ * 
+ */
+.macro publish_sequence  // 5 cycles
+        LBCO    OUTPUT1, C24, SEQUENCE_OFFSET, 4
+        ADD     OUTPUT1, OUTPUT1, 1
+        SBCO    OUTPUT1, C24, SEQUENCE_OFFSET, 4
 .endm
 
 
@@ -224,9 +287,35 @@ start:
     LBBO    HOST_MEM, r0, 0, 4
     // Likewise, grab the host memory length
     LBBO    HOST_MEM_SIZE, r0, 4, 4
+    // And the configuration: decimation rate, number of channels and frames per period
+    LBBO    DECIM, r0, DECIMATION_OFFSET, 1
+    LBBO    NCHAN, r0, NCHAN_OFFSET, 1
+    LBBO    PERIOD_COUNTER, r0, PERIOD_OFFSET, 2
+
+    // The first flush comes before any frame was staged: let it write the zeroed staging registers to the last
+    // burst of the buffer, which is written again before its period is complete, then wrap to the beginning
+    LSL     BYTE_COUNTER, NCHAN, 3  // 4 * BURST_FRAMES * NCHAN
+    RSB     BYTE_COUNTER, BYTE_COUNTER, HOST_MEM_SIZE
+
+#ifdef PRU0
+    // Wait until PRU1 starts us, right after a rising edge of the clock
+wait_start:
+    LBCO    r0, C24, START_OFFSET, 4
+    QBEQ    wait_start, r0, 0
+#else
+    // With 12 channels, start PRU0 right after a rising edge: both take the next one as the first edge and
+    // count the same frames, the host merges them by period
+    LBCO    r0, C24, SYNC_OFFSET, 4
+    QBEQ    synced, r0, 0
+    WBC     IN_PINS, CLK_OFFSET
+    WBS     IN_PINS, CLK_OFFSET
+    SBCO    r0, C25, START_OFFSET, 4
+synced:
+#endif
 
-    // Set the correct offset for the beginning
     LDI     r0, 0
+    // No period has been written yet
+    SBCO    r0, C24, SEQUENCE_OFFSET, 4
     LDI     XFR_OFFSET, 11
 
     // ##### CHANNELS 1 - 3 #####
@@ -234,6 +323,7 @@ chan1to3:
     // Store channel 6 registers to 2nd half of BANK2
     // Store PRU's R1-R11 to BANK2's R12-R22
     XOUT    BANK2, r1, 4 * 11
+load_chan12:
     // Load channels 1 and 2 registers from BANK0
     LDI     XFR_OFFSET, 0
     XIN     BANK0, r1, 4 * 2 * 11
@@ -257,15 +347,27 @@ chan3:
     XOUT    BANK0, r1, 4 * 2 * 11
     // Load channel 3 registers from 1st half of BANK1
     XIN     BANK1, r1, 4 * 11
+    // On the first edge of every other frame, write the 2 frames staged before to the host memory
+    QBNE    chan3_cic, SAMPLE_COUNTER, 1
+    QBBC    flush_frames, PERIOD_COUNTER, 0
+chan3_cic:
     // Integrator and comb stages
-    int_comb_chan3 chan4to6  // 21 cycles (?)
-        
+    int_comb_chan3 chan4to6  // 15 cycles
+    // XFR offset 0 since load_chan12
+    stage_outputs
+
 
     // ##### Channels 4 - 6 #####
 chan4to6:
     // First, store channel 3 registers in first half of BANK1
     XOUT    BANK1, r1, 4 * 11
 
+    // With 3 channels, skip the falling edge, the frame is complete after channel 3
+    QBEQ    load_chan45, NCHAN, 6
+    QBNE    load_chan12, SAMPLE_COUNTER, DECIM
+    QBA     frame_done
+
+load_chan45:
     // Then, load channels 4 and 5 registers from 2nd half of BANK1 and 1st half of BANK2
     // Load BANK1's R12-R22 to PRU's R1-R11
     LDI     XFR_OFFSET, 11
@@ -298,28 +400,53 @@ chan6:
     XIN     BANK2, r1, 4 * 11
 
     // Integrator and comb stages
-    int_comb_chan3 chan1to3  // 21 cycles (?)
+    int_comb_chan3 chan1to3  // 15 cycles
+    LDI     XFR_OFFSET, 3
+    stage_outputs
+    // Back to the offset of chan1to3
+    LDI     XFR_OFFSET, 11
 
+frame_done:
     // If we reach this point, it means we reached R, so reset the counter
     LDI     SAMPLE_COUNTER, 0
-
-    QBNE    check_half, BYTE_COUNTER, HOST_MEM_SIZE
-    // We filled the whole buffer, interrupt the host
-    // TODO: We could store which buffer half has just been written.
-    // This would allow the host to check for missed buffer halves.
-    MOV     r31.b0, PRU1_ARM_INTERRUPT + 16
-    // Reset counter/offset, which will make us write to the beginning of host memory again
-    LDI     BYTE_COUNTER, 0
+    // The frame is staged, flush_frames checks the end of the buffer and of the period
+    SUB     PERIOD_COUNTER, PERIOD_COUNTER, 1
     QBA     chan1to3
 
-check_half:
-    // Check if we have reached half of the buffer
-    LSR     HOST_MEM_SIZE, HOST_MEM_SIZE, 1
-    QBNE    continue, BYTE_COUNTER, HOST_MEM_SIZE
-    // Interrupt the host to tell him we wrote to half of the buffer
-    MOV     r31.b0, PRU1_ARM_INTERRUPT + 15
-continue:
-    LSL     HOST_MEM_SIZE, HOST_MEM_SIZE, 1
 
-    // Go back to computing channels 1 - 4
-    QBA     chan1to3
+    // ##### Write of the staged frames, during channel 3 on a rising edge #####
+flush_frames:
+    QBEQ    flush_chan3, NCHAN, 3
+    // Gather the 2 frames in PRU's R12-R23, which are free until chan4to6
+    // Load BANK0's R23-R28 to PRU's R12-R17 and BANK1's R23-R28 to PRU's R18-R23
+    LDI     XFR_OFFSET, 11
+    XIN     BANK0, r12, 4 * 6
+    LDI     XFR_OFFSET, 5
+    XIN     BANK1, r18, 4 * 6
+    SBBO    r12, HOST_MEM, BYTE_COUNTER, 4 * 6 * BURST_FRAMES
+    ADD     BYTE_COUNTER, BYTE_COUNTER, 4 * 6 * BURST_FRAMES
+    QBA     flush_done
+flush_chan3:
+    // Load BANK0's R23-R25 to PRU's R12-R14 and BANK1's R23-R25 to PRU's R15-R17
+    LDI     XFR_OFFSET, 11
+    XIN     BANK0, r12, 4 * 3
+    LDI     XFR_OFFSET, 8
+    XIN     BANK1, r15, 4 * 3
+    SBBO    r12, HOST_MEM, BYTE_COUNTER, 4 * 3 * BURST_FRAMES
+    ADD     BYTE_COUNTER, BYTE_COUNTER, 4 * 3 * BURST_FRAMES
+flush_done:
+    // Back to the offset of chan4to6
+    LDI     XFR_OFFSET, 0
+
+    QBNE    check_period, BYTE_COUNTER, HOST_MEM_SIZE
+    // We filled the whole buffer, reset counter/offset, which will make us write to the beginning of host memory again
+    LDI     BYTE_COUNTER, 0
+
+check_period:
+    // Check if we have reached the end of a period, otherwise go back to channel 3
+    QBNE    chan3_cic, PERIOD_COUNTER, 0
+    // Start the next period, then interrupt the host to tell him we wrote a period, with its sequence number
+    LBCO    PERIOD_COUNTER, C24, PERIOD_OFFSET, 2
+    publish_sequence
+    MOV     r31.b0, PERIOD_EVENT
+    QBA     chan3_cic